@@ -0,0 +1,443 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "bit_mask.h"
+#include "brick_file.h"
+#include "clahe.h"
+#include "filter3d.h"
+#include "img_vol.h"
+#include "mip_batch.h"
+#include "mpr.h"
+#include "operations.h"
+#include "phantom.h"
+#include "region_stats.h"
+#include "slab_mip.h"
+#include "voxel_memory.h"
+#include "volume_render.h"
+
+using namespace imgvol;
+
+namespace {
+
+class Timer {
+ public:
+  void Start() {
+    start_ = std::chrono::steady_clock::now();
+  }
+
+  void Stop() {
+    std::chrono::duration<double> d = std::chrono::steady_clock::now() - start_;
+    seconds_ += d.count();
+  }
+
+  double Seconds() const {
+    return seconds_;
+  }
+
+ private:
+  std::chrono::steady_clock::time_point start_;
+  double seconds_ = 0;
+};
+
+struct Result {
+  std::string name;
+  size_t size;
+  size_t iterations;
+  double min_seconds;
+  double median_seconds;
+  double items;
+  std::string unit;
+};
+
+struct Options {
+  std::vector<size_t> sizes = {64, 128};
+  size_t iterations = 5;
+  std::string filter;
+  std::string out;
+  std::string tmp_dir = ".";
+  VoxelMemoryOptions memory;
+};
+
+// Run fn iterations times, fn only times its own hot section so setup
+// like copying the input isn't measured. items is the work done by one
+// iteration, in unit.
+Result Run(const std::string& name, size_t size, double items,
+           const std::string& unit, size_t iterations,
+           std::function<void(Timer&)> fn) {
+  Timer warmup;
+  fn(warmup);
+
+  std::vector<double> times;
+
+  for (size_t i = 0; i < iterations; i++) {
+    Timer t;
+    fn(t);
+    times.push_back(t.Seconds());
+  }
+
+  std::sort(times.begin(), times.end());
+
+  Result r;
+  r.name = name;
+  r.size = size;
+  r.iterations = iterations;
+  r.min_seconds = times.front();
+  r.median_seconds = times[times.size()/2];
+  r.items = items;
+  r.unit = unit;
+
+  std::cerr << name << " [" << size << "]: " << r.median_seconds << " s\n";
+  return r;
+}
+
+// Copy of img with its own voxel buffer, for cases that normalize their
+// input in place. The clone is made here so it isn't timed.
+ImgVol Unshared(const ImgVol& img) {
+  ImgVol copy = img;
+  copy.Data();
+  return copy;
+}
+
+std::vector<Result> RunSize(size_t s, const Options& opts) {
+  std::vector<Result> results;
+  size_t iters = opts.iterations;
+
+  auto enabled = [&opts](const std::string& name) {
+    return opts.filter.empty() || name.find(opts.filter) != std::string::npos;
+  };
+
+  ImgVol spheres = bench::SpherePhantom(s, s, s);
+  ImgVol noise = bench::NoisePhantom(s, s, s);
+  ImgVol labels = bench::LabelPhantom(s, s, s);
+
+  double voxels = double(s)*s*s;
+  double pixels = double(s)*s;
+  float diagonal = Diagonal(std::array<float, 3>{float(s), float(s),
+                                                 float(s)});
+  double diag_pixels = double(size_t(diagonal))*size_t(diagonal);
+
+  const std::vector<std::pair<std::string, ImgVol::Axis>> axes = {
+    {"cut_x", ImgVol::Axis::aX},
+    {"cut_y", ImgVol::Axis::aY},
+    {"cut_z", ImgVol::Axis::aZ}
+  };
+
+  for (const auto& a : axes) {
+    if (enabled(a.first)) {
+      results.push_back(Run(a.first, s, pixels*s, "pixels", iters,
+                            [&](Timer& t) {
+        t.Start();
+        for (size_t pos = 0; pos < s; pos++) {
+          Img2D cut = Cut(noise, a.second, pos);
+        }
+        t.Stop();
+      }));
+    }
+  }
+
+  Img2D slice = Cut(spheres, ImgVol::Axis::aZ, s/2);
+  Img2D label_slice = Cut(labels, ImgVol::Axis::aZ, s/2);
+
+  if (enabled("normalize")) {
+    results.push_back(Run("normalize", s, pixels, "pixels", iters,
+                          [&](Timer& t) {
+      Img2D img = slice;
+      t.Start();
+      Normalize(img, 12);
+      t.Stop();
+    }));
+  }
+
+  if (enabled("brightness_contrast")) {
+    results.push_back(Run("brightness_contrast", s, pixels, "pixels", iters,
+                          [&](Timer& t) {
+      Img2D img = slice;
+      t.Start();
+      BrightinessContrast(img, 12, 60, 60);
+      t.Stop();
+    }));
+  }
+
+  if (enabled("color_labels")) {
+    results.push_back(Run("color_labels", s, pixels, "pixels", iters,
+                          [&](Timer& t) {
+      t.Start();
+      ImgColor color = ColorLabels(slice, label_slice, 8);
+      t.Stop();
+    }));
+  }
+
+  if (enabled("corte_planar")) {
+    results.push_back(Run("corte_planar", s, diag_pixels, "pixels", iters,
+                          [&](Timer& t) {
+      t.Start();
+      ImgGray planar = CortePlanar(spheres, std::array<float, 3>{
+          s/2.0f, s/2.0f, s/2.0f}, std::array<float, 3>{1, 2, 3});
+      t.Stop();
+    }));
+  }
+
+  if (enabled("reformata_img")) {
+    const size_t n = 8;
+    results.push_back(Run("reformata_img", s, diag_pixels*n, "voxels", iters,
+                          [&](Timer& t) {
+      t.Start();
+      ImgVol reformat = ReformataImg(spheres, n,
+          std::array<float, 3>{s/4.0f, s/4.0f, s/4.0f},
+          std::array<float, 3>{3*s/4.0f, 3*s/4.0f, 3*s/4.0f});
+      t.Stop();
+    }));
+  }
+
+  if (enabled("mip")) {
+    results.push_back(Run("mip", s, diag_pixels, "pixels", iters,
+                          [&](Timer& t) {
+      ImgVol vol = Unshared(spheres);
+      t.Start();
+      ImgGray mip = MaxIntensionProjection(vol, M_PI/180*30,
+                                           M_PI/180*30,
+                                           std::array<float, 3>{0, 0, 1});
+      t.Stop();
+    }));
+  }
+
+  if (enabled("mip_views")) {
+    const size_t n = 12;
+    std::vector<MipView> views = MipTurntable(n);
+    std::vector<ImgGray> frames;
+    results.push_back(Run("mip_views", s, diag_pixels*n, "pixels", iters,
+                          [&](Timer& t) {
+      ImgVol vol = Unshared(spheres);
+      t.Start();
+      MaxIntensionProjections(vol, views, std::array<float, 3>{0, 0, 1},
+                              MipBatchOptions(), &frames);
+      t.Stop();
+    }));
+  }
+
+  if (enabled("dvr")) {
+    TransferLut lut = BuildTransferLut({{0, {{0, 0, 0, 0}}},
+                                        {64, {{0.8f, 0.5f, 0.3f, 0.02f}}},
+                                        {255, {{1, 1, 1, 0.8f}}}});
+    ImgColor dvr(0, 0);
+    results.push_back(Run("dvr", s, diag_pixels, "pixels", iters,
+                          [&](Timer& t) {
+      t.Start();
+      VolumeRender(spheres, M_PI/180*30, M_PI/180*30,
+                   std::array<float, 3>{0, 0, 1}, lut, DvrOptions(), &dvr);
+      t.Stop();
+    }));
+  }
+
+  if (enabled("mpr")) {
+    MprViews views;
+    results.push_back(Run("mpr", s, 3*pixels + diag_pixels, "pixels", iters,
+                          [&](Timer& t) {
+      t.Start();
+      Mpr(spheres, std::array<size_t, 3>{s/2, s/3, s/4},
+          {std::array<float, 3>{1, 2, 3}}, MprOptions(), &views);
+      t.Stop();
+    }));
+  }
+
+  if (enabled("slab_mip")) {
+    ImgVol slab(0, 0, 0);
+    results.push_back(Run("slab_mip", s, voxels, "voxels", iters,
+                          [&](Timer& t) {
+      t.Start();
+      SlabMip(spheres, ImgVol::Axis::aZ, 16, &slab);
+      t.Stop();
+    }));
+  }
+
+  if (enabled("mask_dilate")) {
+    BitMask mask = ThresholdMask(spheres, 128);
+    BitMask dilated(0, 0, 0);
+    results.push_back(Run("mask_dilate", s, voxels, "voxels", iters,
+                          [&](Timer& t) {
+      t.Start();
+      Dilate(mask, Connectivity::k26, &dilated);
+      t.Stop();
+    }));
+  }
+
+  if (enabled("region_stats")) {
+    results.push_back(Run("region_stats", s, voxels, "voxels", iters,
+                          [&](Timer& t) {
+      t.Start();
+      std::vector<RegionStats> stats = ComputeRegionStats(spheres, labels);
+      t.Stop();
+    }));
+  }
+
+  if (enabled("gaussian")) {
+    ImgVol smooth(0, 0, 0);
+    results.push_back(Run("gaussian", s, voxels, "voxels", iters,
+                          [&](Timer& t) {
+      t.Start();
+      GaussianFilter(spheres, 1.5f, &smooth);
+      t.Stop();
+    }));
+  }
+
+  if (enabled("clahe")) {
+    ImgGray gray(noise.Data() + (s/2)*s*s, s, s);
+    ImgGray equalized(0, 0);
+    results.push_back(Run("clahe", s, pixels, "pixels", iters,
+                          [&](Timer& t) {
+      t.Start();
+      Clahe(gray, ClaheOptions(), &equalized);
+      t.Stop();
+    }));
+  }
+
+  std::string scn = opts.tmp_dir + "/bench_" + std::to_string(s) + ".scn";
+  std::string vbk = opts.tmp_dir + "/bench_" + std::to_string(s) + ".vbk";
+
+  if (enabled("scn_save") || enabled("scn_load")) {
+    results.push_back(Run("scn_save", s, voxels, "voxels", iters,
+                          [&](Timer& t) {
+      t.Start();
+      spheres.WriteImg(scn);
+      t.Stop();
+    }));
+
+    results.push_back(Run("scn_load", s, voxels, "voxels", iters,
+                          [&](Timer& t) {
+      t.Start();
+      ImgVol img(scn);
+      t.Stop();
+    }));
+
+    std::remove(scn.c_str());
+  }
+
+  if (enabled("brick_save") || enabled("brick_load")) {
+    results.push_back(Run("brick_save", s, voxels, "voxels", iters,
+                          [&](Timer& t) {
+      t.Start();
+      WriteBrickVolume(spheres, vbk);
+      t.Stop();
+    }));
+
+    results.push_back(Run("brick_load", s, voxels, "voxels", iters,
+                          [&](Timer& t) {
+      t.Start();
+      BrickVolume bricks(vbk);
+      ImgVol img = bricks.ReadAll();
+      t.Stop();
+    }));
+
+    std::remove(vbk.c_str());
+  }
+
+  return results;
+}
+
+void WriteJson(const std::vector<Result>& results, std::ostream& out) {
+  out << "{\n  \"benchmarks\": [\n";
+
+  for (size_t i = 0; i < results.size(); i++) {
+    const Result& r = results[i];
+    double throughput = r.median_seconds > 0 ? r.items/r.median_seconds : 0;
+
+    out << "    {\"name\": \"" << r.name << "\", \"size\": " << r.size
+        << ", \"iterations\": " << r.iterations
+        << ", \"min_seconds\": " << r.min_seconds
+        << ", \"median_seconds\": " << r.median_seconds
+        << ", \"items\": " << r.items
+        << ", \"unit\": \"" << r.unit << "\""
+        << ", \"throughput\": " << throughput << "}"
+        << (i + 1 < results.size() ? ",\n" : "\n");
+  }
+
+  out << "  ]\n}\n";
+}
+
+std::vector<size_t> ParseSizes(const std::string& arg) {
+  std::vector<size_t> sizes;
+  std::stringstream ss(arg);
+  std::string item;
+
+  while (std::getline(ss, item, ',')) {
+    sizes.push_back(std::stoul(item));
+  }
+
+  return sizes;
+}
+
+void Usage(const char* name) {
+  std::cerr << "usage: " << name << " [--sizes 64,128] [--iterations 5]"
+            << " [--filter name] [--out file.json] [--tmp-dir dir]"
+            << " [--placement first-touch|interleave|slabs]"
+            << " [--huge-pages 0|1]\n";
+}
+
+}
+
+int main(int argc, char **argv) {
+  Options opts;
+
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+
+    if (i + 1 >= argc) {
+      Usage(argv[0]);
+      return 1;
+    }
+
+    if (arg == "--sizes") {
+      opts.sizes = ParseSizes(argv[++i]);
+    } else if (arg == "--iterations") {
+      opts.iterations = std::max(1ul, std::stoul(argv[++i]));
+    } else if (arg == "--filter") {
+      opts.filter = argv[++i];
+    } else if (arg == "--out") {
+      opts.out = argv[++i];
+    } else if (arg == "--tmp-dir") {
+      opts.tmp_dir = argv[++i];
+    } else if (arg == "--placement") {
+      std::string p = argv[++i];
+
+      if (p == "first-touch") {
+        opts.memory.placement = VoxelPlacement::kFirstTouch;
+      } else if (p == "interleave") {
+        opts.memory.placement = VoxelPlacement::kInterleave;
+      } else if (p == "slabs") {
+        opts.memory.placement = VoxelPlacement::kSlabs;
+      } else {
+        Usage(argv[0]);
+        return 1;
+      }
+    } else if (arg == "--huge-pages") {
+      opts.memory.huge_pages = std::stoi(argv[++i]) != 0;
+    } else {
+      Usage(argv[0]);
+      return 1;
+    }
+  }
+
+  SetVoxelMemoryOptions(opts.memory);
+  std::vector<Result> results;
+
+  for (size_t s : opts.sizes) {
+    std::vector<Result> r = RunSize(s, opts);
+    results.insert(results.end(), r.begin(), r.end());
+  }
+
+  if (opts.out.empty()) {
+    WriteJson(results, std::cout);
+  } else {
+    std::ofstream out(opts.out);
+    WriteJson(results, out);
+  }
+
+  return 0;
+}
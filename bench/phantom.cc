@@ -0,0 +1,127 @@
+#include "phantom.h"
+#include <algorithm>
+#include <cmath>
+#include <random>
+
+namespace imgvol {
+namespace bench {
+
+ImgVol SpherePhantom(size_t xsize, size_t ysize, size_t zsize,
+                     uint32_t seed) {
+  ImgVol img(xsize, ysize, zsize);
+  std::mt19937 generator(seed);
+  std::uniform_real_distribution<float> unit(0, 1);
+
+  float cx = xsize/2.0f;
+  float cy = ysize/2.0f;
+  float cz = zsize/2.0f;
+  float radius = std::min(std::min(xsize, ysize), zsize)/2.0f;
+
+  struct Sphere {
+    float x, y, z, r;
+    uint8_t v;
+  };
+
+  std::vector<Sphere> spheres;
+
+  for (int i = 0; i < 8; i++) {
+    spheres.push_back(Sphere{cx + (unit(generator) - 0.5f)*radius,
+                             cy + (unit(generator) - 0.5f)*radius,
+                             cz + (unit(generator) - 0.5f)*radius,
+                             radius*(0.05f + 0.1f*unit(generator)),
+                             uint8_t(200 + 55*unit(generator))});
+  }
+
+  uint8_t* data = img.Data();
+
+  for (size_t z = 0; z < zsize; z++) {
+    for (size_t y = 0; y < ysize; y++) {
+      for (size_t x = 0; x < xsize; x++) {
+        float d = std::sqrt((x - cx)*(x - cx) + (y - cy)*(y - cy) +
+                            (z - cz)*(z - cz));
+        float v = 0;
+
+        if (d < 0.9f*radius) {
+          v = 60;
+        }
+
+        if (d < 0.6f*radius) {
+          v = 120;
+        }
+
+        if (d < 0.3f*radius) {
+          v = 180;
+        }
+
+        for (const auto& s : spheres) {
+          float ds = (x - s.x)*(x - s.x) + (y - s.y)*(y - s.y) +
+              (z - s.z)*(z - s.z);
+
+          if (ds < s.r*s.r) {
+            v = s.v;
+          }
+        }
+
+        data[(z*ysize + y)*xsize + x] = uint8_t(v);
+      }
+    }
+  }
+
+  return img;
+}
+
+ImgVol NoisePhantom(size_t xsize, size_t ysize, size_t zsize,
+                    uint32_t seed) {
+  ImgVol img(xsize, ysize, zsize);
+  std::mt19937 generator(seed);
+  uint8_t* data = img.Data();
+
+  for (size_t i = 0; i < img.NumVoxels(); i++) {
+    data[i] = uint8_t(generator());
+  }
+
+  return img;
+}
+
+ImgVol LabelPhantom(size_t xsize, size_t ysize, size_t zsize,
+                    size_t nlabels, uint32_t seed) {
+  ImgVol img(xsize, ysize, zsize);
+  std::mt19937 generator(seed);
+  std::uniform_real_distribution<float> unit(0, 1);
+  float scale = std::min(std::min(xsize, ysize), zsize);
+  uint8_t* data = img.Data();
+
+  for (size_t l = 1; l <= nlabels; l++) {
+    float bx = unit(generator)*xsize;
+    float by = unit(generator)*ysize;
+    float bz = unit(generator)*zsize;
+    float rx = scale*(0.05f + 0.1f*unit(generator));
+    float ry = scale*(0.05f + 0.1f*unit(generator));
+    float rz = scale*(0.05f + 0.1f*unit(generator));
+
+    size_t x0 = size_t(std::max(0.0f, bx - rx));
+    size_t x1 = size_t(std::min(float(xsize), bx + rx + 1));
+    size_t y0 = size_t(std::max(0.0f, by - ry));
+    size_t y1 = size_t(std::min(float(ysize), by + ry + 1));
+    size_t z0 = size_t(std::max(0.0f, bz - rz));
+    size_t z1 = size_t(std::min(float(zsize), bz + rz + 1));
+
+    for (size_t z = z0; z < z1; z++) {
+      for (size_t y = y0; y < y1; y++) {
+        for (size_t x = x0; x < x1; x++) {
+          float d = (x - bx)*(x - bx)/(rx*rx) + (y - by)*(y - by)/(ry*ry) +
+              (z - bz)*(z - bz)/(rz*rz);
+
+          if (d < 1) {
+            data[(z*ysize + y)*xsize + x] = std::min<size_t>(l, 255);
+          }
+        }
+      }
+    }
+  }
+
+  return img;
+}
+
+}
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <cstdint>
+#include "img_vol.h"
+
+namespace imgvol {
+namespace bench {
+
+// Synthetic volumes for benchmarking, the same seed gives the same volume.
+
+// Nested spheres of increasing intensity centered in the volume, plus a
+// few smaller spheres scattered around it.
+ImgVol SpherePhantom(size_t xsize, size_t ysize, size_t zsize,
+                     uint32_t seed = 1);
+
+// Uniform noise in [0, 255].
+ImgVol NoisePhantom(size_t xsize, size_t ysize, size_t zsize,
+                    uint32_t seed = 1);
+
+// Background 0 with nlabels random ellipsoidal blobs labeled 1..nlabels.
+ImgVol LabelPhantom(size_t xsize, size_t ysize, size_t zsize,
+                    size_t nlabels = 16, uint32_t seed = 1);
+
+}
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+#include <utility>
+
+namespace imgvol {
+
+// Allocator of image buffers aligned to Align bytes, so rows that start at
+// multiples of Align can be processed in whole vectors. Elements are
+// default initialized, resizing leaves new pixels unspecified.
+template<class T, size_t Align = 64>
+class AlignedAllocator {
+ public:
+  typedef T value_type;
+
+  AlignedAllocator() noexcept {}
+
+  template<class U>
+  AlignedAllocator(const AlignedAllocator<U, Align>&) noexcept {}
+
+  T* allocate(size_t n) {
+    void* p = nullptr;
+
+    if (posix_memalign(&p, Align, n > 0 ? n*sizeof(T) : Align) != 0) {
+      throw std::bad_alloc();
+    }
+
+    return static_cast<T*>(p);
+  }
+
+  void deallocate(T* p, size_t) noexcept {
+    std::free(p);
+  }
+
+  template<class U>
+  void construct(U* p) {
+    ::new(static_cast<void*>(p)) U;
+  }
+
+  template<class U, class... Args>
+  void construct(U* p, Args&&... args) {
+    ::new(static_cast<void*>(p)) U(std::forward<Args>(args)...);
+  }
+
+  template<class U>
+  struct rebind {
+    typedef AlignedAllocator<U, Align> other;
+  };
+};
+
+template<class T, class U, size_t Align>
+bool operator==(const AlignedAllocator<T, Align>&,
+                const AlignedAllocator<U, Align>&) {
+  return true;
+}
+
+template<class T, class U, size_t Align>
+bool operator!=(const AlignedAllocator<T, Align>&,
+                const AlignedAllocator<U, Align>&) {
+  return false;
+}
+
+}
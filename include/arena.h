@@ -0,0 +1,77 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace imgvol {
+
+// Bump allocator for the temporaries of render/transform kernels. Memory
+// is handed out from large blocks and given back all at once by
+// ArenaScope, blocks are kept for reuse so a kernel called in a loop stops
+// allocating after its first call. Objects placed in the arena are not
+// destroyed, so only use it for trivially destructible types.
+class Arena {
+ public:
+  struct Mark {
+    size_t block;
+    size_t offset;
+  };
+
+  explicit Arena(size_t block_size = 1 << 20);
+
+  Arena(const Arena&) = delete;
+
+  Arena& operator=(const Arena&) = delete;
+
+  void* Allocate(size_t size, size_t align = alignof(std::max_align_t));
+
+  template<class T>
+  T* Allocate(size_t n) {
+    return static_cast<T*>(Allocate(n*sizeof(T), alignof(T)));
+  }
+
+  Mark GetMark() const noexcept;
+
+  void Release(Mark mark) noexcept;
+
+  // Bytes reserved by the arena blocks.
+  size_t Capacity() const noexcept;
+
+  // Arena of the calling thread.
+  static Arena& Local();
+
+ private:
+  struct Block {
+    std::unique_ptr<uint8_t[]> data;
+    size_t size;
+  };
+
+  std::vector<Block> blocks_;
+  size_t block_size_;
+  size_t current_;
+  size_t offset_;
+};
+
+// Releases everything allocated from the arena during its lifetime.
+class ArenaScope {
+ public:
+  explicit ArenaScope(Arena& arena = Arena::Local())
+    : arena_(arena)
+    , mark_(arena.GetMark()) {}
+
+  ArenaScope(const ArenaScope&) = delete;
+
+  ArenaScope& operator=(const ArenaScope&) = delete;
+
+  ~ArenaScope() {
+    arena_.Release(mark_);
+  }
+
+ private:
+  Arena& arena_;
+  Arena::Mark mark_;
+};
+
+}
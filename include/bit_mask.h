@@ -0,0 +1,125 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <vector>
+#include "img2d.h"
+#include "img_vol.h"
+#include "labeling.h"
+
+namespace imgvol {
+
+// Binary volume with one bit per voxel. Each row along x is packed in
+// whole 64 bit words, voxel x in bit x%64 of word x/64, and the bits past
+// the end of a row are kept clear. Operations work on 64 voxels per word
+// operation.
+class BitMask {
+ public:
+  BitMask(size_t xsize, size_t ysize, size_t zsize);
+
+  bool operator()(size_t x, size_t y, size_t z) const {
+    return (Row(y, z)[x >> 6] >> (x & 63)) & 1;
+  }
+
+  void Set(bool v, size_t x, size_t y, size_t z) {
+    uint64_t bit = uint64_t(1) << (x & 63);
+    uint64_t& word = Row(y, z)[x >> 6];
+    word = v ? word | bit : word & ~bit;
+  }
+
+  size_t SizeX() const noexcept {
+    return xsize_;
+  }
+
+  size_t SizeY() const noexcept {
+    return ysize_;
+  }
+
+  size_t SizeZ() const noexcept {
+    return zsize_;
+  }
+
+  size_t WordsPerRow() const noexcept {
+    return words_per_row_;
+  }
+
+  const uint64_t* Row(size_t y, size_t z) const {
+    return words_.data() + (z*ysize_ + y)*words_per_row_;
+  }
+
+  uint64_t* Row(size_t y, size_t z) {
+    return words_.data() + (z*ysize_ + y)*words_per_row_;
+  }
+
+  // Mask of the valid bits of the last word of a row.
+  uint64_t LastWordMask() const noexcept;
+
+  // Number of voxels set, by popcount.
+  size_t Count() const;
+
+  // Same meaning as ImgVol::Origin().
+  std::array<size_t, 3> Origin() const noexcept {
+    return origin_;
+  }
+
+  void SetOrigin(std::array<size_t, 3> origin) noexcept {
+    origin_ = origin;
+  }
+
+ private:
+  size_t xsize_;
+  size_t ysize_;
+  size_t zsize_;
+  size_t words_per_row_;
+  std::vector<uint64_t> words_;
+  std::array<size_t, 3> origin_;
+};
+
+// Voxels of img in [lo, hi].
+BitMask ThresholdMask(const ImgVol& img, int lo, int hi = 255,
+                      size_t nthreads = 0);
+
+// Voxels of a label volume equal to label.
+BitMask LabelMask(const ImgVol& labels, int label, size_t nthreads = 0);
+
+// Set voxels as value, the others as 0.
+void MaskToVolume(const BitMask& mask, uint8_t value, ImgVol* out);
+
+// Morphology with the 6, 18 or 26 neighbourhood, one voxel per step.
+// Outside the volume counts as background for dilation and foreground
+// for erosion, so neither is affected by the volume border. out may be
+// mask itself.
+void Dilate(const BitMask& mask, Connectivity conn, BitMask* out,
+            size_t nthreads = 0);
+
+void Erode(const BitMask& mask, Connectivity conn, BitMask* out,
+           size_t nthreads = 0);
+
+// Erosion then dilation.
+void Open(const BitMask& mask, Connectivity conn, BitMask* out,
+          size_t nthreads = 0);
+
+// Dilation then erosion.
+void Close(const BitMask& mask, Connectivity conn, BitMask* out,
+           size_t nthreads = 0);
+
+// Cut of the mask laid out as Cut() of a volume, 1 where set. Passing it
+// as the label image of ColorLabels() overlays the mask on the slice.
+void Cut(const BitMask& mask, ImgVol::Axis axis, size_t pos, bool w,
+         Img2D* out);
+
+Img2D Cut(const BitMask& mask, ImgVol::Axis axis, size_t pos,
+          bool w = false);
+
+// MaxIntensionProjection() over the voxels in mask only, rays that meet
+// no voxel of the mask are 0. The mask must have the size of img.
+void MaxIntensionProjection(ImgVol& img, const BitMask& mask, float delta_x,
+                            float delta_y, std::array<float, 3> vet_normal,
+                            ImgGray* out, size_t nthreads = 0);
+
+ImgGray MaxIntensionProjection(ImgVol& img, const BitMask& mask,
+                               float delta_x, float delta_y,
+                               std::array<float, 3> vet_normal,
+                               size_t nthreads = 0);
+
+}
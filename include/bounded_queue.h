@@ -0,0 +1,80 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+
+namespace imgvol {
+
+// Blocking FIFO with a fixed capacity, used to connect pipeline stages.
+// Push blocks while the queue is full and Pop while it is empty. Once
+// closed, Push drops its item and Pop drains the remaining ones.
+template<class T>
+class BoundedQueue {
+ public:
+  explicit BoundedQueue(size_t capacity)
+    : capacity_(capacity > 0 ? capacity : 1)
+    , closed_(false) {}
+
+  BoundedQueue(const BoundedQueue&) = delete;
+
+  BoundedQueue& operator=(const BoundedQueue&) = delete;
+
+  bool Push(T item) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    not_full_.wait(lock, [this]() {
+      return closed_ || queue_.size() < capacity_;
+    });
+
+    if (closed_) {
+      return false;
+    }
+
+    queue_.push_back(std::move(item));
+    not_empty_.notify_one();
+    return true;
+  }
+
+  bool Pop(T* item) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    not_empty_.wait(lock, [this]() {
+      return closed_ || !queue_.empty();
+    });
+
+    if (queue_.empty()) {
+      return false;
+    }
+
+    *item = std::move(queue_.front());
+    queue_.pop_front();
+    not_full_.notify_one();
+    return true;
+  }
+
+  void Close() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    closed_ = true;
+    not_empty_.notify_all();
+    not_full_.notify_all();
+  }
+
+  size_t Size() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return queue_.size();
+  }
+
+  size_t Capacity() const noexcept {
+    return capacity_;
+  }
+
+ private:
+  mutable std::mutex mutex_;
+  std::condition_variable not_empty_;
+  std::condition_variable not_full_;
+  std::deque<T> queue_;
+  size_t capacity_;
+  bool closed_;
+};
+
+}
@@ -0,0 +1,106 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <fstream>
+#include <functional>
+#include <string>
+#include <vector>
+#include "img_vol.h"
+#include "img2d.h"
+
+namespace imgvol {
+
+// Container format (.vbk) that stores an ImgVol as independently
+// zlib-compressed bricks, followed by an index footer for random access:
+//
+//   "VBRK" version xsize ysize zsize brick_x brick_y brick_z
+//   brick 0 | brick 1 | ... | brick n-1
+//   index: (offset, size) per brick, x fastest, then y, then z
+//   index offset, "VBRK"
+//
+// Voxels inside a brick are stored x fastest, bricks on the border are
+// clipped to the volume extent.
+
+std::vector<uint8_t> CompressBrick(const uint8_t* data, size_t size,
+                                   int level = -1);
+
+void DecompressBrick(const uint8_t* src, size_t src_size, uint8_t* dst,
+                     size_t dst_size);
+
+// Throws std::invalid_argument for a zero brick size.
+void WriteBrickVolume(const ImgVol& img, const std::string& file_name,
+                      size_t brick_size = 64, int level = -1,
+                      size_t nthreads = 0);
+
+class BrickVolume {
+ public:
+  struct IndexEntry {
+    uint64_t offset;
+    uint64_t size;
+  };
+
+  // Throws std::runtime_error when the file isn't a brick volume, or its
+  // header or index offset is corrupt.
+  BrickVolume(const std::string& file_name, size_t nthreads = 0);
+
+  BrickVolume(const BrickVolume&) = delete;
+
+  BrickVolume& operator=(const BrickVolume&) = delete;
+
+  ~BrickVolume();
+
+  size_t SizeX() const noexcept;
+
+  size_t SizeY() const noexcept;
+
+  size_t SizeZ() const noexcept;
+
+  std::array<size_t, 3> BrickSize() const noexcept;
+
+  std::array<size_t, 3> NumBricks() const noexcept;
+
+  size_t BrickId(size_t bx, size_t by, size_t bz) const noexcept;
+
+  // Decompress the whole volume.
+  ImgVol ReadAll();
+
+  // Decompress only the bricks that overlap [x0, x1) x [y0, y1) x [z0, z1).
+  // The returned volume has the size of the region.
+  ImgVol ReadRegion(std::array<size_t, 3> p0, std::array<size_t, 3> p1);
+
+  // Same result as Cut() over the full volume, decompressing one brick
+  // layer only.
+  Img2D Cut(ImgVol::Axis axis, size_t pos, bool w = false);
+
+  // Same result as CortePlanar() over the full volume. Only the bricks
+  // sampled by the plane are decompressed, one batch at a time, so the
+  // volume is never held in memory.
+  ImgGray CortePlanar(std::array<float, 3> p1, std::array<float, 3> vec);
+
+  // Bricks whose bounding box is crossed by the plane that passes
+  // through p1 with normal vec.
+  std::vector<size_t> BricksOnPlane(std::array<float, 3> p1,
+                                    std::array<float, 3> vec) const;
+
+ private:
+  // Called with the position k of the brick in ids, its voxels and its
+  // extent [b0, b1). Runs on several threads at once.
+  typedef std::function<void(size_t k, const uint8_t* raw,
+                             std::array<size_t, 3> b0,
+                             std::array<size_t, 3> b1)> BrickFn;
+
+  void DecodeBricks(const std::vector<size_t>& ids, const BrickFn& fn);
+
+  void ReadBricks(const std::vector<size_t>& ids, std::array<size_t, 3> p0,
+                  ImgVol* img);
+
+  std::ifstream in_file_;
+  std::vector<IndexEntry> index_;
+  std::array<size_t, 3> size_;
+  std::array<size_t, 3> brick_;
+  std::array<size_t, 3> nbricks_;
+  size_t nthreads_;
+};
+
+}
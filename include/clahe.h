@@ -0,0 +1,43 @@
+#pragma once
+
+#include "img2d.h"
+#include "img_vol.h"
+
+namespace imgvol {
+
+// Contrast limited adaptive histogram equalization. The image is split in
+// a grid of tiles, each tile gets an equalization LUT from its clipped
+// histogram, and every pixel is mapped through the LUTs of the nearest
+// tiles blended bilinearly (trilinearly for volumes) so tile borders
+// don't show.
+struct ClaheOptions {
+  size_t tiles_x = 8;
+  size_t tiles_y = 8;
+
+  // Only used for volumes.
+  size_t tiles_z = 4;
+
+  // Histogram bins are clipped at clip_limit times the mean bin count and
+  // the excess spread over all bins. 1 leaves the image almost unchanged,
+  // 0 disables clipping (plain adaptive equalization).
+  float clip_limit = 3;
+
+  size_t nthreads = 0;
+};
+
+// out may be img itself.
+void Clahe(const ImgGray& img, const ClaheOptions& opts, ImgGray* out);
+
+ImgGray Clahe(const ImgGray& img, const ClaheOptions& opts = ClaheOptions());
+
+// Values are binned over the [min, max] range of img, out is in 0..255.
+void Clahe(const Img2D& img, const ClaheOptions& opts, Img2D* out);
+
+Img2D Clahe(const Img2D& img, const ClaheOptions& opts = ClaheOptions());
+
+// 3D variant with tiles_x*tiles_y*tiles_z tiles, out may be img itself.
+void Clahe(const ImgVol& img, const ClaheOptions& opts, ImgVol* out);
+
+ImgVol Clahe(const ImgVol& img, const ClaheOptions& opts = ClaheOptions());
+
+}
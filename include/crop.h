@@ -0,0 +1,33 @@
+#pragma once
+
+#include <array>
+#include "img_vol.h"
+
+namespace imgvol {
+
+// Voxels [lo, hi) along each axis.
+struct BoundingBox {
+  std::array<size_t, 3> lo;
+  std::array<size_t, 3> hi;
+
+  bool Empty() const noexcept {
+    return hi[0] <= lo[0] || hi[1] <= lo[1] || hi[2] <= lo[2];
+  }
+};
+
+// Tight box around the voxels above threshold, computed over z slabs in
+// parallel. The box is empty when no voxel is above it.
+BoundingBox ForegroundBox(const ImgVol& img, int threshold = 0,
+                          size_t nthreads = 0);
+
+// Copy of the voxels inside box, clipped to the volume. The copy records
+// its origin, so points in the frame of img keep addressing the same
+// voxels.
+ImgVol Crop(const ImgVol& img, const BoundingBox& box, size_t nthreads = 0);
+
+// Crop to the foreground box grown by margin voxels on each side. An
+// all-background volume is cropped to a single voxel.
+ImgVol CropForeground(const ImgVol& img, int threshold = 0, size_t margin = 0,
+                      size_t nthreads = 0);
+
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include "img_vol.h"
+
+namespace imgvol {
+
+// 3D smoothing filters. The volume is split in z slabs filtered in
+// parallel, each slab reads the neighbour slices it needs (its halo)
+// straight from the source, and borders replicate the edge voxels.
+// The overloads taking only the volume filter it in place.
+
+// Separable Gaussian with a kernel of radius ceil(3*sigma). Throws
+// std::invalid_argument unless sigma > 0.
+void GaussianFilter(const ImgVol& src, float sigma, ImgVol* dst,
+                    size_t nthreads = 0);
+
+void GaussianFilter(ImgVol& img, float sigma);
+
+// Separable mean over a (2*radius + 1)^3 box, computed with running sums
+// so the cost doesn't depend on the radius.
+void BoxFilter(const ImgVol& src, size_t radius, ImgVol* dst,
+               size_t nthreads = 0);
+
+void BoxFilter(ImgVol& img, size_t radius);
+
+// Median of the 3x3x3 neighbourhood.
+void MedianFilter(const ImgVol& src, ImgVol* dst, size_t nthreads = 0);
+
+void MedianFilter(ImgVol& img);
+
+}
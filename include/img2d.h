@@ -49,6 +49,14 @@ class Img2D {
     return pixels_[ysize*xsize_ + xsize];
   }
 
+  // Change the dimensions, the buffer only grows so shrinking and
+  // growing back don't allocate. Pixel values are left unspecified.
+  void Resize(size_t xsize, size_t ysize) {
+    xsize_ = xsize;
+    ysize_ = ysize;
+    pixels_.resize(xsize*ysize);
+  }
+
   size_t SizeX() const noexcept {
     return xsize_;
   }
@@ -65,6 +73,10 @@ class Img2D {
     return pixels_.data();
   }
 
+  int* Data() noexcept {
+    return pixels_.data();
+  }
+
   int& operator[](size_t i) {
     return pixels_[i];
   }
@@ -8,14 +8,27 @@
 #include <opencv2/core.hpp>
 #include <opencv2/imgcodecs.hpp>
 #include <opencv2/highgui.hpp>
+#include "aligned_allocator.h"
+#include "voxel_memory.h"
 
 namespace imgvol {
 
+// Memory layout of ImgColor pixels. Channels are kept in BGR order, as
+// cv::imwrite expects them. kBgrx pads every pixel to 4 bytes, kPlanar
+// stores the B, G and R planes one after the other.
+enum class ColorLayout {
+  kBgr, kBgrx, kPlanar
+};
+
+// Color image in a single 64 byte aligned buffer. Every row, of every
+// plane for kPlanar, starts at a multiple of 64 bytes, so rows can be
+// written and read in whole vectors.
 class ImgColor {
  public:
   ImgColor() = delete;
 
-  ImgColor(size_t xsize, size_t ysize);
+  // Pixels start black.
+  ImgColor(size_t xsize, size_t ysize, ColorLayout layout = ColorLayout::kBgr);
 
   ImgColor(const ImgColor&);
 
@@ -31,20 +44,65 @@ class ImgColor {
 
   void operator()(std::array<uint8_t, 3> v, size_t x, size_t y);
 
+  // Pixel i of the image in row order, i = y*SizeX() + x.
   void operator()(std::array<uint8_t, 3> v, size_t i);
 
+  // Change the dimensions keeping the buffer capacity, pixel values are
+  // left unspecified.
+  void Resize(size_t xsize, size_t ysize);
+
+  void Resize(size_t xsize, size_t ysize, ColorLayout layout);
+
   size_t SizeX() const noexcept;
 
   size_t SizeY() const noexcept;
 
+  ColorLayout Layout() const noexcept;
+
+  // Bytes per pixel in a row: 3, 4, or 1 for each plane of kPlanar.
+  size_t PixelBytes() const noexcept;
+
+  // Bytes from a row to the next one.
+  size_t Stride() const noexcept;
+
+  // Row y, of plane c for kPlanar. Packed layouts have only plane 0.
+  const uint8_t* Row(size_t y, size_t c = 0) const noexcept {
+    return buf_.data() + (c*ysize_ + y)*stride_;
+  }
+
+  uint8_t* Row(size_t y, size_t c = 0) noexcept {
+    return buf_.data() + (c*ysize_ + y)*stride_;
+  }
+
+  // Row(0), the rows follow Stride() bytes apart.
+  const uint8_t* Data() const noexcept;
+
+  uint8_t* Data() noexcept;
+
+  // Set every pixel to v, in BGR order.
+  void Fill(std::array<uint8_t, 3> v);
+
+  // Store n pixels of row y from x0 on, given one array per channel.
+  void WriteRow(size_t y, size_t x0, size_t n, const uint8_t* b,
+                const uint8_t* g, const uint8_t* r);
+
+  // Blend n pixels over row y from x0 on, with alpha from 0 (keep the
+  // pixel) to 255 (replace it).
+  void BlendRow(size_t y, size_t x0, size_t n, const uint8_t* b,
+                const uint8_t* g, const uint8_t* r, const uint8_t* alpha);
+
+  // Files ending in .png are written by the PNG encoder, any other
+  // extension goes through OpenCV.
   void WriteImg(const std::string& file_name);
 
  private:
   void Copy(const ImgColor&);
   void Move(ImgColor&&);
-  std::vector<std::array<uint8_t, 3>> img_;
+  std::vector<uint8_t, AlignedAllocator<uint8_t>> buf_;
   size_t xsize_;
   size_t ysize_;
+  size_t stride_;
+  ColorLayout layout_;
 };
 
 class ImgGray {
@@ -67,10 +125,20 @@ class ImgGray {
 
   void operator()(uint8_t v, size_t x, size_t y);
 
+  // Change the dimensions keeping the buffer capacity, pixel values are
+  // left unspecified.
+  void Resize(size_t xsize, size_t ysize);
+
   size_t SizeX() const noexcept;
 
   size_t SizeY() const noexcept;
 
+  const uint8_t* Data() const noexcept;
+
+  uint8_t* Data() noexcept;
+
+  // Files ending in .png are written by the PNG encoder, any other
+  // extension goes through OpenCV.
   void WriteImg(const std::string& file_name);
 
  private:
@@ -81,6 +149,11 @@ class ImgGray {
   size_t ysize_;
 };
 
+// The voxels live in a reference counted buffer shared by copies, so
+// copying or passing a volume around is O(1). The first write through a
+// copy (SetVoxelIntensity, Data(), Resize) clones the buffer in one bulk
+// copy when other volumes still share it. New buffers are placed on the
+// NUMA nodes following SetVoxelMemoryOptions().
 class ImgVol {
  public:
   enum class Axis {
@@ -89,19 +162,26 @@ class ImgVol {
 
   ImgVol(size_t xsize, size_t ysize, size_t zsize);
 
+  // Read a .scn volume. The file is a text header
+  //
+  //   SCN
+  //   xsize ysize zsize
+  //   dx dy dz
+  //   nbits
+  //
+  // followed by the voxels, x fastest, then y, then z. nbits is 8 for one
+  // byte per voxel or 16 for two little-endian bytes, 16 bit volumes
+  // whose maximum is above 255 are rescaled to [0, 255].
   ImgVol(std::string file_name);
 
   ImgVol(const ImgVol& img);
 
-  ImgVol(ImgVol&& img) {
-    img_ = std::move(img.img_);
-  }
+  // Moves leave the source empty and never allocate.
+  ImgVol(ImgVol&& img) noexcept;
 
   ImgVol& operator=(const ImgVol& img);
 
-  ImgVol& operator=(ImgVol&& img) {
-    img_ = std::move(img.img_);
-  }
+  ImgVol& operator=(ImgVol&& img) noexcept;
 
   ~ImgVol();
 
@@ -109,20 +189,47 @@ class ImgVol {
 
   int VoxelIntensity(size_t x, size_t y, size_t z) const;
 
+  // Unshares the buffer on every call, loops writing many voxels should
+  // take Data() once instead.
   void SetVoxelIntensity(float b, size_t x, size_t y, size_t z);
 
+  // Change the dimensions keeping the buffer capacity, voxel values are
+  // left unspecified.
+  void Resize(size_t xsize, size_t ysize, size_t zsize);
+
   size_t SizeX() const noexcept;
 
   size_t SizeY() const noexcept;
 
   size_t SizeZ() const noexcept;
 
+  size_t NumVoxels() const noexcept;
+
+  const uint8_t* Data() const noexcept;
+
+  // Unshares the buffer before handing it out. Take the pointer once
+  // before writing from several threads.
+  uint8_t* Data();
+
+  // True when no other volume shares the voxel buffer.
+  bool Unique() const noexcept;
+
   float DimX() const noexcept;
 
   float DimY() const noexcept;
 
   float DimZ() const noexcept;
 
+  void SetVoxelSize(float dx, float dy, float dz) noexcept;
+
+  // Position of voxel (0, 0, 0) in the volume it was cropped from. Points
+  // given to CortePlanar, ReformataImg and Mpr are in that frame. Resize
+  // keeps the origin.
+  std::array<size_t, 3> Origin() const noexcept;
+
+  void SetOrigin(std::array<size_t, 3> origin) noexcept;
+
+  // Write an 8 bit .scn volume.
   void WriteImg(std::string file_name);
 
   uint8_t Imax();
@@ -131,10 +238,17 @@ class ImgVol {
                                   ImgVol& img);
 
  private:
-  std::vector<uint8_t> img_;
+  void Copy(const ImgVol&);
+  void Move(ImgVol&&) noexcept;
+  void Detach();
+  std::shared_ptr<VoxelBuffer> img_;
   size_t xsize_;
   size_t ysize_;
   size_t zsize_;
+  float dx_;
+  float dy_;
+  float dz_;
+  std::array<size_t, 3> origin_;
 };
 
 }
@@ -0,0 +1,139 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+// Per-operation counters and timers. Every thread accumulates into its own
+// slot without locking, Snapshot() sums the slots of all threads. Building
+// with VIMAGE_NO_INSTRUMENTATION defined turns the macros into no-ops.
+
+namespace imgvol {
+namespace instrument {
+
+enum class Counter {
+  kCutPixels,
+  kWindowedPixels,
+  kColorLabelPixels,
+  kPlanarSamples,
+  kReformatSlices,
+  kRaysCast,
+  kRaySamples,
+  kNormalizedVoxels,
+  kWireframeLines,
+  kNumCounters
+};
+
+// Timers are inclusive, ReformataImg time also counts in CortePlanar.
+enum class Timer {
+  kCut,
+  kNormalize,
+  kNegative,
+  kBrightinessContrast,
+  kColorLabels,
+  kCortePlanar,
+  kReformataImg,
+  kMaxIntensionProjection,
+  kNormalizeImage,
+  kDrawWireframe,
+  kVolumeRender,
+  kMpr,
+  kSlabMip,
+  kLabelMip,
+  kClahe,
+  kNumTimers
+};
+
+const size_t kNumCounters = size_t(Counter::kNumCounters);
+const size_t kNumTimers = size_t(Timer::kNumTimers);
+
+struct TimerStats {
+  uint64_t calls;
+  uint64_t nanoseconds;
+};
+
+struct Snapshot {
+  std::array<uint64_t, kNumCounters> counters;
+  std::array<TimerStats, kNumTimers> timers;
+
+  uint64_t operator[](Counter c) const {
+    return counters[size_t(c)];
+  }
+
+  const TimerStats& operator[](Timer t) const {
+    return timers[size_t(t)];
+  }
+
+  // Work done between an earlier snapshot and this one.
+  Snapshot operator-(const Snapshot& earlier) const;
+
+  std::string ToJson() const;
+};
+
+// Counts of one thread. Only the owner thread writes, so updates are a
+// relaxed load and store instead of a locked read-modify-write, and
+// readers from other threads still see whole values.
+struct ThreadSlot {
+  std::array<std::atomic<uint64_t>, kNumCounters> counters;
+  std::array<std::atomic<uint64_t>, kNumTimers> calls;
+  std::array<std::atomic<uint64_t>, kNumTimers> nanoseconds;
+};
+
+ThreadSlot& LocalSlot();
+
+inline void Add(std::atomic<uint64_t>& v, uint64_t n) {
+  v.store(v.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+}
+
+inline void Count(Counter c, uint64_t n = 1) {
+  Add(LocalSlot().counters[size_t(c)], n);
+}
+
+// Totals of every thread, including threads that already exited.
+Snapshot TakeSnapshot();
+
+class ScopedTimer {
+ public:
+  explicit ScopedTimer(Timer timer)
+    : timer_(timer)
+    , start_(std::chrono::steady_clock::now()) {}
+
+  ScopedTimer(const ScopedTimer&) = delete;
+
+  ScopedTimer& operator=(const ScopedTimer&) = delete;
+
+  ~ScopedTimer() {
+    auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - start_).count();
+    ThreadSlot& slot = LocalSlot();
+    Add(slot.calls[size_t(timer_)], 1);
+    Add(slot.nanoseconds[size_t(timer_)], ns);
+  }
+
+ private:
+  Timer timer_;
+  std::chrono::steady_clock::time_point start_;
+};
+
+const char* Name(Counter c);
+
+const char* Name(Timer t);
+
+}
+}
+
+#define VIMAGE_CONCAT_(a, b) a##b
+#define VIMAGE_CONCAT(a, b) VIMAGE_CONCAT_(a, b)
+
+#ifdef VIMAGE_NO_INSTRUMENTATION
+#define VIMAGE_SCOPED_TIMER(timer)
+#define VIMAGE_COUNT(counter, n)
+#else
+#define VIMAGE_SCOPED_TIMER(timer) \
+  ::imgvol::instrument::ScopedTimer VIMAGE_CONCAT(vimage_timer_, __LINE__)( \
+      ::imgvol::instrument::Timer::timer)
+#define VIMAGE_COUNT(counter, n) \
+  ::imgvol::instrument::Count(::imgvol::instrument::Counter::counter, (n))
+#endif
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <array>
+#include "img2d.h"
+#include "img_vol.h"
+
+namespace imgvol {
+
+// Per ray results of LabelMaxIntensionProjection, all of them in the
+// MaxIntensionProjection image layout.
+struct LabelMip {
+  // Maximum intensity along the ray, 0 when the ray misses the volume.
+  Img2D intensity = Img2D(0, 0);
+
+  // Label of the voxel holding the maximum, the front-most one on ties.
+  Img2D labels = Img2D(0, 0);
+
+  // Voxels traversed from the ray entry to that voxel, -1 on a miss.
+  Img2D depth = Img2D(0, 0);
+
+  // intensity and labels colored by ColorLabels.
+  ImgColor overlay = ImgColor(0, 0);
+};
+
+// MIP of img that marches the label volume along in the same traversal,
+// so the label and depth of each pixel are those of the voxel that won.
+// Both volumes must have the same size. img is normalized in place as
+// MaxIntensionProjection does.
+void LabelMaxIntensionProjection(ImgVol& img, const ImgVol& labels,
+                                 float delta_x, float delta_y,
+                                 std::array<float, 3> vet_normal,
+                                 LabelMip* out, size_t nthreads = 0);
+
+LabelMip LabelMaxIntensionProjection(ImgVol& img, const ImgVol& labels,
+                                     float delta_x, float delta_y,
+                                     std::array<float, 3> vet_normal,
+                                     size_t nthreads = 0);
+
+}
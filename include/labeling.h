@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include "img_vol.h"
+
+namespace imgvol {
+
+enum class Connectivity {
+  k6 = 6, k18 = 18, k26 = 26
+};
+
+struct Components {
+  // Label of every voxel, 0 for background. Components are numbered
+  // 1..n by decreasing size, ties broken by their first voxel in raster
+  // order.
+  std::vector<uint32_t> labels;
+
+  // sizes[l] is the number of voxels of component l, sizes[0] counts the
+  // background.
+  std::vector<size_t> sizes;
+
+  // Same labels as an ImgVol. Voxels hold 8 bits, so only the 255 largest
+  // components are kept, smaller ones are written as background.
+  ImgVol label_img;
+};
+
+// Label the connected components of the voxels above threshold. The
+// volume is labeled in z slabs in parallel with a union-find per slab,
+// then the slabs are merged across their boundary slices.
+Components LabelComponents(const ImgVol& img, int threshold = 0,
+                           Connectivity conn = Connectivity::k26,
+                           size_t nthreads = 0);
+
+}
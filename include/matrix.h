@@ -1,5 +1,6 @@
 #pragma once
 
+#include <array>
 #include <string>
 #include <vector>
 #include <initializer_list>
@@ -12,13 +13,13 @@ class Matrix {
   Matrix(size_t ncols, size_t nrows)
     : nrows_{nrows}
     , ncols_{ncols} {
-      mat_.reserve(ncols_*nrows_);
+      mat_.resize(ncols_*nrows_);
   }
 
   Matrix(std::initializer_list<std::initializer_list<T>>&& list) {
-    ncols_ = list.size();
+    nrows_ = list.size();
     auto it = list.begin();
-    nrows_ = it->size();
+    ncols_ = it->size();
     mat_.reserve(ncols_*nrows_);
 
     for (auto& line : list) {
@@ -99,16 +100,48 @@ Matrix<T> MultMatrices(const Matrix<T>& a, const Matrix<T>& b) {
   size_t n1 = b.nrows();
   size_t n2 = b.ncols();
 
-  Matrix<T> res = Matrix<T>(m1, n2);
+  Matrix<T> res = Matrix<T>(n2, m1);
   for (size_t i = 0; i < m1; i++) {
     for (size_t j = 0; j < n2; j++) {
-      res(i, j)= 0;
+      T v = 0;
       for (size_t x = 0; x < m2; x++) {
-        T v = a(i, j)*b(x, j);
-        res(v, i, j);
+        v += a(i, x)*b(x, j);
       }
+      res(v, i, j);
     }
   }
+
+  return res;
+}
+
+// Row major 4x4 matrix and 4-vector with fixed storage, for transforms
+// applied per pixel where a heap backed Matrix would allocate.
+typedef std::array<double, 16> Mat4;
+typedef std::array<double, 4> Vec4;
+
+inline Mat4 MultMat4(const Mat4& a, const Mat4& b) {
+  Mat4 res;
+  for (size_t i = 0; i < 4; i++) {
+    for (size_t j = 0; j < 4; j++) {
+      double v = 0;
+      for (size_t x = 0; x < 4; x++) {
+        v += a[i*4 + x]*b[x*4 + j];
+      }
+      res[i*4 + j] = v;
+    }
+  }
+
+  return res;
+}
+
+inline Vec4 MultMat4(const Mat4& a, const Vec4& b) {
+  Vec4 res;
+  for (size_t i = 0; i < 4; i++) {
+    res[i] = a[i*4]*b[0] + a[i*4 + 1]*b[1] + a[i*4 + 2]*b[2] +
+        a[i*4 + 3]*b[3];
+  }
+
+  return res;
 }
 
-}
\ No newline at end of file
+}
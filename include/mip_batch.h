@@ -0,0 +1,69 @@
+#pragma once
+
+#include <array>
+#include <string>
+#include <vector>
+#include "img_vol.h"
+#include "png_encoder.h"
+
+namespace imgvol {
+
+// Many MIP views of one volume rendered together, e.g. the frames of a
+// rotating cine loop. The volume is normalized once for all the views.
+// Rays of several views are traced side by side and advanced brick by
+// brick: every ray waits in the queue of the brick it is in, and a brick
+// is walked by all its queued rays, of every view, while it is in cache.
+// Frames are identical to MaxIntensionProjection() of each view.
+
+struct MipView {
+  float delta_x;
+  float delta_y;
+};
+
+// n views turning around the y axis, tilted by delta_x.
+std::vector<MipView> MipTurntable(size_t n, float delta_x = 0);
+
+struct MipBatchOptions {
+  // Edge of the cubic bricks, 64 voxels make 256 KiB bricks that stay in
+  // a typical L2 cache.
+  size_t brick_size = 64;
+
+  // Rays traced together by one thread. The views and rows of a batch
+  // are chosen to fill it, more views per batch share more brick visits.
+  size_t max_rays = 1 << 16;
+
+  // Used by ExportMipViews only.
+  PngOptions png;
+  size_t queue_depth = 8;
+
+  // Encoding threads of ExportMipViews, 0 for a quarter of nthreads.
+  size_t encode_threads = 0;
+
+  size_t nthreads = 0;
+};
+
+void MaxIntensionProjections(ImgVol& img, const std::vector<MipView>& views,
+                             std::array<float, 3> vet_normal,
+                             const MipBatchOptions& opts,
+                             std::vector<ImgGray>* out);
+
+std::vector<ImgGray> MaxIntensionProjections(
+    ImgVol& img, const std::vector<MipView>& views,
+    std::array<float, 3> vet_normal,
+    const MipBatchOptions& opts = MipBatchOptions());
+
+struct MipExportStats {
+  size_t frames;
+  double seconds;
+  double frames_per_sec;
+};
+
+// Render the views and write them as prefix<view>.png files. Finished
+// frames are PNG encoded and written while the next views render, and a
+// frame is released once written.
+MipExportStats ExportMipViews(ImgVol& img, const std::vector<MipView>& views,
+                              std::array<float, 3> vet_normal,
+                              const std::string& prefix,
+                              const MipBatchOptions& opts = MipBatchOptions());
+
+}
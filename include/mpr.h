@@ -0,0 +1,45 @@
+#pragma once
+
+#include <array>
+#include <vector>
+#include "img2d.h"
+#include "img_vol.h"
+
+namespace imgvol {
+
+struct MprOptions {
+  // Flip the orthogonal slices as Cut does.
+  bool w = false;
+
+  // Oblique planes and the axial slice are split in bands of this many
+  // rows, so one large plane doesn't keep the other threads waiting.
+  size_t band_rows = 32;
+
+  size_t nthreads = 0;
+};
+
+// Planes through the crosshair. The orthogonal slices match Cut on the
+// same axis, the oblique ones match CortePlanar.
+struct MprViews {
+  Img2D axial = Img2D(0, 0);
+  Img2D coronal = Img2D(0, 0);
+  Img2D sagittal = Img2D(0, 0);
+  std::vector<ImgGray> oblique;
+};
+
+// Render the axial (z), coronal (y) and sagittal (x) slices through point
+// plus one oblique plane through it per normal, all in one call. point is
+// in the frame of the uncropped volume, see ImgVol::Origin(). The work
+// is split in tasks run concurrently: axial and oblique row bands, and z
+// ranges where coronal and sagittal share a single pass over the slices,
+// each slice read once for both. Reusing out across cursor moves keeps
+// the image buffers.
+void Mpr(const ImgVol& img, std::array<size_t, 3> point,
+         const std::vector<std::array<float, 3>>& oblique_normals,
+         const MprOptions& opts, MprViews* out);
+
+MprViews Mpr(const ImgVol& img, std::array<size_t, 3> point,
+             const std::vector<std::array<float, 3>>& oblique_normals,
+             const MprOptions& opts = MprOptions());
+
+}
@@ -2,11 +2,19 @@
 
 #include "img_vol.h"
 #include "img2d.h"
+#include "matrix.h"
+#include "sampler.h"
 
 namespace imgvol {
 
 Img2D Cut(const ImgVol& img_vol, ImgVol::Axis axis, size_t pos, bool w = false);
 
+// The overloads taking an output image render into it, resizing it when
+// needed. Reusing the same output across calls avoids heap allocations
+// once its buffer is large enough.
+void Cut(const ImgVol& img_vol, ImgVol::Axis axis, size_t pos, bool w,
+         Img2D* out);
+
 void BrightinessContrast(Img2D& img, size_t num_bits, float b, float c);
 
 void Normalize(Img2D& img, size_t num_bits);
@@ -15,23 +23,79 @@ void Negative(Img2D& img);
 
 ImgColor ColorLabels(const Img2D& img_cut, const Img2D& img_lb, size_t nbits);
 
+void ColorLabels(const Img2D& img_cut, const Img2D& img_lb, size_t nbits,
+                 ImgColor* out);
+
 ImgGray DrawWireframe(const ImgVol& img_vol, std::array<float, 3> rad);
 
-ImgVol Interp(ImgVol& img_vol, float sx, float sy, float sz);
+// Resample by factors sx, sy, sz along each axis, the output has
+// round(size*s) voxels per axis and voxel sizes divided by s. Throws
+// std::invalid_argument unless every factor is positive and finite.
+void Interp(const ImgVol& img_vol, float sx, float sy, float sz,
+            Interpolation interp, ImgVol* out, size_t nthreads = 0);
+
+ImgVol Interp(const ImgVol& img_vol, float sx, float sy, float sz,
+              Interpolation interp = Interpolation::kTrilinear);
 
 float Sign(float v);
 
-ImgVol Refactor(const ImgVol& img_vol, float dx2, float dy2, float dz2);
+// Resample to voxel sizes dx2, dy2, dz2, which must be positive.
+void Refactor(const ImgVol& img_vol, float dx2, float dy2, float dz2,
+              Interpolation interp, ImgVol* out, size_t nthreads = 0);
+
+ImgVol Refactor(const ImgVol& img_vol, float dx2, float dy2, float dz2,
+                Interpolation interp = Interpolation::kTrilinear);
 
 float Diagonal(std::array<float, 3> size);
 
-ImgGray CortePlanar(ImgVol& img, std::array<float, 3> p1, std::array<float, 3> vec);
+std::array<float, 3> VecNorm(std::array<float, 3> v);
+
+// Transform from the CortePlanar output pixels (u, v, -diagonal/2) to
+// voxel coordinates, for the plane through p1 with normal vec. p1 is
+// given in the frame of the uncropped volume.
+Mat4 PlanarTransform(std::array<size_t, 3> size,
+                     std::array<size_t, 3> origin, std::array<float, 3> p1,
+                     std::array<float, 3> vec);
+
+Mat4 PlanarTransform(const ImgVol& img, std::array<float, 3> p1,
+                     std::array<float, 3> vec);
 
-ImgVol ReformataImg(ImgVol& img, size_t n, std::array<float,3> p1, std::array<float,3> pn);
+// Plane and reformat sampling default to the nearest voxel, points off
+// the volume read 0.
+ImgGray CortePlanar(ImgVol& img, std::array<float, 3> p1, std::array<float, 3> vec,
+                    Interpolation interp = Interpolation::kNearest);
+
+void CortePlanar(const ImgVol& img, std::array<float, 3> p1,
+                 std::array<float, 3> vec, ImgGray* out,
+                 Interpolation interp = Interpolation::kNearest);
+
+// Render only rows [row_begin, row_end) into an output that already has
+// the full diagonal x diagonal size, so a frame can be split in tiles.
+void CortePlanarRows(const ImgVol& img, std::array<float, 3> p1,
+                     std::array<float, 3> vec, size_t row_begin,
+                     size_t row_end, ImgGray* out,
+                     Interpolation interp = Interpolation::kNearest);
+
+ImgVol ReformataImg(ImgVol& img, size_t n, std::array<float,3> p1, std::array<float,3> pn,
+                    Interpolation interp = Interpolation::kNearest);
+
+void ReformataImg(const ImgVol& img, size_t n, std::array<float,3> p1,
+                  std::array<float,3> pn, ImgVol* out,
+                  Interpolation interp = Interpolation::kNearest);
 
 ImgGray MaxIntensionProjection(ImgVol& img, float delta_x, float delta_y, std::array<float, 3> vet_normal);
 
-float Dda3d(ImgVol& img, std::array<float,3> p1, std::array<float,3> pn);
+void MaxIntensionProjection(ImgVol& img, float delta_x, float delta_y,
+                            std::array<float, 3> vet_normal, ImgGray* out);
+
+// Rows variant, the volume is expected to be normalized already.
+void MaxIntensionProjectionRows(const ImgVol& img, float delta_x,
+                                float delta_y, std::array<float, 3> vet_normal,
+                                size_t row_begin, size_t row_end,
+                                ImgGray* out);
+
+// Maximum intensity over every voxel the segment p1 -> pn pierces.
+float Dda3d(const ImgVol& img, std::array<float,3> p1, std::array<float,3> pn);
 
 void NormalizeImage(ImgVol& img_vol);
 }
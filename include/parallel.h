@@ -0,0 +1,82 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace imgvol {
+
+inline size_t NumThreads(size_t nthreads = 0) {
+  if (nthreads > 0) {
+    return nthreads;
+  }
+
+  size_t hw = std::thread::hardware_concurrency();
+  return hw > 0 ? hw : 1;
+}
+
+// Split [begin, end) in contiguous chunks and run fn(chunk_begin, chunk_end)
+// on each of them, one chunk per thread. The calling thread runs the last
+// chunk, so small ranges don't pay for a thread spawn. The first exception
+// thrown by any chunk is rethrown once all of them have finished.
+template<class Fn>
+void ParallelFor(size_t begin, size_t end, Fn fn, size_t nthreads = 0) {
+  if (end <= begin) {
+    return;
+  }
+
+  size_t n = end - begin;
+  nthreads = std::min(NumThreads(nthreads), n);
+
+  if (nthreads == 1) {
+    fn(begin, end);
+    return;
+  }
+
+  std::vector<std::thread> workers;
+  workers.reserve(nthreads - 1);
+
+  std::exception_ptr error;
+  std::mutex error_mutex;
+
+  auto run = [&fn, &error, &error_mutex](size_t b, size_t e) {
+    try {
+      fn(b, e);
+    } catch (...) {
+      std::lock_guard<std::mutex> lock(error_mutex);
+
+      if (!error) {
+        error = std::current_exception();
+      }
+    }
+  };
+
+  size_t chunk = n/nthreads;
+  size_t rest = n%nthreads;
+  size_t b = begin;
+
+  for (size_t t = 0; t < nthreads; t++) {
+    size_t e = b + chunk + (t < rest ? 1 : 0);
+
+    if (t == nthreads - 1) {
+      run(b, e);
+    } else {
+      workers.emplace_back(run, b, e);
+    }
+
+    b = e;
+  }
+
+  for (auto& w : workers) {
+    w.join();
+  }
+
+  if (error) {
+    std::rethrow_exception(error);
+  }
+}
+
+}
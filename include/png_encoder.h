@@ -0,0 +1,43 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "img_vol.h"
+
+namespace imgvol {
+
+struct PngOptions {
+  enum class Filter {
+    kNone, kSub, kUp, kAvg, kPaeth, kAdaptive
+  };
+
+  // zlib level, from 0 (store) to 9, -1 is zlib's default.
+  int compression_level = 6;
+
+  Filter filter = Filter::kAdaptive;
+
+  // Images with at least this many pixels are filtered and deflated in
+  // row bands on several threads, smaller ones go through libpng.
+  size_t parallel_min_pixels = 1 << 20;
+
+  size_t nthreads = 0;
+};
+
+// Encode the image buffer as a PNG file in memory. Rows are handed to the
+// encoder straight from the image, no intermediate copy is made.
+std::vector<uint8_t> EncodePng(const ImgGray& img,
+                               const PngOptions& opts = PngOptions());
+
+// BGR and BGRX rows are read in place as well, planar images are
+// interleaved one row at a time.
+std::vector<uint8_t> EncodePng(const ImgColor& img,
+                               const PngOptions& opts = PngOptions());
+
+void WritePng(const ImgGray& img, const std::string& file_name,
+              const PngOptions& opts = PngOptions());
+
+void WritePng(const ImgColor& img, const std::string& file_name,
+              const PngOptions& opts = PngOptions());
+
+}
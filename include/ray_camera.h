@@ -0,0 +1,38 @@
+#pragma once
+
+#include <array>
+#include "img_vol.h"
+#include "matrix.h"
+
+namespace imgvol {
+
+// Orthographic camera shared by the projective renderers. The view plane
+// is a diagonal x diagonal image centered on the volume and rotated by
+// delta_x around x and delta_y around y, every pixel casts a ray along the
+// rotated normal.
+class RayCamera {
+ public:
+  RayCamera(const ImgVol& img, float delta_x, float delta_y,
+            std::array<float, 3> normal);
+
+  size_t Width() const noexcept;
+
+  size_t Height() const noexcept;
+
+  // Unit direction of the rays in voxel coordinates.
+  std::array<float, 3> Direction() const noexcept;
+
+  // Voxels where the ray of pixel (i, j) enters (p1) and leaves (pn) the
+  // volume. Returns false when the ray misses it.
+  bool Clip(int i, int j, std::array<float, 3>* p1,
+            std::array<float, 3>* pn) const;
+
+ private:
+  float diagonal_;
+  size_t size_;
+  std::array<float, 3> dims_;
+  Mat4 phi_inv_;
+  Vec4 dir_;
+};
+
+}
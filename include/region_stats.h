@@ -0,0 +1,34 @@
+#pragma once
+
+#include <array>
+#include <vector>
+#include "crop.h"
+#include "img_vol.h"
+
+namespace imgvol {
+
+struct RegionStats {
+  int label;
+  size_t voxels;
+  double mean;
+  int min;
+  int max;
+
+  // Mean voxel position and the box around the voxels of the label, both
+  // in the frame of ImgVol::Origin(). Subtract the origin from the box to
+  // pass it to Crop().
+  std::array<double, 3> centroid;
+  BoundingBox box;
+};
+
+// Statistics of img over every label of the label volume, in one pass
+// over both. Each z slab accumulates into its own table indexed by label,
+// and the tables are merged at the end. Returns the labels present in
+// increasing order, background (label 0) included only when asked. Both
+// volumes must have the same size.
+std::vector<RegionStats> ComputeRegionStats(const ImgVol& img,
+                                            const ImgVol& labels,
+                                            bool include_background = false,
+                                            size_t nthreads = 0);
+
+}
@@ -0,0 +1,92 @@
+#pragma once
+
+#include <array>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+#include "img_vol.h"
+
+namespace imgvol {
+
+enum class RenderPriority {
+  kInteractive, kBatch
+};
+
+// Set on the future of a job that was superseded or cancelled before it
+// finished.
+class RenderCancelled : public std::runtime_error {
+ public:
+  RenderCancelled()
+    : std::runtime_error("render cancelled") {}
+};
+
+// Render rows [row_begin, row_end) of an output that already has its
+// final size.
+typedef std::function<void(size_t row_begin, size_t row_end, ImgGray* out)>
+    RowRenderer;
+
+// Worker threads rendering frames in tiles of rows. Every job belongs to
+// a viewport, and submitting a job cancels the unfinished jobs of the same
+// viewport: their queued tiles are dropped, tiles already running finish
+// and the future gets RenderCancelled. Interactive jobs get their tiles
+// ahead of batch jobs, jobs of the same priority run in submission order.
+class RenderService {
+ public:
+  explicit RenderService(size_t nthreads = 0, size_t tile_rows = 16);
+
+  RenderService(const RenderService&) = delete;
+
+  RenderService& operator=(const RenderService&) = delete;
+
+  // Cancels the jobs still pending and waits for the running tiles.
+  ~RenderService();
+
+  std::future<ImgGray> Submit(size_t viewport, RenderPriority priority,
+                              size_t width, size_t height,
+                              RowRenderer render);
+
+  // The volume is taken by value, the job shares its voxels copy-on-write
+  // so the caller may keep editing its own copy. The first tile to run
+  // normalizes the volume, and the normalized copy is kept for the next
+  // jobs of the viewport until they pass a volume with other voxels.
+  std::future<ImgGray> MaxIntensionProjection(size_t viewport,
+                                              RenderPriority priority,
+                                              ImgVol img, float delta_x,
+                                              float delta_y,
+                                              std::array<float, 3> vet_normal);
+
+  std::future<ImgGray> CortePlanar(size_t viewport, RenderPriority priority,
+                                   ImgVol img, std::array<float, 3> p1,
+                                   std::array<float, 3> vec);
+
+  // Cancel every unfinished job of the viewport.
+  void Cancel(size_t viewport);
+
+ private:
+  struct Job;
+  struct NormalizedVolume;
+
+  void Worker();
+  void CancelJob(const std::shared_ptr<Job>& job);
+  void FinishIfDone(const std::shared_ptr<Job>& job);
+  std::shared_ptr<NormalizedVolume> Normalized(size_t viewport,
+                                               const ImgVol& img);
+
+  std::mutex mutex_;
+  std::condition_variable work_;
+  std::array<std::deque<std::shared_ptr<Job>>, 2> queues_;
+  std::vector<std::shared_ptr<Job>> active_;
+  std::map<size_t, std::shared_ptr<NormalizedVolume>> normalized_;
+  std::vector<std::thread> workers_;
+  size_t tile_rows_;
+  bool stop_;
+};
+
+}
@@ -0,0 +1,288 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include "img_vol.h"
+
+namespace imgvol {
+
+// Point samplers over a volume, chosen at compile time so the kernel is
+// inlined into the loop that uses it. Point (x, y, z) is in voxel units
+// with voxel (i, j, k) covering [i, i + 1) x [j, j + 1) x [k, k + 1), so
+// its center is at (i + 0.5, j + 0.5, k + 0.5) and NearestSampler reads
+// the voxel the point falls in, as ImgVol::operator() does.
+//
+// The Border policy decides what points outside the volume read: 0 with
+// ZeroBorder, the nearest edge voxel with ClampBorder. Neighbours of a
+// point inside the volume always replicate the edge voxels.
+//
+// Sample() is the batch entry point. Coordinates are handled in blocks
+// of kSamplerBlock: a first loop over the block computes offsets and
+// weights with branch free arithmetic the compiler vectorizes, a second
+// one gathers the voxels and blends them. The volume must not be empty.
+
+enum class Interpolation {
+  kNearest,
+  kTrilinear,
+  kTricubic
+};
+
+struct ZeroBorder {
+  static const bool kClamp = false;
+};
+
+struct ClampBorder {
+  static const bool kClamp = true;
+};
+
+const size_t kSamplerBlock = 64;
+
+namespace internal {
+
+// Sizes and strides of a volume as the samplers use them.
+struct SamplerGrid {
+  explicit SamplerGrid(const ImgVol& img)
+    : data(img.Data())
+    , size{{float(img.SizeX()), float(img.SizeY()), float(img.SizeZ())}}
+    , last{{size[0] - 1, size[1] - 1, size[2] - 1}}
+    , stride_y(int64_t(img.SizeX()))
+    , stride_z(int64_t(img.SizeX()*img.SizeY())) {}
+
+  // 1 when the point is inside the volume or the border clamps.
+  template <class Border>
+  uint8_t Keep(float x, float y, float z) const {
+    if (Border::kClamp) {
+      return 1;
+    }
+
+    return uint8_t((x >= 0) & (x < size[0]) & (y >= 0) & (y < size[1]) &
+                   (z >= 0) & (z < size[2]));
+  }
+
+  const uint8_t* data;
+  std::array<float, 3> size;
+  std::array<float, 3> last;
+  // 64 bit so offsets into volumes over 2 GiB don't overflow.
+  int64_t stride_y;
+  int64_t stride_z;
+};
+
+inline float ClampTo(float v, float last) {
+  return std::min(std::max(v, 0.0f), last);
+}
+
+}
+
+template <class Border = ZeroBorder>
+class NearestSampler {
+ public:
+  explicit NearestSampler(const ImgVol& img)
+    : grid_(img) {}
+
+  void Sample(const float* x, const float* y, const float* z, size_t n,
+              uint8_t* out) const {
+    int64_t offset[kSamplerBlock];
+    uint8_t keep[kSamplerBlock];
+
+    for (size_t b = 0; b < n; b += kSamplerBlock) {
+      size_t m = std::min(kSamplerBlock, n - b);
+
+      for (size_t i = 0; i < m; i++) {
+        keep[i] = grid_.Keep<Border>(x[b + i], y[b + i], z[b + i]);
+        offset[i] = int64_t(internal::ClampTo(x[b + i], grid_.last[0])) +
+            int64_t(internal::ClampTo(y[b + i], grid_.last[1]))*grid_.stride_y +
+            int64_t(internal::ClampTo(z[b + i], grid_.last[2]))*grid_.stride_z;
+      }
+
+      for (size_t i = 0; i < m; i++) {
+        out[b + i] = grid_.data[offset[i]]*keep[i];
+      }
+    }
+  }
+
+  // Single precision coordinate for a double precision one. Snapping to
+  // the voxel corner first keeps the rounding from moving a point that
+  // lies just below a voxel edge into the next voxel.
+  static float Coordinate(double v) {
+    return float(std::floor(v));
+  }
+
+  uint8_t operator()(float x, float y, float z) const {
+    uint8_t v;
+    Sample(&x, &y, &z, 1, &v);
+    return v;
+  }
+
+ private:
+  internal::SamplerGrid grid_;
+};
+
+// Trilinear interpolation between the 8 voxel centers around the point,
+// with 8 bit fixed-point weights and integer blending.
+template <class Border = ZeroBorder>
+class TrilinearSampler {
+ public:
+  explicit TrilinearSampler(const ImgVol& img)
+    : grid_(img) {}
+
+  void Sample(const float* x, const float* y, const float* z, size_t n,
+              uint8_t* out) const {
+    int64_t offset[kSamplerBlock];
+    int64_t step[3][kSamplerBlock];
+    uint32_t w[3][kSamplerBlock];
+    uint8_t keep[kSamplerBlock];
+    const float* p[3] = {x, y, z};
+    const int64_t strides[3] = {1, grid_.stride_y, grid_.stride_z};
+
+    for (size_t b = 0; b < n; b += kSamplerBlock) {
+      size_t m = std::min(kSamplerBlock, n - b);
+
+      for (size_t i = 0; i < m; i++) {
+        keep[i] = grid_.Keep<Border>(x[b + i], y[b + i], z[b + i]);
+        offset[i] = 0;
+      }
+
+      for (int a = 0; a < 3; a++) {
+        const float* c = p[a] + b;
+        float last = grid_.last[a];
+
+        for (size_t i = 0; i < m; i++) {
+          float f = internal::ClampTo(c[i] - 0.5f, last);
+          int64_t i0 = int64_t(f);
+          w[a][i] = uint32_t((f - i0)*256 + 0.5f);
+          step[a][i] = (float(i0) < last)*strides[a];
+          offset[i] += i0*strides[a];
+        }
+      }
+
+      for (size_t i = 0; i < m; i++) {
+        const uint8_t* v = grid_.data + offset[i];
+        int64_t sx = step[0][i], sy = step[1][i], sz = step[2][i];
+        uint32_t wx = w[0][i], wy = w[1][i], wz = w[2][i];
+        uint32_t c00 = v[0]*(256 - wx) + v[sx]*wx;
+        uint32_t c10 = v[sy]*(256 - wx) + v[sy + sx]*wx;
+        uint32_t c01 = v[sz]*(256 - wx) + v[sz + sx]*wx;
+        uint32_t c11 = v[sz + sy]*(256 - wx) + v[sz + sy + sx]*wx;
+        uint32_t c0 = c00*(256 - wy) + c10*wy;
+        uint32_t c1 = c01*(256 - wy) + c11*wy;
+        uint32_t c = c0*(256 - wz) + c1*wz;
+        out[b + i] = uint8_t(((c + (1u << 23)) >> 24)*keep[i]);
+      }
+    }
+  }
+
+  static float Coordinate(double v) {
+    return float(v);
+  }
+
+  uint8_t operator()(float x, float y, float z) const {
+    uint8_t v;
+    Sample(&x, &y, &z, 1, &v);
+    return v;
+  }
+
+ private:
+  internal::SamplerGrid grid_;
+};
+
+// Catmull-Rom tricubic interpolation over the 4x4x4 voxel centers around
+// the point, clamped to 0..255. Sharper than trilinear, about 8 times the
+// memory reads.
+template <class Border = ZeroBorder>
+class TricubicSampler {
+ public:
+  explicit TricubicSampler(const ImgVol& img)
+    : grid_(img) {}
+
+  void Sample(const float* x, const float* y, const float* z, size_t n,
+              uint8_t* out) const {
+    int64_t index[3][4][kSamplerBlock];
+    float w[3][4][kSamplerBlock];
+    uint8_t keep[kSamplerBlock];
+    const float* p[3] = {x, y, z};
+    const int64_t strides[3] = {1, grid_.stride_y, grid_.stride_z};
+
+    for (size_t b = 0; b < n; b += kSamplerBlock) {
+      size_t m = std::min(kSamplerBlock, n - b);
+
+      for (size_t i = 0; i < m; i++) {
+        keep[i] = grid_.Keep<Border>(x[b + i], y[b + i], z[b + i]);
+      }
+
+      for (int a = 0; a < 3; a++) {
+        const float* c = p[a] + b;
+        float last = grid_.last[a];
+
+        for (size_t i = 0; i < m; i++) {
+          float f = internal::ClampTo(c[i] - 0.5f, last);
+          float f0 = std::floor(f);
+          float t = f - f0;
+          float t2 = t*t;
+          float t3 = t2*t;
+          w[a][0][i] = 0.5f*(-t3 + 2*t2 - t);
+          w[a][1][i] = 0.5f*(3*t3 - 5*t2 + 2);
+          w[a][2][i] = 0.5f*(-3*t3 + 4*t2 + t);
+          w[a][3][i] = 0.5f*(t3 - t2);
+
+          for (int k = 0; k < 4; k++) {
+            index[a][k][i] = int64_t(internal::ClampTo(f0 + k - 1, last))*
+                strides[a];
+          }
+        }
+      }
+
+      for (size_t i = 0; i < m; i++) {
+        float acc = 0;
+
+        for (int kz = 0; kz < 4; kz++) {
+          for (int ky = 0; ky < 4; ky++) {
+            const uint8_t* row = grid_.data + index[2][kz][i] +
+                index[1][ky][i];
+            float r = w[0][0][i]*row[index[0][0][i]] +
+                w[0][1][i]*row[index[0][1][i]] +
+                w[0][2][i]*row[index[0][2][i]] +
+                w[0][3][i]*row[index[0][3][i]];
+            acc += w[2][kz][i]*w[1][ky][i]*r;
+          }
+        }
+
+        acc = std::min(std::max(acc + 0.5f, 0.0f), 255.0f);
+        out[b + i] = uint8_t(acc)*keep[i];
+      }
+    }
+  }
+
+  static float Coordinate(double v) {
+    return float(v);
+  }
+
+  uint8_t operator()(float x, float y, float z) const {
+    uint8_t v;
+    Sample(&x, &y, &z, 1, &v);
+    return v;
+  }
+
+ private:
+  internal::SamplerGrid grid_;
+};
+
+// Call fn with the sampler for interp, so a runtime choice still runs a
+// loop specialized for the kernel.
+template <class Border = ZeroBorder, class Fn>
+void WithSampler(const ImgVol& img, Interpolation interp, Fn fn) {
+  switch (interp) {
+    case Interpolation::kNearest:
+      fn(NearestSampler<Border>(img));
+      break;
+    case Interpolation::kTrilinear:
+      fn(TrilinearSampler<Border>(img));
+      break;
+    case Interpolation::kTricubic:
+      fn(TricubicSampler<Border>(img));
+      break;
+  }
+}
+
+}
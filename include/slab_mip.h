@@ -0,0 +1,35 @@
+#pragma once
+
+#include <array>
+#include "img2d.h"
+#include "img_vol.h"
+
+namespace imgvol {
+
+// Thick-slab maximum intensity projection. The slab at position p along
+// an axis covers slices [p - (thickness - 1)/2, p + thickness/2], clipped
+// to the volume, so a thickness of 1 is the plain slice.
+
+// Slab MIP at every position along the axis, out has the size of img and
+// may be img itself. Uses the van Herk/Gil-Werman running max, about three
+// comparisons per voxel whatever the thickness. When scrolling, Cut the
+// result at each position, and only recompute when the thickness changes.
+void SlabMip(const ImgVol& img, ImgVol::Axis axis, size_t thickness,
+             ImgVol* out, size_t nthreads = 0);
+
+ImgVol SlabMip(const ImgVol& img, ImgVol::Axis axis, size_t thickness,
+               size_t nthreads = 0);
+
+// One slab as a Cut at pos would lay it out, reading only its slices.
+void SlabMipCut(const ImgVol& img, ImgVol::Axis axis, size_t pos,
+                size_t thickness, bool w, Img2D* out);
+
+Img2D SlabMipCut(const ImgVol& img, ImgVol::Axis axis, size_t pos,
+                 size_t thickness, bool w = false);
+
+// ReformataImg followed by a slab MIP over its n slices.
+void ReformataSlabMip(const ImgVol& img, size_t n, std::array<float, 3> p1,
+                      std::array<float, 3> pn, size_t thickness,
+                      ImgVol* out, size_t nthreads = 0);
+
+}
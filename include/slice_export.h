@@ -0,0 +1,42 @@
+#pragma once
+
+#include <functional>
+#include <string>
+#include "img_vol.h"
+#include "img2d.h"
+#include "png_encoder.h"
+
+namespace imgvol {
+
+struct SliceExportOptions {
+  // Applied to every slice before it is clamped to [0, 255], e.g.
+  // [](Img2D& s) { Normalize(s, 8); }
+  std::function<void(Img2D&)> window;
+
+  // Mirror the slices, as the w argument of Cut().
+  bool w = false;
+
+  PngOptions png;
+
+  // Maximum number of slices waiting between two stages.
+  size_t queue_depth = 8;
+
+  size_t nthreads = 0;
+};
+
+struct SliceExportStats {
+  size_t slices;
+  double seconds;
+  double slices_per_sec;
+};
+
+// Write the slices [first, last) along axis as prefix<pos>.png files.
+// Slice extraction, windowing, PNG encoding and file writing run as a
+// pipeline of bounded queues, encoding uses the remaining threads.
+SliceExportStats ExportSlices(const ImgVol& img, ImgVol::Axis axis,
+                              size_t first, size_t last,
+                              const std::string& prefix,
+                              const SliceExportOptions& opts =
+                                  SliceExportOptions());
+
+}
@@ -0,0 +1,127 @@
+#pragma once
+
+#include <array>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <vector>
+#include "img2d.h"
+#include "img_vol.h"
+
+namespace imgvol {
+
+struct TimeSeriesOptions {
+  // Every keyframe_interval-th frame is stored whole, the frames between
+  // keyframes as differences to their keyframe, so any frame decodes from
+  // two frames at most.
+  size_t keyframe_interval = 16;
+
+  // Frames are compressed in slabs of this many z slices. Slabs equal to
+  // the keyframe take no space.
+  size_t slab_slices = 8;
+
+  // zlib level of the slabs.
+  int level = 1;
+
+  // Decoded frames kept, least recently used ones are dropped first.
+  size_t cache_frames = 4;
+
+  // Frame(t) queues frame t + 1 for decoding on the background thread.
+  bool prefetch = true;
+
+  size_t nthreads = 0;
+};
+
+// Volumes of the same geometry over time, kept compressed in memory and
+// decoded one frame at a time on access.
+class TimeSeries {
+ public:
+  TimeSeries(size_t xsize, size_t ysize, size_t zsize,
+             const TimeSeriesOptions& opts = TimeSeriesOptions());
+
+  TimeSeries(const TimeSeries&) = delete;
+
+  TimeSeries& operator=(const TimeSeries&) = delete;
+
+  ~TimeSeries();
+
+  // Encode and add a frame, it must have the series size. The first frame
+  // sets the voxel size and origin of the series, later frames must have
+  // the same ones. Frames may be read while another thread appends, but
+  // only one thread appends.
+  void Append(const ImgVol& frame);
+
+  size_t NumFrames() const;
+
+  size_t SizeX() const noexcept;
+
+  size_t SizeY() const noexcept;
+
+  size_t SizeZ() const noexcept;
+
+  // Compressed size of all frames.
+  size_t EncodedBytes() const;
+
+  // Frame t, from the cache or decoded now. The volume shares the cached
+  // buffer copy-on-write, so Cut, MaxIntensionProjection and the other
+  // operations take it as any ImgVol.
+  ImgVol Frame(size_t t);
+
+  // Same as Cut(Frame(t), ...), but a z cut of a frame that isn't cached
+  // decodes the one slab holding the slice.
+  Img2D Cut(size_t t, ImgVol::Axis axis, size_t pos, bool w = false);
+
+  // Queue frame t for decoding on the background thread.
+  void Prefetch(size_t t);
+
+ private:
+  struct EncodedFrame {
+    size_t key;
+    std::vector<std::vector<uint8_t>> slabs;
+  };
+
+  typedef std::shared_ptr<const EncodedFrame> EncodedPtr;
+
+  size_t NumSlabs() const noexcept;
+  size_t SlabBytes(size_t s) const noexcept;
+  void Encoded(size_t t, EncodedPtr* frame, EncodedPtr* key) const;
+  void DecodeSlab(const EncodedFrame& frame, const EncodedFrame& key,
+                  size_t s, const ImgVol* key_img, uint8_t* dst) const;
+  ImgVol Decode(size_t t);
+  bool Cached(size_t t, ImgVol* img);
+  void Insert(size_t t, const ImgVol& img);
+  void PrefetchLoop();
+
+  size_t xsize_;
+  size_t ysize_;
+  size_t zsize_;
+  TimeSeriesOptions opts_;
+
+  // Appending may reallocate frames_, so decoders copy the pointers of
+  // the frames they need under the lock. The frames themselves never
+  // change and are decoded without it.
+  std::vector<EncodedPtr> frames_;
+
+  // Only touched by Append.
+  ImgVol last_key_;
+
+  // Set by the first Append before the frame is published, read only once
+  // a frame was seen under the lock.
+  std::array<float, 3> voxel_size_;
+  std::array<size_t, 3> origin_;
+
+  mutable std::mutex mutex_;
+  std::condition_variable changed_;
+  std::list<std::pair<size_t, ImgVol>> cache_;
+  std::set<size_t> decoding_;
+  std::deque<size_t> prefetch_;
+  bool stop_;
+  std::thread prefetcher_;
+};
+
+}
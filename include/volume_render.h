@@ -0,0 +1,47 @@
+#pragma once
+
+#include <array>
+#include <vector>
+#include "img_vol.h"
+
+namespace imgvol {
+
+// Control point of a transfer function, color and opacity in [0, 1].
+struct TfPoint {
+  int intensity;
+  std::array<float, 4> rgba;
+};
+
+// Color and opacity of each of the 256 intensities.
+typedef std::array<std::array<float, 4>, 256> TransferLut;
+
+// Interpolate the control points linearly over the intensity range.
+// Intensities below the first point or above the last one take its value.
+TransferLut BuildTransferLut(std::vector<TfPoint> points);
+
+struct DvrOptions {
+  // A ray stops once its accumulated opacity reaches this value.
+  float opacity_threshold = 0.95f;
+
+  // Pixels are rendered in square tiles handed out to the threads on
+  // demand, so tiles missing the volume don't leave threads idle.
+  size_t tile_size = 32;
+
+  // Color behind the volume, in [0, 1].
+  std::array<float, 3> background = {{0, 0, 0}};
+
+  size_t nthreads = 0;
+};
+
+// Direct volume rendering with the MaxIntensionProjection camera. Samples
+// are composited front to back along each ray through the transfer
+// function, opacities are corrected for the sampling step.
+ImgColor VolumeRender(const ImgVol& img, float delta_x, float delta_y,
+                      std::array<float, 3> vet_normal, const TransferLut& lut,
+                      const DvrOptions& opts = DvrOptions());
+
+void VolumeRender(const ImgVol& img, float delta_x, float delta_y,
+                  std::array<float, 3> vet_normal, const TransferLut& lut,
+                  const DvrOptions& opts, ImgColor* out);
+
+}
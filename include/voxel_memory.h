@@ -0,0 +1,109 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <new>
+#include <vector>
+
+namespace imgvol {
+
+// Where the pages of new volume buffers go on NUMA machines.
+enum class VoxelPlacement {
+  // Zeroed by the allocating thread, so all pages land on its node.
+  kFirstTouch,
+
+  // Pages spread round robin over all nodes.
+  kInterleave,
+
+  // Z slabs spread over the nodes in order, each slab zeroed by threads
+  // bound to its node. ParallelForSlabs then runs on the owning node.
+  kSlabs
+};
+
+struct VoxelMemoryOptions {
+  VoxelPlacement placement = VoxelPlacement::kFirstTouch;
+
+  // Back buffers of 2 MiB or more with transparent huge pages.
+  bool huge_pages = false;
+};
+
+// Policy for the volume buffers allocated after the call, process wide.
+void SetVoxelMemoryOptions(const VoxelMemoryOptions& opts);
+
+VoxelMemoryOptions GetVoxelMemoryOptions();
+
+// 1 when built without libnuma or when the kernel has no NUMA support.
+size_t NumNumaNodes();
+
+// Node owning slice z of a volume with zsize slices under kSlabs.
+size_t SlabNode(size_t z, size_t zsize);
+
+// Buffers of a page or more are page aligned and span whole pages, so the
+// placement policies apply to all of them. Smaller ones are 64 byte
+// aligned.
+void* AllocateVoxels(size_t bytes);
+
+// bytes must be the size p was allocated with.
+void FreeVoxels(void* p, size_t bytes) noexcept;
+
+// Zero a freshly allocated buffer of zsize slices following the current
+// placement.
+void PlaceVoxels(uint8_t* data, size_t slice_bytes, size_t zsize);
+
+// ParallelFor over the slices [zbegin, zend) of a volume with zsize
+// slices. Under kSlabs every chunk runs bound to the node owning its
+// slices, elsewhere it is a plain ParallelFor.
+void ParallelForSlabs(size_t zbegin, size_t zend, size_t zsize,
+                      const std::function<void(size_t, size_t)>& fn,
+                      size_t nthreads = 0);
+
+// Allocator of the volume buffers. Elements are default initialized, so
+// resizing doesn't touch the pages and PlaceVoxels decides where they go.
+template<class T>
+class VoxelAllocator {
+ public:
+  typedef T value_type;
+
+  VoxelAllocator() noexcept {}
+
+  template<class U>
+  VoxelAllocator(const VoxelAllocator<U>&) noexcept {}
+
+  T* allocate(size_t n) {
+    return static_cast<T*>(AllocateVoxels(n*sizeof(T)));
+  }
+
+  void deallocate(T* p, size_t n) noexcept {
+    FreeVoxels(p, n*sizeof(T));
+  }
+
+  template<class U>
+  void construct(U* p) {
+    ::new(static_cast<void*>(p)) U;
+  }
+
+  template<class U, class... Args>
+  void construct(U* p, Args&&... args) {
+    ::new(static_cast<void*>(p)) U(std::forward<Args>(args)...);
+  }
+
+  template<class U>
+  struct rebind {
+    typedef VoxelAllocator<U> other;
+  };
+};
+
+template<class T, class U>
+bool operator==(const VoxelAllocator<T>&, const VoxelAllocator<U>&) {
+  return true;
+}
+
+template<class T, class U>
+bool operator!=(const VoxelAllocator<T>&, const VoxelAllocator<U>&) {
+  return false;
+}
+
+typedef std::vector<uint8_t, VoxelAllocator<uint8_t>> VoxelBuffer;
+
+}
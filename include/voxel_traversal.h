@@ -0,0 +1,98 @@
+#pragma once
+
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <limits>
+#include "img_vol.h"
+
+namespace imgvol {
+
+// Amanatides-Woo traversal of the voxels pierced by the segment between
+// the centers of voxels p1 and pn, both inside the volume. Coordinates
+// are rounded to the nearest voxel. The ray parameter is scaled by
+// 2*|dx|*|dy|*|dz| (over the non-zero terms), which makes every t-max and
+// t-delta an integer, so no step is ever skipped or repeated by rounding.
+// The voxel is tracked as a linear offset into Data() advanced by signed
+// strides.
+//
+//   for (VoxelTraversal t(img, p1, pn); !t.Done(); t.Next()) {
+//     v = std::max(v, data[t.Offset()]);
+//   }
+//
+// When the ray crosses an edge or a corner exactly, the axes are stepped
+// one at a time in x, y, z order, so the voxel sharing only that edge is
+// visited as well.
+class VoxelTraversal {
+ public:
+  VoxelTraversal(const ImgVol& img, std::array<float, 3> p1,
+                 std::array<float, 3> pn) {
+    std::array<int64_t, 3> strides = {{1, int64_t(img.SizeX()),
+                                       int64_t(img.SizeX()*img.SizeY())}};
+    std::array<int64_t, 3> n;
+    int64_t scale = 2;
+    offset_ = 0;
+    remaining_ = 1;
+
+    for (int a = 0; a < 3; a++) {
+      int64_t b = std::lround(p1[a]);
+      int64_t d = std::lround(pn[a]) - b;
+      n[a] = std::abs(d);
+      step_[a] = d < 0 ? -strides[a] : strides[a];
+      offset_ += b*strides[a];
+      remaining_ += n[a];
+
+      if (n[a] > 0) {
+        scale *= n[a];
+      }
+    }
+
+    for (int a = 0; a < 3; a++) {
+      if (n[a] > 0) {
+        t_delta_[a] = scale/n[a];
+        t_max_[a] = t_delta_[a]/2;
+      } else {
+        t_delta_[a] = 0;
+        t_max_[a] = std::numeric_limits<int64_t>::max();
+      }
+    }
+  }
+
+  bool Done() const noexcept {
+    return remaining_ == 0;
+  }
+
+  // Index of the current voxel in the volume buffer.
+  size_t Offset() const noexcept {
+    return size_t(offset_);
+  }
+
+  // Voxels left to visit, the current one included.
+  size_t Remaining() const noexcept {
+    return remaining_;
+  }
+
+  // Step to the next voxel. Returns the axis stepped along, or -1 once
+  // the traversal is done.
+  int Next() noexcept {
+    if (--remaining_ == 0) {
+      return -1;
+    }
+
+    int a = t_max_[0] <= t_max_[1] ? 0 : 1;
+    a = t_max_[a] <= t_max_[2] ? a : 2;
+    offset_ += step_[a];
+    t_max_[a] += t_delta_[a];
+    return a;
+  }
+
+ private:
+  int64_t offset_;
+  size_t remaining_;
+  std::array<int64_t, 3> step_;
+  std::array<int64_t, 3> t_max_;
+  std::array<int64_t, 3> t_delta_;
+};
+
+}
@@ -0,0 +1,69 @@
+#include "arena.h"
+#include <algorithm>
+
+namespace imgvol {
+
+Arena::Arena(size_t block_size)
+  : block_size_(block_size)
+  , current_(0)
+  , offset_(0) {}
+
+void* Arena::Allocate(size_t size, size_t align) {
+  while (current_ < blocks_.size()) {
+    Block& block = blocks_[current_];
+    uintptr_t base = reinterpret_cast<uintptr_t>(block.data.get());
+    size_t start = ((base + offset_ + align - 1) & ~(align - 1)) - base;
+
+    if (start + size <= block.size) {
+      offset_ = start + size;
+      return block.data.get() + start;
+    }
+
+    // A block kept from an earlier, smaller request is replaced.
+    if (offset_ == 0) {
+      break;
+    }
+
+    current_++;
+    offset_ = 0;
+  }
+
+  Block block;
+  block.size = std::max(block_size_, size + align);
+  block.data.reset(new uint8_t[block.size]);
+
+  if (current_ < blocks_.size()) {
+    blocks_[current_] = std::move(block);
+  } else {
+    blocks_.push_back(std::move(block));
+  }
+
+  offset_ = 0;
+  return Allocate(size, align);
+}
+
+Arena::Mark Arena::GetMark() const noexcept {
+  return Mark{current_, offset_};
+}
+
+void Arena::Release(Mark mark) noexcept {
+  current_ = mark.block;
+  offset_ = mark.offset;
+}
+
+size_t Arena::Capacity() const noexcept {
+  size_t total = 0;
+
+  for (const auto& b : blocks_) {
+    total += b.size;
+  }
+
+  return total;
+}
+
+Arena& Arena::Local() {
+  thread_local Arena arena;
+  return arena;
+}
+
+}
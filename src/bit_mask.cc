@@ -0,0 +1,364 @@
+#include "bit_mask.h"
+#include <algorithm>
+#include <bitset>
+#include <cmath>
+#include <stdexcept>
+#include "instrument.h"
+#include "operations.h"
+#include "parallel.h"
+#include "ray_camera.h"
+#include "voxel_traversal.h"
+
+namespace imgvol {
+
+namespace {
+
+// Rows of the neighbourhood as (dy, dz) offsets. spread_x rows also take
+// the voxels at x - 1 and x + 1.
+struct NeighbourRow {
+  int dy;
+  int dz;
+  bool spread_x;
+};
+
+std::vector<NeighbourRow> NeighbourRows(Connectivity conn) {
+  std::vector<NeighbourRow> rows;
+
+  for (int dz = -1; dz <= 1; dz++) {
+    for (int dy = -1; dy <= 1; dy++) {
+      int n = std::abs(dy) + std::abs(dz);
+
+      if (conn == Connectivity::k6 && n > 1) {
+        continue;
+      }
+
+      bool spread = conn == Connectivity::k26 || n == 0 ||
+          (conn == Connectivity::k18 && n == 1);
+      rows.push_back(NeighbourRow{dy, dz, spread});
+    }
+  }
+
+  return rows;
+}
+
+// Dilation, or erosion computed as the dilation of the complement. flip
+// is all ones for erosion: rows are complemented as they are read, rows
+// outside the volume read as 0 (foreground before complementing), and
+// the result is complemented back.
+void Morph(const BitMask& src, Connectivity conn, bool erode, BitMask* out,
+           size_t nthreads) {
+  size_t nx = src.SizeX();
+  size_t ny = src.SizeY();
+  size_t nz = src.SizeZ();
+  size_t nw = src.WordsPerRow();
+  uint64_t flip = erode ? ~uint64_t(0) : 0;
+  uint64_t last_mask = src.LastWordMask();
+  std::vector<NeighbourRow> neighbours = NeighbourRows(conn);
+
+  *out = BitMask(nx, ny, nz);
+  out->SetOrigin(src.Origin());
+
+  if (nx*ny*nz == 0) {
+    return;
+  }
+
+  ParallelFor(0, ny*nz, [&](size_t r0, size_t r1) {
+    std::vector<uint64_t> row(nw);
+    std::vector<uint64_t> acc(nw);
+
+    for (size_t r = r0; r < r1; r++) {
+      size_t y = r%ny;
+      size_t z = r/ny;
+      std::fill(acc.begin(), acc.end(), 0);
+
+      for (const NeighbourRow& n : neighbours) {
+        long yy = long(y) + n.dy;
+        long zz = long(z) + n.dz;
+
+        if (yy < 0 || yy >= long(ny) || zz < 0 || zz >= long(nz)) {
+          continue;
+        }
+
+        const uint64_t* in = src.Row(yy, zz);
+
+        for (size_t i = 0; i < nw; i++) {
+          row[i] = in[i] ^ flip;
+        }
+
+        row[nw - 1] &= last_mask;
+
+        if (!n.spread_x) {
+          for (size_t i = 0; i < nw; i++) {
+            acc[i] |= row[i];
+          }
+
+          continue;
+        }
+
+        // Bit x takes bits x - 1 and x + 1, carrying across words.
+        for (size_t i = 0; i < nw; i++) {
+          uint64_t prev = i > 0 ? row[i - 1] : 0;
+          uint64_t next = i + 1 < nw ? row[i + 1] : 0;
+          acc[i] |= row[i] | (row[i] << 1) | (prev >> 63) | (row[i] >> 1) |
+              (next << 63);
+        }
+      }
+
+      uint64_t* dst = out->Row(y, z);
+
+      for (size_t i = 0; i < nw; i++) {
+        dst[i] = acc[i] ^ flip;
+      }
+
+      dst[nw - 1] &= last_mask;
+    }
+  }, nthreads);
+}
+
+template <class Pred>
+BitMask PackMask(const ImgVol& img, Pred pred, size_t nthreads) {
+  size_t nx = img.SizeX();
+  size_t ny = img.SizeY();
+  size_t nz = img.SizeZ();
+  BitMask mask(nx, ny, nz);
+  mask.SetOrigin(img.Origin());
+  const uint8_t* data = img.Data();
+
+  ParallelFor(0, ny*nz, [&](size_t r0, size_t r1) {
+    for (size_t r = r0; r < r1; r++) {
+      const uint8_t* in = data + r*nx;
+      uint64_t* out = mask.Row(r%ny, r/ny);
+
+      for (size_t x0 = 0; x0 < nx; x0 += 64) {
+        size_t n = std::min<size_t>(64, nx - x0);
+        uint64_t word = 0;
+
+        for (size_t b = 0; b < n; b++) {
+          word |= uint64_t(pred(in[x0 + b])) << b;
+        }
+
+        out[x0 >> 6] = word;
+      }
+    }
+  }, nthreads);
+
+  return mask;
+}
+
+void CheckSize(const ImgVol& img, const BitMask& mask) {
+  if (img.SizeX() != mask.SizeX() || img.SizeY() != mask.SizeY() ||
+      img.SizeZ() != mask.SizeZ()) {
+    throw std::invalid_argument("mask size differs from the image");
+  }
+}
+
+}
+
+BitMask::BitMask(size_t xsize, size_t ysize, size_t zsize)
+  : xsize_(xsize)
+  , ysize_(ysize)
+  , zsize_(zsize)
+  , words_per_row_((xsize + 63)/64)
+  , words_(words_per_row_*ysize*zsize)
+  , origin_{{0, 0, 0}} {}
+
+uint64_t BitMask::LastWordMask() const noexcept {
+  size_t bits = xsize_ & 63;
+  return bits == 0 ? ~uint64_t(0) : (uint64_t(1) << bits) - 1;
+}
+
+size_t BitMask::Count() const {
+  size_t n = 0;
+
+  for (uint64_t w : words_) {
+    n += std::bitset<64>(w).count();
+  }
+
+  return n;
+}
+
+BitMask ThresholdMask(const ImgVol& img, int lo, int hi, size_t nthreads) {
+  return PackMask(img, [lo, hi](uint8_t v) {
+    return v >= lo && v <= hi;
+  }, nthreads);
+}
+
+BitMask LabelMask(const ImgVol& labels, int label, size_t nthreads) {
+  return PackMask(labels, [label](uint8_t v) {
+    return v == label;
+  }, nthreads);
+}
+
+void MaskToVolume(const BitMask& mask, uint8_t value, ImgVol* out) {
+  size_t nx = mask.SizeX();
+  size_t ny = mask.SizeY();
+  size_t nz = mask.SizeZ();
+  out->Resize(nx, ny, nz);
+  out->SetOrigin(mask.Origin());
+  uint8_t* data = out->Data();
+
+  for (size_t z = 0; z < nz; z++) {
+    for (size_t y = 0; y < ny; y++) {
+      const uint64_t* in = mask.Row(y, z);
+      uint8_t* row = data + (z*ny + y)*nx;
+
+      for (size_t x = 0; x < nx; x++) {
+        row[x] = value*uint8_t((in[x >> 6] >> (x & 63)) & 1);
+      }
+    }
+  }
+}
+
+void Dilate(const BitMask& mask, Connectivity conn, BitMask* out,
+            size_t nthreads) {
+  if (out == &mask) {
+    BitMask src = mask;
+    Morph(src, conn, false, out, nthreads);
+    return;
+  }
+
+  Morph(mask, conn, false, out, nthreads);
+}
+
+void Erode(const BitMask& mask, Connectivity conn, BitMask* out,
+           size_t nthreads) {
+  if (out == &mask) {
+    BitMask src = mask;
+    Morph(src, conn, true, out, nthreads);
+    return;
+  }
+
+  Morph(mask, conn, true, out, nthreads);
+}
+
+void Open(const BitMask& mask, Connectivity conn, BitMask* out,
+          size_t nthreads) {
+  BitMask tmp(0, 0, 0);
+  Morph(mask, conn, true, &tmp, nthreads);
+  Morph(tmp, conn, false, out, nthreads);
+}
+
+void Close(const BitMask& mask, Connectivity conn, BitMask* out,
+           size_t nthreads) {
+  BitMask tmp(0, 0, 0);
+  Morph(mask, conn, false, &tmp, nthreads);
+  Morph(tmp, conn, true, out, nthreads);
+}
+
+Img2D Cut(const BitMask& mask, ImgVol::Axis axis, size_t pos, bool w) {
+  Img2D img2d(0, 0);
+  Cut(mask, axis, pos, w, &img2d);
+  return img2d;
+}
+
+void Cut(const BitMask& mask, ImgVol::Axis axis, size_t pos, bool w,
+         Img2D* out) {
+  size_t s1, s2;
+
+  if (axis == ImgVol::Axis::aZ) {
+    s1 = mask.SizeX();
+    s2 = mask.SizeY();
+  } else if (axis == ImgVol::Axis::aX) {
+    s1 = mask.SizeZ();
+    s2 = mask.SizeY();
+  } else {
+    s1 = mask.SizeZ();
+    s2 = mask.SizeX();
+  }
+
+  out->Resize(s1, s2);
+  int* data = out->Data();
+
+  for (size_t j = 0; j < s2; j++) {
+    for (size_t i = 0; i < s1; i++) {
+      size_t k = w ? s1 - i - 1 : i;
+      bool v;
+
+      if (axis == ImgVol::Axis::aZ) {
+        v = mask(k, j, pos);
+      } else if (axis == ImgVol::Axis::aX) {
+        v = mask(pos, j, k);
+      } else {
+        v = mask(j, pos, k);
+      }
+
+      data[j*s1 + i] = v;
+    }
+  }
+}
+
+ImgGray MaxIntensionProjection(ImgVol& img, const BitMask& mask,
+                               float delta_x, float delta_y,
+                               std::array<float, 3> vet_normal,
+                               size_t nthreads) {
+  ImgGray img_out(0, 0);
+  MaxIntensionProjection(img, mask, delta_x, delta_y, vet_normal, &img_out,
+                         nthreads);
+  return img_out;
+}
+
+void MaxIntensionProjection(ImgVol& img, const BitMask& mask, float delta_x,
+                            float delta_y, std::array<float, 3> vet_normal,
+                            ImgGray* out, size_t nthreads) {
+  VIMAGE_SCOPED_TIMER(kMaxIntensionProjection);
+  CheckSize(img, mask);
+  NormalizeImage(img);
+
+  RayCamera camera(img, delta_x, delta_y, vet_normal);
+  size_t width = camera.Width();
+  size_t height = camera.Height();
+  out->Resize(width, height);
+
+  const uint8_t* data = img.Data();
+  uint8_t* pixels = out->Data();
+
+  ParallelFor(0, height, [&](size_t y0, size_t y1) {
+    std::array<float, 3> p1;
+    std::array<float, 3> pn;
+    size_t rays = 0;
+    size_t samples = 0;
+
+    for (size_t y = y0; y < y1; y++) {
+      for (size_t x = 0; x < width; x++) {
+        uint8_t max = 0;
+
+        if (camera.Clip(x, y, &p1, &pn)) {
+          // The voxel is tracked next to the traversal to find its bit.
+          std::array<long, 3> v;
+          std::array<long, 3> dir;
+
+          for (int a = 0; a < 3; a++) {
+            v[a] = std::lround(p1[a]);
+            dir[a] = std::lround(pn[a]) < v[a] ? -1 : 1;
+          }
+
+          VoxelTraversal t(img, p1, pn);
+          samples += t.Remaining();
+
+          while (true) {
+            if (mask(v[0], v[1], v[2])) {
+              max = std::max(max, data[t.Offset()]);
+            }
+
+            int a = t.Next();
+
+            if (a < 0) {
+              break;
+            }
+
+            v[a] += dir[a];
+          }
+
+          rays++;
+        }
+
+        pixels[y*width + x] = max;
+      }
+    }
+
+    VIMAGE_COUNT(kRaysCast, rays);
+    VIMAGE_COUNT(kRaySamples, samples);
+  }, nthreads);
+}
+
+}
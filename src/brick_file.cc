@@ -0,0 +1,520 @@
+#include "brick_file.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+#include <zlib.h>
+#include "operations.h"
+#include "parallel.h"
+
+namespace imgvol {
+
+namespace {
+
+const char kMagic[4] = {'V', 'B', 'R', 'K'};
+const uint32_t kVersion = 1;
+
+// Number of bricks compressed or decompressed per thread before the
+// results are flushed, bounds the memory used by in-flight bricks.
+const size_t kBricksPerThread = 4;
+
+struct Header {
+  char magic[4];
+  uint32_t version;
+  uint64_t size[3];
+  uint32_t brick[3];
+};
+
+struct Footer {
+  uint64_t index_offset;
+  char magic[4];
+};
+
+size_t DivUp(size_t a, size_t b) {
+  return (a + b - 1)/b;
+}
+
+// Voxel extent [b0, b1) covered by brick (bx, by, bz).
+void BrickExtent(std::array<size_t, 3> brick, std::array<size_t, 3> size,
+                 std::array<size_t, 3> bpos, std::array<size_t, 3>* b0,
+                 std::array<size_t, 3>* b1) {
+  for (size_t a = 0; a < 3; a++) {
+    (*b0)[a] = bpos[a]*brick[a];
+    (*b1)[a] = std::min((*b0)[a] + brick[a], size[a]);
+  }
+}
+
+}
+
+std::vector<uint8_t> CompressBrick(const uint8_t* data, size_t size,
+                                   int level) {
+  uLongf out_size = compressBound(size);
+  std::vector<uint8_t> out(out_size);
+
+  int ret = compress2(out.data(), &out_size, data, size, level);
+
+  if (ret != Z_OK) {
+    throw std::runtime_error("brick compression failed");
+  }
+
+  out.resize(out_size);
+  return out;
+}
+
+void DecompressBrick(const uint8_t* src, size_t src_size, uint8_t* dst,
+                     size_t dst_size) {
+  uLongf out_size = dst_size;
+  int ret = uncompress(dst, &out_size, src, src_size);
+
+  if (ret != Z_OK || out_size != dst_size) {
+    throw std::runtime_error("corrupted brick");
+  }
+}
+
+void WriteBrickVolume(const ImgVol& img, const std::string& file_name,
+                      size_t brick_size, int level, size_t nthreads) {
+  if (brick_size == 0) {
+    throw std::invalid_argument("brick size must be positive");
+  }
+
+  std::array<size_t, 3> size = {img.SizeX(), img.SizeY(), img.SizeZ()};
+  std::array<size_t, 3> brick = {brick_size, brick_size, brick_size};
+  std::array<size_t, 3> nbricks;
+
+  for (size_t a = 0; a < 3; a++) {
+    nbricks[a] = DivUp(size[a], brick[a]);
+  }
+
+  size_t total = nbricks[0]*nbricks[1]*nbricks[2];
+
+  std::ofstream fout;
+  fout.open(file_name, std::ios::binary | std::ios::out);
+
+  if (!fout) {
+    throw std::runtime_error("can't open file: " + file_name);
+  }
+
+  Header header;
+  std::memset(&header, 0, sizeof(header));
+  std::memcpy(header.magic, kMagic, sizeof(kMagic));
+  header.version = kVersion;
+
+  for (size_t a = 0; a < 3; a++) {
+    header.size[a] = size[a];
+    header.brick[a] = brick[a];
+  }
+
+  fout.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+  std::vector<BrickVolume::IndexEntry> index(total);
+  uint64_t offset = sizeof(header);
+
+  nthreads = NumThreads(nthreads);
+  size_t batch = nthreads*kBricksPerThread;
+  std::vector<std::vector<uint8_t>> blobs(batch);
+
+  for (size_t first = 0; first < total; first += batch) {
+    size_t last = std::min(first + batch, total);
+
+    ParallelFor(first, last, [&](size_t begin, size_t end) {
+      std::vector<uint8_t> raw(brick[0]*brick[1]*brick[2]);
+
+      for (size_t id = begin; id < end; id++) {
+        std::array<size_t, 3> bpos = {id%nbricks[0],
+                                      (id/nbricks[0])%nbricks[1],
+                                      id/(nbricks[0]*nbricks[1])};
+        std::array<size_t, 3> b0, b1;
+        BrickExtent(brick, size, bpos, &b0, &b1);
+
+        size_t row = b1[0] - b0[0];
+        uint8_t* dst = raw.data();
+
+        for (size_t z = b0[2]; z < b1[2]; z++) {
+          for (size_t y = b0[1]; y < b1[1]; y++) {
+            const uint8_t* src = img.Data() + z*size[0]*size[1] +
+                y*size[0] + b0[0];
+            std::memcpy(dst, src, row);
+            dst += row;
+          }
+        }
+
+        blobs[id - first] = CompressBrick(raw.data(), dst - raw.data(),
+                                          level);
+      }
+    }, nthreads);
+
+    for (size_t id = first; id < last; id++) {
+      std::vector<uint8_t>& blob = blobs[id - first];
+      index[id].offset = offset;
+      index[id].size = blob.size();
+      fout.write(reinterpret_cast<const char*>(blob.data()), blob.size());
+      offset += blob.size();
+      std::vector<uint8_t>().swap(blob);
+    }
+  }
+
+  Footer footer;
+  std::memset(&footer, 0, sizeof(footer));
+  footer.index_offset = offset;
+  std::memcpy(footer.magic, kMagic, sizeof(kMagic));
+
+  fout.write(reinterpret_cast<const char*>(index.data()),
+             index.size()*sizeof(BrickVolume::IndexEntry));
+  fout.write(reinterpret_cast<const char*>(&footer), sizeof(footer));
+  fout.close();
+}
+
+BrickVolume::BrickVolume(const std::string& file_name, size_t nthreads)
+  : nthreads_(NumThreads(nthreads)) {
+  in_file_.open(file_name, std::ios::in | std::ios::binary);
+
+  if (!in_file_) {
+    throw std::runtime_error("can't open file: " + file_name);
+  }
+
+  Header header;
+  in_file_.read(reinterpret_cast<char*>(&header), sizeof(header));
+
+  if (!in_file_ || std::memcmp(header.magic, kMagic, sizeof(kMagic)) != 0 ||
+      header.version != kVersion) {
+    throw std::runtime_error("not a brick volume: " + file_name);
+  }
+
+  for (size_t a = 0; a < 3; a++) {
+    if (header.brick[a] == 0) {
+      throw std::runtime_error("corrupted brick volume header: " + file_name);
+    }
+
+    size_[a] = header.size[a];
+    brick_[a] = header.brick[a];
+    nbricks_[a] = DivUp(size_[a], brick_[a]);
+  }
+
+  Footer footer;
+  in_file_.seekg(0, std::ios::end);
+  uint64_t file_size = uint64_t(in_file_.tellg());
+  in_file_.seekg(-static_cast<std::streamoff>(sizeof(footer)), std::ios::end);
+  in_file_.read(reinterpret_cast<char*>(&footer), sizeof(footer));
+
+  if (!in_file_ || std::memcmp(footer.magic, kMagic, sizeof(kMagic)) != 0) {
+    throw std::runtime_error("missing brick index: " + file_name);
+  }
+
+  // The index lies between the bricks and the footer. The brick count is
+  // checked against the room left before multiplying it out, so sizes
+  // from a corrupt header can't overflow it.
+  if (footer.index_offset < sizeof(header) ||
+      footer.index_offset > file_size - sizeof(footer)) {
+    throw std::runtime_error("corrupted brick index offset: " + file_name);
+  }
+
+  uint64_t room = (file_size - sizeof(footer) - footer.index_offset)/
+      sizeof(IndexEntry);
+  uint64_t count = 1;
+
+  for (size_t a = 0; a < 3; a++) {
+    if (nbricks_[a] != 0 && count > room/nbricks_[a]) {
+      throw std::runtime_error("truncated brick index: " + file_name);
+    }
+
+    count *= nbricks_[a];
+  }
+
+  index_.resize(count);
+  in_file_.seekg(footer.index_offset, std::ios::beg);
+  in_file_.read(reinterpret_cast<char*>(index_.data()),
+                index_.size()*sizeof(IndexEntry));
+
+  if (!in_file_) {
+    throw std::runtime_error("truncated brick index: " + file_name);
+  }
+}
+
+BrickVolume::~BrickVolume() {}
+
+size_t BrickVolume::SizeX() const noexcept {
+  return size_[0];
+}
+
+size_t BrickVolume::SizeY() const noexcept {
+  return size_[1];
+}
+
+size_t BrickVolume::SizeZ() const noexcept {
+  return size_[2];
+}
+
+std::array<size_t, 3> BrickVolume::BrickSize() const noexcept {
+  return brick_;
+}
+
+std::array<size_t, 3> BrickVolume::NumBricks() const noexcept {
+  return nbricks_;
+}
+
+size_t BrickVolume::BrickId(size_t bx, size_t by, size_t bz) const noexcept {
+  return bz*nbricks_[0]*nbricks_[1] + by*nbricks_[0] + bx;
+}
+
+void BrickVolume::DecodeBricks(const std::vector<size_t>& ids,
+                               const BrickFn& fn) {
+  size_t batch = nthreads_*kBricksPerThread;
+  std::vector<std::vector<uint8_t>> blobs(batch);
+
+  for (size_t first = 0; first < ids.size(); first += batch) {
+    size_t last = std::min(first + batch, ids.size());
+
+    // The file is read serially, bricks are decompressed in parallel.
+    for (size_t k = first; k < last; k++) {
+      const IndexEntry& entry = index_[ids[k]];
+      std::vector<uint8_t>& blob = blobs[k - first];
+      blob.resize(entry.size);
+      in_file_.seekg(entry.offset, std::ios::beg);
+      in_file_.read(reinterpret_cast<char*>(blob.data()), entry.size);
+    }
+
+    if (!in_file_) {
+      throw std::runtime_error("truncated brick volume");
+    }
+
+    ParallelFor(first, last, [&](size_t begin, size_t end) {
+      std::vector<uint8_t> raw(brick_[0]*brick_[1]*brick_[2]);
+
+      for (size_t k = begin; k < end; k++) {
+        size_t id = ids[k];
+        std::array<size_t, 3> bpos = {id%nbricks_[0],
+                                      (id/nbricks_[0])%nbricks_[1],
+                                      id/(nbricks_[0]*nbricks_[1])};
+        std::array<size_t, 3> b0, b1;
+        BrickExtent(brick_, size_, bpos, &b0, &b1);
+
+        const std::vector<uint8_t>& blob = blobs[k - first];
+        size_t bsize = (b1[0] - b0[0])*(b1[1] - b0[1])*(b1[2] - b0[2]);
+        DecompressBrick(blob.data(), blob.size(), raw.data(), bsize);
+        fn(k, raw.data(), b0, b1);
+      }
+    }, nthreads_);
+  }
+}
+
+void BrickVolume::ReadBricks(const std::vector<size_t>& ids,
+                             std::array<size_t, 3> p0, ImgVol* img) {
+  std::array<size_t, 3> p1 = {p0[0] + img->SizeX(), p0[1] + img->SizeY(),
+                              p0[2] + img->SizeZ()};
+  uint8_t* voxels = img->Data();
+
+  DecodeBricks(ids, [&](size_t, const uint8_t* raw, std::array<size_t, 3> b0,
+                        std::array<size_t, 3> b1) {
+    // Copy the part of the brick that falls inside the region.
+    std::array<size_t, 3> r0, r1;
+
+    for (size_t a = 0; a < 3; a++) {
+      r0[a] = std::max(b0[a], p0[a]);
+      r1[a] = std::min(b1[a], p1[a]);
+    }
+
+    if (r0[0] >= r1[0] || r0[1] >= r1[1] || r0[2] >= r1[2]) {
+      return;
+    }
+
+    size_t bx = b1[0] - b0[0];
+    size_t by = b1[1] - b0[1];
+
+    for (size_t z = r0[2]; z < r1[2]; z++) {
+      for (size_t y = r0[1]; y < r1[1]; y++) {
+        const uint8_t* src = raw + (z - b0[2])*bx*by + (y - b0[1])*bx +
+            (r0[0] - b0[0]);
+        uint8_t* dst = voxels + (z - p0[2])*img->SizeX()*img->SizeY() +
+            (y - p0[1])*img->SizeX() + (r0[0] - p0[0]);
+        std::memcpy(dst, src, r1[0] - r0[0]);
+      }
+    }
+  });
+}
+
+ImgVol BrickVolume::ReadAll() {
+  return ReadRegion(std::array<size_t, 3>{0, 0, 0}, size_);
+}
+
+ImgVol BrickVolume::ReadRegion(std::array<size_t, 3> p0,
+                               std::array<size_t, 3> p1) {
+  for (size_t a = 0; a < 3; a++) {
+    p1[a] = std::min(p1[a], size_[a]);
+
+    if (p0[a] >= p1[a]) {
+      throw std::out_of_range("empty brick volume region");
+    }
+  }
+
+  ImgVol img(p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2]);
+  std::vector<size_t> ids;
+
+  for (size_t bz = p0[2]/brick_[2]; bz < DivUp(p1[2], brick_[2]); bz++) {
+    for (size_t by = p0[1]/brick_[1]; by < DivUp(p1[1], brick_[1]); by++) {
+      for (size_t bx = p0[0]/brick_[0]; bx < DivUp(p1[0], brick_[0]); bx++) {
+        ids.push_back(BrickId(bx, by, bz));
+      }
+    }
+  }
+
+  ReadBricks(ids, p0, &img);
+  return img;
+}
+
+Img2D BrickVolume::Cut(ImgVol::Axis axis, size_t pos, bool w) {
+  std::array<size_t, 3> p0 = {0, 0, 0};
+  std::array<size_t, 3> p1 = size_;
+  size_t a;
+
+  if (axis == ImgVol::Axis::aX) {
+    a = 0;
+  } else if (axis == ImgVol::Axis::aY) {
+    a = 1;
+  } else {
+    a = 2;
+  }
+
+  p0[a] = pos;
+  p1[a] = pos + 1;
+
+  ImgVol layer = ReadRegion(p0, p1);
+  return imgvol::Cut(layer, axis, 0, w);
+}
+
+std::vector<size_t> BrickVolume::BricksOnPlane(std::array<float, 3> p1,
+                                               std::array<float, 3> vec) const {
+  std::vector<size_t> ids;
+
+  for (size_t bz = 0; bz < nbricks_[2]; bz++) {
+    for (size_t by = 0; by < nbricks_[1]; by++) {
+      for (size_t bx = 0; bx < nbricks_[0]; bx++) {
+        std::array<size_t, 3> b0, b1;
+        BrickExtent(brick_, size_, std::array<size_t, 3>{bx, by, bz},
+                    &b0, &b1);
+
+        // The plane crosses the box when its corners are not all on the
+        // same side. Samples are truncated to voxels, so the box spans
+        // [b0, b1) in continuous coordinates.
+        bool neg = false;
+        bool pos = false;
+
+        for (int c = 0; c < 8; c++) {
+          float d = 0;
+
+          for (size_t a = 0; a < 3; a++) {
+            float v = (c & (1 << a)) ? b1[a] : b0[a];
+            d += (v - p1[a])*vec[a];
+          }
+
+          neg = neg || d <= 0;
+          pos = pos || d >= 0;
+        }
+
+        if (neg && pos) {
+          ids.push_back(BrickId(bx, by, bz));
+        }
+      }
+    }
+  }
+
+  return ids;
+}
+
+ImgGray BrickVolume::CortePlanar(std::array<float, 3> p1,
+                                 std::array<float, 3> vec) {
+  float diagonal = Diagonal(std::array<float, 3>{(float)size_[0],
+      (float)size_[1], (float)size_[2]});
+  ImgGray out(diagonal, diagonal);
+  size_t width = out.SizeX();
+  size_t npixels = width*out.SizeY();
+  Mat4 phi_inv = PlanarTransform(size_, std::array<size_t, 3>{0, 0, 0}, p1,
+                                 vec);
+
+  // The voxel each pixel reads is found as NearestSampler does, pixels
+  // off the volume stay 0. Pixels are then grouped by brick, so every
+  // brick is decompressed once, into a scratch buffer, and fills its
+  // pixels.
+  const size_t kOutside = ~size_t(0);
+  std::vector<size_t> pixel_brick(npixels);
+  std::vector<uint32_t> pixel_offset(npixels);
+
+  ParallelFor(0, out.SizeY(), [&](size_t v0, size_t v1) {
+    for (size_t v = v0; v < v1; v++) {
+      for (size_t u = 0; u < width; u++) {
+        Vec4 q = {double(u), double(v), -diagonal/2, 1};
+        Vec4 p = MultMat4(phi_inv, q);
+        std::array<size_t, 3> voxel;
+        bool inside = true;
+
+        for (size_t a = 0; a < 3; a++) {
+          float c = NearestSampler<>::Coordinate(p[a]);
+          inside = inside && c >= 0 && c < float(size_[a]);
+          voxel[a] = inside ? size_t(c) : 0;
+        }
+
+        size_t i = v*width + u;
+
+        if (!inside) {
+          pixel_brick[i] = kOutside;
+          continue;
+        }
+
+        std::array<size_t, 3> bpos, local, extent;
+
+        for (size_t a = 0; a < 3; a++) {
+          bpos[a] = voxel[a]/brick_[a];
+          local[a] = voxel[a] - bpos[a]*brick_[a];
+          extent[a] = std::min(brick_[a], size_[a] - bpos[a]*brick_[a]);
+        }
+
+        pixel_brick[i] = BrickId(bpos[0], bpos[1], bpos[2]);
+        pixel_offset[i] = uint32_t((local[2]*extent[1] + local[1])*extent[0] +
+                                   local[0]);
+      }
+    }
+  }, nthreads_);
+
+  // Counting sort of the pixels by brick.
+  std::vector<size_t> first(index_.size() + 1, 0);
+
+  for (size_t i = 0; i < npixels; i++) {
+    if (pixel_brick[i] != kOutside) {
+      first[pixel_brick[i] + 1]++;
+    }
+  }
+
+  std::vector<size_t> ids;
+
+  for (size_t id = 0; id < index_.size(); id++) {
+    if (first[id + 1] > 0) {
+      ids.push_back(id);
+    }
+
+    first[id + 1] += first[id];
+  }
+
+  std::vector<size_t> pixels(first.back());
+  std::vector<size_t> next(first.begin(), first.end() - 1);
+
+  for (size_t i = 0; i < npixels; i++) {
+    if (pixel_brick[i] != kOutside) {
+      pixels[next[pixel_brick[i]]++] = i;
+    }
+  }
+
+  uint8_t* dst = out.Data();
+  std::fill(dst, dst + npixels, 0);
+
+  DecodeBricks(ids, [&](size_t k, const uint8_t* raw, std::array<size_t, 3>,
+                        std::array<size_t, 3>) {
+    size_t id = ids[k];
+
+    for (size_t j = first[id]; j < first[id + 1]; j++) {
+      dst[pixels[j]] = raw[pixel_offset[pixels[j]]];
+    }
+  });
+
+  return out;
+}
+
+}
@@ -0,0 +1,267 @@
+#include "clahe.h"
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <vector>
+#include "instrument.h"
+#include "parallel.h"
+
+namespace imgvol {
+
+namespace {
+
+// Tiles along one axis of n pixels, the last tile may be smaller.
+struct TileAxis {
+  size_t tiles;
+  size_t size;
+};
+
+TileAxis MakeTileAxis(size_t n, size_t tiles) {
+  tiles = std::max<size_t>(1, std::min(tiles, n));
+  size_t size = (n + tiles - 1)/tiles;
+  return TileAxis{(n + size - 1)/size, size};
+}
+
+// For each coordinate, the two tiles whose centers surround it and the
+// weight of the second one in 1/256ths. Outside the first and last tile
+// centers both tiles are the same.
+struct AxisTable {
+  std::vector<uint32_t> lo;
+  std::vector<uint32_t> hi;
+  std::vector<uint32_t> w;
+};
+
+AxisTable MakeAxisTable(size_t n, const TileAxis& axis, size_t stride) {
+  AxisTable table;
+  table.lo.resize(n);
+  table.hi.resize(n);
+  table.w.resize(n);
+
+  for (size_t i = 0; i < n; i++) {
+    float f = (i + 0.5f)/axis.size - 0.5f;
+    size_t t = f <= 0 ? 0 : std::min(size_t(f), axis.tiles - 1);
+    size_t u = std::min(t + 1, axis.tiles - 1);
+    float w = std::min(std::max(f - t, 0.0f), 1.0f);
+    table.lo[i] = uint32_t(t*stride);
+    table.hi[i] = uint32_t(u*stride);
+    table.w[i] = t == u ? 0 : uint32_t(w*256 + 0.5f);
+  }
+
+  return table;
+}
+
+// Equalization LUT of a histogram of npix values, clipped first.
+void BuildLut(std::array<uint32_t, 256>& hist, size_t npix, float clip_limit,
+              uint8_t* lut) {
+  if (clip_limit > 0) {
+    uint32_t limit = std::max<uint32_t>(1, uint32_t(clip_limit*npix/256));
+    size_t excess = 0;
+
+    for (auto& h : hist) {
+      if (h > limit) {
+        excess += h - limit;
+        h = limit;
+      }
+    }
+
+    size_t each = excess/256;
+    size_t rest = excess%256;
+
+    for (auto& h : hist) {
+      h += uint32_t(each);
+    }
+
+    // The step is fixed up front, rest reaches 0 on the last pass.
+    size_t step = std::max<size_t>(1, 256/std::max<size_t>(1, rest));
+
+    for (size_t i = 0; rest > 0; i = (i + step)%256) {
+      hist[i]++;
+      rest--;
+    }
+  }
+
+  size_t cdf = 0;
+
+  for (size_t v = 0; v < 256; v++) {
+    cdf += hist[v];
+    lut[v] = uint8_t(std::min<size_t>(255, (cdf*255 + npix/2)/npix));
+  }
+}
+
+// Bilinear blend along one row of the LUTs of two tile rows, the result
+// is scaled by 65536. The LUT reads are gathers, everything else is
+// branch free and runs over contiguous tables.
+void BlendRow(const uint8_t* src, size_t n, const AxisTable& tx,
+              const uint8_t* top, const uint8_t* bottom, uint32_t wy,
+              uint32_t* out) {
+  const uint32_t* lo = tx.lo.data();
+  const uint32_t* hi = tx.hi.data();
+  const uint32_t* wx = tx.w.data();
+
+  for (size_t x = 0; x < n; x++) {
+    uint32_t v = src[x];
+    uint32_t t = top[lo[x] + v]*(256 - wx[x]) + top[hi[x] + v]*wx[x];
+    uint32_t b = bottom[lo[x] + v]*(256 - wx[x]) + bottom[hi[x] + v]*wx[x];
+    out[x] = t*(256 - wy) + b*wy;
+  }
+}
+
+// CLAHE of an nx*ny*nz 8 bit image, in and out may alias.
+void ClaheVoxels(const uint8_t* in, size_t nx, size_t ny, size_t nz,
+                 size_t tiles_x, size_t tiles_y, size_t tiles_z,
+                 float clip_limit, size_t nthreads, uint8_t* out) {
+  if (nx*ny*nz == 0) {
+    return;
+  }
+
+  TileAxis ax = MakeTileAxis(nx, tiles_x);
+  TileAxis ay = MakeTileAxis(ny, tiles_y);
+  TileAxis az = MakeTileAxis(nz, tiles_z);
+  size_t ntiles = ax.tiles*ay.tiles*az.tiles;
+  std::vector<uint8_t> luts(ntiles*256);
+
+  ParallelFor(0, ntiles, [&](size_t t0, size_t t1) {
+    std::array<uint32_t, 256> hist;
+
+    for (size_t t = t0; t < t1; t++) {
+      size_t tx = t%ax.tiles;
+      size_t ty = t/ax.tiles%ay.tiles;
+      size_t tz = t/(ax.tiles*ay.tiles);
+      size_t x0 = tx*ax.size, x1 = std::min(x0 + ax.size, nx);
+      size_t y0 = ty*ay.size, y1 = std::min(y0 + ay.size, ny);
+      size_t z0 = tz*az.size, z1 = std::min(z0 + az.size, nz);
+      hist.fill(0);
+
+      for (size_t z = z0; z < z1; z++) {
+        for (size_t y = y0; y < y1; y++) {
+          const uint8_t* row = in + (z*ny + y)*nx;
+
+          for (size_t x = x0; x < x1; x++) {
+            hist[row[x]]++;
+          }
+        }
+      }
+
+      BuildLut(hist, (x1 - x0)*(y1 - y0)*(z1 - z0), clip_limit,
+               luts.data() + t*256);
+    }
+  }, nthreads);
+
+  // LUTs are laid out [tz][ty][tx][256], so a tile row starts every
+  // tiles_x*256 bytes.
+  size_t row_stride = ax.tiles*256;
+  AxisTable tx = MakeAxisTable(nx, ax, 256);
+  AxisTable ty = MakeAxisTable(ny, ay, row_stride);
+  AxisTable tz = MakeAxisTable(nz, az, ay.tiles*row_stride);
+
+  ParallelFor(0, ny*nz, [&](size_t r0, size_t r1) {
+    std::vector<uint32_t> near(nx);
+    std::vector<uint32_t> far(nx);
+
+    for (size_t r = r0; r < r1; r++) {
+      size_t y = r%ny;
+      size_t z = r/ny;
+      const uint8_t* src = in + r*nx;
+      uint8_t* dst = out + r*nx;
+      const uint8_t* plane = luts.data() + tz.lo[z];
+
+      BlendRow(src, nx, tx, plane + ty.lo[y], plane + ty.hi[y], ty.w[y],
+               near.data());
+
+      if (tz.w[z] == 0) {
+        for (size_t x = 0; x < nx; x++) {
+          dst[x] = uint8_t((near[x] + 32768) >> 16);
+        }
+
+        continue;
+      }
+
+      plane = luts.data() + tz.hi[z];
+      BlendRow(src, nx, tx, plane + ty.lo[y], plane + ty.hi[y], ty.w[y],
+               far.data());
+      uint64_t wz = tz.w[z];
+
+      for (size_t x = 0; x < nx; x++) {
+        dst[x] = uint8_t((near[x]*(256 - wz) + far[x]*wz + (1 << 23)) >> 24);
+      }
+    }
+  }, nthreads);
+}
+
+}
+
+void Clahe(const ImgGray& img, const ClaheOptions& opts, ImgGray* out) {
+  VIMAGE_SCOPED_TIMER(kClahe);
+  size_t nx = img.SizeX();
+  size_t ny = img.SizeY();
+
+  if (out != &img) {
+    out->Resize(nx, ny);
+  }
+
+  ClaheVoxels(img.Data(), nx, ny, 1, opts.tiles_x, opts.tiles_y, 1,
+              opts.clip_limit, opts.nthreads, out->Data());
+}
+
+ImgGray Clahe(const ImgGray& img, const ClaheOptions& opts) {
+  ImgGray out(img.SizeX(), img.SizeY());
+  Clahe(img, opts, &out);
+  return out;
+}
+
+void Clahe(const Img2D& img, const ClaheOptions& opts, Img2D* out) {
+  VIMAGE_SCOPED_TIMER(kClahe);
+  size_t nx = img.SizeX();
+  size_t ny = img.SizeY();
+  size_t n = nx*ny;
+  const int* in = img.Data();
+  std::vector<uint8_t> bins(n);
+
+  if (n > 0) {
+    auto range = std::minmax_element(in, in + n);
+    long lo = *range.first;
+    long span = std::max(1L, long(*range.second) - lo);
+
+    for (size_t i = 0; i < n; i++) {
+      bins[i] = uint8_t((in[i] - lo)*255/span);
+    }
+  }
+
+  ClaheVoxels(bins.data(), nx, ny, 1, opts.tiles_x, opts.tiles_y, 1,
+              opts.clip_limit, opts.nthreads, bins.data());
+
+  out->Resize(nx, ny);
+  std::copy(bins.begin(), bins.end(), out->Data());
+}
+
+Img2D Clahe(const Img2D& img, const ClaheOptions& opts) {
+  Img2D out(img.SizeX(), img.SizeY());
+  Clahe(img, opts, &out);
+  return out;
+}
+
+void Clahe(const ImgVol& img, const ClaheOptions& opts, ImgVol* out) {
+  VIMAGE_SCOPED_TIMER(kClahe);
+  size_t nx = img.SizeX();
+  size_t ny = img.SizeY();
+  size_t nz = img.SizeZ();
+
+  if (out != &img) {
+    out->Resize(nx, ny, nz);
+    out->SetOrigin(img.Origin());
+  }
+
+  // Unshare out before reading img, they are the same buffer when out is
+  // img.
+  uint8_t* dst = out->Data();
+  ClaheVoxels(img.Data(), nx, ny, nz, opts.tiles_x, opts.tiles_y,
+              opts.tiles_z, opts.clip_limit, opts.nthreads, dst);
+}
+
+ImgVol Clahe(const ImgVol& img, const ClaheOptions& opts) {
+  ImgVol out(0, 0, 0);
+  Clahe(img, opts, &out);
+  return out;
+}
+
+}
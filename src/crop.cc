@@ -0,0 +1,120 @@
+#include "crop.h"
+#include <algorithm>
+#include <cstring>
+#include <vector>
+#include "parallel.h"
+
+namespace imgvol {
+
+BoundingBox ForegroundBox(const ImgVol& img, int threshold,
+                          size_t nthreads) {
+  size_t nx = img.SizeX();
+  size_t ny = img.SizeY();
+  size_t nz = img.SizeZ();
+  const uint8_t* data = img.Data();
+
+  BoundingBox empty = {{{nx, ny, nz}}, {{0, 0, 0}}};
+  nthreads = std::max<size_t>(1, std::min(NumThreads(nthreads), nz));
+  std::vector<BoundingBox> boxes(nthreads, empty);
+
+  ParallelFor(0, nthreads, [&](size_t t0, size_t t1) {
+    for (size_t t = t0; t < t1; t++) {
+      BoundingBox& box = boxes[t];
+
+      for (size_t z = t*nz/nthreads; z < (t + 1)*nz/nthreads; z++) {
+        for (size_t y = 0; y < ny; y++) {
+          const uint8_t* row = data + (z*ny + y)*nx;
+          size_t x0 = 0;
+
+          while (x0 < nx && row[x0] <= threshold) {
+            x0++;
+          }
+
+          if (x0 == nx) {
+            continue;
+          }
+
+          // Only the part right of the current box can move its end.
+          size_t x1 = nx;
+
+          while (x1 > std::max(x0, box.hi[0]) && row[x1 - 1] <= threshold) {
+            x1--;
+          }
+
+          box.lo = {{std::min(box.lo[0], x0), std::min(box.lo[1], y),
+                     std::min(box.lo[2], z)}};
+          box.hi = {{std::max(box.hi[0], x1), std::max(box.hi[1], y + 1),
+                     std::max(box.hi[2], z + 1)}};
+        }
+      }
+    }
+  }, nthreads);
+
+  BoundingBox res = empty;
+
+  for (const BoundingBox& box : boxes) {
+    for (int a = 0; a < 3; a++) {
+      res.lo[a] = std::min(res.lo[a], box.lo[a]);
+      res.hi[a] = std::max(res.hi[a], box.hi[a]);
+    }
+  }
+
+  return res;
+}
+
+ImgVol Crop(const ImgVol& img, const BoundingBox& box, size_t nthreads) {
+  std::array<size_t, 3> size = {{img.SizeX(), img.SizeY(), img.SizeZ()}};
+  std::array<size_t, 3> lo;
+  std::array<size_t, 3> hi;
+
+  for (int a = 0; a < 3; a++) {
+    hi[a] = std::min(box.hi[a], size[a]);
+    lo[a] = std::min(box.lo[a], hi[a]);
+  }
+
+  size_t nx = hi[0] - lo[0];
+  size_t ny = hi[1] - lo[1];
+  size_t nz = hi[2] - lo[2];
+
+  ImgVol out(nx, ny, nz);
+  std::array<size_t, 3> origin = img.Origin();
+  out.SetOrigin({{origin[0] + lo[0], origin[1] + lo[1], origin[2] + lo[2]}});
+  out.SetVoxelSize(img.DimX(), img.DimY(), img.DimZ());
+
+  if (nx*ny*nz == 0) {
+    return out;
+  }
+
+  const uint8_t* src = img.Data();
+  uint8_t* dst = out.Data();
+
+  ParallelFor(0, nz, [&](size_t z0, size_t z1) {
+    for (size_t z = z0; z < z1; z++) {
+      for (size_t y = 0; y < ny; y++) {
+        std::memcpy(dst + (z*ny + y)*nx,
+                    src + ((z + lo[2])*size[1] + y + lo[1])*size[0] + lo[0],
+                    nx);
+      }
+    }
+  }, nthreads);
+
+  return out;
+}
+
+ImgVol CropForeground(const ImgVol& img, int threshold, size_t margin,
+                      size_t nthreads) {
+  BoundingBox box = ForegroundBox(img, threshold, nthreads);
+
+  if (box.Empty()) {
+    box = {{{0, 0, 0}}, {{1, 1, 1}}};
+  }
+
+  for (int a = 0; a < 3; a++) {
+    box.lo[a] = box.lo[a] > margin ? box.lo[a] - margin : 0;
+    box.hi[a] += margin;
+  }
+
+  return Crop(img, box, nthreads);
+}
+
+}
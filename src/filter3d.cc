@@ -0,0 +1,354 @@
+#include "filter3d.h"
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <vector>
+#include "parallel.h"
+#include "voxel_memory.h"
+
+namespace imgvol {
+
+namespace {
+
+// Separable kernel, either explicit weights of size 2*radius + 1 or a
+// box of the same size when weights is empty.
+struct Kernel {
+  size_t radius;
+  std::vector<float> weights;
+};
+
+Kernel GaussianKernel(float sigma) {
+  if (!(sigma > 0)) {
+    throw std::invalid_argument("gaussian sigma must be positive");
+  }
+
+  Kernel kernel;
+
+  // A sigma so small its variance underflows leaves the volume as is.
+  if (2*sigma*sigma == 0) {
+    kernel.radius = 0;
+    kernel.weights = {1};
+    return kernel;
+  }
+
+  kernel.radius = size_t(std::ceil(3*sigma));
+  kernel.weights.resize(2*kernel.radius + 1);
+
+  float sum = 0;
+
+  for (size_t k = 0; k < kernel.weights.size(); k++) {
+    float d = float(k) - kernel.radius;
+    kernel.weights[k] = std::exp(-d*d/(2*sigma*sigma));
+    sum += kernel.weights[k];
+  }
+
+  for (auto& w : kernel.weights) {
+    w /= sum;
+  }
+
+  return kernel;
+}
+
+Kernel BoxKernel(size_t radius) {
+  Kernel kernel;
+  kernel.radius = radius;
+  return kernel;
+}
+
+size_t Clamp(long v, size_t n) {
+  return v < 0 ? 0 : (size_t(v) >= n ? n - 1 : size_t(v));
+}
+
+// Filter one row along x. pad has room for n + 2*radius values.
+void FilterRowX(const Kernel& kernel, const uint8_t* in, size_t n,
+                float* pad, float* out) {
+  size_t r = kernel.radius;
+
+  for (size_t i = 0; i < r; i++) {
+    pad[i] = in[0];
+    pad[n + r + i] = in[n - 1];
+  }
+
+  for (size_t x = 0; x < n; x++) {
+    pad[r + x] = in[x];
+  }
+
+  if (kernel.weights.empty()) {
+    float acc = 0;
+
+    for (size_t k = 0; k < 2*r + 1; k++) {
+      acc += pad[k];
+    }
+
+    out[0] = acc;
+
+    for (size_t x = 1; x < n; x++) {
+      acc += pad[x + 2*r] - pad[x - 1];
+      out[x] = acc;
+    }
+
+    return;
+  }
+
+  // Tap by tap over the whole row, the inner loop runs along contiguous x
+  // and vectorizes.
+  std::fill(out, out + n, 0.0f);
+
+  for (size_t k = 0; k < 2*r + 1; k++) {
+    float w = kernel.weights[k];
+    const float* src = pad + k;
+
+    for (size_t x = 0; x < n; x++) {
+      out[x] += w*src[x];
+    }
+  }
+}
+
+// Combine rows (or slices) of length n along the y (or z) axis:
+// out = sum_k w[k]*lines[k]. lines[k] is the line at offset k - radius.
+void CombineLines(const Kernel& kernel, const float* const* lines, size_t n,
+                  float* out) {
+  std::fill(out, out + n, 0.0f);
+
+  for (size_t k = 0; k < 2*kernel.radius + 1; k++) {
+    float w = kernel.weights[k];
+    const float* src = lines[k];
+
+    for (size_t x = 0; x < n; x++) {
+      out[x] += w*src[x];
+    }
+  }
+}
+
+// Running sum step along y or z: acc += entering - leaving.
+void SlideLines(const float* entering, const float* leaving, size_t n,
+                float* acc) {
+  for (size_t x = 0; x < n; x++) {
+    acc[x] += entering[x] - leaving[x];
+  }
+}
+
+void SumLines(const float* const* lines, size_t count, size_t n, float* acc) {
+  std::fill(acc, acc + n, 0.0f);
+
+  for (size_t k = 0; k < count; k++) {
+    for (size_t x = 0; x < n; x++) {
+      acc[x] += lines[k][x];
+    }
+  }
+}
+
+// Filter slice z of src along x then y into out.
+void FilterSliceXY(const Kernel& kernel, const ImgVol& src, size_t z,
+                   float* out, std::vector<float>* rows,
+                   std::vector<float>* pad) {
+  size_t nx = src.SizeX();
+  size_t ny = src.SizeY();
+  size_t r = kernel.radius;
+  const uint8_t* slice = src.Data() + z*nx*ny;
+
+  for (size_t y = 0; y < ny; y++) {
+    FilterRowX(kernel, slice + y*nx, nx, pad->data(), rows->data() + y*nx);
+  }
+
+  std::vector<const float*> lines(2*r + 1);
+
+  if (kernel.weights.empty()) {
+    for (size_t k = 0; k < 2*r + 1; k++) {
+      lines[k] = rows->data() + Clamp(long(k) - long(r), ny)*nx;
+    }
+
+    SumLines(lines.data(), lines.size(), nx, out);
+
+    for (size_t y = 1; y < ny; y++) {
+      const float* entering = rows->data() + Clamp(long(y + r), ny)*nx;
+      const float* leaving = rows->data() +
+          Clamp(long(y) - long(r) - 1, ny)*nx;
+      std::copy(out + (y - 1)*nx, out + y*nx, out + y*nx);
+      SlideLines(entering, leaving, nx, out + y*nx);
+    }
+
+    return;
+  }
+
+  for (size_t y = 0; y < ny; y++) {
+    for (size_t k = 0; k < 2*r + 1; k++) {
+      lines[k] = rows->data() + Clamp(long(y + k) - long(r), ny)*nx;
+    }
+
+    CombineLines(kernel, lines.data(), nx, out + y*nx);
+  }
+}
+
+void StoreSlice(const float* in, size_t n, float scale, uint8_t* out) {
+  for (size_t i = 0; i < n; i++) {
+    float v = in[i]*scale + 0.5f;
+    out[i] = uint8_t(std::min(std::max(v, 0.0f), 255.0f));
+  }
+}
+
+void SeparableFilter(const ImgVol& src, const Kernel& kernel, ImgVol* dst,
+                     size_t nthreads) {
+  size_t nx = src.SizeX();
+  size_t ny = src.SizeY();
+  size_t nz = src.SizeZ();
+  size_t r = kernel.radius;
+  size_t slice = nx*ny;
+  size_t window = 2*r + 1;
+  float scale = kernel.weights.empty() ? 1.0f/(window*window*window) : 1.0f;
+
+  dst->Resize(nx, ny, nz);
+  dst->SetOrigin(src.Origin());
+
+  if (slice*nz == 0) {
+    return;
+  }
+
+  uint8_t* out = dst->Data();
+
+  ParallelForSlabs(0, nz, nz, [&](size_t z0, size_t z1) {
+    // Ring of the xy filtered slices in the z window, slice z is kept at
+    // ring[(z + r) % window]. The chunk first loads its r halo slices.
+    std::vector<std::vector<float>> ring(window, std::vector<float>(slice));
+    std::vector<float> rows(slice);
+    std::vector<float> pad(nx + 2*r);
+    std::vector<float> acc(slice);
+    std::vector<const float*> lines(window);
+
+    auto slot = [&](long z) -> float* {
+      return ring[size_t(z + long(r))%window].data();
+    };
+
+    for (long z = long(z0) - long(r); z < long(z0) + long(r); z++) {
+      FilterSliceXY(kernel, src, Clamp(z, nz), slot(z), &rows, &pad);
+    }
+
+    for (size_t z = z0; z < z1; z++) {
+      // The slice leaving the window shares its slot with the entering
+      // one, take it out of the running sum first.
+      if (kernel.weights.empty() && z > z0) {
+        const float* leaving = slot(long(z) - long(r) - 1);
+
+        for (size_t i = 0; i < slice; i++) {
+          acc[i] -= leaving[i];
+        }
+      }
+
+      FilterSliceXY(kernel, src, Clamp(long(z + r), nz), slot(long(z + r)),
+                    &rows, &pad);
+
+      if (kernel.weights.empty()) {
+        if (z == z0) {
+          for (size_t k = 0; k < window; k++) {
+            lines[k] = slot(long(z + k) - long(r));
+          }
+
+          SumLines(lines.data(), window, slice, acc.data());
+        } else {
+          const float* entering = slot(long(z + r));
+
+          for (size_t i = 0; i < slice; i++) {
+            acc[i] += entering[i];
+          }
+        }
+
+        StoreSlice(acc.data(), slice, scale, out + z*slice);
+      } else {
+        for (size_t k = 0; k < window; k++) {
+          lines[k] = slot(long(z + k) - long(r));
+        }
+
+        CombineLines(kernel, lines.data(), slice, acc.data());
+        StoreSlice(acc.data(), slice, scale, out + z*slice);
+      }
+    }
+  }, nthreads);
+}
+
+}
+
+void GaussianFilter(const ImgVol& src, float sigma, ImgVol* dst,
+                    size_t nthreads) {
+  if (dst == &src) {
+    GaussianFilter(*dst, sigma);
+    return;
+  }
+
+  SeparableFilter(src, GaussianKernel(sigma), dst, nthreads);
+}
+
+void GaussianFilter(ImgVol& img, float sigma) {
+  // The copy shares the voxels, writing to img unshares them.
+  ImgVol src = img;
+  SeparableFilter(src, GaussianKernel(sigma), &img, 0);
+}
+
+void BoxFilter(const ImgVol& src, size_t radius, ImgVol* dst,
+               size_t nthreads) {
+  if (dst == &src) {
+    BoxFilter(*dst, radius);
+    return;
+  }
+
+  SeparableFilter(src, BoxKernel(radius), dst, nthreads);
+}
+
+void BoxFilter(ImgVol& img, size_t radius) {
+  ImgVol src = img;
+  SeparableFilter(src, BoxKernel(radius), &img, 0);
+}
+
+void MedianFilter(const ImgVol& src, ImgVol* dst, size_t nthreads) {
+  if (dst == &src) {
+    MedianFilter(*dst);
+    return;
+  }
+
+  size_t nx = src.SizeX();
+  size_t ny = src.SizeY();
+  size_t nz = src.SizeZ();
+
+  dst->Resize(nx, ny, nz);
+  dst->SetOrigin(src.Origin());
+
+  if (nx*ny*nz == 0) {
+    return;
+  }
+
+  uint8_t* out = dst->Data();
+  const uint8_t* in = src.Data();
+
+  ParallelForSlabs(0, nz, nz, [&](size_t z0, size_t z1) {
+    uint8_t values[27];
+
+    for (size_t z = z0; z < z1; z++) {
+      for (size_t y = 0; y < ny; y++) {
+        for (size_t x = 0; x < nx; x++) {
+          size_t n = 0;
+
+          for (long dz = -1; dz <= 1; dz++) {
+            const uint8_t* plane = in + Clamp(long(z) + dz, nz)*nx*ny;
+
+            for (long dy = -1; dy <= 1; dy++) {
+              const uint8_t* row = plane + Clamp(long(y) + dy, ny)*nx;
+
+              for (long dx = -1; dx <= 1; dx++) {
+                values[n++] = row[Clamp(long(x) + dx, nx)];
+              }
+            }
+          }
+
+          std::nth_element(values, values + 13, values + 27);
+          out[z*nx*ny + y*nx + x] = values[13];
+        }
+      }
+    }
+  }, nthreads);
+}
+
+void MedianFilter(ImgVol& img) {
+  ImgVol src = img;
+  MedianFilter(src, &img, 0);
+}
+
+}
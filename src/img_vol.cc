@@ -1,27 +1,76 @@
 #include "img_vol.h"
+#include <algorithm>
+#include <cstring>
 #include <fstream>
+#include <limits>
+#include <stdexcept>
+#include "png_encoder.h"
 
 namespace imgvol {
 
-ImgColor::ImgColor(size_t xsize, size_t ysize) {
-  xsize_ = xsize_;
-  ysize_ = ysize;
-  img_.reserve(xsize*ysize);
+namespace {
+
+bool IsPng(const std::string& file_name) {
+  const std::string ext = ".png";
+
+  return file_name.size() >= ext.size() &&
+      file_name.compare(file_name.size() - ext.size(), ext.size(), ext) == 0;
+}
+
+// (v*a + d*(255 - a))/255 rounded, exact for all 8 bit inputs.
+inline uint8_t Blend(uint8_t v, uint8_t d, uint8_t a) {
+  unsigned t = v*a + d*(255 - a) + 128;
+  return uint8_t((t + (t >> 8)) >> 8);
+}
+
+// Buffer left in moved-from volumes. It is shared by all of them, so a
+// write through one clones it first like any shared buffer.
+const std::shared_ptr<VoxelBuffer>& EmptyBuffer() {
+  static const std::shared_ptr<VoxelBuffer> empty =
+      std::make_shared<VoxelBuffer>();
+  return empty;
+}
+
+// Buffer of zsize slices placed following the voxel memory options, a
+// copy of src when given, zeroed otherwise.
+std::shared_ptr<VoxelBuffer> NewBuffer(size_t slice, size_t zsize,
+                                       const uint8_t* src = nullptr) {
+  auto buffer = std::make_shared<VoxelBuffer>(slice*zsize);
+  uint8_t* dst = buffer->data();
+
+  if (buffer->empty()) {
+    return buffer;
+  } else if (!src) {
+    PlaceVoxels(dst, slice, zsize);
+  } else if (GetVoxelMemoryOptions().placement == VoxelPlacement::kSlabs) {
+    ParallelForSlabs(0, zsize, zsize, [&](size_t z0, size_t z1) {
+      std::memcpy(dst + z0*slice, src + z0*slice, (z1 - z0)*slice);
+    });
+  } else {
+    std::memcpy(dst, src, slice*zsize);
+  }
+
+  return buffer;
+}
+
+}
+
+ImgColor::ImgColor(size_t xsize, size_t ysize, ColorLayout layout)
+  : xsize_(0)
+  , ysize_(0)
+  , stride_(0)
+  , layout_(layout) {
+  Resize(xsize, ysize);
+  std::fill(buf_.begin(), buf_.end(), 0);
 }
 
 ImgColor::~ImgColor() {}
 
 ImgColor::ImgColor(ImgColor&& img) {
-  xsize_ = img.xsize_;
-  ysize_ = img.ysize_;
   Move(std::move(img));
-  img.xsize_ = 0;
-  img.ysize_ = 0;
 }
 
 ImgColor::ImgColor(const ImgColor& img) {
-  xsize_ = img.xsize_;
-  ysize_ = img.ysize_;
   Copy(img);
 }
 
@@ -36,26 +85,206 @@ ImgColor& ImgColor::operator=(const ImgColor& img) {
 }
 
 void ImgColor::Copy(const ImgColor& img) {
-  img_ = img.img_;
+  buf_ = img.buf_;
+  xsize_ = img.xsize_;
+  ysize_ = img.ysize_;
+  stride_ = img.stride_;
+  layout_ = img.layout_;
 }
 
 void ImgColor::Move(ImgColor&& img) {
-  img_ = std::move(img.img_);
+  buf_ = std::move(img.buf_);
+  xsize_ = img.xsize_;
+  ysize_ = img.ysize_;
+  stride_ = img.stride_;
+  layout_ = img.layout_;
+  img.xsize_ = 0;
+  img.ysize_ = 0;
+  img.stride_ = 0;
 }
 
 void ImgColor::operator()(std::array<uint8_t, 3> v, size_t x, size_t y) {
-  img_[y*xsize_ + x] = v;
+  if (layout_ == ColorLayout::kPlanar) {
+    Row(y, 0)[x] = v[0];
+    Row(y, 1)[x] = v[1];
+    Row(y, 2)[x] = v[2];
+    return;
+  }
+
+  uint8_t* p = Row(y) + x*PixelBytes();
+  p[0] = v[0];
+  p[1] = v[1];
+  p[2] = v[2];
 }
 
 std::array<uint8_t, 3> ImgColor::operator()(size_t x, size_t y) const {
-  return img_[y*xsize_ + x];
+  if (layout_ == ColorLayout::kPlanar) {
+    return {{Row(y, 0)[x], Row(y, 1)[x], Row(y, 2)[x]}};
+  }
+
+  const uint8_t* p = Row(y) + x*PixelBytes();
+  return {{p[0], p[1], p[2]}};
 }
 
 void ImgColor::operator()(std::array<uint8_t, 3> v, size_t i) {
-  img_[i] = v;
+  this->operator()(v, i%xsize_, i/xsize_);
+}
+
+void ImgColor::Resize(size_t xsize, size_t ysize) {
+  size_t planes = layout_ == ColorLayout::kPlanar ? 3 : 1;
+  xsize_ = xsize;
+  ysize_ = ysize;
+  stride_ = (xsize*PixelBytes() + 63)/64*64;
+  buf_.resize(stride_*ysize*planes);
+}
+
+void ImgColor::Resize(size_t xsize, size_t ysize, ColorLayout layout) {
+  layout_ = layout;
+  Resize(xsize, ysize);
+}
+
+size_t ImgColor::SizeX() const noexcept {
+  return xsize_;
+}
+
+size_t ImgColor::SizeY() const noexcept {
+  return ysize_;
+}
+
+ColorLayout ImgColor::Layout() const noexcept {
+  return layout_;
+}
+
+size_t ImgColor::PixelBytes() const noexcept {
+  switch (layout_) {
+    case ColorLayout::kBgr:
+      return 3;
+
+    case ColorLayout::kBgrx:
+      return 4;
+
+    default:
+      return 1;
+  }
+}
+
+size_t ImgColor::Stride() const noexcept {
+  return stride_;
+}
+
+const uint8_t* ImgColor::Data() const noexcept {
+  return buf_.data();
+}
+
+uint8_t* ImgColor::Data() noexcept {
+  return buf_.data();
+}
+
+void ImgColor::Fill(std::array<uint8_t, 3> v) {
+  if (buf_.empty()) {
+    return;
+  }
+
+  if (layout_ == ColorLayout::kPlanar) {
+    for (size_t c = 0; c < 3; c++) {
+      std::memset(Row(0, c), v[c], stride_*ysize_);
+    }
+
+    return;
+  }
+
+  // The first row is filled pixel by pixel and copied to the others.
+  size_t bytes = PixelBytes();
+
+  for (size_t y = 0; y < ysize_; y++) {
+    uint8_t* row = Row(y);
+
+    if (y > 0) {
+      std::memcpy(row, Row(0), xsize_*bytes);
+      continue;
+    }
+
+    for (size_t x = 0; x < xsize_; x++) {
+      row[x*bytes] = v[0];
+      row[x*bytes + 1] = v[1];
+      row[x*bytes + 2] = v[2];
+
+      if (bytes == 4) {
+        row[x*bytes + 3] = 0;
+      }
+    }
+  }
+}
+
+void ImgColor::WriteRow(size_t y, size_t x0, size_t n, const uint8_t* b,
+                        const uint8_t* g, const uint8_t* r) {
+  switch (layout_) {
+    case ColorLayout::kBgr: {
+      uint8_t* p = Row(y) + 3*x0;
+
+      for (size_t i = 0; i < n; i++) {
+        p[3*i] = b[i];
+        p[3*i + 1] = g[i];
+        p[3*i + 2] = r[i];
+      }
+
+      break;
+    }
+
+    case ColorLayout::kBgrx: {
+      uint8_t* p = Row(y) + 4*x0;
+
+      for (size_t i = 0; i < n; i++) {
+        p[4*i] = b[i];
+        p[4*i + 1] = g[i];
+        p[4*i + 2] = r[i];
+        p[4*i + 3] = 0;
+      }
+
+      break;
+    }
+
+    case ColorLayout::kPlanar:
+      std::memcpy(Row(y, 0) + x0, b, n);
+      std::memcpy(Row(y, 1) + x0, g, n);
+      std::memcpy(Row(y, 2) + x0, r, n);
+      break;
+  }
+}
+
+void ImgColor::BlendRow(size_t y, size_t x0, size_t n, const uint8_t* b,
+                        const uint8_t* g, const uint8_t* r,
+                        const uint8_t* alpha) {
+  if (layout_ == ColorLayout::kPlanar) {
+    const uint8_t* src[3] = {b, g, r};
+
+    for (size_t c = 0; c < 3; c++) {
+      uint8_t* p = Row(y, c) + x0;
+
+      for (size_t i = 0; i < n; i++) {
+        p[i] = Blend(src[c][i], p[i], alpha[i]);
+      }
+    }
+
+    return;
+  }
+
+  size_t bytes = PixelBytes();
+  uint8_t* p = Row(y) + bytes*x0;
+
+  for (size_t i = 0; i < n; i++) {
+    p[bytes*i] = Blend(b[i], p[bytes*i], alpha[i]);
+    p[bytes*i + 1] = Blend(g[i], p[bytes*i + 1], alpha[i]);
+    p[bytes*i + 2] = Blend(r[i], p[bytes*i + 2], alpha[i]);
+  }
 }
 
 void ImgColor::WriteImg(const std::string& file_name) {
+  if (IsPng(file_name)) {
+    WritePng(*this, file_name);
+    return;
+  }
+
   cv::Mat mat(ysize_, xsize_, CV_8UC3, cv::Scalar(0, 0, 0));
 
   for(size_t y=0;y<ysize_;y++) {
@@ -74,23 +303,18 @@ void ImgColor::WriteImg(const std::string& file_name) {
   cv::imwrite(file_name, mat);
 }
 
-size_t ImgColor::SizeX() const noexcept {
-  return xsize_;
-}
-
-size_t ImgColor::SizeY() const noexcept {
-  return ysize_;
-}
-
 ////////////////////////////////////////////////////////////
 
 ImgGray::ImgGray(size_t xsize, size_t ysize) {
-  img_.reserve(xsize*ysize);
-
+  xsize_ = xsize;
+  ysize_ = ysize;
+  img_.resize(xsize*ysize);
 }
 
 ImgGray::ImgGray(const uint8_t* data, size_t xsize, size_t ysize) {
-  img_.reserve(xsize*ysize);
+  xsize_ = xsize;
+  ysize_ = ysize;
+  img_.resize(xsize*ysize);
 
   for (int i = 0; i < ysize; i++) {
     for (int j = 0; j < xsize; j++) {
@@ -127,6 +351,8 @@ void ImgGray::Copy(const ImgGray& img) {
 
 void ImgGray::Move(ImgGray&& img) {
   img_ = std::move(img.img_);
+  xsize_ = img.xsize_;
+  ysize_ = img.ysize_;
   img.xsize_ = 0;
   img.ysize_ = 0;
 }
@@ -140,7 +366,18 @@ uint8_t ImgGray::operator()(size_t x, size_t y) const {
   return img_[y*xsize_ + x];
 }
 
+void ImgGray::Resize(size_t xsize, size_t ysize) {
+  xsize_ = xsize;
+  ysize_ = ysize;
+  img_.resize(xsize*ysize);
+}
+
 void ImgGray::WriteImg(const std::string& file_name) {
+  if (IsPng(file_name)) {
+    WritePng(*this, file_name);
+    return;
+  }
+
   cv::Mat mat(ysize_, xsize_, CV_8UC1, cv::Scalar(0, 0, 0));
 
   for(size_t y=0;y<ysize_;y++) {
@@ -161,71 +398,178 @@ size_t ImgGray::SizeY() const noexcept {
   return ysize_;
 }
 
+const uint8_t* ImgGray::Data() const noexcept {
+  return img_.data();
+}
+
+uint8_t* ImgGray::Data() noexcept {
+  return img_.data();
+}
+
 /////////////////////////////////////////////////////////////////////////
 
 ImgVol::ImgVol(size_t xsize, size_t ysize, size_t zsize) {
-  img_.reserve(xsize*ysize*zsize);
+  img_ = NewBuffer(xsize*ysize, zsize);
   xsize_ = xsize;
   ysize_ = ysize;
   zsize_ = zsize;
+  dx_ = dy_ = dz_ = 1;
+  origin_ = {{0, 0, 0}};
 }
 
 ImgVol::ImgVol(std::string file_name) {
   std::ifstream in_file;
-  size_t size = 0; // here
+  in_file.open(file_name, std::ios::in | std::ios::binary);
 
-	in_file.open(file_name, std::ios::in|std::ios::binary|std::ios::ate );
-	char* oData = 0;
+  if (!in_file) {
+    throw std::runtime_error("can't open file: " + file_name);
+  }
+
+  std::string magic;
+  int nbits;
+  in_file >> magic >> xsize_ >> ysize_ >> zsize_ >> dx_ >> dy_ >> dz_ >> nbits;
+  origin_ = {{0, 0, 0}};
+  in_file.get();
+
+  if (!in_file || magic != "SCN") {
+    throw std::runtime_error("not a scn file: " + file_name);
+  }
 
-	in_file.seekg(0, std::ios::end); // set the pointer to the end
-	size = in_file.tellg() ; // get the length of the file
-	in_file.seekg(0, std::ios::beg); // set the pointer to the beginning
-  img_.reserve(size);
+  size_t n = xsize_*ysize_*zsize_;
+  img_ = NewBuffer(xsize_*ysize_, zsize_);
+  VoxelBuffer& voxels = *img_;
+
+  if (nbits == 8) {
+    in_file.read(reinterpret_cast<char*>(voxels.data()), n);
+  } else if (nbits == 16) {
+    // Voxels are stored in 8 bits, wider intensities are rescaled to
+    // [0, 255] when they don't fit.
+    std::vector<uint8_t> bytes(2*n);
+    in_file.read(reinterpret_cast<char*>(bytes.data()), bytes.size());
+
+    std::vector<uint16_t> raw(n);
+    uint16_t max = 0;
+
+    for (size_t i = 0; i < n; i++) {
+      raw[i] = uint16_t(bytes[2*i] | (bytes[2*i + 1] << 8));
+      max = std::max(max, raw[i]);
+    }
+
+    for (size_t i = 0; i < n; i++) {
+      voxels[i] = max > 255 ? uint8_t(255*uint32_t(raw[i])/max) : raw[i];
+    }
+  } else {
+    throw std::runtime_error("unsupported scn depth: " + file_name);
+  }
+
+  if (!in_file) {
+    throw std::runtime_error("truncated scn file: " + file_name);
+  }
 
-	oData = new char[size];
-	in_file.read(reinterpret_cast<char*>(img_.data()), size);
   in_file.close();
 }
 
 ImgVol::ImgVol(const ImgVol& img) {
-  for (size_t x = 0; x < SizeX(); x++) {
-    for (size_t y = 0; y < SizeY(); y++) {
-      for (size_t z = 0; z < SizeZ(); z++) {
-        SetVoxelIntensity(img.VoxelIntensity(x, y, z), x, y, z);
-      }
-    }
-  }
+  Copy(img);
+}
+
+ImgVol::ImgVol(ImgVol&& img) noexcept {
+  Move(std::move(img));
 }
 
 ImgVol& ImgVol::operator=(const ImgVol& img) {
-  for (size_t x = 0; x < SizeX(); x++) {
-    for (size_t y = 0; y < SizeY(); y++) {
-      for (size_t z = 0; z < SizeZ(); z++) {
-        SetVoxelIntensity(img.VoxelIntensity(x, y, z), x, y, z);
-      }
-    }
+  Copy(img);
+  return *this;
+}
+
+ImgVol& ImgVol::operator=(ImgVol&& img) noexcept {
+  if (this != &img) {
+    Move(std::move(img));
   }
 
   return *this;
 }
 
+void ImgVol::Copy(const ImgVol& img) {
+  img_ = img.img_;
+  xsize_ = img.xsize_;
+  ysize_ = img.ysize_;
+  zsize_ = img.zsize_;
+  dx_ = img.dx_;
+  dy_ = img.dy_;
+  dz_ = img.dz_;
+  origin_ = img.origin_;
+}
+
+void ImgVol::Move(ImgVol&& img) noexcept {
+  img_ = std::move(img.img_);
+  xsize_ = img.xsize_;
+  ysize_ = img.ysize_;
+  zsize_ = img.zsize_;
+  dx_ = img.dx_;
+  dy_ = img.dy_;
+  dz_ = img.dz_;
+  origin_ = img.origin_;
+  img.img_ = EmptyBuffer();
+  img.xsize_ = 0;
+  img.ysize_ = 0;
+  img.zsize_ = 0;
+}
+
+void ImgVol::Detach() {
+  if (img_.use_count() != 1) {
+    img_ = NewBuffer(xsize_*ysize_, zsize_, img_->data());
+  }
+}
+
+bool ImgVol::Unique() const noexcept {
+  return img_.use_count() == 1;
+}
+
 ImgVol::~ImgVol() {}
 
 void ImgVol::WriteImg(std::string file_name) {
   std::ofstream fout;
   fout.open(file_name, std::ios::binary | std::ios::out);
 
-  fout.write((char*) img_.data(), img_.size());
+  if (!fout) {
+    throw std::runtime_error("can't open file: " + file_name);
+  }
+
+  // Voxel sizes are written with enough digits to read back exactly.
+  fout.precision(std::numeric_limits<float>::max_digits10);
+  fout << "SCN\n" << xsize_ << " " << ysize_ << " " << zsize_ << "\n"
+       << dx_ << " " << dy_ << " " << dz_ << "\n" << 8 << "\n";
+  fout.write((char*) img_->data(), img_->size());
 
   fout.close();
+
+  if (!fout) {
+    throw std::runtime_error("can't write file: " + file_name);
+  }
 }
 
 int ImgVol::VoxelIntensity(size_t x, size_t y, size_t z) const {
-  return img_[z*xsize_*ysize_ + y*xsize_ + x];
+  return (*img_)[z*xsize_*ysize_ + y*xsize_ + x];
 }
 
 void ImgVol::SetVoxelIntensity(float b, size_t x, size_t y, size_t z) {
-  img_[z*xsize_*ysize_ + y*xsize_ + x] = uint8_t(b);
+  Detach();
+  (*img_)[z*xsize_*ysize_ + y*xsize_ + x] = uint8_t(b);
+}
+
+void ImgVol::Resize(size_t xsize, size_t ysize, size_t zsize) {
+  xsize_ = xsize;
+  ysize_ = ysize;
+  zsize_ = zsize;
+
+  // The values are unspecified after a resize, a shared buffer is
+  // replaced instead of cloned.
+  if (img_.use_count() != 1) {
+    img_ = NewBuffer(xsize*ysize, zsize);
+  } else {
+    img_->resize(xsize*ysize*zsize);
+  }
 }
 
 int ImgVol::operator()(size_t x, size_t y, size_t z) const{
@@ -244,10 +588,49 @@ size_t ImgVol::SizeZ() const noexcept {
   return zsize_;
 }
 
+float ImgVol::DimX() const noexcept {
+  return dx_;
+}
+
+float ImgVol::DimY() const noexcept {
+  return dy_;
+}
+
+float ImgVol::DimZ() const noexcept {
+  return dz_;
+}
+
+void ImgVol::SetVoxelSize(float dx, float dy, float dz) noexcept {
+  dx_ = dx;
+  dy_ = dy;
+  dz_ = dz;
+}
+
+std::array<size_t, 3> ImgVol::Origin() const noexcept {
+  return origin_;
+}
+
+void ImgVol::SetOrigin(std::array<size_t, 3> origin) noexcept {
+  origin_ = origin;
+}
+
+size_t ImgVol::NumVoxels() const noexcept {
+  return img_->size();
+}
+
+const uint8_t* ImgVol::Data() const noexcept {
+  return img_->data();
+}
+
+uint8_t* ImgVol::Data() {
+  Detach();
+  return img_->data();
+}
+
 uint8_t ImgVol::Imax() {
   uint8_t max = 0;
 
-  for (auto& e : img_) {
+  for (auto& e : *img_) {
     if (e > max) max = e;
   }
 
@@ -0,0 +1,186 @@
+#include "instrument.h"
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <vector>
+
+namespace imgvol {
+namespace instrument {
+
+namespace {
+
+const char* kCounterNames[kNumCounters] = {
+  "cut_pixels",
+  "windowed_pixels",
+  "color_label_pixels",
+  "planar_samples",
+  "reformat_slices",
+  "rays_cast",
+  "ray_samples",
+  "normalized_voxels",
+  "wireframe_lines"
+};
+
+const char* kTimerNames[kNumTimers] = {
+  "Cut",
+  "Normalize",
+  "Negative",
+  "BrightinessContrast",
+  "ColorLabels",
+  "CortePlanar",
+  "ReformataImg",
+  "MaxIntensionProjection",
+  "NormalizeImage",
+  "DrawWireframe",
+  "VolumeRender",
+  "Mpr",
+  "SlabMip",
+  "LabelMip",
+  "Clahe"
+};
+
+// Slots of the live threads plus the totals of the threads that exited.
+// The mutex is only taken when a thread starts or ends and by snapshots.
+class Registry {
+ public:
+  static Registry& Get() {
+    // Never destroyed, threads may still exit after static destructors.
+    static Registry* registry = new Registry;
+    return *registry;
+  }
+
+  void Register(ThreadSlot* slot) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    slots_.push_back(slot);
+  }
+
+  void Unregister(ThreadSlot* slot) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    Accumulate(*slot, &retired_);
+
+    for (auto it = slots_.begin(); it != slots_.end(); ++it) {
+      if (*it == slot) {
+        slots_.erase(it);
+        break;
+      }
+    }
+  }
+
+  Snapshot Total() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    Snapshot snap = retired_;
+
+    for (ThreadSlot* slot : slots_) {
+      Accumulate(*slot, &snap);
+    }
+
+    return snap;
+  }
+
+ private:
+  Registry() {
+    for (auto& c : retired_.counters) {
+      c = 0;
+    }
+
+    for (auto& t : retired_.timers) {
+      t = TimerStats{0, 0};
+    }
+  }
+
+  static void Accumulate(const ThreadSlot& slot, Snapshot* snap) {
+    for (size_t i = 0; i < kNumCounters; i++) {
+      snap->counters[i] += slot.counters[i].load(std::memory_order_relaxed);
+    }
+
+    for (size_t i = 0; i < kNumTimers; i++) {
+      snap->timers[i].calls += slot.calls[i].load(std::memory_order_relaxed);
+      snap->timers[i].nanoseconds +=
+          slot.nanoseconds[i].load(std::memory_order_relaxed);
+    }
+  }
+
+  std::mutex mutex_;
+  std::vector<ThreadSlot*> slots_;
+  Snapshot retired_;
+};
+
+struct SlotOwner {
+  SlotOwner() {
+    for (auto& c : slot.counters) {
+      c.store(0, std::memory_order_relaxed);
+    }
+
+    for (size_t i = 0; i < kNumTimers; i++) {
+      slot.calls[i].store(0, std::memory_order_relaxed);
+      slot.nanoseconds[i].store(0, std::memory_order_relaxed);
+    }
+
+    Registry::Get().Register(&slot);
+  }
+
+  ~SlotOwner() {
+    Registry::Get().Unregister(&slot);
+  }
+
+  ThreadSlot slot;
+};
+
+}
+
+ThreadSlot& LocalSlot() {
+  thread_local SlotOwner owner;
+  return owner.slot;
+}
+
+Snapshot TakeSnapshot() {
+  return Registry::Get().Total();
+}
+
+Snapshot Snapshot::operator-(const Snapshot& earlier) const {
+  Snapshot diff;
+
+  for (size_t i = 0; i < kNumCounters; i++) {
+    diff.counters[i] = counters[i] - earlier.counters[i];
+  }
+
+  for (size_t i = 0; i < kNumTimers; i++) {
+    diff.timers[i].calls = timers[i].calls - earlier.timers[i].calls;
+    diff.timers[i].nanoseconds =
+        timers[i].nanoseconds - earlier.timers[i].nanoseconds;
+  }
+
+  return diff;
+}
+
+std::string Snapshot::ToJson() const {
+  std::ostringstream out;
+  out << "{\"counters\": {";
+
+  for (size_t i = 0; i < kNumCounters; i++) {
+    out << (i > 0 ? ", " : "") << "\"" << kCounterNames[i] << "\": "
+        << counters[i];
+  }
+
+  out << "}, \"timers\": {";
+
+  for (size_t i = 0; i < kNumTimers; i++) {
+    out << (i > 0 ? ", " : "") << "\"" << kTimerNames[i] << "\": {"
+        << "\"calls\": " << timers[i].calls
+        << ", \"seconds\": " << timers[i].nanoseconds*1e-9 << "}";
+  }
+
+  out << "}}";
+  return out.str();
+}
+
+const char* Name(Counter c) {
+  return kCounterNames[size_t(c)];
+}
+
+const char* Name(Timer t) {
+  return kTimerNames[size_t(t)];
+}
+
+}
+}
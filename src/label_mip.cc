@@ -0,0 +1,91 @@
+#include "label_mip.h"
+#include <stdexcept>
+#include "instrument.h"
+#include "operations.h"
+#include "parallel.h"
+#include "ray_camera.h"
+#include "voxel_traversal.h"
+
+namespace imgvol {
+
+LabelMip LabelMaxIntensionProjection(ImgVol& img, const ImgVol& labels,
+                                     float delta_x, float delta_y,
+                                     std::array<float, 3> vet_normal,
+                                     size_t nthreads) {
+  LabelMip res;
+  LabelMaxIntensionProjection(img, labels, delta_x, delta_y, vet_normal,
+                              &res, nthreads);
+  return res;
+}
+
+void LabelMaxIntensionProjection(ImgVol& img, const ImgVol& labels,
+                                 float delta_x, float delta_y,
+                                 std::array<float, 3> vet_normal,
+                                 LabelMip* out, size_t nthreads) {
+  VIMAGE_SCOPED_TIMER(kLabelMip);
+
+  if (img.SizeX() != labels.SizeX() || img.SizeY() != labels.SizeY() ||
+      img.SizeZ() != labels.SizeZ()) {
+    throw std::invalid_argument("label volume size differs from the image");
+  }
+
+  NormalizeImage(img);
+
+  RayCamera camera(img, delta_x, delta_y, vet_normal);
+  size_t width = camera.Width();
+  size_t height = camera.Height();
+  out->intensity.Resize(width, height);
+  out->labels.Resize(width, height);
+  out->depth.Resize(width, height);
+
+  const uint8_t* data = img.Data();
+  const uint8_t* lb = labels.Data();
+  int* intensity = out->intensity.Data();
+  int* label = out->labels.Data();
+  int* depth = out->depth.Data();
+
+  ParallelFor(0, height, [&](size_t y0, size_t y1) {
+    std::array<float, 3> p1;
+    std::array<float, 3> pn;
+    size_t rays = 0;
+    size_t samples = 0;
+
+    for (size_t y = y0; y < y1; y++) {
+      for (size_t x = 0; x < width; x++) {
+        size_t i = y*width + x;
+
+        if (!camera.Clip(x, y, &p1, &pn)) {
+          intensity[i] = 0;
+          label[i] = 0;
+          depth[i] = -1;
+          continue;
+        }
+
+        VoxelTraversal t(img, p1, pn);
+        int max_i = -1;
+        size_t best = 0;
+        size_t k = 0;
+        samples += t.Remaining();
+
+        for (; !t.Done(); t.Next(), k++) {
+          if (data[t.Offset()] > max_i) {
+            max_i = data[t.Offset()];
+            best = t.Offset();
+            depth[i] = k;
+          }
+        }
+
+        intensity[i] = max_i;
+        label[i] = lb[best];
+        rays++;
+      }
+    }
+
+    VIMAGE_COUNT(kRaysCast, rays);
+    VIMAGE_COUNT(kRaySamples, samples);
+  }, nthreads);
+
+  ColorLabels(out->intensity, out->labels, 8, &out->overlay);
+}
+
+}
@@ -0,0 +1,278 @@
+#include "labeling.h"
+#include <algorithm>
+#include <array>
+#include <cstdlib>
+#include <numeric>
+#include "parallel.h"
+
+namespace imgvol {
+
+namespace {
+
+struct Offset {
+  long dx, dy, dz;
+};
+
+// Neighbours that come before a voxel in raster order (x fastest).
+std::vector<Offset> BackwardNeighbours(Connectivity conn) {
+  std::vector<Offset> offsets;
+
+  for (long dz = -1; dz <= 0; dz++) {
+    for (long dy = -1; dy <= 1; dy++) {
+      for (long dx = -1; dx <= 1; dx++) {
+        if (dz == 0 && (dy > 0 || (dy == 0 && dx >= 0))) {
+          continue;
+        }
+
+        int dist = std::abs(dx) + std::abs(dy) + std::abs(dz);
+
+        if ((conn == Connectivity::k6 && dist > 1) ||
+            (conn == Connectivity::k18 && dist > 2)) {
+          continue;
+        }
+
+        offsets.push_back(Offset{dx, dy, dz});
+      }
+    }
+  }
+
+  return offsets;
+}
+
+uint32_t Find(std::vector<uint32_t>& parent, uint32_t l) {
+  while (parent[l] != l) {
+    parent[l] = parent[parent[l]];
+    l = parent[l];
+  }
+
+  return l;
+}
+
+// The smaller label becomes the root, so roots are the first label seen
+// in raster order.
+void Union(std::vector<uint32_t>& parent, uint32_t a, uint32_t b) {
+  a = Find(parent, a);
+  b = Find(parent, b);
+
+  if (a < b) {
+    parent[b] = a;
+  } else if (b < a) {
+    parent[a] = b;
+  }
+}
+
+}
+
+Components LabelComponents(const ImgVol& img, int threshold,
+                           Connectivity conn, size_t nthreads) {
+  size_t nx = img.SizeX();
+  size_t ny = img.SizeY();
+  size_t nz = img.SizeZ();
+  size_t slice = nx*ny;
+  const uint8_t* in = img.Data();
+
+  Components res{std::vector<uint32_t>(img.NumVoxels()),
+                 std::vector<size_t>(1, 0), ImgVol(nx, ny, nz)};
+
+  res.label_img.SetOrigin(img.Origin());
+
+  if (img.NumVoxels() == 0) {
+    return res;
+  }
+
+  std::vector<Offset> neighbours = BackwardNeighbours(conn);
+  uint32_t* labels = res.labels.data();
+
+  nthreads = std::min(NumThreads(nthreads), nz);
+  std::vector<size_t> slab_begin(nthreads + 1);
+
+  for (size_t t = 0; t <= nthreads; t++) {
+    slab_begin[t] = t*nz/nthreads;
+  }
+
+  // First pass, each slab labels its voxels with local labels 1..n
+  // ignoring the slices of the slabs before it.
+  std::vector<std::vector<uint32_t>> local_parents(nthreads);
+
+  ParallelFor(0, nthreads, [&](size_t t0, size_t t1) {
+    for (size_t t = t0; t < t1; t++) {
+      std::vector<uint32_t>& parent = local_parents[t];
+      parent.push_back(0);
+      size_t zb = slab_begin[t];
+
+      for (size_t z = zb; z < slab_begin[t + 1]; z++) {
+        for (size_t y = 0; y < ny; y++) {
+          for (size_t x = 0; x < nx; x++) {
+            size_t i = z*slice + y*nx + x;
+
+            if (in[i] <= threshold) {
+              labels[i] = 0;
+              continue;
+            }
+
+            uint32_t label = 0;
+
+            for (const Offset& o : neighbours) {
+              long qx = long(x) + o.dx;
+              long qy = long(y) + o.dy;
+              long qz = long(z) + o.dz;
+
+              if (qx < 0 || qx >= long(nx) || qy < 0 || qy >= long(ny) ||
+                  qz < long(zb)) {
+                continue;
+              }
+
+              uint32_t l = labels[qz*slice + qy*nx + qx];
+
+              if (l == 0) {
+                continue;
+              }
+
+              if (label == 0) {
+                label = l;
+              } else if (l != label) {
+                Union(parent, label, l);
+              }
+            }
+
+            if (label == 0) {
+              label = parent.size();
+              parent.push_back(label);
+            }
+
+            labels[i] = label;
+          }
+        }
+      }
+    }
+  }, nthreads);
+
+  // Global label space, slab t owns [offset[t] + 1, offset[t + 1]].
+  std::vector<uint32_t> offset(nthreads + 1, 0);
+
+  for (size_t t = 0; t < nthreads; t++) {
+    offset[t + 1] = offset[t] + local_parents[t].size() - 1;
+  }
+
+  std::vector<uint32_t> parent(offset[nthreads] + 1);
+  parent[0] = 0;
+
+  for (size_t t = 0; t < nthreads; t++) {
+    for (size_t l = 1; l < local_parents[t].size(); l++) {
+      parent[offset[t] + l] = offset[t] + Find(local_parents[t], l);
+    }
+
+    std::vector<uint32_t>().swap(local_parents[t]);
+  }
+
+  // Merge pass, join the first slice of each slab with the last slice of
+  // the slab before it.
+  for (size_t t = 1; t < nthreads; t++) {
+    size_t z = slab_begin[t];
+
+    for (size_t y = 0; y < ny; y++) {
+      for (size_t x = 0; x < nx; x++) {
+        uint32_t l = labels[z*slice + y*nx + x];
+
+        if (l == 0) {
+          continue;
+        }
+
+        for (const Offset& o : neighbours) {
+          long qx = long(x) + o.dx;
+          long qy = long(y) + o.dy;
+
+          if (o.dz != -1 || qx < 0 || qx >= long(nx) || qy < 0 ||
+              qy >= long(ny)) {
+            continue;
+          }
+
+          uint32_t q = labels[(z - 1)*slice + qy*nx + qx];
+
+          if (q != 0) {
+            Union(parent, offset[t] + l, offset[t - 1] + q);
+          }
+        }
+      }
+    }
+  }
+
+  // Count the voxels of every provisional label, then add the counts to
+  // the roots. Slab t only meets the labels it owns, so the slabs share
+  // one array without conflicts. Parents are smaller than their labels,
+  // so walking the labels upwards leaves each one pointing at its root.
+  for (uint32_t l = 1; l < parent.size(); l++) {
+    Find(parent, l);
+  }
+
+  std::vector<size_t> total(parent.size(), 0);
+  std::vector<size_t> background(nthreads, 0);
+
+  ParallelFor(0, nthreads, [&](size_t t0, size_t t1) {
+    for (size_t t = t0; t < t1; t++) {
+      size_t* count = total.data() + offset[t];
+      size_t empty = 0;
+
+      for (size_t i = slab_begin[t]*slice; i < slab_begin[t + 1]*slice; i++) {
+        if (labels[i] == 0) {
+          empty++;
+        } else {
+          count[labels[i]]++;
+        }
+      }
+
+      background[t] = empty;
+    }
+  }, nthreads);
+
+  total[0] = std::accumulate(background.begin(), background.end(),
+                             size_t(0));
+
+  for (uint32_t l = 1; l < parent.size(); l++) {
+    if (parent[l] != l) {
+      total[parent[l]] += total[l];
+    }
+  }
+
+  // Number the roots by decreasing size, ties by first voxel.
+  std::vector<uint32_t> roots;
+
+  for (uint32_t l = 1; l < parent.size(); l++) {
+    if (parent[l] == l) {
+      roots.push_back(l);
+    }
+  }
+
+  std::stable_sort(roots.begin(), roots.end(), [&](uint32_t a, uint32_t b) {
+    return total[a] > total[b];
+  });
+
+  std::vector<uint32_t> final_label(parent.size(), 0);
+  res.sizes.resize(roots.size() + 1);
+  res.sizes[0] = total[0];
+
+  for (size_t k = 0; k < roots.size(); k++) {
+    final_label[roots[k]] = k + 1;
+    res.sizes[k + 1] = total[roots[k]];
+  }
+
+  for (uint32_t l = 1; l < parent.size(); l++) {
+    final_label[l] = final_label[parent[l]];
+  }
+
+  uint8_t* out = res.label_img.Data();
+
+  ParallelFor(0, nthreads, [&](size_t t0, size_t t1) {
+    for (size_t t = t0; t < t1; t++) {
+      for (size_t i = slab_begin[t]*slice; i < slab_begin[t + 1]*slice; i++) {
+        uint32_t l = labels[i] == 0 ? 0 : final_label[offset[t] + labels[i]];
+        labels[i] = l;
+        out[i] = l <= 255 ? l : 0;
+      }
+    }
+  }, nthreads);
+
+  return res;
+}
+
+}
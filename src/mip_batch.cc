@@ -0,0 +1,433 @@
+#include "mip_batch.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <exception>
+#include <fstream>
+#include <functional>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include "bounded_queue.h"
+#include "instrument.h"
+#include "operations.h"
+#include "parallel.h"
+#include "ray_camera.h"
+#include "voxel_traversal.h"
+
+namespace imgvol {
+
+namespace {
+
+struct Ray {
+  VoxelTraversal traversal;
+
+  // Current voxel and the direction of the steps along each axis.
+  std::array<int32_t, 3> voxel;
+  std::array<int32_t, 3> dir;
+
+  uint8_t max;
+  uint32_t view;
+  uint32_t pixel;
+};
+
+// Bricks of brick_size^3 voxels over the volume.
+struct BrickGrid {
+  BrickGrid(const ImgVol& img, size_t brick_size)
+    : size(int32_t(std::max<size_t>(1, brick_size)))
+    , count{{int32_t((img.SizeX() + size - 1)/size),
+             int32_t((img.SizeY() + size - 1)/size),
+             int32_t((img.SizeZ() + size - 1)/size)}} {}
+
+  size_t NumBricks() const {
+    return size_t(count[0])*count[1]*count[2];
+  }
+
+  size_t Brick(const std::array<int32_t, 3>& voxel) const {
+    return (size_t(voxel[2]/size)*count[1] + voxel[1]/size)*count[0] +
+        voxel[0]/size;
+  }
+
+  int32_t size;
+  std::array<int32_t, 3> count;
+};
+
+// One batch of rays: the rows [row_begin, row_end) of views
+// [view_begin, view_end).
+struct Batch {
+  size_t view_begin;
+  size_t view_end;
+  size_t row_begin;
+  size_t row_end;
+};
+
+// Rays, bricks queues and work list of one thread, reused across batches.
+struct BatchState {
+  std::vector<Ray> rays;
+  std::vector<std::vector<uint32_t>> queues;
+  std::vector<uint32_t> work;
+};
+
+// Walk the ray through the brick it is in, then queue it on the next one.
+// Returns false once the ray is done.
+bool WalkBrick(const uint8_t* data, const BrickGrid& grid, Ray* ray,
+               size_t* samples, size_t* next_brick) {
+  std::array<int32_t, 3> lo;
+  std::array<int32_t, 3> hi;
+
+  for (int a = 0; a < 3; a++) {
+    lo[a] = ray->voxel[a]/grid.size*grid.size;
+    hi[a] = lo[a] + grid.size;
+  }
+
+  VoxelTraversal& t = ray->traversal;
+  uint8_t max = ray->max;
+  size_t n = 0;
+
+  while (true) {
+    max = std::max(max, data[t.Offset()]);
+    n++;
+    int a = t.Next();
+
+    if (a < 0) {
+      ray->max = max;
+      *samples += n;
+      return false;
+    }
+
+    int32_t c = ray->voxel[a] += ray->dir[a];
+
+    if (c < lo[a] || c >= hi[a]) {
+      ray->max = max;
+      *samples += n;
+      *next_brick = grid.Brick(ray->voxel);
+      return true;
+    }
+  }
+}
+
+void TraceBatch(const ImgVol& img, const std::vector<RayCamera>& cameras,
+                const BrickGrid& grid, const Batch& batch,
+                std::vector<ImgGray>* frames, BatchState* state) {
+  const uint8_t* data = img.Data();
+  size_t width = cameras[0].Width();
+  std::vector<Ray>& rays = state->rays;
+  std::vector<std::vector<uint32_t>>& queues = state->queues;
+  rays.clear();
+  queues.resize(grid.NumBricks());
+
+  std::array<float, 3> p1;
+  std::array<float, 3> pn;
+
+  for (size_t v = batch.view_begin; v < batch.view_end; v++) {
+    uint8_t* out = (*frames)[v].Data();
+
+    for (size_t j = batch.row_begin; j < batch.row_end; j++) {
+      for (size_t i = 0; i < width; i++) {
+        if (!cameras[v].Clip(int(i), int(j), &p1, &pn)) {
+          out[j*width + i] = 0;
+          continue;
+        }
+
+        Ray ray = {VoxelTraversal(img, p1, pn), {}, {}, 0, uint32_t(v),
+                   uint32_t(j*width + i)};
+
+        for (int a = 0; a < 3; a++) {
+          int32_t b = int32_t(std::lround(p1[a]));
+          int32_t e = int32_t(std::lround(pn[a]));
+          ray.voxel[a] = b;
+          ray.dir[a] = e < b ? -1 : 1;
+        }
+
+        queues[grid.Brick(ray.voxel)].push_back(uint32_t(rays.size()));
+        rays.push_back(ray);
+      }
+    }
+  }
+
+  VIMAGE_COUNT(kRaysCast, rays.size());
+
+  // Sweep the bricks forward then backward until every ray is done. Rays
+  // moving along the sweep reach their next brick in the same sweep.
+  size_t nbricks = queues.size();
+  size_t pending = rays.size();
+  size_t samples = 0;
+  bool forward = true;
+
+  while (pending > 0) {
+    for (size_t k = 0; k < nbricks; k++) {
+      size_t b = forward ? k : nbricks - 1 - k;
+
+      if (queues[b].empty()) {
+        continue;
+      }
+
+      state->work.swap(queues[b]);
+
+      for (uint32_t r : state->work) {
+        Ray& ray = rays[r];
+        size_t next;
+
+        if (WalkBrick(data, grid, &ray, &samples, &next)) {
+          queues[next].push_back(r);
+        } else {
+          (*frames)[ray.view].Data()[ray.pixel] = ray.max;
+          pending--;
+        }
+      }
+
+      state->work.clear();
+    }
+
+    forward = !forward;
+  }
+
+  VIMAGE_COUNT(kRaySamples, samples);
+}
+
+// Trace all views, calling done(view, frame) from the worker threads as
+// soon as the last batch of a view finishes. Tracing stops early when
+// done returns false. img is expected to be normalized already.
+void TraceViews(const ImgVol& img, const std::vector<MipView>& views,
+                std::array<float, 3> vet_normal, const MipBatchOptions& opts,
+                const std::function<bool(size_t, ImgGray&&)>& done) {
+  size_t nviews = views.size();
+
+  if (nviews == 0) {
+    return;
+  }
+
+  std::vector<RayCamera> cameras;
+
+  for (const MipView& v : views) {
+    cameras.emplace_back(img, v.delta_x, v.delta_y, vet_normal);
+  }
+
+  size_t width = cameras[0].Width();
+  size_t height = cameras[0].Height();
+  std::vector<ImgGray> frames(nviews, ImgGray(0, 0));
+
+  if (img.NumVoxels() == 0 || width*height == 0) {
+    for (size_t v = 0; v < nviews; v++) {
+      frames[v].Resize(width, height);
+      std::fill(frames[v].Data(), frames[v].Data() + width*height, 0);
+
+      if (!done(v, std::move(frames[v]))) {
+        return;
+      }
+    }
+
+    return;
+  }
+
+  // At least 8 rows per view so the rays of a batch stay coherent, then
+  // as many views as fit.
+  size_t max_rays = std::max<size_t>(opts.max_rays, width);
+  size_t group = std::min(nviews, std::max<size_t>(1, max_rays/(width*8)));
+  size_t band = std::min(height,
+                         std::max<size_t>(1, max_rays/(width*group)));
+  size_t ngroups = (nviews + group - 1)/group;
+  size_t nbands = (height + band - 1)/band;
+  size_t nbatches = ngroups*nbands;
+
+  // Batches are taken group by group, so the frames of a group finish
+  // together while the next group starts.
+  std::vector<std::once_flag> allocated(ngroups);
+  std::vector<std::atomic<size_t>> bands_left(ngroups);
+
+  for (auto& b : bands_left) {
+    b = nbands;
+  }
+
+  BrickGrid grid(img, opts.brick_size);
+  std::atomic<size_t> next_batch(0);
+  std::atomic<bool> stop(false);
+  size_t nthreads = std::min(NumThreads(opts.nthreads), nbatches);
+
+  ParallelFor(0, nthreads, [&](size_t, size_t) {
+    BatchState state;
+
+    for (size_t t = next_batch++; t < nbatches && !stop; t = next_batch++) {
+      size_t g = t/nbands;
+      Batch batch;
+      batch.view_begin = g*group;
+      batch.view_end = std::min(nviews, batch.view_begin + group);
+      batch.row_begin = (t%nbands)*band;
+      batch.row_end = std::min(height, batch.row_begin + band);
+
+      std::call_once(allocated[g], [&]() {
+        for (size_t v = batch.view_begin; v < batch.view_end; v++) {
+          frames[v].Resize(width, height);
+        }
+      });
+
+      TraceBatch(img, cameras, grid, batch, &frames, &state);
+
+      if (--bands_left[g] == 0) {
+        for (size_t v = batch.view_begin; v < batch.view_end && !stop; v++) {
+          if (!done(v, std::move(frames[v]))) {
+            stop = true;
+          }
+        }
+      }
+    }
+  }, nthreads);
+}
+
+struct Frame {
+  size_t view;
+  ImgGray img;
+};
+
+struct EncodedFrame {
+  size_t view;
+  std::vector<uint8_t> png;
+};
+
+}
+
+std::vector<MipView> MipTurntable(size_t n, float delta_x) {
+  std::vector<MipView> views(n);
+
+  for (size_t k = 0; k < n; k++) {
+    views[k] = MipView{delta_x, float(2*M_PI*k/n)};
+  }
+
+  return views;
+}
+
+std::vector<ImgGray> MaxIntensionProjections(
+    ImgVol& img, const std::vector<MipView>& views,
+    std::array<float, 3> vet_normal, const MipBatchOptions& opts) {
+  std::vector<ImgGray> out;
+  MaxIntensionProjections(img, views, vet_normal, opts, &out);
+  return out;
+}
+
+void MaxIntensionProjections(ImgVol& img, const std::vector<MipView>& views,
+                             std::array<float, 3> vet_normal,
+                             const MipBatchOptions& opts,
+                             std::vector<ImgGray>* out) {
+  VIMAGE_SCOPED_TIMER(kMaxIntensionProjection);
+  NormalizeImage(img);
+
+  out->resize(views.size(), ImgGray(0, 0));
+  TraceViews(img, views, vet_normal, opts, [out](size_t v, ImgGray&& frame) {
+    (*out)[v] = std::move(frame);
+    return true;
+  });
+}
+
+MipExportStats ExportMipViews(ImgVol& img, const std::vector<MipView>& views,
+                              std::array<float, 3> vet_normal,
+                              const std::string& prefix,
+                              const MipBatchOptions& opts) {
+  VIMAGE_SCOPED_TIMER(kMaxIntensionProjection);
+  MipExportStats stats = {0, 0, 0};
+  auto start = std::chrono::steady_clock::now();
+
+  NormalizeImage(img);
+
+  BoundedQueue<Frame> frame_queue(opts.queue_depth);
+  BoundedQueue<EncodedFrame> png_queue(opts.queue_depth);
+
+  std::exception_ptr error;
+  std::mutex error_mutex;
+
+  // On failure every queue is closed, so blocked stages wake up and stop.
+  auto fail = [&]() {
+    {
+      std::lock_guard<std::mutex> lock(error_mutex);
+
+      if (!error) {
+        error = std::current_exception();
+      }
+    }
+
+    frame_queue.Close();
+    png_queue.Close();
+  };
+
+  // Workers block on a full frame queue when encoding falls behind, which
+  // bounds the frames held in memory.
+  std::thread renderer([&]() {
+    try {
+      TraceViews(img, views, vet_normal, opts,
+                 [&](size_t v, ImgGray&& frame) {
+        return frame_queue.Push(Frame{v, std::move(frame)});
+      });
+    } catch (...) {
+      fail();
+    }
+
+    frame_queue.Close();
+  });
+
+  size_t nencoders = opts.encode_threads ? opts.encode_threads :
+      std::max<size_t>(1, NumThreads(opts.nthreads)/4);
+  std::vector<std::thread> encoders;
+
+  for (size_t t = 0; t < nencoders; t++) {
+    encoders.emplace_back([&]() {
+      try {
+        Frame frame{0, ImgGray(0, 0)};
+
+        while (frame_queue.Pop(&frame)) {
+          if (!png_queue.Push(EncodedFrame{frame.view,
+                                           EncodePng(frame.img, opts.png)})) {
+            break;
+          }
+        }
+      } catch (...) {
+        fail();
+      }
+    });
+  }
+
+  std::thread closer([&]() {
+    for (auto& e : encoders) {
+      e.join();
+    }
+
+    png_queue.Close();
+  });
+
+  // Files are written from the calling thread, one at a time.
+  try {
+    EncodedFrame frame;
+
+    while (png_queue.Pop(&frame)) {
+      std::string file_name = prefix + std::to_string(frame.view) + ".png";
+      std::ofstream fout;
+      fout.open(file_name, std::ios::binary | std::ios::out);
+      fout.write(reinterpret_cast<const char*>(frame.png.data()),
+                 frame.png.size());
+      fout.close();
+
+      if (!fout) {
+        throw std::runtime_error("can't write file: " + file_name);
+      }
+
+      stats.frames++;
+    }
+  } catch (...) {
+    fail();
+  }
+
+  renderer.join();
+  closer.join();
+
+  if (error) {
+    std::rethrow_exception(error);
+  }
+
+  std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+  stats.seconds = elapsed.count();
+  stats.frames_per_sec = stats.seconds > 0 ? stats.frames/stats.seconds : 0;
+
+  return stats;
+}
+
+}
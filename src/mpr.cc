@@ -0,0 +1,150 @@
+#include "mpr.h"
+#include <algorithm>
+#include <atomic>
+#include <stdexcept>
+#include "instrument.h"
+#include "operations.h"
+#include "parallel.h"
+
+namespace imgvol {
+
+namespace {
+
+struct Task {
+  enum class Kind {
+    kAxial, kCoronalSagittal, kOblique
+  };
+
+  Kind kind;
+  size_t plane;
+  size_t begin;
+  size_t end;
+};
+
+void AddBands(Task::Kind kind, size_t plane, size_t n, size_t band,
+              std::vector<Task>* tasks) {
+  for (size_t b = 0; b < n; b += band) {
+    tasks->push_back(Task{kind, plane, b, std::min(b + band, n)});
+  }
+}
+
+}
+
+MprViews Mpr(const ImgVol& img, std::array<size_t, 3> point,
+             const std::vector<std::array<float, 3>>& oblique_normals,
+             const MprOptions& opts) {
+  MprViews views;
+  Mpr(img, point, oblique_normals, opts, &views);
+  return views;
+}
+
+void Mpr(const ImgVol& img, std::array<size_t, 3> point,
+         const std::vector<std::array<float, 3>>& oblique_normals,
+         const MprOptions& opts, MprViews* out) {
+  VIMAGE_SCOPED_TIMER(kMpr);
+  size_t nx = img.SizeX();
+  size_t ny = img.SizeY();
+  size_t nz = img.SizeZ();
+
+  std::array<float, 3> center = {(float) point[0], (float) point[1],
+                                 (float) point[2]};
+  std::array<size_t, 3> origin = img.Origin();
+
+  for (int i = 0; i < 3; i++) {
+    if (point[i] < origin[i]) {
+      throw std::invalid_argument("crosshair outside the volume");
+    }
+
+    point[i] -= origin[i];
+  }
+
+  if (point[0] >= nx || point[1] >= ny || point[2] >= nz) {
+    throw std::invalid_argument("crosshair outside the volume");
+  }
+
+  float diagonal = Diagonal(std::array<float, 3>{(float) nx, (float) ny,
+      (float) nz});
+
+  out->axial.Resize(nx, ny);
+  out->coronal.Resize(nz, nx);
+  out->sagittal.Resize(nz, ny);
+
+  while (out->oblique.size() < oblique_normals.size()) {
+    out->oblique.emplace_back(0, 0);
+  }
+
+  out->oblique.erase(out->oblique.begin() + oblique_normals.size(),
+                     out->oblique.end());
+
+  for (auto& plane : out->oblique) {
+    plane.Resize(diagonal, diagonal);
+  }
+
+  VIMAGE_COUNT(kCutPixels, nx*ny + nz*nx + nz*ny);
+
+  size_t nthreads = NumThreads(opts.nthreads);
+  size_t band = std::max<size_t>(opts.band_rows, 1);
+  std::vector<Task> tasks;
+
+  // Largest tasks first, so the short ones fill the gaps at the end.
+  for (size_t p = 0; p < oblique_normals.size(); p++) {
+    AddBands(Task::Kind::kOblique, p, out->oblique[p].SizeY(), band, &tasks);
+  }
+
+  AddBands(Task::Kind::kCoronalSagittal, 0, nz,
+           std::max<size_t>(1, (nz + nthreads - 1)/nthreads), &tasks);
+  AddBands(Task::Kind::kAxial, 0, ny, band, &tasks);
+
+  const uint8_t* voxels = img.Data();
+  int* axial = out->axial.Data();
+  int* coronal = out->coronal.Data();
+  int* sagittal = out->sagittal.Data();
+  bool w = opts.w;
+  std::atomic<size_t> next(0);
+
+  ParallelFor(0, nthreads, [&](size_t, size_t) {
+    for (size_t t = next++; t < tasks.size(); t = next++) {
+      const Task& task = tasks[t];
+
+      switch (task.kind) {
+        case Task::Kind::kAxial: {
+          const uint8_t* slice = voxels + point[2]*nx*ny;
+
+          for (size_t y = task.begin; y < task.end; y++) {
+            for (size_t x = 0; x < nx; x++) {
+              axial[y*nx + x] = slice[y*nx + (w ? nx - x - 1 : x)];
+            }
+          }
+
+          break;
+        }
+
+        case Task::Kind::kCoronalSagittal:
+          // Coronal pixel (z, x) and sagittal pixel (z, y) both come from
+          // slice z, the row y = point[1] and the column x = point[0].
+          for (size_t z = task.begin; z < task.end; z++) {
+            const uint8_t* slice = voxels + z*nx*ny;
+            size_t i = w ? nz - z - 1 : z;
+            const uint8_t* row = slice + point[1]*nx;
+
+            for (size_t x = 0; x < nx; x++) {
+              coronal[x*nz + i] = row[x];
+            }
+
+            for (size_t y = 0; y < ny; y++) {
+              sagittal[y*nz + i] = slice[y*nx + point[0]];
+            }
+          }
+
+          break;
+
+        case Task::Kind::kOblique:
+          CortePlanarRows(img, center, oblique_normals[task.plane],
+                          task.begin, task.end, &out->oblique[task.plane]);
+          break;
+      }
+    }
+  }, nthreads);
+}
+
+}
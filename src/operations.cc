@@ -4,15 +4,29 @@
 #include <iostream>
 #include <algorithm>
 #include <random>
+#include <vector>
 #include <cstdio>
 #include <cstdlib>
-#include <map>
+#include <stdexcept>
 #include "operations.h"
 #include "matrix.h"
+#include "instrument.h"
+#include "arena.h"
+#include "parallel.h"
+#include "ray_camera.h"
+#include "voxel_traversal.h"
 
 namespace imgvol {
 
 Img2D Cut(const ImgVol& img_vol, ImgVol::Axis axis, size_t pos, bool w) {
+  Img2D img2d(0, 0);
+  Cut(img_vol, axis, pos, w, &img2d);
+  return img2d;
+}
+
+void Cut(const ImgVol& img_vol, ImgVol::Axis axis, size_t pos, bool w,
+         Img2D* out) {
+  VIMAGE_SCOPED_TIMER(kCut);
   size_t s1, s2;
 
   if (axis == ImgVol::Axis::aZ) {
@@ -26,7 +40,9 @@ Img2D Cut(const ImgVol& img_vol, ImgVol::Axis axis, size_t pos, bool w) {
     s2 = img_vol.SizeX();
   }
 
-  Img2D img2d(s1, s2);
+  Img2D& img2d = *out;
+  img2d.Resize(s1, s2);
+  VIMAGE_COUNT(kCutPixels, s1*s2);
 
   for (int i = 0; i < s1; i++) {
     for (int j = 0; j < s2; j++) {
@@ -39,8 +55,6 @@ Img2D Cut(const ImgVol& img_vol, ImgVol::Axis axis, size_t pos, bool w) {
       }
     }
   }
-
-  return img2d;
 }
 
 std::array<size_t, 2> MinMax(const Img2D& img) {
@@ -62,6 +76,8 @@ std::array<size_t, 2> MinMax(const Img2D& img) {
 }
 
 void Normalize(Img2D& img, size_t num_bits) {
+  VIMAGE_SCOPED_TIMER(kNormalize);
+  VIMAGE_COUNT(kWindowedPixels, img.NumPixels());
   int h = pow(2, num_bits) - 1;
   float k1 = 0, k2 = h;
   float i1 = MinMax(img)[0];
@@ -82,6 +98,8 @@ void Normalize(Img2D& img, size_t num_bits) {
 }
 
 void Negative(Img2D& img) {
+  VIMAGE_SCOPED_TIMER(kNegative);
+  VIMAGE_COUNT(kWindowedPixels, img.NumPixels());
   float k1 = MinMax(img)[1], k2 = MinMax(img)[0];
   float i1 = MinMax(img)[0];
 
@@ -100,6 +118,8 @@ void Negative(Img2D& img) {
 }
 
 void BrightinessContrast(Img2D& img, size_t num_bits, float b, float c) {
+  VIMAGE_SCOPED_TIMER(kBrightinessContrast);
+  VIMAGE_COUNT(kWindowedPixels, img.NumPixels());
   float h = MinMax(img)[1];
 
   b = 100 -b;
@@ -127,30 +147,64 @@ void BrightinessContrast(Img2D& img, size_t num_bits, float b, float c) {
 }
 
 ImgColor ColorLabels(const Img2D& img_cut, const Img2D& img_lb, size_t nbits) {
-  std::map<int, int> tab_color;
+  ImgColor img_color(0, 0);
+  ColorLabels(img_cut, img_lb, nbits, &img_color);
+  return img_color;
+}
+
+void ColorLabels(const Img2D& img_cut, const Img2D& img_lb, size_t nbits,
+                 ImgColor* out) {
+  VIMAGE_SCOPED_TIMER(kColorLabels);
+  VIMAGE_COUNT(kColorLabelPixels, img_lb.NumPixels());
+  ArenaScope scope;
   std::default_random_engine generator;
 
+  // Colors are drawn in order of first appearance of each label, the
+  // table maps label - min_label to its color, -1 when not drawn yet.
+  int min_label = 0;
+  int max_label = 0;
+
+  for (size_t i = 0; i < img_lb.NumPixels(); i++) {
+    min_label = std::min(min_label, img_lb[i]);
+    max_label = std::max(max_label, img_lb[i]);
+  }
+
+  size_t tab_size = size_t(max_label - min_label) + 1;
+  int* tab_color = Arena::Local().Allocate<int>(tab_size);
+  std::fill(tab_color, tab_color + tab_size, -1);
+
   float h = pow(2, nbits) - 1;
   std::uniform_int_distribution<int> distribution(0,int(h));
-  ImgColor img_color(img_cut.SizeX(), img_cut.SizeY());
+  ImgColor& img_color = *out;
+  img_color.Resize(img_cut.SizeX(), img_cut.SizeY());
   std::array<uint8_t, 3> cor;
   std::array<uint8_t, 3> cinza;
 
   float y, cg, co;
   float maxH = MinMax(img_cut)[1];
 
-  for (int i = 0; i < img_lb.NumPixels(); i++) {
-    if (img_lb[i] == 0) {
-      cor[0] = cor[1] = cor[2] = (int)(255*img_cut[i]/maxH);
-      img_color(cor, i);
-      continue;
-    }
+  // Rows are colored into one array per channel and stored whole.
+  size_t width = img_color.SizeX();
+  uint8_t* row_b = Arena::Local().Allocate<uint8_t>(3*width);
+  uint8_t* row_g = row_b + width;
+  uint8_t* row_r = row_g + width;
+
+  for (size_t j = 0; j < img_color.SizeY(); j++) {
+    for (size_t x = 0; x < width; x++) {
+      int i = j*width + x;
+
+      if (img_lb[i] == 0 || i%2 != 0) {
+        cor[0] = cor[1] = cor[2] = (int)(255*img_cut[i]/maxH);
+        row_b[x] = cor[0];
+        row_g[x] = cor[1];
+        row_r[x] = cor[2];
+        continue;
+      }
 
-    if (i%2 == 0) {
-      int p = img_lb[i];
+      int p = img_lb[i] - min_label;
 
-      if (tab_color.find(p) == tab_color.end())
-        tab_color.insert(std::pair<int, int>(p, distribution(generator)));
+      if (tab_color[p] < 0)
+        tab_color[p] = distribution(generator);
 
       int m = tab_color[p];
       float v = m/h;
@@ -184,13 +238,13 @@ ImgColor ColorLabels(const Img2D& img_cut, const Img2D& img_lb, size_t nbits) {
       cor[1] = 255*cor[1]/(255*2);
       cor[2] = 255*cor[2]/(255*2);
 
-      img_color(cor, i);
-    } else {
-      cor[0] = cor[1] = cor[2] = (int)(255*img_cut[i]/maxH);
-      img_color(cor, i);
+      row_b[x] = cor[0];
+      row_g[x] = cor[1];
+      row_r[x] = cor[2];
     }
+
+    img_color.WriteRow(j, 0, width, row_b, row_g, row_r);
   }
-  return img_color;
 }
 
 std::array<float, 3> VecNorm(std::array<float, 3> v) {
@@ -199,12 +253,18 @@ std::array<float, 3> VecNorm(std::array<float, 3> v) {
   return vr;
 }
 
-ImgGray CortePlanar(ImgVol& img, std::array<float, 3> p1, std::array<float, 3> vec) {
+Mat4 PlanarTransform(std::array<size_t, 3> size,
+                     std::array<size_t, 3> origin, std::array<float, 3> p1,
+                     std::array<float, 3> vec) {
+  for (int i = 0; i < 3; i++) {
+    p1[i] -= origin[i];
+  }
+
   vec = VecNorm(vec);
   // Handle vec[2] = 0
   float alpha_x = atan(vec[1]/ vec[2]);
-  float diagonal = Diagonal(std::array<float, 3>{(float)img.SizeX(),
-      (float)img.SizeY(), (float)img.SizeZ()});
+  float diagonal = Diagonal(std::array<float, 3>{(float)size[0],
+      (float)size[1], (float)size[2]});
 
   if (vec[2] < 0) {
     alpha_x -= M_PI;
@@ -227,66 +287,124 @@ ImgGray CortePlanar(ImgVol& img, std::array<float, 3> p1, std::array<float, 3> v
     }
   }
 
-  Matrix<double> t_mqc = {
-    {1, 0, 0, -qc[0]},
-    {0, 1, 0, -qc[1]},
-    {0, 0, 1, -qc[2]},
-    {0, 0, 0, 1     }
+  Mat4 t_mqc = {
+    1, 0, 0, -qc[0],
+    0, 1, 0, -qc[1],
+    0, 0, 1, -qc[2],
+    0, 0, 0, 1
   };
 
   alpha_x = -alpha_x;
-  Matrix<double> rotx = {
-    {1,      0,              0,      0},
-    {0, cos(alpha_x), -sin(alpha_x), 0},
-    {0, sin(alpha_x), cos(alpha_x),  0},
-    {0,      0,             0,       1}
+  Mat4 rotx = {
+    1,      0,              0,      0,
+    0, cos(alpha_x), -sin(alpha_x), 0,
+    0, sin(alpha_x), cos(alpha_x),  0,
+    0,      0,             0,       1
   };
 
-  Matrix<double> roty = {
-    {cos(alpha_y),      0,  sin(alpha_y),      0},
-    {0,                 1,       0,            0},
-    {-sin(alpha_y),     0,  cos(alpha_x),      0},
-    {0,                 0,       0,            1}
+  Mat4 roty = {
+    cos(alpha_y),      0,  sin(alpha_y),      0,
+    0,                 1,       0,            0,
+    -sin(alpha_y),     0,  cos(alpha_y),      0,
+    0,                 0,       0,            1
   };
 
-  Matrix<double> t_p1 = {
-    {1, 0, 0, p1[0]},
-    {0, 1, 0, p1[1]},
-    {0, 0, 1, p1[2]},
-    {0, 0, 0, 1}
+  Mat4 t_p1 = {
+    1, 0, 0, p1[0],
+    0, 1, 0, p1[1],
+    0, 0, 1, p1[2],
+    0, 0, 0, 1
   };
-  Matrix<double> tmp_rx_tqc = MultMatrices(roty, t_mqc);
-  Matrix<double> tmp_ry_rx_tqc = MultMatrices(rotx, tmp_rx_tqc);
-  Matrix<double> phi_inv = MultMatrices(t_p1, tmp_ry_rx_tqc);
-
-  ImgGray img_out(diagonal, diagonal);
-  Matrix<double> q = Matrix<double>(1, 4);
-
-  for (int u = 0; u < (int) diagonal; u++) {
-    for (int v = 0; v < (int) diagonal; v++) {
-      q[0] = u;
-      q[1] = v;
-      q[2] = -diagonal/2;
-      q[3] = 1;
-
-      Matrix<double> p = MultMatrices(phi_inv, q);
-      int intensity;
-
-      if (p[0] < 0 || p[1] < 0 || p[2] < 0) {
-        intensity = 0;
-      } else  if (p[0] >= img.SizeX() || p[1] >= img.SizeY() || p[2] >= img.SizeZ()) {
-        intensity = 0;
-      } else {
-        intensity = img(p[0], p[1], p[2]);
+  Mat4 tmp_rx_tqc = MultMat4(roty, t_mqc);
+  Mat4 tmp_ry_rx_tqc = MultMat4(rotx, tmp_rx_tqc);
+  return MultMat4(t_p1, tmp_ry_rx_tqc);
+}
+
+Mat4 PlanarTransform(const ImgVol& img, std::array<float, 3> p1,
+                     std::array<float, 3> vec) {
+  return PlanarTransform(std::array<size_t, 3>{img.SizeX(), img.SizeY(),
+                                               img.SizeZ()},
+                         img.Origin(), p1, vec);
+}
+
+// Sample the plane into out, pixel (u, v) at out[v*stride + u]. Each row
+// is mapped to volume coordinates and sampled in blocks.
+template <class Sampler>
+void SamplePlane(const Sampler& sampler, const Mat4& phi_inv, float diagonal,
+                 size_t row_begin, size_t row_end, uint8_t* out,
+                 size_t stride) {
+  VIMAGE_COUNT(kPlanarSamples, size_t(diagonal)*(row_end - row_begin));
+  size_t width = size_t(diagonal);
+  float px[kSamplerBlock], py[kSamplerBlock], pz[kSamplerBlock];
+  Vec4 q;
+
+  for (size_t v = row_begin; v < row_end; v++) {
+    for (size_t u0 = 0; u0 < width; u0 += kSamplerBlock) {
+      size_t n = std::min(kSamplerBlock, width - u0);
+
+      for (size_t k = 0; k < n; k++) {
+        q[0] = double(u0 + k);
+        q[1] = double(v);
+        q[2] = -diagonal/2;
+        q[3] = 1;
+
+        Vec4 p = MultMat4(phi_inv, q);
+        px[k] = Sampler::Coordinate(p[0]);
+        py[k] = Sampler::Coordinate(p[1]);
+        pz[k] = Sampler::Coordinate(p[2]);
       }
 
-      img_out(intensity, u, v);
+      sampler.Sample(px, py, pz, n, out + v*stride + u0);
+    }
+  }
+}
+
+void SamplePlane(const ImgVol& img, Interpolation interp, const Mat4& phi_inv,
+                 float diagonal, size_t row_begin, size_t row_end,
+                 uint8_t* out, size_t stride) {
+  if (img.NumVoxels() == 0) {
+    for (size_t v = row_begin; v < row_end; v++) {
+      std::fill(out + v*stride, out + v*stride + size_t(diagonal), 0);
     }
+
+    return;
   }
 
+  WithSampler(img, interp, [&](const auto& sampler) {
+    SamplePlane(sampler, phi_inv, diagonal, row_begin, row_end, out, stride);
+  });
+}
+
+ImgGray CortePlanar(ImgVol& img, std::array<float, 3> p1, std::array<float, 3> vec,
+                    Interpolation interp) {
+  ImgGray img_out(0, 0);
+  CortePlanar(img, p1, vec, &img_out, interp);
   return img_out;
 }
 
+void CortePlanar(const ImgVol& img, std::array<float, 3> p1,
+                 std::array<float, 3> vec, ImgGray* out,
+                 Interpolation interp) {
+  VIMAGE_SCOPED_TIMER(kCortePlanar);
+  float diagonal = Diagonal(std::array<float, 3>{(float)img.SizeX(),
+      (float)img.SizeY(), (float)img.SizeZ()});
+
+  out->Resize(diagonal, diagonal);
+  SamplePlane(img, interp, PlanarTransform(img, p1, vec), diagonal, 0,
+              out->SizeY(), out->Data(), out->SizeX());
+}
+
+void CortePlanarRows(const ImgVol& img, std::array<float, 3> p1,
+                     std::array<float, 3> vec, size_t row_begin,
+                     size_t row_end, ImgGray* out,
+                     Interpolation interp) {
+  float diagonal = Diagonal(std::array<float, 3>{(float)img.SizeX(),
+      (float)img.SizeY(), (float)img.SizeZ()});
+
+  SamplePlane(img, interp, PlanarTransform(img, p1, vec), diagonal,
+              row_begin, row_end, out->Data(), out->SizeX());
+}
+
 std::array<float,3> CalcVector(std::array<float,3> p1, std::array<float,3> pn) {
   std::array<float, 3> sub = {pn[0] - p1[0], pn[1] - p1[1], pn[2] - p1[2]};
 
@@ -296,16 +414,17 @@ std::array<float,3> CalcVector(std::array<float,3> p1, std::array<float,3> pn) {
   return vr;
 }
 
-void FillImg(const ImgGray& img_gray, size_t z, ImgVol* img_vol) {
-  for (size_t iy = 0; iy < img_gray.SizeY(); iy++) {
-    for (size_t ix = 0; ix < img_gray.SizeX(); ix++) {
-      img_vol->SetVoxelIntensity(img_gray(ix, iy), ix, iy, z);
-    }
-  }
+ImgVol ReformataImg(ImgVol& img, size_t n, std::array<float,3> p1, std::array<float,3> pn,
+                    Interpolation interp) {
+  ImgVol img_vol(0, 0, 0);
+  ReformataImg(img, n, p1, pn, &img_vol, interp);
+  return img_vol;
 }
 
-ImgVol ReformataImg(ImgVol& img, size_t n, std::array<float,3> p1, std::array<float,3> pn) {
-  float dz2 = (pn[2] - p1[2])/float(n);
+void ReformataImg(const ImgVol& img, size_t n, std::array<float,3> p1,
+                  std::array<float,3> pn, ImgVol* out,
+                  Interpolation interp) {
+  VIMAGE_SCOPED_TIMER(kReformataImg);
 
   std::array<float, 3> sub = {pn[0] - p1[0], pn[1] - p1[1], pn[2] - p1[2]};
 
@@ -316,207 +435,77 @@ ImgVol ReformataImg(ImgVol& img, size_t n, std::array<float,3> p1, std::array<fl
   float diagonal = Diagonal(std::array<float, 3>{(float)img.SizeX(),
       (float)img.SizeY(), (float)img.SizeZ()});
 
-  ImgVol img_vol(diagonal, diagonal, n);
+  ImgVol& img_vol = *out;
+  img_vol.Resize(diagonal, diagonal, n);
+  size_t slice = img_vol.SizeX()*img_vol.SizeY();
 
+  // Every slice is sampled straight into its place in the output volume.
   std::array<float, 3> p = p1;
   for (size_t i = 0; i < n; i++) {
     std::array<float, 3> v_inc = {lambda*vec[0], lambda*vec[1], lambda*vec[2]};
     p[0] = p[0] + v_inc[0];
     p[1] = p[1] + v_inc[1];
     p[2] = p[2] + v_inc[2];
-    ImgGray img_gray = CortePlanar(img, p, vec);
 
-    FillImg(img_gray, i, &img_vol);
+    VIMAGE_SCOPED_TIMER(kCortePlanar);
+    SamplePlane(img, interp, PlanarTransform(img, p, vec), diagonal, 0,
+                img_vol.SizeY(), img_vol.Data() + i*slice, img_vol.SizeX());
+    VIMAGE_COUNT(kReformatSlices, 1);
   }
-
-  return img_vol;
 }
 
 ImgGray MaxIntensionProjection(ImgVol& img, float delta_x, float delta_y, std::array<float, 3> vet_normal) {
-  float diagonal = Diagonal(std::array<float, 3>{(float) img.SizeX(),
-      (float) img.SizeY(), (float) img.SizeZ()});
+  ImgGray img_out(0, 0);
+  MaxIntensionProjection(img, delta_x, delta_y, vet_normal, &img_out);
+  return img_out;
+}
 
-  vet_normal = VecNorm(vet_normal);
+void MaxIntensionProjection(ImgVol& img, float delta_x, float delta_y,
+                            std::array<float, 3> vet_normal, ImgGray* out) {
+  VIMAGE_SCOPED_TIMER(kMaxIntensionProjection);
   NormalizeImage(img);
 
-  Matrix<double> pc_l = {
-    {1, 0, 0, -diagonal/2},
-    {0, 1, 0, -diagonal/2},
-    {0, 0, 1, -diagonal/2},
-    {0, 0, 0, 1}
-  };
-
-  Matrix<double> rotx = {
-    {1, 0, 0, 0},
-    {0, cos(-delta_x), -sin(-delta_x), 0},
-    {0, sin(-delta_x), cos(-delta_x), 0},
-    {0, 0, 0, 1}
-  };
-
-  Matrix<double> roty = {
-    {cos(-delta_y), 0, sin(-delta_y), 0},
-    {0, 1, 0, 0},
-    {-sin(-delta_y), 0, cos(-delta_y), 0},
-    {0, 0, 0, 1}
-  };
-
-  Matrix<double> pc = {
-    {1, 0, 0, (double)(img.SizeX()-1)/2},
-    {0, 1, 0, (double)(img.SizeY()-1)/2},
-    {0, 0, 1, (double)(img.SizeZ()-1)/2},
-    {0, 0, 0, 1}
-  };
-
-  float nx = (float) img.SizeX();
-  float ny = (float) img.SizeY();
-  float nz = (float) img.SizeZ();
-  std::vector<std::array<float, 3>> nj = {{1, 0, 0}, {-1, 0, 0},
-                                          {0, 1, 0}, {0, -1, 0},
-                                          {0, 0, 1}, {0, 0, -1}};
-
-  std::vector<std::array<float, 3>> cj = {{nx-1, (ny-1)/2, (nz-1)/2}, {0, (ny-1)/2, (nz-1)/2},
-                                          {(nx-1)/2, ny-1, (nz-1)/2}, {(nx-1)/2, 0, (nz-1)/2},
-                                          {(nx-1)/2, (ny-1)/2, nz-1}, {(nx-1)/2, (ny-1)/2, 0}};
-
-
-  Matrix<double> v_norm_mat = Matrix<double>(1, 4);
-  v_norm_mat[0] = vet_normal[0];
-  v_norm_mat[1] = vet_normal[1];
-  v_norm_mat[2] = vet_normal[2];
-  v_norm_mat[3] = 1;
-
-  Matrix<double> tmp_rx_norm_mat = MultMatrices(roty, v_norm_mat);
-  Matrix<double> phi_inv_norm = MultMatrices(rotx, tmp_rx_norm_mat);
-  phi_inv_norm[3] = 0;
-
-  ImgGray img_out(diagonal, diagonal);
+  RayCamera camera(img, delta_x, delta_y, vet_normal);
+  out->Resize(camera.Width(), camera.Height());
+  MaxIntensionProjectionRows(img, delta_x, delta_y, vet_normal, 0,
+                             out->SizeY(), out);
+}
 
-  float term_1, term_2, term_3, lambda[6], lambda_max, lambda_min;
+void MaxIntensionProjectionRows(const ImgVol& img, float delta_x,
+                                float delta_y, std::array<float, 3> vet_normal,
+                                size_t row_begin, size_t row_end,
+                                ImgGray* out) {
+  RayCamera camera(img, delta_x, delta_y, vet_normal);
+  ImgGray& img_out = *out;
+  size_t rays = 0;
 
   std::array<float,3> p1;
   std::array<float,3> pn;
 
-  Matrix<double> q = Matrix<double>(1, 4);
-
-  Matrix<double> find_point = Matrix<double>(1, 4);
-
-  for (int i = 0; i < diagonal; i++) {
-    for (int j = 0; j < diagonal; j++) {
-      lambda_max = 0;
-      lambda_min = 2*diagonal;
-
-      q[0] = i;
-      q[1] = j;
-      q[2] = -diagonal/2;
-      q[3] = 1;
-
-      Matrix<double> tmp_pcl_q = MultMatrices(pc_l, q);
-      Matrix<double> tmp_rx_pcl_q = MultMatrices(roty, tmp_pcl_q);
-      Matrix<double> tmp_ry_rx_pcl_q = MultMatrices(rotx, tmp_rx_pcl_q);
-      Matrix<double> q_inv = MultMatrices(pc, tmp_ry_rx_pcl_q);
-      q_inv[3] = 0;
-
-      bool passed_if = false;
-
-      for (int a = 0; a < 6; a++) {
-        term_1 = 0;
-        term_2 = 0;
-        term_3 = 0;
-        for (int x = 0; x < 3; x++) {
-          term_1 += nj[a][x]*cj[a][x];
-        }
-
-        for (int x = 0; x < 3; x++) {
-          term_2 += nj[a][x]*q_inv[x];
-        }
-
-        for (int x = 0; x < 3; x++) {
-          term_3 += nj[a][x]*phi_inv_norm[x];
-        }
-
-        lambda[a] = (term_1-term_2)/term_3;
-
-        find_point[0] = std::round(q_inv[0] + lambda[a]*phi_inv_norm[0]);
-        find_point[1] = std::round(q_inv[1] + lambda[a]*phi_inv_norm[1]);
-        find_point[2] = std::round(q_inv[2] + lambda[a]*phi_inv_norm[2]);
-        find_point[3] = 1;
-
-        if (find_point[0] >= 0 && find_point[0] < nx && find_point[1] >= 0 && find_point[1] < ny &&
-          find_point[2] >= 0 && find_point[2] < nz) {
-          passed_if = true;
-
-          if (lambda[a] > lambda_max) {
-            lambda_max = lambda[a];
-            pn[0] = find_point[0];
-            pn[1] = find_point[1];
-            pn[2] = find_point[2];
-          }
-
-          if (lambda[a] < lambda_min) {
-            lambda_min = lambda[a];
-            p1[0] = find_point[0];
-            p1[1] = find_point[1];
-            p1[2] = find_point[2];
-          }
-        }
-      } // for a
-
-      if (passed_if) {
+  for (int i = 0; i < (int) img_out.SizeX(); i++) {
+    for (int j = row_begin; j < (int) row_end; j++) {
+      if (camera.Clip(i, j, &p1, &pn)) {
         float dda = Dda3d(img, p1, pn);
         img_out(static_cast<int>(dda), i, j);
-        passed_if = false;
-      }
-
-    }
-  }
-
-  return img_out;
-}
-
-float Dda3d(ImgVol& img, std::array<float,3> p1, std::array<float,3> pn) {
-  float n;
-  float Dx, Dy, Dz;
-  float dx, dy, dz;
-  if (p1 == pn) {
-    n = 1;
-  } else {
-    Dx = pn[0] - p1[0];
-    Dy = pn[1] - p1[1];
-    Dz = pn[2] - p1[2];
-
-    if (abs(Dx) >= abs(Dy) && abs(Dx) >= abs(Dz)) {
-      n = abs(Dx) + 1;
-      dx = Sign(Dx);
-      dy = dx*Dy/Dx;
-      dz = dx*Dz/Dx;
-    } else {
-      if (abs(Dy) >= abs(Dx) && abs(Dy) >= abs(Dz)) {
-        n = abs(Dy) + 1;
-        dy = Sign(Dy);
-        dx = dy*Dx/Dy;
-        dz = dy*Dz/Dy;
+        rays++;
       } else {
-        n = abs(Dz) + 1;
-        dz = Sign(Dz);
-        dx = dz*Dx/Dz;
-        dy = dz*Dy/Dz;
+        img_out(0, i, j);
       }
     }
   }
 
-  std::array<float,3> p = p1;
-  float max_i = -1;
+  VIMAGE_COUNT(kRaysCast, rays);
+}
 
-  for (size_t k = 0; k < n; k++) {
-    int i = img(p[0], p[1], p[2]);
+float Dda3d(const ImgVol& img, std::array<float,3> p1, std::array<float,3> pn) {
+  const uint8_t* data = img.Data();
+  int max_i = 0;
+  VoxelTraversal t(img, p1, pn);
 
-    if (i > max_i) {
-      max_i = i;
-    }
+  VIMAGE_COUNT(kRaySamples, t.Remaining());
 
-    p[0] = p[0] + dx;
-    p[1] = p[1] + dy;
-    p[2] = p[2] + dz;
+  for (; !t.Done(); t.Next()) {
+    max_i = std::max<int>(max_i, data[t.Offset()]);
   }
 
   return max_i;
@@ -571,6 +560,7 @@ float DotProduct(std::array<float, 3> vec) {
 float Diagonal(std::array<float, 3> size) {
   float res = size[0]*size[0] + size[1]*size[1] + size[2]*size[2];
   res = sqrt(res);
+  return res;
 }
 
 bool TestVisibleFace(std::array<float, 3> face, std::array<float, 3> rad) {
@@ -634,6 +624,92 @@ std::vector<std::array<float, 3>> VertexWireframe(const ImgVol& img_vol, std::ar
   return out_vec;
 }
 
+ImgVol Interp(const ImgVol& img_vol, float sx, float sy, float sz,
+              Interpolation interp) {
+  ImgVol out(0, 0, 0);
+  Interp(img_vol, sx, sy, sz, interp, &out);
+  return out;
+}
+
+void Interp(const ImgVol& img_vol, float sx, float sy, float sz,
+            Interpolation interp, ImgVol* out, size_t nthreads) {
+  std::array<float, 3> scale = {sx, sy, sz};
+
+  for (float f : scale) {
+    if (!(f > 0) || std::isinf(f)) {
+      throw std::invalid_argument("scale factors must be positive and finite");
+    }
+  }
+
+  std::array<size_t, 3> in_size = {img_vol.SizeX(), img_vol.SizeY(),
+                                   img_vol.SizeZ()};
+  std::array<size_t, 3> size;
+  std::array<size_t, 3> origin = img_vol.Origin();
+
+  for (int a = 0; a < 3; a++) {
+    size[a] = in_size[a] == 0 ? 0 :
+        std::max<size_t>(1, size_t(std::lround(in_size[a]*scale[a])));
+    origin[a] = size_t(std::lround(origin[a]*scale[a]));
+  }
+
+  // out may share its buffer with img_vol, keep the source alive.
+  ImgVol src = img_vol;
+  out->Resize(size[0], size[1], size[2]);
+  out->SetOrigin(origin);
+  out->SetVoxelSize(src.DimX()*in_size[0]/std::max<size_t>(1, size[0]),
+                    src.DimY()*in_size[1]/std::max<size_t>(1, size[1]),
+                    src.DimZ()*in_size[2]/std::max<size_t>(1, size[2]));
+
+  if (out->NumVoxels() == 0) {
+    return;
+  }
+
+  uint8_t* data = out->Data();
+  size_t nx = size[0];
+
+  // Output voxel centers map onto the input, so edges line up whatever
+  // the factor. The x coordinates are the same for every row.
+  std::vector<float> xs(nx);
+
+  for (size_t x = 0; x < nx; x++) {
+    xs[x] = (x + 0.5f)*in_size[0]/nx;
+  }
+
+  WithSampler<ClampBorder>(src, interp, [&](const auto& sampler) {
+    ParallelFor(0, size[1]*size[2], [&](size_t r0, size_t r1) {
+      std::vector<float> ys(nx);
+      std::vector<float> zs(nx);
+
+      for (size_t r = r0; r < r1; r++) {
+        size_t y = r%size[1];
+        size_t z = r/size[1];
+        std::fill(ys.begin(), ys.end(), (y + 0.5f)*in_size[1]/size[1]);
+        std::fill(zs.begin(), zs.end(), (z + 0.5f)*in_size[2]/size[2]);
+        sampler.Sample(xs.data(), ys.data(), zs.data(), nx, data + r*nx);
+      }
+    }, nthreads);
+  });
+}
+
+ImgVol Refactor(const ImgVol& img_vol, float dx2, float dy2, float dz2,
+                Interpolation interp) {
+  ImgVol out(0, 0, 0);
+  Refactor(img_vol, dx2, dy2, dz2, interp, &out);
+  return out;
+}
+
+void Refactor(const ImgVol& img_vol, float dx2, float dy2, float dz2,
+              Interpolation interp, ImgVol* out, size_t nthreads) {
+  if (!(dx2 > 0) || !(dy2 > 0) || !(dz2 > 0)) {
+    throw std::invalid_argument("voxel sizes must be positive");
+  }
+
+  ImgVol src = img_vol;
+  Interp(src, src.DimX()/dx2, src.DimY()/dy2, src.DimZ()/dz2, interp, out,
+         nthreads);
+  out->SetVoxelSize(dx2, dy2, dz2);
+}
+
 float Sign(float v) {
   if (v < 0)
     return -1;
@@ -644,6 +720,7 @@ float Sign(float v) {
 }
 
 void DrawLine(std::array<float, 3> p1, std::array<float, 3> p2, ImgGray& img) {
+  VIMAGE_COUNT(kWireframeLines, 1);
   int n;
   float Du, Dv;
   float du, dv;
@@ -674,6 +751,7 @@ void DrawLine(std::array<float, 3> p1, std::array<float, 3> p2, ImgGray& img) {
 }
 
 ImgGray DrawWireframe(const ImgVol& img_vol, std::array<float, 3> rad) {
+  VIMAGE_SCOPED_TIMER(kDrawWireframe);
   std::array<float, 3> size;
   size[0] = img_vol.SizeX();
   size[1] = img_vol.SizeY();
@@ -760,19 +838,19 @@ std::array<size_t, 2> MinMax(const ImgVol& img_vol) {
 }
 
 void NormalizeImage(ImgVol& img_vol) {
+  VIMAGE_SCOPED_TIMER(kNormalizeImage);
   int i_max = img_vol.Imax();
   i_max = std::pow(2, i_max - 1);
 
   if (i_max > 255) {
     std::array<size_t, 2> arr = MinMax(img_vol);
+    VIMAGE_COUNT(kNormalizedVoxels, img_vol.NumVoxels());
 
-    for (size_t x = 0; x < img_vol.SizeX(); x++) {
-      for (size_t y = 0; y < img_vol.SizeY(); y++) {
-        for (size_t z = 0; z < img_vol.SizeZ(); z++) {
-          float b = 255*img_vol(x, y, z)/arr[1];
-          img_vol.SetVoxelIntensity(b, x, y, z);
-        }
-      }
+    // The buffer is unshared once, then written in place.
+    uint8_t* data = img_vol.Data();
+
+    for (size_t i = 0; i < img_vol.NumVoxels(); i++) {
+      data[i] = uint8_t(255*size_t(data[i])/arr[1]);
     }
   }
 }
@@ -0,0 +1,446 @@
+#include "png_encoder.h"
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <png.h>
+#include <zlib.h>
+#include "parallel.h"
+
+namespace imgvol {
+
+namespace {
+
+void WriteToVector(png_structp png, png_bytep data, png_size_t length) {
+  auto* out = static_cast<std::vector<uint8_t>*>(png_get_io_ptr(png));
+  out->insert(out->end(), data, data + length);
+}
+
+void FlushVector(png_structp) {}
+
+// Image rows handed to the encoders, stride bytes apart. Color images are
+// read in their ImgColor layout.
+struct Source {
+  const uint8_t* data;
+  size_t width;
+  size_t height;
+  size_t stride;
+  int channels;
+  ColorLayout layout;
+};
+
+// Row y as PNG samples. Gray rows are returned in place, color rows are
+// converted to RGB in buf.
+const uint8_t* PngRow(const Source& src, size_t y, uint8_t* buf) {
+  const uint8_t* row = src.data + y*src.stride;
+
+  if (src.channels == 1) {
+    return row;
+  }
+
+  if (src.layout == ColorLayout::kPlanar) {
+    size_t plane = src.stride*src.height;
+
+    for (size_t x = 0; x < src.width; x++) {
+      buf[3*x] = row[x + 2*plane];
+      buf[3*x + 1] = row[x + plane];
+      buf[3*x + 2] = row[x];
+    }
+
+    return buf;
+  }
+
+  size_t bytes = src.layout == ColorLayout::kBgrx ? 4 : 3;
+
+  for (size_t x = 0; x < src.width; x++) {
+    buf[3*x] = row[bytes*x + 2];
+    buf[3*x + 1] = row[bytes*x + 1];
+    buf[3*x + 2] = row[bytes*x];
+  }
+
+  return buf;
+}
+
+int LibpngFilter(PngOptions::Filter filter) {
+  switch (filter) {
+    case PngOptions::Filter::kNone:
+      return PNG_FILTER_NONE;
+
+    case PngOptions::Filter::kSub:
+      return PNG_FILTER_SUB;
+
+    case PngOptions::Filter::kUp:
+      return PNG_FILTER_UP;
+
+    case PngOptions::Filter::kAvg:
+      return PNG_FILTER_AVG;
+
+    case PngOptions::Filter::kPaeth:
+      return PNG_FILTER_PAETH;
+
+    default:
+      return PNG_ALL_FILTERS;
+  }
+}
+
+// Gray, BGR and BGRX rows are read by libpng straight from the image,
+// planar rows are interleaved one at a time.
+std::vector<uint8_t> EncodeLibpng(const Source& src, const PngOptions& opts) {
+  std::vector<uint8_t> out;
+  std::vector<png_bytep> rows(src.height);
+  std::vector<uint8_t> scratch;
+
+  for (size_t y = 0; y < src.height; y++) {
+    rows[y] = const_cast<png_bytep>(src.data + y*src.stride);
+  }
+
+  png_structp png = png_create_write_struct(PNG_LIBPNG_VER_STRING, nullptr,
+                                            nullptr, nullptr);
+
+  if (!png) {
+    throw std::runtime_error("can't create png encoder");
+  }
+
+  png_infop info = png_create_info_struct(png);
+
+  if (!info || setjmp(png_jmpbuf(png))) {
+    png_destroy_write_struct(&png, &info);
+    throw std::runtime_error("png encoding failed");
+  }
+
+  // Computed after setjmp, so they aren't live across it and a longjmp
+  // from libpng can't clobber them.
+  const bool color = src.channels == 3;
+  const bool planar = color && src.layout == ColorLayout::kPlanar;
+
+  if (planar) {
+    scratch.resize(3*src.width);
+  }
+
+  png_set_write_fn(png, &out, WriteToVector, FlushVector);
+  png_set_compression_level(png, opts.compression_level);
+  png_set_filter(png, PNG_FILTER_TYPE_BASE, LibpngFilter(opts.filter));
+
+  png_set_IHDR(png, info, src.width, src.height, 8,
+               color ? PNG_COLOR_TYPE_RGB : PNG_COLOR_TYPE_GRAY,
+               PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_BASE,
+               PNG_FILTER_TYPE_BASE);
+  png_write_info(png, info);
+
+  if (planar) {
+    for (size_t y = 0; y < src.height; y++) {
+      png_write_row(png, PngRow(src, y, scratch.data()));
+    }
+  } else {
+    if (color) {
+      png_set_bgr(png);
+    }
+
+    if (color && src.layout == ColorLayout::kBgrx) {
+      png_set_filler(png, 0, PNG_FILLER_AFTER);
+    }
+
+    png_write_rows(png, rows.data(), src.height);
+  }
+
+  png_write_end(png, info);
+  png_destroy_write_struct(&png, &info);
+
+  return out;
+}
+
+uint8_t Paeth(int a, int b, int c) {
+  int p = a + b - c;
+  int pa = std::abs(p - a);
+  int pb = std::abs(p - b);
+  int pc = std::abs(p - c);
+
+  if (pa <= pb && pa <= pc) {
+    return a;
+  }
+
+  return pb <= pc ? b : c;
+}
+
+// Apply a PNG filter to one row. prior is the previous unfiltered row, or
+// nullptr for the first row of the image. out receives the filter type
+// byte followed by the filtered row.
+void FilterRow(const uint8_t* row, const uint8_t* prior, size_t stride,
+               int bpp, int type, uint8_t* out) {
+  out[0] = type;
+  out++;
+
+  for (size_t i = 0; i < stride; i++) {
+    int left = i >= size_t(bpp) ? row[i - bpp] : 0;
+    int up = prior ? prior[i] : 0;
+    int up_left = (prior && i >= size_t(bpp)) ? prior[i - bpp] : 0;
+    int pred;
+
+    switch (type) {
+      case 1:
+        pred = left;
+        break;
+
+      case 2:
+        pred = up;
+        break;
+
+      case 3:
+        pred = (left + up)/2;
+        break;
+
+      case 4:
+        pred = Paeth(left, up, up_left);
+        break;
+
+      default:
+        pred = 0;
+    }
+
+    out[i] = uint8_t(row[i] - pred);
+  }
+}
+
+// Same heuristic as libpng: keep the filter with the smallest sum of
+// absolute signed residuals.
+void AdaptiveFilterRow(const uint8_t* row, const uint8_t* prior,
+                       size_t stride, int bpp, uint8_t* out,
+                       uint8_t* scratch) {
+  size_t best_sum = 0;
+
+  for (int type = 0; type < 5; type++) {
+    uint8_t* dst = type == 0 ? out : scratch;
+    FilterRow(row, prior, stride, bpp, type, dst);
+
+    size_t sum = 0;
+
+    for (size_t i = 1; i <= stride; i++) {
+      sum += dst[i] < 128 ? dst[i] : 256 - dst[i];
+    }
+
+    if (type == 0 || sum < best_sum) {
+      best_sum = sum;
+
+      if (type != 0) {
+        std::memcpy(out, scratch, stride + 1);
+      }
+    }
+  }
+}
+
+int FilterType(PngOptions::Filter filter) {
+  switch (filter) {
+    case PngOptions::Filter::kSub:
+      return 1;
+
+    case PngOptions::Filter::kUp:
+      return 2;
+
+    case PngOptions::Filter::kAvg:
+      return 3;
+
+    case PngOptions::Filter::kPaeth:
+      return 4;
+
+    default:
+      return 0;
+  }
+}
+
+void PutUint32(uint32_t v, std::vector<uint8_t>* out) {
+  out->push_back(v >> 24);
+  out->push_back(v >> 16);
+  out->push_back(v >> 8);
+  out->push_back(v);
+}
+
+void PutChunk(const char* type, const uint8_t* data, size_t size,
+              std::vector<uint8_t>* out) {
+  PutUint32(size, out);
+  size_t start = out->size();
+  out->insert(out->end(), type, type + 4);
+  out->insert(out->end(), data, data + size);
+
+  uLong crc = crc32(0, out->data() + start, size + 4);
+  PutUint32(crc, out);
+}
+
+// Raw deflate of one band. Every band but the last ends with a sync flush
+// so the bands can be concatenated into a single deflate stream.
+std::vector<uint8_t> DeflateBand(const std::vector<uint8_t>& in, int level,
+                                 bool last) {
+  z_stream strm;
+  std::memset(&strm, 0, sizeof(strm));
+
+  if (deflateInit2(&strm, level, Z_DEFLATED, -15, 8,
+                   Z_DEFAULT_STRATEGY) != Z_OK) {
+    throw std::runtime_error("can't initialize deflate");
+  }
+
+  std::vector<uint8_t> out(deflateBound(&strm, in.size()) + 16);
+  strm.next_in = const_cast<Bytef*>(in.data());
+  strm.avail_in = in.size();
+  strm.next_out = out.data();
+  strm.avail_out = out.size();
+
+  int ret = deflate(&strm, last ? Z_FINISH : Z_SYNC_FLUSH);
+  size_t size = out.size() - strm.avail_out;
+  deflateEnd(&strm);
+
+  if ((last && ret != Z_STREAM_END) || (!last && ret != Z_OK) ||
+      strm.avail_in != 0) {
+    throw std::runtime_error("deflate failed");
+  }
+
+  out.resize(size);
+  return out;
+}
+
+std::vector<uint8_t> EncodeParallel(const Source& src,
+                                    const PngOptions& opts) {
+  size_t width = src.width;
+  size_t height = src.height;
+  int channels = src.channels;
+  size_t stride = width*channels;
+  size_t nbands = std::min(NumThreads(opts.nthreads), height);
+  size_t band_rows = (height + nbands - 1)/nbands;
+  nbands = (height + band_rows - 1)/band_rows;
+
+  std::vector<std::vector<uint8_t>> deflated(nbands);
+  std::vector<uLong> adlers(nbands);
+  std::vector<size_t> lengths(nbands);
+
+  ParallelFor(0, nbands, [&](size_t begin, size_t end) {
+    std::vector<uint8_t> scratch(stride + 1);
+    std::vector<uint8_t> rgb_row;
+    std::vector<uint8_t> rgb_prior;
+    bool color = channels == 3;
+
+    if (color) {
+      rgb_row.resize(stride);
+      rgb_prior.resize(stride);
+    }
+
+    // Color rows are converted to RGB before filtering.
+    auto fetch = [&](size_t y, std::vector<uint8_t>* buf) -> const uint8_t* {
+      return PngRow(src, y, buf->data());
+    };
+
+    for (size_t b = begin; b < end; b++) {
+      size_t y0 = b*band_rows;
+      size_t y1 = std::min(y0 + band_rows, height);
+      std::vector<uint8_t> filtered((y1 - y0)*(stride + 1));
+
+      const uint8_t* prior = y0 > 0 ? fetch(y0 - 1, &rgb_prior) : nullptr;
+
+      for (size_t y = y0; y < y1; y++) {
+        const uint8_t* row = fetch(y, &rgb_row);
+        uint8_t* out = filtered.data() + (y - y0)*(stride + 1);
+
+        if (opts.filter == PngOptions::Filter::kAdaptive) {
+          AdaptiveFilterRow(row, prior, stride, channels, out,
+                            scratch.data());
+        } else {
+          FilterRow(row, prior, stride, channels, FilterType(opts.filter),
+                    out);
+        }
+
+        if (color) {
+          std::swap(rgb_row, rgb_prior);
+          prior = rgb_prior.data();
+        } else {
+          prior = row;
+        }
+      }
+
+      adlers[b] = adler32(adler32(0, nullptr, 0), filtered.data(),
+                          filtered.size());
+      lengths[b] = filtered.size();
+      deflated[b] = DeflateBand(filtered, opts.compression_level,
+                                b == nbands - 1);
+    }
+  }, opts.nthreads);
+
+  std::vector<uint8_t> idat = {0x78, 0x9c};
+  uLong adler = adlers[0];
+
+  for (size_t b = 0; b < nbands; b++) {
+    idat.insert(idat.end(), deflated[b].begin(), deflated[b].end());
+
+    if (b > 0) {
+      adler = adler32_combine(adler, adlers[b], lengths[b]);
+    }
+  }
+
+  PutUint32(adler, &idat);
+
+  const uint8_t signature[8] = {137, 80, 78, 71, 13, 10, 26, 10};
+  std::vector<uint8_t> out(signature, signature + 8);
+
+  std::vector<uint8_t> ihdr;
+  PutUint32(width, &ihdr);
+  PutUint32(height, &ihdr);
+  ihdr.push_back(8);
+  ihdr.push_back(channels == 1 ? 0 : 2);
+  ihdr.push_back(0);
+  ihdr.push_back(0);
+  ihdr.push_back(0);
+
+  PutChunk("IHDR", ihdr.data(), ihdr.size(), &out);
+  PutChunk("IDAT", idat.data(), idat.size(), &out);
+  PutChunk("IEND", nullptr, 0, &out);
+
+  return out;
+}
+
+std::vector<uint8_t> Encode(const Source& src, const PngOptions& opts) {
+  if (src.width == 0 || src.height == 0) {
+    throw std::invalid_argument("can't encode an empty image");
+  }
+
+  if (src.width*src.height >= opts.parallel_min_pixels && src.height > 1 &&
+      NumThreads(opts.nthreads) > 1) {
+    return EncodeParallel(src, opts);
+  }
+
+  return EncodeLibpng(src, opts);
+}
+
+void WriteFile(const std::vector<uint8_t>& png, const std::string& file_name) {
+  std::ofstream fout;
+  fout.open(file_name, std::ios::binary | std::ios::out);
+
+  if (!fout) {
+    throw std::runtime_error("can't open file: " + file_name);
+  }
+
+  fout.write(reinterpret_cast<const char*>(png.data()), png.size());
+  fout.close();
+}
+
+}
+
+std::vector<uint8_t> EncodePng(const ImgGray& img, const PngOptions& opts) {
+  Source src = {img.Data(), img.SizeX(), img.SizeY(), img.SizeX(), 1,
+                ColorLayout::kBgr};
+  return Encode(src, opts);
+}
+
+std::vector<uint8_t> EncodePng(const ImgColor& img, const PngOptions& opts) {
+  Source src = {img.Data(), img.SizeX(), img.SizeY(), img.Stride(), 3,
+                img.Layout()};
+  return Encode(src, opts);
+}
+
+void WritePng(const ImgGray& img, const std::string& file_name,
+              const PngOptions& opts) {
+  WriteFile(EncodePng(img, opts), file_name);
+}
+
+void WritePng(const ImgColor& img, const std::string& file_name,
+              const PngOptions& opts) {
+  WriteFile(EncodePng(img, opts), file_name);
+}
+
+}
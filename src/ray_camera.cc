@@ -0,0 +1,124 @@
+#include "ray_camera.h"
+#include <cmath>
+#include <limits>
+#include "operations.h"
+
+namespace imgvol {
+
+RayCamera::RayCamera(const ImgVol& img, float delta_x, float delta_y,
+                     std::array<float, 3> normal) {
+  diagonal_ = Diagonal(std::array<float, 3>{(float) img.SizeX(),
+      (float) img.SizeY(), (float) img.SizeZ()});
+  size_ = diagonal_;
+  dims_ = {(float) img.SizeX(), (float) img.SizeY(), (float) img.SizeZ()};
+
+  normal = VecNorm(normal);
+
+  Mat4 pc_l = {
+    1, 0, 0, -diagonal_/2,
+    0, 1, 0, -diagonal_/2,
+    0, 0, 1, -diagonal_/2,
+    0, 0, 0, 1
+  };
+
+  Mat4 rotx = {
+    1, 0, 0, 0,
+    0, cos(-delta_x), -sin(-delta_x), 0,
+    0, sin(-delta_x), cos(-delta_x), 0,
+    0, 0, 0, 1
+  };
+
+  Mat4 roty = {
+    cos(-delta_y), 0, sin(-delta_y), 0,
+    0, 1, 0, 0,
+    -sin(-delta_y), 0, cos(-delta_y), 0,
+    0, 0, 0, 1
+  };
+
+  Mat4 pc = {
+    1, 0, 0, (double)(img.SizeX()-1)/2,
+    0, 1, 0, (double)(img.SizeY()-1)/2,
+    0, 0, 1, (double)(img.SizeZ()-1)/2,
+    0, 0, 0, 1
+  };
+
+  // Same as pc*rotx*roty*pc_l applied to each pixel, folded once.
+  phi_inv_ = MultMat4(pc, MultMat4(rotx, MultMat4(roty, pc_l)));
+
+  Vec4 v_norm_mat = {normal[0], normal[1], normal[2], 1};
+  dir_ = MultMat4(rotx, MultMat4(roty, v_norm_mat));
+  dir_[3] = 0;
+}
+
+size_t RayCamera::Width() const noexcept {
+  return size_;
+}
+
+size_t RayCamera::Height() const noexcept {
+  return size_;
+}
+
+std::array<float, 3> RayCamera::Direction() const noexcept {
+  return {(float) dir_[0], (float) dir_[1], (float) dir_[2]};
+}
+
+bool RayCamera::Clip(int i, int j, std::array<float, 3>* p1,
+                     std::array<float, 3>* pn) const {
+  float nx = dims_[0];
+  float ny = dims_[1];
+  float nz = dims_[2];
+  std::array<std::array<float, 3>, 6> nj = {{{1, 0, 0}, {-1, 0, 0},
+                                            {0, 1, 0}, {0, -1, 0},
+                                            {0, 0, 1}, {0, 0, -1}}};
+
+  std::array<std::array<float, 3>, 6> cj = {{{nx-1, (ny-1)/2, (nz-1)/2}, {0, (ny-1)/2, (nz-1)/2},
+                                            {(nx-1)/2, ny-1, (nz-1)/2}, {(nx-1)/2, 0, (nz-1)/2},
+                                            {(nx-1)/2, (ny-1)/2, nz-1}, {(nx-1)/2, (ny-1)/2, 0}}};
+
+  // The ray is clipped as a whole line, so rays pointing away from the
+  // view plane still get both end points.
+  float lambda_max = -std::numeric_limits<float>::infinity();
+  float lambda_min = std::numeric_limits<float>::infinity();
+  bool hit = false;
+
+  Vec4 q = {(double) i, (double) j, -diagonal_/2, 1};
+  Vec4 q_inv = MultMat4(phi_inv_, q);
+
+  for (int a = 0; a < 6; a++) {
+    float term_1 = 0;
+    float term_2 = 0;
+    float term_3 = 0;
+
+    for (int x = 0; x < 3; x++) {
+      term_1 += nj[a][x]*cj[a][x];
+      term_2 += nj[a][x]*q_inv[x];
+      term_3 += nj[a][x]*dir_[x];
+    }
+
+    float lambda = (term_1-term_2)/term_3;
+    std::array<float, 3> point;
+
+    for (int x = 0; x < 3; x++) {
+      point[x] = std::round(q_inv[x] + lambda*dir_[x]);
+    }
+
+    if (point[0] >= 0 && point[0] < nx && point[1] >= 0 && point[1] < ny &&
+        point[2] >= 0 && point[2] < nz) {
+      hit = true;
+
+      if (lambda > lambda_max) {
+        lambda_max = lambda;
+        *pn = point;
+      }
+
+      if (lambda < lambda_min) {
+        lambda_min = lambda;
+        *p1 = point;
+      }
+    }
+  }
+
+  return hit;
+}
+
+}
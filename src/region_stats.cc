@@ -0,0 +1,148 @@
+#include "region_stats.h"
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <mutex>
+#include <stdexcept>
+#include "voxel_memory.h"
+
+namespace imgvol {
+
+namespace {
+
+const size_t kNumLabels = 256;
+
+struct Accumulator {
+  uint64_t voxels;
+  uint64_t sum;
+  uint64_t sum_x;
+  uint64_t sum_y;
+  uint64_t sum_z;
+  uint8_t min;
+  uint8_t max;
+  std::array<size_t, 3> lo;
+  std::array<size_t, 3> hi;
+};
+
+Accumulator EmptyAccumulator() {
+  size_t big = std::numeric_limits<size_t>::max();
+  return Accumulator{0, 0, 0, 0, 0, 255, 0, {{big, big, big}}, {{0, 0, 0}}};
+}
+
+void Merge(const Accumulator& a, Accumulator* to) {
+  to->voxels += a.voxels;
+  to->sum += a.sum;
+  to->sum_x += a.sum_x;
+  to->sum_y += a.sum_y;
+  to->sum_z += a.sum_z;
+  to->min = std::min(to->min, a.min);
+  to->max = std::max(to->max, a.max);
+
+  for (int i = 0; i < 3; i++) {
+    to->lo[i] = std::min(to->lo[i], a.lo[i]);
+    to->hi[i] = std::max(to->hi[i], a.hi[i]);
+  }
+}
+
+}
+
+std::vector<RegionStats> ComputeRegionStats(const ImgVol& img,
+                                            const ImgVol& labels,
+                                            bool include_background,
+                                            size_t nthreads) {
+  if (img.SizeX() != labels.SizeX() || img.SizeY() != labels.SizeY() ||
+      img.SizeZ() != labels.SizeZ()) {
+    throw std::invalid_argument("label volume size differs from the image");
+  }
+
+  size_t nx = img.SizeX();
+  size_t ny = img.SizeY();
+  size_t nz = img.SizeZ();
+  const uint8_t* data = img.Data();
+  const uint8_t* lb = labels.Data();
+
+  std::vector<Accumulator> total(kNumLabels, EmptyAccumulator());
+  std::mutex total_mutex;
+
+  ParallelForSlabs(0, nz, nz, [&](size_t z0, size_t z1) {
+    std::vector<Accumulator> acc(kNumLabels, EmptyAccumulator());
+
+    // Counts per label of the current row, so the y and z sums and the
+    // y, z extents are updated once per row instead of once per voxel.
+    std::array<uint32_t, kNumLabels> row_count;
+    // Labels met in the row, in order. Every voxel writes its label past
+    // the end of the list and only keeps it when new, so one extra slot.
+    std::array<uint8_t, kNumLabels + 1> row_labels;
+    row_count.fill(0);
+
+    for (size_t z = z0; z < z1; z++) {
+      for (size_t y = 0; y < ny; y++) {
+        size_t row = (z*ny + y)*nx;
+        size_t nlabels = 0;
+
+        for (size_t x = 0; x < nx; x++) {
+          uint8_t l = lb[row + x];
+          uint8_t v = data[row + x];
+          Accumulator& a = acc[l];
+          row_labels[nlabels] = l;
+          nlabels += row_count[l]++ == 0;
+          a.sum += v;
+          a.sum_x += x;
+          a.min = std::min(a.min, v);
+          a.max = std::max(a.max, v);
+          a.lo[0] = std::min(a.lo[0], x);
+          a.hi[0] = std::max(a.hi[0], x + 1);
+        }
+
+        for (size_t k = 0; k < nlabels; k++) {
+          uint8_t l = row_labels[k];
+          Accumulator& a = acc[l];
+          a.voxels += row_count[l];
+          a.sum_y += uint64_t(y)*row_count[l];
+          a.sum_z += uint64_t(z)*row_count[l];
+          a.lo[1] = std::min(a.lo[1], y);
+          a.hi[1] = std::max(a.hi[1], y + 1);
+          a.lo[2] = std::min(a.lo[2], z);
+          a.hi[2] = std::max(a.hi[2], z + 1);
+          row_count[l] = 0;
+        }
+      }
+    }
+
+    std::lock_guard<std::mutex> lock(total_mutex);
+
+    for (size_t l = 0; l < kNumLabels; l++) {
+      Merge(acc[l], &total[l]);
+    }
+  }, nthreads);
+
+  std::array<size_t, 3> origin = img.Origin();
+  std::vector<RegionStats> stats;
+
+  for (size_t l = include_background ? 0 : 1; l < kNumLabels; l++) {
+    const Accumulator& a = total[l];
+
+    if (a.voxels == 0) {
+      continue;
+    }
+
+    double n = double(a.voxels);
+    RegionStats s;
+    s.label = int(l);
+    s.voxels = a.voxels;
+    s.mean = a.sum/n;
+    s.min = a.min;
+    s.max = a.max;
+    s.centroid = {{origin[0] + a.sum_x/n, origin[1] + a.sum_y/n,
+                   origin[2] + a.sum_z/n}};
+    s.box = BoundingBox{{{origin[0] + a.lo[0], origin[1] + a.lo[1],
+                          origin[2] + a.lo[2]}},
+                        {{origin[0] + a.hi[0], origin[1] + a.hi[1],
+                          origin[2] + a.hi[2]}}};
+    stats.push_back(s);
+  }
+
+  return stats;
+}
+
+}
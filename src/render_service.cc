@@ -0,0 +1,252 @@
+#include "render_service.h"
+#include <algorithm>
+#include "operations.h"
+#include "parallel.h"
+
+namespace imgvol {
+
+struct RenderService::Job {
+  Job(size_t viewport, RenderPriority priority, size_t width, size_t height,
+      size_t tile_rows, RowRenderer render)
+    : viewport(viewport)
+    , priority(priority)
+    , render(std::move(render))
+    , img(width, height)
+    , num_tiles((height + tile_rows - 1)/tile_rows)
+    , next_tile(0)
+    , in_flight(0)
+    , cancelled(false) {}
+
+  size_t viewport;
+  RenderPriority priority;
+  RowRenderer render;
+  ImgGray img;
+  size_t num_tiles;
+  size_t next_tile;
+  size_t in_flight;
+  bool cancelled;
+  std::exception_ptr error;
+  std::promise<ImgGray> promise;
+};
+
+// A volume and its normalized copy, made by whichever tile needs it first.
+// Holding the source keeps its buffer alive, so a volume sharing that
+// buffer is known to have the same voxels.
+struct RenderService::NormalizedVolume {
+  explicit NormalizedVolume(const ImgVol& source)
+    : source(source)
+    , normalized(0, 0, 0) {}
+
+  const ImgVol& Get() {
+    std::call_once(once, [this]() {
+      normalized = source;
+      NormalizeImage(normalized);
+    });
+
+    return normalized;
+  }
+
+  const ImgVol source;
+  ImgVol normalized;
+  std::once_flag once;
+};
+
+RenderService::RenderService(size_t nthreads, size_t tile_rows)
+  : tile_rows_(std::max<size_t>(tile_rows, 1))
+  , stop_(false) {
+  nthreads = NumThreads(nthreads);
+
+  for (size_t i = 0; i < nthreads; i++) {
+    workers_.emplace_back(&RenderService::Worker, this);
+  }
+}
+
+RenderService::~RenderService() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+    std::vector<std::shared_ptr<Job>> jobs = active_;
+
+    for (auto& job : jobs) {
+      CancelJob(job);
+    }
+  }
+
+  work_.notify_all();
+
+  for (auto& w : workers_) {
+    w.join();
+  }
+}
+
+std::future<ImgGray> RenderService::Submit(size_t viewport,
+                                           RenderPriority priority,
+                                           size_t width, size_t height,
+                                           RowRenderer render) {
+  auto job = std::make_shared<Job>(viewport, priority, width, height,
+                                   tile_rows_, std::move(render));
+  std::future<ImgGray> future = job->promise.get_future();
+
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::vector<std::shared_ptr<Job>> jobs = active_;
+
+    for (auto& old : jobs) {
+      if (old->viewport == viewport) {
+        CancelJob(old);
+      }
+    }
+
+    active_.push_back(job);
+
+    if (job->num_tiles == 0) {
+      FinishIfDone(job);
+      return future;
+    }
+
+    queues_[size_t(priority)].push_back(job);
+  }
+
+  work_.notify_all();
+  return future;
+}
+
+std::future<ImgGray> RenderService::MaxIntensionProjection(
+    size_t viewport, RenderPriority priority, ImgVol img, float delta_x,
+    float delta_y, std::array<float, 3> vet_normal) {
+  std::shared_ptr<NormalizedVolume> volume = Normalized(viewport, img);
+  float diagonal = Diagonal(std::array<float, 3>{(float) img.SizeX(),
+      (float) img.SizeY(), (float) img.SizeZ()});
+
+  return Submit(viewport, priority, diagonal, diagonal,
+                [volume, delta_x, delta_y, vet_normal](size_t row_begin,
+                                                       size_t row_end,
+                                                       ImgGray* out) {
+    MaxIntensionProjectionRows(volume->Get(), delta_x, delta_y, vet_normal,
+                               row_begin, row_end, out);
+  });
+}
+
+std::future<ImgGray> RenderService::CortePlanar(size_t viewport,
+                                                RenderPriority priority,
+                                                ImgVol img,
+                                                std::array<float, 3> p1,
+                                                std::array<float, 3> vec) {
+  float diagonal = Diagonal(std::array<float, 3>{(float) img.SizeX(),
+      (float) img.SizeY(), (float) img.SizeZ()});
+
+  return Submit(viewport, priority, diagonal, diagonal,
+                [img, p1, vec](size_t row_begin, size_t row_end,
+                               ImgGray* out) {
+    CortePlanarRows(img, p1, vec, row_begin, row_end, out);
+  });
+}
+
+std::shared_ptr<RenderService::NormalizedVolume> RenderService::Normalized(
+    size_t viewport, const ImgVol& img) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  std::shared_ptr<NormalizedVolume>& cached = normalized_[viewport];
+
+  if (!cached || cached->source.Data() != img.Data() ||
+      cached->source.SizeX() != img.SizeX() ||
+      cached->source.SizeY() != img.SizeY() ||
+      cached->source.SizeZ() != img.SizeZ()) {
+    cached = std::make_shared<NormalizedVolume>(img);
+  }
+
+  return cached;
+}
+
+void RenderService::Cancel(size_t viewport) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  std::vector<std::shared_ptr<Job>> jobs = active_;
+
+  for (auto& job : jobs) {
+    if (job->viewport == viewport) {
+      CancelJob(job);
+    }
+  }
+}
+
+// Called with the mutex held.
+void RenderService::CancelJob(const std::shared_ptr<Job>& job) {
+  job->cancelled = true;
+  auto& queue = queues_[size_t(job->priority)];
+  queue.erase(std::remove(queue.begin(), queue.end(), job), queue.end());
+  FinishIfDone(job);
+}
+
+// Called with the mutex held. Fulfills the promise once no tile of the
+// job is running and either all tiles ran or the job was stopped.
+void RenderService::FinishIfDone(const std::shared_ptr<Job>& job) {
+  bool stopped = job->cancelled || job->error;
+
+  if (job->in_flight > 0 || (!stopped && job->next_tile < job->num_tiles)) {
+    return;
+  }
+
+  auto it = std::find(active_.begin(), active_.end(), job);
+
+  if (it == active_.end()) {
+    return;
+  }
+
+  active_.erase(it);
+
+  if (job->error) {
+    job->promise.set_exception(job->error);
+  } else if (job->cancelled) {
+    job->promise.set_exception(std::make_exception_ptr(RenderCancelled()));
+  } else {
+    job->promise.set_value(std::move(job->img));
+  }
+}
+
+void RenderService::Worker() {
+  std::unique_lock<std::mutex> lock(mutex_);
+
+  while (true) {
+    work_.wait(lock, [this]() {
+      return stop_ || !queues_[0].empty() || !queues_[1].empty();
+    });
+
+    auto& queue = queues_[0].empty() ? queues_[1] : queues_[0];
+
+    if (queue.empty()) {
+      return;
+    }
+
+    std::shared_ptr<Job> job = queue.front();
+    size_t tile = job->next_tile++;
+
+    if (job->next_tile == job->num_tiles) {
+      queue.pop_front();
+    }
+
+    job->in_flight++;
+    lock.unlock();
+
+    size_t row_begin = tile*tile_rows_;
+    size_t row_end = std::min(row_begin + tile_rows_, job->img.SizeY());
+    std::exception_ptr error;
+
+    try {
+      job->render(row_begin, row_end, &job->img);
+    } catch (...) {
+      error = std::current_exception();
+    }
+
+    lock.lock();
+    job->in_flight--;
+
+    if (error && !job->error) {
+      job->error = error;
+      auto& q = queues_[size_t(job->priority)];
+      q.erase(std::remove(q.begin(), q.end(), job), q.end());
+    }
+
+    FinishIfDone(job);
+  }
+}
+
+}
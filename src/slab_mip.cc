@@ -0,0 +1,212 @@
+#include "slab_mip.h"
+#include <algorithm>
+#include <stdexcept>
+#include <vector>
+#include "instrument.h"
+#include "operations.h"
+#include "parallel.h"
+
+namespace imgvol {
+
+namespace {
+
+// Contiguous voxels of one position along the axis are processed
+// together, in runs of at most this many.
+const size_t kRun = 4096;
+
+// The volume seen as [outer][n][inner] with the axis in the middle.
+struct Layout {
+  size_t outer;
+  size_t n;
+  size_t inner;
+};
+
+Layout AxisLayout(const ImgVol& img, ImgVol::Axis axis) {
+  size_t nx = img.SizeX();
+  size_t ny = img.SizeY();
+  size_t nz = img.SizeZ();
+
+  if (axis == ImgVol::Axis::aZ) {
+    return Layout{1, nz, nx*ny};
+  } else if (axis == ImgVol::Axis::aY) {
+    return Layout{nz, ny, nx};
+  }
+
+  return Layout{nz*ny, nx, 1};
+}
+
+// Slab MIP of the lines in [i0, i1) of one outer block. in and out may
+// alias: h is built from the input first, then out takes the forward
+// block max g, which is only read at or after the position being written.
+void SlabLines(const uint8_t* in, uint8_t* out, size_t n, size_t stride,
+               size_t i0, size_t i1, size_t thickness, uint8_t* h) {
+  size_t len = i1 - i0;
+
+  for (size_t k = n; k-- > 0;) {
+    const uint8_t* src = in + k*stride + i0;
+    uint8_t* dst = h + k*len;
+    bool block_end = k == n - 1 || (k + 1)%thickness == 0;
+
+    for (size_t i = 0; i < len; i++) {
+      dst[i] = block_end ? src[i] : std::max(src[i], dst[i + len]);
+    }
+  }
+
+  for (size_t k = 0; k < n; k++) {
+    const uint8_t* src = in + k*stride + i0;
+    uint8_t* dst = out + k*stride + i0;
+
+    if (k%thickness != 0) {
+      const uint8_t* prev = out + (k - 1)*stride + i0;
+
+      for (size_t i = 0; i < len; i++) {
+        dst[i] = std::max(src[i], prev[i]);
+      }
+    } else if (dst != src) {
+      std::copy(src, src + len, dst);
+    }
+  }
+
+  size_t before = (thickness - 1)/2;
+  size_t after = thickness/2;
+
+  for (size_t k = 0; k < n; k++) {
+    size_t s = k > before ? k - before : 0;
+    size_t e = std::min(k + after, n - 1);
+    uint8_t* dst = out + k*stride + i0;
+    const uint8_t* g = out + e*stride + i0;
+    const uint8_t* hs = h + s*len;
+
+    // A full window starting on a block boundary is g at its end. A
+    // clipped one lies in the first or last block, where g or h alone
+    // covers it. Otherwise it spans two blocks.
+    if (s%thickness == 0) {
+      std::copy(g, g + len, dst);
+    } else if (s/thickness == e/thickness) {
+      std::copy(hs, hs + len, dst);
+    } else {
+      for (size_t i = 0; i < len; i++) {
+        dst[i] = std::max(hs[i], g[i]);
+      }
+    }
+  }
+}
+
+}
+
+ImgVol SlabMip(const ImgVol& img, ImgVol::Axis axis, size_t thickness,
+               size_t nthreads) {
+  ImgVol out(0, 0, 0);
+  SlabMip(img, axis, thickness, &out, nthreads);
+  return out;
+}
+
+void SlabMip(const ImgVol& img, ImgVol::Axis axis, size_t thickness,
+             ImgVol* out, size_t nthreads) {
+  VIMAGE_SCOPED_TIMER(kSlabMip);
+
+  if (thickness == 0) {
+    throw std::invalid_argument("slab thickness must be at least 1");
+  }
+
+  if (out != &img) {
+    out->Resize(img.SizeX(), img.SizeY(), img.SizeZ());
+    out->SetOrigin(img.Origin());
+  }
+
+  Layout l = AxisLayout(img, axis);
+
+  if (img.NumVoxels() == 0) {
+    return;
+  }
+
+  // Taking the output pointer first keeps the input valid when out is img.
+  uint8_t* dst = out->Data();
+  const uint8_t* src = out == &img ? dst : img.Data();
+  size_t runs = (l.inner + kRun - 1)/kRun;
+  size_t block = l.n*l.inner;
+
+  ParallelFor(0, l.outer*runs, [&](size_t begin, size_t end) {
+    std::vector<uint8_t> h(l.n*std::min(l.inner, kRun));
+
+    for (size_t t = begin; t < end; t++) {
+      size_t o = t/runs;
+      size_t i0 = (t%runs)*kRun;
+      size_t i1 = std::min(i0 + kRun, l.inner);
+      SlabLines(src + o*block, dst + o*block, l.n, l.inner, i0, i1,
+                thickness, h.data());
+    }
+  }, nthreads);
+}
+
+Img2D SlabMipCut(const ImgVol& img, ImgVol::Axis axis, size_t pos,
+                 size_t thickness, bool w) {
+  Img2D img2d(0, 0);
+  SlabMipCut(img, axis, pos, thickness, w, &img2d);
+  return img2d;
+}
+
+void SlabMipCut(const ImgVol& img, ImgVol::Axis axis, size_t pos,
+                size_t thickness, bool w, Img2D* out) {
+  VIMAGE_SCOPED_TIMER(kSlabMip);
+  Layout l = AxisLayout(img, axis);
+
+  if (thickness == 0) {
+    throw std::invalid_argument("slab thickness must be at least 1");
+  }
+
+  if (pos >= l.n) {
+    throw std::out_of_range("slab position outside the volume");
+  }
+
+  size_t s = pos > (thickness - 1)/2 ? pos - (thickness - 1)/2 : 0;
+  size_t e = std::min(pos + thickness/2, l.n - 1);
+
+  // Same layout as Cut: z-axis cuts are x by y, the others z by y or z
+  // by x, with the first image axis flipped when w is set.
+  size_t s1, s2;
+
+  if (axis == ImgVol::Axis::aZ) {
+    s1 = img.SizeX();
+    s2 = img.SizeY();
+  } else if (axis == ImgVol::Axis::aX) {
+    s1 = img.SizeZ();
+    s2 = img.SizeY();
+  } else {
+    s1 = img.SizeZ();
+    s2 = img.SizeX();
+  }
+
+  out->Resize(s1, s2);
+  std::fill(out->Data(), out->Data() + s1*s2, 0);
+  VIMAGE_COUNT(kCutPixels, s1*s2);
+
+  for (size_t k = s; k <= e; k++) {
+    for (size_t j = 0; j < s2; j++) {
+      for (size_t i = 0; i < s1; i++) {
+        size_t a = w ? s1 - i - 1 : i;
+        int v;
+
+        if (axis == ImgVol::Axis::aZ) {
+          v = img(a, j, k);
+        } else if (axis == ImgVol::Axis::aX) {
+          v = img(k, j, a);
+        } else {
+          v = img(j, k, a);
+        }
+
+        int& p = (*out)[j*s1 + i];
+        p = std::max(p, v);
+      }
+    }
+  }
+}
+
+void ReformataSlabMip(const ImgVol& img, size_t n, std::array<float, 3> p1,
+                      std::array<float, 3> pn, size_t thickness,
+                      ImgVol* out, size_t nthreads) {
+  ReformataImg(img, n, p1, pn, out);
+  SlabMip(*out, ImgVol::Axis::aZ, thickness, out, nthreads);
+}
+
+}
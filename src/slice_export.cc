@@ -0,0 +1,192 @@
+#include "slice_export.h"
+#include <algorithm>
+#include <chrono>
+#include <exception>
+#include <fstream>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+#include "bounded_queue.h"
+#include "operations.h"
+#include "parallel.h"
+
+namespace imgvol {
+
+namespace {
+
+struct Slice {
+  size_t pos;
+  Img2D img;
+};
+
+struct GraySlice {
+  size_t pos;
+  ImgGray img;
+};
+
+struct EncodedSlice {
+  size_t pos;
+  std::vector<uint8_t> png;
+};
+
+size_t AxisSize(const ImgVol& img, ImgVol::Axis axis) {
+  if (axis == ImgVol::Axis::aX) {
+    return img.SizeX();
+  } else if (axis == ImgVol::Axis::aY) {
+    return img.SizeY();
+  }
+
+  return img.SizeZ();
+}
+
+ImgGray ToGray(const Img2D& img) {
+  std::vector<uint8_t> gray(img.NumPixels());
+  const int* data = img.Data();
+
+  for (size_t i = 0; i < gray.size(); i++) {
+    gray[i] = uint8_t(std::min(std::max(data[i], 0), 255));
+  }
+
+  return ImgGray(gray.data(), img.SizeX(), img.SizeY());
+}
+
+}
+
+SliceExportStats ExportSlices(const ImgVol& img, ImgVol::Axis axis,
+                              size_t first, size_t last,
+                              const std::string& prefix,
+                              const SliceExportOptions& opts) {
+  last = std::min(last, AxisSize(img, axis));
+
+  SliceExportStats stats = {0, 0, 0};
+
+  if (first >= last) {
+    return stats;
+  }
+
+  auto start = std::chrono::steady_clock::now();
+
+  BoundedQueue<Slice> cut_queue(opts.queue_depth);
+  BoundedQueue<GraySlice> gray_queue(opts.queue_depth);
+  BoundedQueue<EncodedSlice> png_queue(opts.queue_depth);
+
+  std::exception_ptr error;
+  std::mutex error_mutex;
+
+  // On failure every queue is closed, so blocked stages wake up and stop.
+  auto fail = [&]() {
+    {
+      std::lock_guard<std::mutex> lock(error_mutex);
+
+      if (!error) {
+        error = std::current_exception();
+      }
+    }
+
+    cut_queue.Close();
+    gray_queue.Close();
+    png_queue.Close();
+  };
+
+  std::thread cutter([&]() {
+    try {
+      for (size_t pos = first; pos < last; pos++) {
+        if (!cut_queue.Push(Slice{pos, Cut(img, axis, pos, opts.w)})) {
+          break;
+        }
+      }
+    } catch (...) {
+      fail();
+    }
+
+    cut_queue.Close();
+  });
+
+  std::thread windower([&]() {
+    try {
+      Slice slice{0, Img2D(0, 0)};
+
+      while (cut_queue.Pop(&slice)) {
+        if (opts.window) {
+          opts.window(slice.img);
+        }
+
+        if (!gray_queue.Push(GraySlice{slice.pos, ToGray(slice.img)})) {
+          break;
+        }
+      }
+    } catch (...) {
+      fail();
+    }
+
+    gray_queue.Close();
+  });
+
+  size_t nencoders = std::max(NumThreads(opts.nthreads), size_t(3)) - 2;
+  std::vector<std::thread> encoders;
+
+  for (size_t t = 0; t < nencoders; t++) {
+    encoders.emplace_back([&]() {
+      try {
+        GraySlice slice{0, ImgGray(0, 0)};
+
+        while (gray_queue.Pop(&slice)) {
+          if (!png_queue.Push(EncodedSlice{slice.pos,
+                                           EncodePng(slice.img, opts.png)})) {
+            break;
+          }
+        }
+      } catch (...) {
+        fail();
+      }
+    });
+  }
+
+  std::thread closer([&]() {
+    for (auto& e : encoders) {
+      e.join();
+    }
+
+    png_queue.Close();
+  });
+
+  // Files are written from the calling thread, one at a time.
+  try {
+    EncodedSlice slice;
+
+    while (png_queue.Pop(&slice)) {
+      std::string file_name = prefix + std::to_string(slice.pos) + ".png";
+      std::ofstream fout;
+      fout.open(file_name, std::ios::binary | std::ios::out);
+      fout.write(reinterpret_cast<const char*>(slice.png.data()),
+                 slice.png.size());
+      fout.close();
+
+      if (!fout) {
+        throw std::runtime_error("can't write file: " + file_name);
+      }
+
+      stats.slices++;
+    }
+  } catch (...) {
+    fail();
+  }
+
+  cutter.join();
+  windower.join();
+  closer.join();
+
+  if (error) {
+    std::rethrow_exception(error);
+  }
+
+  std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+  stats.seconds = elapsed.count();
+  stats.slices_per_sec = stats.seconds > 0 ? stats.slices/stats.seconds : 0;
+
+  return stats;
+}
+
+}
@@ -0,0 +1,339 @@
+#include "time_series.h"
+#include <algorithm>
+#include <stdexcept>
+#include "brick_file.h"
+#include "operations.h"
+#include "parallel.h"
+
+namespace imgvol {
+
+TimeSeries::TimeSeries(size_t xsize, size_t ysize, size_t zsize,
+                       const TimeSeriesOptions& opts)
+  : xsize_(xsize)
+  , ysize_(ysize)
+  , zsize_(zsize)
+  , opts_(opts)
+  , last_key_(0, 0, 0)
+  , voxel_size_{{1, 1, 1}}
+  , origin_{{0, 0, 0}}
+  , stop_(false) {
+  opts_.keyframe_interval = std::max<size_t>(opts_.keyframe_interval, 1);
+  opts_.slab_slices = std::max<size_t>(opts_.slab_slices, 1);
+  opts_.cache_frames = std::max<size_t>(opts_.cache_frames, 1);
+  prefetcher_ = std::thread(&TimeSeries::PrefetchLoop, this);
+}
+
+TimeSeries::~TimeSeries() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+
+  changed_.notify_all();
+  prefetcher_.join();
+}
+
+size_t TimeSeries::NumSlabs() const noexcept {
+  return (zsize_ + opts_.slab_slices - 1)/opts_.slab_slices;
+}
+
+size_t TimeSeries::SlabBytes(size_t s) const noexcept {
+  size_t z0 = s*opts_.slab_slices;
+  return (std::min(z0 + opts_.slab_slices, zsize_) - z0)*xsize_*ysize_;
+}
+
+void TimeSeries::Append(const ImgVol& frame) {
+  if (frame.SizeX() != xsize_ || frame.SizeY() != ysize_ ||
+      frame.SizeZ() != zsize_) {
+    throw std::invalid_argument("frame size differs from the series");
+  }
+
+  size_t t = NumFrames();
+  std::array<float, 3> voxel_size = {{frame.DimX(), frame.DimY(),
+                                      frame.DimZ()}};
+
+  if (t == 0) {
+    voxel_size_ = voxel_size;
+    origin_ = frame.Origin();
+  } else if (voxel_size != voxel_size_ || frame.Origin() != origin_) {
+    throw std::invalid_argument(
+        "frame voxel size or origin differs from the series");
+  }
+
+  bool key = t%opts_.keyframe_interval == 0;
+  EncodedFrame encoded{key ? t : t - t%opts_.keyframe_interval,
+                       std::vector<std::vector<uint8_t>>(NumSlabs())};
+  size_t slab = opts_.slab_slices*xsize_*ysize_;
+  const uint8_t* data = frame.Data();
+  const uint8_t* base = last_key_.Data();
+
+  ParallelFor(0, NumSlabs(), [&](size_t s0, size_t s1) {
+    std::vector<uint8_t> diff;
+
+    for (size_t s = s0; s < s1; s++) {
+      const uint8_t* src = data + s*slab;
+      size_t n = SlabBytes(s);
+
+      if (key) {
+        encoded.slabs[s] = CompressBrick(src, n, opts_.level);
+        continue;
+      }
+
+      // Differences modulo 256, slabs equal to the keyframe stay empty.
+      const uint8_t* ref = base + s*slab;
+      diff.resize(n);
+      bool changed = false;
+
+      for (size_t i = 0; i < n; i++) {
+        diff[i] = uint8_t(src[i] - ref[i]);
+        changed |= diff[i] != 0;
+      }
+
+      if (changed) {
+        encoded.slabs[s] = CompressBrick(diff.data(), n, opts_.level);
+      }
+    }
+  }, opts_.nthreads);
+
+  if (key) {
+    last_key_ = frame;
+  }
+
+  auto ptr = std::make_shared<const EncodedFrame>(std::move(encoded));
+  std::lock_guard<std::mutex> lock(mutex_);
+  frames_.push_back(std::move(ptr));
+}
+
+size_t TimeSeries::NumFrames() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return frames_.size();
+}
+
+size_t TimeSeries::SizeX() const noexcept {
+  return xsize_;
+}
+
+size_t TimeSeries::SizeY() const noexcept {
+  return ysize_;
+}
+
+size_t TimeSeries::SizeZ() const noexcept {
+  return zsize_;
+}
+
+size_t TimeSeries::EncodedBytes() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  size_t bytes = 0;
+
+  for (const auto& frame : frames_) {
+    for (const auto& s : frame->slabs) {
+      bytes += s.size();
+    }
+  }
+
+  return bytes;
+}
+
+// Frame t and its keyframe, the same frame for keyframes.
+void TimeSeries::Encoded(size_t t, EncodedPtr* frame, EncodedPtr* key) const {
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  if (t >= frames_.size()) {
+    throw std::out_of_range("frame index out of range");
+  }
+
+  *frame = frames_[t];
+  *key = frames_[(*frame)->key];
+}
+
+// Decode slab s of frame into dst. key_img is the decoded keyframe when
+// available, otherwise the slab of key is decompressed too.
+void TimeSeries::DecodeSlab(const EncodedFrame& frame,
+                            const EncodedFrame& key, size_t s,
+                            const ImgVol* key_img, uint8_t* dst) const {
+  size_t n = SlabBytes(s);
+
+  if (key_img) {
+    const uint8_t* src = key_img->Data() + s*opts_.slab_slices*xsize_*ysize_;
+    std::copy(src, src + n, dst);
+  } else {
+    const std::vector<uint8_t>& k = key.slabs[s];
+    DecompressBrick(k.data(), k.size(), dst, n);
+  }
+
+  if (&frame == &key || frame.slabs[s].empty()) {
+    return;
+  }
+
+  std::vector<uint8_t> diff(n);
+  DecompressBrick(frame.slabs[s].data(), frame.slabs[s].size(), diff.data(),
+                  n);
+
+  for (size_t i = 0; i < n; i++) {
+    dst[i] = uint8_t(dst[i] + diff[i]);
+  }
+}
+
+// Decode frame t, reusing its keyframe when it is cached.
+ImgVol TimeSeries::Decode(size_t t) {
+  EncodedPtr frame;
+  EncodedPtr key;
+  Encoded(t, &frame, &key);
+
+  ImgVol key_img(0, 0, 0);
+  bool have_key = frame != key && Cached(frame->key, &key_img);
+
+  ImgVol img(xsize_, ysize_, zsize_);
+  img.SetVoxelSize(voxel_size_[0], voxel_size_[1], voxel_size_[2]);
+  img.SetOrigin(origin_);
+  uint8_t* dst = img.Data();
+  size_t slab = opts_.slab_slices*xsize_*ysize_;
+
+  ParallelFor(0, NumSlabs(), [&](size_t s0, size_t s1) {
+    for (size_t s = s0; s < s1; s++) {
+      DecodeSlab(*frame, *key, s, have_key ? &key_img : nullptr,
+                 dst + s*slab);
+    }
+  }, opts_.nthreads);
+
+  return img;
+}
+
+bool TimeSeries::Cached(size_t t, ImgVol* img) {
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  for (auto it = cache_.begin(); it != cache_.end(); ++it) {
+    if (it->first == t) {
+      cache_.splice(cache_.begin(), cache_, it);
+      *img = it->second;
+      return true;
+    }
+  }
+
+  return false;
+}
+
+// Called with the mutex held.
+void TimeSeries::Insert(size_t t, const ImgVol& img) {
+  cache_.emplace_front(t, img);
+
+  while (cache_.size() > opts_.cache_frames) {
+    cache_.pop_back();
+  }
+}
+
+ImgVol TimeSeries::Frame(size_t t) {
+  if (t >= NumFrames()) {
+    throw std::out_of_range("frame index out of range");
+  }
+
+  if (opts_.prefetch && t + 1 < NumFrames()) {
+    Prefetch(t + 1);
+  }
+
+  ImgVol img(0, 0, 0);
+
+  {
+    // Wait for the prefetcher instead of decoding the same frame twice.
+    std::unique_lock<std::mutex> lock(mutex_);
+    changed_.wait(lock, [this, t]() {
+      return decoding_.count(t) == 0;
+    });
+  }
+
+  if (Cached(t, &img)) {
+    return img;
+  }
+
+  img = Decode(t);
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  Insert(t, img);
+  return img;
+}
+
+Img2D TimeSeries::Cut(size_t t, ImgVol::Axis axis, size_t pos, bool w) {
+  if (t >= NumFrames()) {
+    throw std::out_of_range("frame index out of range");
+  }
+
+  ImgVol img(0, 0, 0);
+
+  if (Cached(t, &img)) {
+    return imgvol::Cut(img, axis, pos, w);
+  }
+
+  if (axis != ImgVol::Axis::aZ || pos >= zsize_) {
+    return imgvol::Cut(Frame(t), axis, pos, w);
+  }
+
+  EncodedPtr frame;
+  EncodedPtr key;
+  Encoded(t, &frame, &key);
+
+  size_t s = pos/opts_.slab_slices;
+  size_t z0 = s*opts_.slab_slices;
+  ImgVol slab(xsize_, ysize_, SlabBytes(s)/(xsize_*ysize_));
+  slab.SetVoxelSize(voxel_size_[0], voxel_size_[1], voxel_size_[2]);
+  slab.SetOrigin({{origin_[0], origin_[1], origin_[2] + z0}});
+  DecodeSlab(*frame, *key, s, nullptr, slab.Data());
+  return imgvol::Cut(slab, axis, pos - z0, w);
+}
+
+void TimeSeries::Prefetch(size_t t) {
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  if (t >= frames_.size() || decoding_.count(t) > 0 ||
+      std::find(prefetch_.begin(), prefetch_.end(), t) != prefetch_.end()) {
+    return;
+  }
+
+  for (const auto& e : cache_) {
+    if (e.first == t) {
+      return;
+    }
+  }
+
+  prefetch_.push_back(t);
+  changed_.notify_all();
+}
+
+void TimeSeries::PrefetchLoop() {
+  std::unique_lock<std::mutex> lock(mutex_);
+
+  while (true) {
+    changed_.wait(lock, [this]() {
+      return stop_ || !prefetch_.empty();
+    });
+
+    if (stop_) {
+      return;
+    }
+
+    size_t t = prefetch_.front();
+    prefetch_.pop_front();
+    decoding_.insert(t);
+    lock.unlock();
+
+    ImgVol img(0, 0, 0);
+    bool ok = true;
+
+    try {
+      img = Decode(t);
+    } catch (...) {
+      // A failed prefetch is retried, and reported, by Frame().
+      ok = false;
+    }
+
+    lock.lock();
+
+    if (ok) {
+      Insert(t, img);
+    }
+
+    decoding_.erase(t);
+    changed_.notify_all();
+  }
+}
+
+}
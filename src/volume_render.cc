@@ -0,0 +1,195 @@
+#include "volume_render.h"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <stdexcept>
+#include "arena.h"
+#include "instrument.h"
+#include "parallel.h"
+#include "ray_camera.h"
+#include "sampler.h"
+
+namespace imgvol {
+
+namespace {
+
+// Largest absolute coordinate of d, the extent of the ray along its major
+// axis. Rays are sampled once per voxel along that axis.
+float MajorAxis(std::array<float, 3> d) {
+  return std::max(std::abs(d[0]), std::max(std::abs(d[1]), std::abs(d[2])));
+}
+
+// Samples fetched at once along a ray. Short, so rays that terminate
+// early don't fetch much past their last sample.
+const size_t kRayChunk = 16;
+
+uint8_t ToByte(float v) {
+  return uint8_t(std::min(255.0f, std::max(0.0f, v*255 + 0.5f)));
+}
+
+}
+
+TransferLut BuildTransferLut(std::vector<TfPoint> points) {
+  if (points.empty()) {
+    throw std::invalid_argument("transfer function without points");
+  }
+
+  std::stable_sort(points.begin(), points.end(),
+                   [](const TfPoint& a, const TfPoint& b) {
+    return a.intensity < b.intensity;
+  });
+
+  TransferLut lut;
+  size_t k = 0;
+
+  for (int i = 0; i < 256; i++) {
+    while (k + 1 < points.size() && points[k + 1].intensity <= i) {
+      k++;
+    }
+
+    const TfPoint& a = points[k];
+
+    if (i <= a.intensity || k + 1 == points.size()) {
+      lut[i] = a.rgba;
+      continue;
+    }
+
+    const TfPoint& b = points[k + 1];
+    float t = float(i - a.intensity)/(b.intensity - a.intensity);
+
+    for (int c = 0; c < 4; c++) {
+      lut[i][c] = a.rgba[c] + t*(b.rgba[c] - a.rgba[c]);
+    }
+  }
+
+  return lut;
+}
+
+ImgColor VolumeRender(const ImgVol& img, float delta_x, float delta_y,
+                      std::array<float, 3> vet_normal, const TransferLut& lut,
+                      const DvrOptions& opts) {
+  ImgColor img_out(0, 0);
+  VolumeRender(img, delta_x, delta_y, vet_normal, lut, opts, &img_out);
+  return img_out;
+}
+
+void VolumeRender(const ImgVol& img, float delta_x, float delta_y,
+                  std::array<float, 3> vet_normal, const TransferLut& lut,
+                  const DvrOptions& opts, ImgColor* out) {
+  VIMAGE_SCOPED_TIMER(kVolumeRender);
+  RayCamera camera(img, delta_x, delta_y, vet_normal);
+  out->Resize(camera.Width(), camera.Height());
+
+  size_t width = out->SizeX();
+  size_t height = out->SizeY();
+  using Sampler = NearestSampler<ClampBorder>;
+  Sampler sampler(img);
+
+  // Every ray is parallel, so the step length is the same for all of them
+  // and the opacity correction alpha' = 1 - (1 - alpha)^step is folded in
+  // the table once, with the colors premultiplied.
+  std::array<float, 3> dir = camera.Direction();
+  float step = 1/MajorAxis(dir);
+
+  TransferLut table;
+
+  for (size_t i = 0; i < table.size(); i++) {
+    float alpha = 1 - std::pow(1 - std::min(1.0f, lut[i][3]), step);
+
+    for (int c = 0; c < 3; c++) {
+      table[i][c] = lut[i][c]*alpha;
+    }
+
+    table[i][3] = alpha;
+  }
+
+  size_t tile = std::max<size_t>(opts.tile_size, 1);
+  size_t tiles_x = (width + tile - 1)/tile;
+  size_t num_tiles = tiles_x*((height + tile - 1)/tile);
+  std::atomic<size_t> next_tile(0);
+  size_t nthreads = NumThreads(opts.nthreads);
+
+  ParallelFor(0, nthreads, [&](size_t, size_t) {
+    size_t rays = 0;
+    size_t samples = 0;
+
+    // A row of a tile is shaded into one array per channel and stored
+    // whole.
+    ArenaScope scope;
+    uint8_t* row_b = Arena::Local().Allocate<uint8_t>(3*tile);
+    uint8_t* row_g = row_b + tile;
+    uint8_t* row_r = row_g + tile;
+    float px[kRayChunk], py[kRayChunk], pz[kRayChunk];
+    uint8_t values[kRayChunk];
+
+    for (size_t t = next_tile++; t < num_tiles; t = next_tile++) {
+      size_t x0 = (t%tiles_x)*tile;
+      size_t y0 = (t/tiles_x)*tile;
+      size_t x1 = std::min(x0 + tile, width);
+      size_t y1 = std::min(y0 + tile, height);
+
+      for (size_t y = y0; y < y1; y++) {
+        for (size_t x = x0; x < x1; x++) {
+          // The camera indexes pixels as (i, j) = (column, row).
+          std::array<float, 4> acc = {{0, 0, 0, 0}};
+          std::array<float, 3> a;
+          std::array<float, 3> b;
+
+          if (camera.Clip(x, y, &a, &b)) {
+            std::array<float, 3> d = {b[0] - a[0], b[1] - a[1], b[2] - a[2]};
+            float m = MajorAxis(d);
+            size_t n = size_t(m) + 1;
+
+            if (m > 0) {
+              d = {d[0]/m, d[1]/m, d[2]/m};
+            }
+
+            // The end points are voxel indices, the sampler takes voxel i
+            // as [i, i + 1), so each sample reads the voxel nearest to its
+            // point on the ray.
+            bool opaque = false;
+
+            for (size_t k0 = 0; k0 < n && !opaque; k0 += kRayChunk) {
+              size_t m = std::min(kRayChunk, n - k0);
+
+              for (size_t k = 0; k < m; k++) {
+                px[k] = Sampler::Coordinate(a[0] + (k0 + k)*d[0] + 0.5f);
+                py[k] = Sampler::Coordinate(a[1] + (k0 + k)*d[1] + 0.5f);
+                pz[k] = Sampler::Coordinate(a[2] + (k0 + k)*d[2] + 0.5f);
+              }
+
+              sampler.Sample(px, py, pz, m, values);
+
+              for (size_t k = 0; k < m && !opaque; k++) {
+                const std::array<float, 4>& s = table[values[k]];
+                float w = 1 - acc[3];
+
+                acc[0] += w*s[0];
+                acc[1] += w*s[1];
+                acc[2] += w*s[2];
+                acc[3] += w*s[3];
+                samples++;
+                opaque = acc[3] >= opts.opacity_threshold;
+              }
+            }
+
+            rays++;
+          }
+
+          float w = 1 - acc[3];
+
+          row_b[x - x0] = ToByte(acc[2] + w*opts.background[2]);
+          row_g[x - x0] = ToByte(acc[1] + w*opts.background[1]);
+          row_r[x - x0] = ToByte(acc[0] + w*opts.background[0]);
+        }
+
+        out->WriteRow(y, x0, x1 - x0, row_b, row_g, row_r);
+      }
+    }
+
+    VIMAGE_COUNT(kRaysCast, rays);
+    VIMAGE_COUNT(kRaySamples, samples);
+  }, nthreads);
+}
+
+}
@@ -0,0 +1,184 @@
+#include "voxel_memory.h"
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <sched.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "parallel.h"
+
+#ifdef VIMAGE_HAVE_NUMA
+#include <numa.h>
+#endif
+
+namespace imgvol {
+
+namespace {
+
+const size_t kHugePage = 2 << 20;
+const size_t kCacheLine = 64;
+
+size_t PageSize() {
+  static size_t page = size_t(std::max(1L, sysconf(_SC_PAGESIZE)));
+  return page;
+}
+
+// Buffers of at least a page are mapped whole pages, which NUMA policies
+// and madvise need, the smaller ones come from the heap. The choice only
+// depends on the size, so FreeVoxels makes the same one.
+bool Mapped(size_t bytes) {
+  return bytes >= PageSize();
+}
+
+size_t MappedBytes(size_t bytes) {
+  return (bytes + PageSize() - 1)/PageSize()*PageSize();
+}
+
+std::mutex options_mutex;
+VoxelMemoryOptions options;
+
+// Binds the calling thread to a node for its lifetime and restores the
+// previous affinity afterwards.
+class NodeBinding {
+ public:
+  explicit NodeBinding(size_t node)
+    : bound_(false) {
+#ifdef VIMAGE_HAVE_NUMA
+    if (NumNumaNodes() > 1 &&
+        sched_getaffinity(0, sizeof(saved_), &saved_) == 0) {
+      bound_ = numa_run_on_node(int(node)) == 0;
+    }
+#else
+    (void) node;
+#endif
+  }
+
+  NodeBinding(const NodeBinding&) = delete;
+
+  NodeBinding& operator=(const NodeBinding&) = delete;
+
+  ~NodeBinding() {
+    if (bound_) {
+      sched_setaffinity(0, sizeof(saved_), &saved_);
+    }
+  }
+
+ private:
+  bool bound_;
+  cpu_set_t saved_;
+};
+
+}
+
+void SetVoxelMemoryOptions(const VoxelMemoryOptions& opts) {
+  std::lock_guard<std::mutex> lock(options_mutex);
+  options = opts;
+}
+
+VoxelMemoryOptions GetVoxelMemoryOptions() {
+  std::lock_guard<std::mutex> lock(options_mutex);
+  return options;
+}
+
+size_t NumNumaNodes() {
+#ifdef VIMAGE_HAVE_NUMA
+  static size_t nodes = numa_available() < 0 ? 1 :
+      size_t(std::max(1, numa_max_node() + 1));
+  return nodes;
+#else
+  return 1;
+#endif
+}
+
+size_t SlabNode(size_t z, size_t zsize) {
+  return zsize == 0 ? 0 : z*NumNumaNodes()/zsize;
+}
+
+void* AllocateVoxels(size_t bytes) {
+  if (!Mapped(bytes)) {
+    void* p = nullptr;
+
+    if (posix_memalign(&p, kCacheLine, std::max<size_t>(bytes, 1)) != 0) {
+      throw std::bad_alloc();
+    }
+
+    return p;
+  }
+
+  VoxelMemoryOptions opts = GetVoxelMemoryOptions();
+  size_t size = MappedBytes(bytes);
+  void* p = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+  if (p == MAP_FAILED) {
+    throw std::bad_alloc();
+  }
+
+  // The kernel backs the 2 MiB aligned parts of the mapping with huge
+  // pages.
+#ifdef MADV_HUGEPAGE
+  if (opts.huge_pages && bytes >= kHugePage) {
+    madvise(p, size, MADV_HUGEPAGE);
+  }
+#endif
+
+#ifdef VIMAGE_HAVE_NUMA
+  if (opts.placement == VoxelPlacement::kInterleave && NumNumaNodes() > 1) {
+    numa_interleave_memory(p, size, numa_all_nodes_ptr);
+  }
+#else
+  (void) opts;
+#endif
+
+  return p;
+}
+
+void FreeVoxels(void* p, size_t bytes) noexcept {
+  if (p == nullptr) {
+    return;
+  }
+
+  if (Mapped(bytes)) {
+    munmap(p, MappedBytes(bytes));
+  } else {
+    std::free(p);
+  }
+}
+
+void PlaceVoxels(uint8_t* data, size_t slice_bytes, size_t zsize) {
+  if (GetVoxelMemoryOptions().placement != VoxelPlacement::kSlabs ||
+      NumNumaNodes() == 1) {
+    std::memset(data, 0, slice_bytes*zsize);
+    return;
+  }
+
+  ParallelForSlabs(0, zsize, zsize, [&](size_t z0, size_t z1) {
+    std::memset(data + z0*slice_bytes, 0, (z1 - z0)*slice_bytes);
+  });
+}
+
+void ParallelForSlabs(size_t zbegin, size_t zend, size_t zsize,
+                      const std::function<void(size_t, size_t)>& fn,
+                      size_t nthreads) {
+  size_t nodes = NumNumaNodes();
+
+  if (nodes == 1 ||
+      GetVoxelMemoryOptions().placement != VoxelPlacement::kSlabs) {
+    ParallelFor(zbegin, zend, fn, nthreads);
+    return;
+  }
+
+  // Round the thread count to a multiple of the nodes, so chunk
+  // boundaries follow the slab boundaries.
+  nthreads = NumThreads(nthreads);
+  nthreads = std::max(nodes, nthreads - nthreads%nodes);
+
+  ParallelFor(zbegin, zend, [&](size_t z0, size_t z1) {
+    NodeBinding binding(SlabNode((z0 + z1 - 1)/2, zsize));
+    fn(z0, z1);
+  }, nthreads);
+}
+
+}
@@ -0,0 +1,344 @@
+#include <algorithm>
+#include <random>
+#include <stdexcept>
+#include <vector>
+#include "bit_mask.h"
+#include "check.h"
+#include "operations.h"
+#include "ray_camera.h"
+#include "voxel_traversal.h"
+
+// Bit-packed masks against plain byte volumes: morphology by testing
+// every neighbour of every voxel, counts, masks from thresholds and
+// labels, cuts, and the masked MIP against a walk of each ray. Widths
+// around and past 64 exercise the last, partial word of each row.
+
+namespace {
+
+using imgvol::BitMask;
+using imgvol::Connectivity;
+using imgvol::ImgVol;
+
+// One byte per voxel, 0 or 1.
+struct Bytes {
+  size_t x, y, z;
+  std::vector<uint8_t> v;
+
+  uint8_t At(long i, long j, long k, uint8_t outside) const {
+    if (i < 0 || j < 0 || k < 0 || i >= long(x) || j >= long(y) ||
+        k >= long(z)) {
+      return outside;
+    }
+
+    return v[(k*y + j)*x + i];
+  }
+};
+
+Bytes RandomBytes(size_t x, size_t y, size_t z, double density,
+                  std::mt19937* rng) {
+  Bytes b = {x, y, z, std::vector<uint8_t>(x*y*z)};
+  std::bernoulli_distribution set(density);
+
+  for (uint8_t& v : b.v) {
+    v = set(*rng);
+  }
+
+  return b;
+}
+
+BitMask ToMask(const Bytes& b) {
+  BitMask mask(b.x, b.y, b.z);
+
+  for (size_t k = 0; k < b.z; k++) {
+    for (size_t j = 0; j < b.y; j++) {
+      for (size_t i = 0; i < b.x; i++) {
+        mask.Set(b.v[(k*b.y + j)*b.x + i], i, j, k);
+      }
+    }
+  }
+
+  return mask;
+}
+
+// Same voxels, and the bits past the end of each row still clear.
+bool Same(const BitMask& mask, const Bytes& b) {
+  if (mask.SizeX() != b.x || mask.SizeY() != b.y || mask.SizeZ() != b.z) {
+    return false;
+  }
+
+  for (size_t k = 0; k < b.z; k++) {
+    for (size_t j = 0; j < b.y; j++) {
+      const uint64_t* row = mask.Row(j, k);
+
+      if (row[mask.WordsPerRow() - 1] & ~mask.LastWordMask()) {
+        return false;
+      }
+
+      for (size_t i = 0; i < b.x; i++) {
+        if (mask(i, j, k) != bool(b.v[(k*b.y + j)*b.x + i])) {
+          return false;
+        }
+      }
+    }
+  }
+
+  return true;
+}
+
+bool Neighbour(int dx, int dy, int dz, Connectivity conn) {
+  int n = (dx != 0) + (dy != 0) + (dz != 0);
+  return n <= (conn == Connectivity::k6 ? 1 :
+               conn == Connectivity::k18 ? 2 : 3);
+}
+
+// Dilation sets a voxel when any neighbour is set, erosion keeps it when
+// every neighbour is set. Outside the volume reads as the identity of
+// each.
+Bytes Morph(const Bytes& b, Connectivity conn, bool dilate) {
+  Bytes out = b;
+
+  for (size_t k = 0; k < b.z; k++) {
+    for (size_t j = 0; j < b.y; j++) {
+      for (size_t i = 0; i < b.x; i++) {
+        bool v = !dilate;
+
+        for (int dz = -1; dz <= 1; dz++) {
+          for (int dy = -1; dy <= 1; dy++) {
+            for (int dx = -1; dx <= 1; dx++) {
+              if (Neighbour(dx, dy, dz, conn)) {
+                uint8_t n = b.At(long(i) + dx, long(j) + dy, long(k) + dz,
+                                 !dilate);
+                v = dilate ? v || n : v && n;
+              }
+            }
+          }
+        }
+
+        out.v[(k*b.y + j)*b.x + i] = v;
+      }
+    }
+  }
+
+  return out;
+}
+
+void TestMorphology(const Bytes& b, size_t nthreads) {
+  BitMask mask = ToMask(b);
+  CHECK(Same(mask, b));
+
+  for (Connectivity conn : {Connectivity::k6, Connectivity::k18,
+                            Connectivity::k26}) {
+    Bytes dilated = Morph(b, conn, true);
+    Bytes eroded = Morph(b, conn, false);
+    BitMask out(1, 1, 1);
+
+    imgvol::Dilate(mask, conn, &out, nthreads);
+    CHECK(Same(out, dilated));
+    imgvol::Erode(mask, conn, &out, nthreads);
+    CHECK(Same(out, eroded));
+    imgvol::Open(mask, conn, &out, nthreads);
+    CHECK(Same(out, Morph(eroded, conn, true)));
+    imgvol::Close(mask, conn, &out, nthreads);
+    CHECK(Same(out, Morph(dilated, conn, false)));
+
+    BitMask in_place = mask;
+    imgvol::Dilate(in_place, conn, &in_place, nthreads);
+    CHECK(Same(in_place, dilated));
+    in_place = mask;
+    imgvol::Erode(in_place, conn, &in_place, nthreads);
+    CHECK(Same(in_place, eroded));
+  }
+}
+
+ImgVol Random(size_t x, size_t y, size_t z, int max, std::mt19937* rng) {
+  ImgVol img(x, y, z);
+  std::uniform_int_distribution<int> dist(0, max);
+  uint8_t* data = img.Data();
+
+  for (size_t i = 0; i < img.NumVoxels(); i++) {
+    data[i] = dist(*rng);
+  }
+
+  return img;
+}
+
+// The highest voxel of the mask along each ray, 0 when the ray meets
+// none.
+bool SameMaskedMip(const ImgVol& img, const Bytes& b, float delta_x,
+                   float delta_y, std::array<float, 3> normal) {
+  BitMask mask = ToMask(b);
+  ImgVol normalized = img;
+  imgvol::ImgGray mip = imgvol::MaxIntensionProjection(
+      normalized, mask, delta_x, delta_y, normal, 2);
+  imgvol::RayCamera camera(normalized, delta_x, delta_y, normal);
+  const uint8_t* data = static_cast<const ImgVol&>(normalized).Data();
+
+  if (mip.SizeX() != camera.Width() || mip.SizeY() != camera.Height()) {
+    return false;
+  }
+
+  for (size_t y = 0; y < mip.SizeY(); y++) {
+    for (size_t x = 0; x < mip.SizeX(); x++) {
+      std::array<float, 3> p1;
+      std::array<float, 3> pn;
+      uint8_t max = 0;
+
+      if (camera.Clip(x, y, &p1, &pn)) {
+        for (imgvol::VoxelTraversal t(normalized, p1, pn); !t.Done();
+             t.Next()) {
+          if (b.v[t.Offset()]) {
+            max = std::max(max, data[t.Offset()]);
+          }
+        }
+      }
+
+      if (mip(x, y) != max) {
+        return false;
+      }
+    }
+  }
+
+  return true;
+}
+
+}
+
+int main() {
+  std::mt19937 rng(48);
+
+  for (size_t x : {1, 5, 63, 64, 65, 130}) {
+    for (double density : {0.05, 0.5, 0.9}) {
+      Bytes b = RandomBytes(x, 6, 5, density, &rng);
+
+      for (size_t nthreads : {1, 3}) {
+        TestMorphology(b, nthreads);
+      }
+
+      size_t count = 0;
+
+      for (uint8_t v : b.v) {
+        count += v;
+      }
+
+      CHECK(ToMask(b).Count() == count);
+    }
+  }
+
+  // Empty and full masks, the border must not erode a full one.
+  {
+    Bytes empty = {70, 3, 4, std::vector<uint8_t>(70*3*4, 0)};
+    Bytes full = {70, 3, 4, std::vector<uint8_t>(70*3*4, 1)};
+    BitMask out(1, 1, 1);
+    imgvol::Erode(ToMask(full), Connectivity::k26, &out);
+    CHECK(Same(out, full) && out.Count() == 70*3*4);
+    imgvol::Dilate(ToMask(empty), Connectivity::k26, &out);
+    CHECK(Same(out, empty) && out.Count() == 0);
+  }
+
+  // Masks from thresholds and labels, and back to a volume.
+  {
+    ImgVol img = Random(67, 9, 4, 255, &rng);
+    ImgVol labels = Random(67, 9, 4, 5, &rng);
+
+    for (size_t nthreads : {1, 3}) {
+      for (int lo : {0, 40, 200}) {
+        BitMask mask = imgvol::ThresholdMask(img, lo, 220, nthreads);
+        Bytes b = {67, 9, 4, std::vector<uint8_t>(img.NumVoxels())};
+
+        for (size_t i = 0; i < img.NumVoxels(); i++) {
+          uint8_t v = static_cast<const ImgVol&>(img).Data()[i];
+          b.v[i] = v >= lo && v <= 220;
+        }
+
+        CHECK(Same(mask, b));
+      }
+
+      for (int label : {0, 3, 9}) {
+        BitMask mask = imgvol::LabelMask(labels, label, nthreads);
+        Bytes b = {67, 9, 4, std::vector<uint8_t>(labels.NumVoxels())};
+
+        for (size_t i = 0; i < labels.NumVoxels(); i++) {
+          b.v[i] = static_cast<const ImgVol&>(labels).Data()[i] == label;
+        }
+
+        CHECK(Same(mask, b));
+
+        ImgVol vol(1, 1, 1);
+        imgvol::MaskToVolume(mask, 7, &vol);
+        bool same = vol.NumVoxels() == labels.NumVoxels();
+
+        for (size_t i = 0; same && i < vol.NumVoxels(); i++) {
+          same = static_cast<const ImgVol&>(vol).Data()[i] == 7*b.v[i];
+        }
+
+        CHECK(same);
+      }
+    }
+  }
+
+  // Cuts of a mask match cuts of the same mask as a volume.
+  {
+    Bytes b = RandomBytes(70, 11, 8, 0.4, &rng);
+    BitMask mask = ToMask(b);
+    ImgVol vol(1, 1, 1);
+    imgvol::MaskToVolume(mask, 1, &vol);
+
+    for (ImgVol::Axis axis : {ImgVol::Axis::aX, ImgVol::Axis::aY,
+                              ImgVol::Axis::aZ}) {
+      for (bool w : {false, true}) {
+        imgvol::Img2D cut = imgvol::Cut(mask, axis, 3, w);
+        imgvol::Img2D expected = imgvol::Cut(vol, axis, 3, w);
+        bool same = cut.SizeX() == expected.SizeX() &&
+                    cut.SizeY() == expected.SizeY();
+
+        for (size_t i = 0; same && i < cut.NumPixels(); i++) {
+          same = cut[i] == expected[i];
+        }
+
+        CHECK(same);
+      }
+    }
+  }
+
+  // Masked MIP along and across the axes. A full mask is the plain MIP.
+  {
+    ImgVol img = Random(66, 13, 9, 200, &rng);
+    Bytes b = RandomBytes(66, 13, 9, 0.3, &rng);
+    CHECK(SameMaskedMip(img, b, 0, 0, {{0, 0, 1}}));
+    CHECK(SameMaskedMip(img, b, 0.4f, 1.1f, {{0, 0, 1}}));
+    CHECK(SameMaskedMip(img, b, -0.8f, 2.3f, {{0.2f, -0.3f, 1}}));
+    CHECK(SameMaskedMip(img, RandomBytes(66, 13, 9, 0, &rng), 0.3f, 0.2f,
+                        {{0, 0, -1}}));
+
+    Bytes full = {66, 13, 9, std::vector<uint8_t>(66*13*9, 1)};
+    ImgVol a = img;
+    ImgVol c = img;
+    imgvol::ImgGray masked = imgvol::MaxIntensionProjection(
+        a, ToMask(full), 0.6f, -0.9f, {{0, 0, 1}});
+    imgvol::ImgGray plain = imgvol::MaxIntensionProjection(c, 0.6f, -0.9f,
+                                                           {{0, 0, 1}});
+    bool same = masked.SizeX() == plain.SizeX() &&
+                masked.SizeY() == plain.SizeY();
+
+    for (size_t y = 0; same && y < plain.SizeY(); y++) {
+      for (size_t x = 0; x < plain.SizeX(); x++) {
+        same = same && masked(x, y) == plain(x, y);
+      }
+    }
+
+    CHECK(same);
+
+    bool thrown = false;
+
+    try {
+      imgvol::MaxIntensionProjection(a, BitMask(66, 13, 8), 0, 0,
+                                     {{0, 0, 1}});
+    } catch (const std::invalid_argument&) {
+      thrown = true;
+    }
+
+    CHECK(thrown);
+  }
+
+  return imgvol::test::TestResult();
+}
@@ -0,0 +1,167 @@
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <random>
+#include <stdexcept>
+#include <vector>
+#include "brick_file.h"
+#include "check.h"
+#include "operations.h"
+
+// Round trip of the brick container with sizes that are not multiples of
+// the brick size, and reads that must match the same operations over the
+// full volume, and corrupt headers and footers that must be rejected.
+
+namespace {
+
+bool SameVolume(const imgvol::ImgVol& a, const imgvol::ImgVol& b) {
+  if (a.SizeX() != b.SizeX() || a.SizeY() != b.SizeY() ||
+      a.SizeZ() != b.SizeZ()) {
+    return false;
+  }
+
+  for (size_t i = 0; i < a.NumVoxels(); i++) {
+    if (a.Data()[i] != b.Data()[i]) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+bool SameImage(const imgvol::ImgGray& a, const imgvol::ImgGray& b) {
+  if (a.SizeX() != b.SizeX() || a.SizeY() != b.SizeY()) {
+    return false;
+  }
+
+  for (size_t i = 0; i < a.SizeX()*a.SizeY(); i++) {
+    if (a.Data()[i] != b.Data()[i]) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+bool SameCut(const imgvol::Img2D& a, const imgvol::Img2D& b) {
+  if (a.SizeX() != b.SizeX() || a.SizeY() != b.SizeY()) {
+    return false;
+  }
+
+  for (size_t i = 0; i < a.NumPixels(); i++) {
+    if (a[i] != b[i]) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+// Write bytes to file_name and check it's rejected on open.
+bool Rejected(const std::vector<char>& bytes, const char* file_name) {
+  std::ofstream(file_name, std::ios::binary).write(bytes.data(),
+                                                   bytes.size());
+
+  try {
+    imgvol::BrickVolume bricks(file_name);
+  } catch (const std::runtime_error&) {
+    return true;
+  }
+
+  return false;
+}
+
+}
+
+int main() {
+  const char* file_name = "brick_file_test.vbk";
+  std::mt19937 rng(7);
+  imgvol::ImgVol img(37, 20, 13);
+  uint8_t* data = img.Data();
+
+  for (size_t i = 0; i < img.NumVoxels(); i++) {
+    data[i] = rng()%256;
+  }
+
+  for (size_t brick : {8, 16, 64}) {
+    imgvol::WriteBrickVolume(img, file_name, brick, -1, 3);
+    imgvol::BrickVolume bricks(file_name, 3);
+
+    CHECK(bricks.SizeX() == 37 && bricks.SizeY() == 20 &&
+          bricks.SizeZ() == 13);
+    CHECK(SameVolume(bricks.ReadAll(), img));
+
+    imgvol::ImgVol region = bricks.ReadRegion(
+        std::array<size_t, 3>{5, 3, 2}, std::array<size_t, 3>{30, 19, 13});
+    bool same_region = region.SizeX() == 25 && region.SizeY() == 16 &&
+        region.SizeZ() == 11;
+
+    for (size_t z = 0; same_region && z < region.SizeZ(); z++) {
+      for (size_t y = 0; y < region.SizeY(); y++) {
+        for (size_t x = 0; x < region.SizeX(); x++) {
+          same_region = same_region &&
+              region(x, y, z) == img(x + 5, y + 3, z + 2);
+        }
+      }
+    }
+
+    CHECK(same_region);
+
+    CHECK(SameCut(bricks.Cut(imgvol::ImgVol::Axis::aX, 36, true),
+                  imgvol::Cut(img, imgvol::ImgVol::Axis::aX, 36, true)));
+    CHECK(SameCut(bricks.Cut(imgvol::ImgVol::Axis::aY, 9),
+                  imgvol::Cut(img, imgvol::ImgVol::Axis::aY, 9)));
+    CHECK(SameCut(bricks.Cut(imgvol::ImgVol::Axis::aZ, 12),
+                  imgvol::Cut(img, imgvol::ImgVol::Axis::aZ, 12)));
+
+    const std::array<float, 3> planes[][2] = {
+      {{{18, 10, 6}}, {{0, 0, 1}}},
+      {{{18, 10, 6}}, {{1, 0, 0}}},
+      {{{20, 4, 9}}, {{1, 2, 3}}},
+      {{{3, 17, 1}}, {{-2, 1, -1}}},
+    };
+
+    for (const auto& plane : planes) {
+      CHECK(SameImage(bricks.CortePlanar(plane[0], plane[1]),
+                      imgvol::CortePlanar(img, plane[0], plane[1])));
+    }
+  }
+
+  // A zero brick size, and index offsets past the end of the file or
+  // leaving no room for the index. The header holds the brick size after
+  // the magic, version and three 64 bit sizes, the footer ends the file
+  // with the 64 bit index offset and the magic, padded to 16 bytes.
+  {
+    imgvol::WriteBrickVolume(img, file_name, 16);
+    std::ifstream fin(file_name, std::ios::binary);
+    std::vector<char> good((std::istreambuf_iterator<char>(fin)),
+                           std::istreambuf_iterator<char>());
+    uint64_t size = good.size();
+    std::vector<char> bad = good;
+    std::memset(&bad[32], 0, 4);
+    CHECK(Rejected(bad, file_name));
+
+    for (uint64_t offset : {size, size - 16, size - 24, uint64_t(3),
+                            ~uint64_t(0)}) {
+      bad = good;
+      std::memcpy(&bad[size - 16], &offset, sizeof(offset));
+      CHECK(Rejected(bad, file_name));
+    }
+
+    CHECK(!Rejected(good, file_name));
+
+    bool thrown = false;
+
+    try {
+      imgvol::WriteBrickVolume(img, file_name, 0);
+    } catch (const std::invalid_argument&) {
+      thrown = true;
+    }
+
+    CHECK(thrown);
+  }
+
+  std::remove(file_name);
+  return imgvol::test::TestResult();
+}
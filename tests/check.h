@@ -0,0 +1,38 @@
+#pragma once
+
+#include <iostream>
+
+// Minimal checks for the test programs. A failed CHECK prints where it
+// failed and the test carries on, TestResult() gives the exit status.
+
+namespace imgvol {
+namespace test {
+
+inline int& Failures() {
+  static int failures = 0;
+  return failures;
+}
+
+inline bool Check(bool ok, const char* expr, const char* file, int line) {
+  if (!ok) {
+    std::cerr << file << ":" << line << ": check failed: " << expr << "\n";
+    Failures()++;
+  }
+
+  return ok;
+}
+
+inline int TestResult() {
+  if (Failures() > 0) {
+    std::cerr << Failures() << " checks failed\n";
+    return 1;
+  }
+
+  std::cout << "ok\n";
+  return 0;
+}
+
+}
+}
+
+#define CHECK(cond) ::imgvol::test::Check((cond), #cond, __FILE__, __LINE__)
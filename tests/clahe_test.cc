@@ -0,0 +1,197 @@
+#include <algorithm>
+#include <cstdlib>
+#include <random>
+#include <vector>
+#include "check.h"
+#include "clahe.h"
+
+// CLAHE on images with a known answer: constant images, clip limits that
+// flatten the histograms, a single tile, excess that doesn't divide evenly
+// over the bins, and in-place runs.
+
+namespace {
+
+using imgvol::ClaheOptions;
+using imgvol::ImgGray;
+using imgvol::ImgVol;
+
+ImgGray Noise(size_t x, size_t y, std::mt19937* rng) {
+  ImgGray img(x, y);
+  std::uniform_int_distribution<int> dist(0, 255);
+
+  for (size_t i = 0; i < x*y; i++) {
+    img.Data()[i] = dist(*rng);
+  }
+
+  return img;
+}
+
+ImgVol NoiseVol(size_t x, size_t y, size_t z, std::mt19937* rng) {
+  ImgVol img(x, y, z);
+  std::uniform_int_distribution<int> dist(0, 255);
+  uint8_t* data = img.Data();
+
+  for (size_t i = 0; i < img.NumVoxels(); i++) {
+    data[i] = dist(*rng);
+  }
+
+  return img;
+}
+
+bool Constant(const uint8_t* p, size_t n) {
+  return std::all_of(p, p + n, [&](uint8_t v) { return v == p[0]; });
+}
+
+int MaxDiff(const uint8_t* a, const uint8_t* b, size_t n) {
+  int diff = 0;
+
+  for (size_t i = 0; i < n; i++) {
+    diff = std::max(diff, std::abs(int(a[i]) - int(b[i])));
+  }
+
+  return diff;
+}
+
+bool Equal(const ImgGray& a, const ImgGray& b) {
+  return a.SizeX() == b.SizeX() && a.SizeY() == b.SizeY() &&
+         std::equal(a.Data(), a.Data() + a.SizeX()*a.SizeY(), b.Data());
+}
+
+bool Equal(const ImgVol& a, const ImgVol& b) {
+  return a.SizeX() == b.SizeX() && a.SizeY() == b.SizeY() &&
+         a.SizeZ() == b.SizeZ() &&
+         std::equal(a.Data(), a.Data() + a.NumVoxels(), b.Data());
+}
+
+}
+
+int main() {
+  std::mt19937 rng(45);
+  ClaheOptions opts;
+
+  // Tiles of the same size get the same LUT, so a constant image stays
+  // constant whatever the clip limit.
+  for (float clip : {0.0f, 1.0f, 3.0f}) {
+    opts.clip_limit = clip;
+    ImgGray img(64, 48);
+    std::fill(img.Data(), img.Data() + 64*48, 90);
+    ImgGray out = imgvol::Clahe(img, opts);
+    CHECK(Constant(out.Data(), 64*48));
+
+    ImgVol vol(32, 24, 16);
+    std::fill(vol.Data(), vol.Data() + vol.NumVoxels(), 7);
+    ImgVol vout = imgvol::Clahe(vol, opts);
+    CHECK(Constant(static_cast<const ImgVol&>(vout).Data(),
+                   vout.NumVoxels()));
+  }
+
+  // Without clipping every tile maps its only value to 255, even when the
+  // last tiles are smaller.
+  {
+    opts.clip_limit = 0;
+    ImgGray img(61, 37);
+    std::fill(img.Data(), img.Data() + 61*37, 90);
+    ImgGray out = imgvol::Clahe(img, opts);
+    CHECK(out(0, 0) == 255 && Constant(out.Data(), 61*37));
+  }
+
+  // Clipping every bin at the mean count flattens the histograms of
+  // uniform noise, so the LUTs are close to the identity. Tiles need
+  // enough pixels for their histograms to be close to flat already.
+  {
+    opts.clip_limit = 1;
+    opts.tiles_x = 2;
+    opts.tiles_y = 2;
+    opts.tiles_z = 2;
+    ImgGray img = Noise(256, 256, &rng);
+    ImgGray out = imgvol::Clahe(img, opts);
+    CHECK(MaxDiff(img.Data(), out.Data(), 256*256) <= 2);
+
+    ImgVol vol = NoiseVol(64, 64, 32, &rng);
+    ImgVol vout = imgvol::Clahe(vol, opts);
+    const ImgVol& v = vol;
+    CHECK(MaxDiff(v.Data(), static_cast<const ImgVol&>(vout).Data(),
+                  vol.NumVoxels()) <= 2);
+    opts = ClaheOptions();
+  }
+
+  // One tile without clipping is plain histogram equalization.
+  {
+    opts.clip_limit = 0;
+    opts.tiles_x = 1;
+    opts.tiles_y = 1;
+    ImgGray img(53, 29);
+    std::uniform_int_distribution<int> dist(40, 120);
+
+    for (size_t i = 0; i < 53*29; i++) {
+      img.Data()[i] = dist(rng);
+    }
+
+    std::vector<size_t> cdf(256, 0);
+
+    for (size_t i = 0; i < 53*29; i++) {
+      cdf[img.Data()[i]]++;
+    }
+
+    for (size_t v = 1; v < 256; v++) {
+      cdf[v] += cdf[v - 1];
+    }
+
+    ImgGray out = imgvol::Clahe(img, opts);
+    bool same = true;
+
+    for (size_t i = 0; i < 53*29; i++) {
+      size_t n = 53*29;
+      same = same && out.Data()[i] == (cdf[img.Data()[i]]*255 + n/2)/n;
+    }
+
+    CHECK(same);
+    opts = ClaheOptions();
+  }
+
+  // Noise with the default clip limit leaves a remainder of excess counts
+  // to spread. None of it may be lost: with one tile the LUT ends at the
+  // whole pixel count, so 255 maps to 255.
+  for (size_t n : {16, 32, 128, 200, 256}) {
+    ImgGray img = Noise(n, n, &rng);
+    img.Data()[0] = 255;
+    ImgGray out = imgvol::Clahe(img, opts);
+    opts.nthreads = 1;
+    CHECK(Equal(imgvol::Clahe(img, opts), out));
+
+    opts.tiles_x = 1;
+    opts.tiles_y = 1;
+    CHECK(imgvol::Clahe(img, opts)(0, 0) == 255);
+    opts = ClaheOptions();
+  }
+
+  // In place equals out of place, for any thread count.
+  for (size_t nthreads : {1, 3}) {
+    opts.nthreads = nthreads;
+    opts.tiles_x = 5;
+    opts.tiles_y = 3;
+    opts.tiles_z = 2;
+
+    ImgGray img = Noise(77, 41, &rng);
+    ImgGray out = imgvol::Clahe(img, opts);
+    ImgGray in_place = img;
+    imgvol::Clahe(in_place, opts, &in_place);
+    CHECK(Equal(in_place, out));
+
+    ImgVol vol = NoiseVol(33, 19, 11, &rng);
+    const ImgVol& source = vol;
+    std::vector<uint8_t> original(source.Data(),
+                                  source.Data() + vol.NumVoxels());
+    ImgVol vout = imgvol::Clahe(vol, opts);
+    ImgVol shared = vol;
+    imgvol::Clahe(shared, opts, &shared);
+    CHECK(Equal(shared, vout));
+    CHECK(std::equal(original.begin(), original.end(), source.Data()));
+
+    opts.nthreads = 1;
+    CHECK(Equal(imgvol::Clahe(img, opts), out));
+    CHECK(Equal(imgvol::Clahe(vol, opts), vout));
+  }
+
+  return imgvol::test::TestResult();
+}
@@ -0,0 +1,208 @@
+#include <algorithm>
+#include <random>
+#include "check.h"
+#include "crop.h"
+#include "mpr.h"
+#include "operations.h"
+
+// Foreground boxes against a scan of every voxel, and crops addressed
+// through their origin by the plane operations.
+
+namespace {
+
+using imgvol::BoundingBox;
+using imgvol::ImgGray;
+using imgvol::ImgVol;
+
+BoundingBox Reference(const ImgVol& img, int threshold) {
+  BoundingBox box = {{{img.SizeX(), img.SizeY(), img.SizeZ()}},
+                     {{0, 0, 0}}};
+
+  for (size_t z = 0; z < img.SizeZ(); z++) {
+    for (size_t y = 0; y < img.SizeY(); y++) {
+      for (size_t x = 0; x < img.SizeX(); x++) {
+        if (img(x, y, z) > threshold) {
+          std::array<size_t, 3> p = {{x, y, z}};
+
+          for (int a = 0; a < 3; a++) {
+            box.lo[a] = std::min(box.lo[a], p[a]);
+            box.hi[a] = std::max(box.hi[a], p[a] + 1);
+          }
+        }
+      }
+    }
+  }
+
+  return box;
+}
+
+bool Same(const BoundingBox& a, const BoundingBox& b) {
+  return a.Empty() ? b.Empty() : a.lo == b.lo && a.hi == b.hi;
+}
+
+// Sparse voxels of random intensity at random places.
+ImgVol Sparse(size_t x, size_t y, size_t z, size_t n, std::mt19937* rng) {
+  ImgVol img(x, y, z);
+  uint8_t* data = img.Data();
+  std::uniform_int_distribution<size_t> at(0, img.NumVoxels() - 1);
+  std::uniform_int_distribution<int> v(1, 255);
+
+  for (size_t i = 0; i < n; i++) {
+    data[at(*rng)] = v(*rng);
+  }
+
+  return img;
+}
+
+// Every voxel of the crop is the voxel of img at the same point of the
+// uncropped frame.
+bool MatchesSource(const ImgVol& crop, const ImgVol& img) {
+  std::array<size_t, 3> o = crop.Origin();
+  std::array<size_t, 3> s = img.Origin();
+
+  for (size_t z = 0; z < crop.SizeZ(); z++) {
+    for (size_t y = 0; y < crop.SizeY(); y++) {
+      for (size_t x = 0; x < crop.SizeX(); x++) {
+        if (crop(x, y, z) != img(o[0] + x - s[0], o[1] + y - s[1],
+                                 o[2] + z - s[2])) {
+          return false;
+        }
+      }
+    }
+  }
+
+  return true;
+}
+
+}
+
+int main() {
+  std::mt19937 rng(41);
+
+  for (size_t n : {1, 2, 5, 40, 2000}) {
+    ImgVol img = Sparse(37, 29, 19, n, &rng);
+
+    for (int threshold : {0, 100, 200}) {
+      BoundingBox expected = Reference(img, threshold);
+
+      for (size_t nthreads : {1, 2, 5, 40}) {
+        CHECK(Same(imgvol::ForegroundBox(img, threshold, nthreads),
+                   expected));
+      }
+    }
+  }
+
+  // An empty volume has an empty box and crops to one voxel plus margin.
+  {
+    ImgVol img(20, 15, 10);
+    CHECK(imgvol::ForegroundBox(img).Empty());
+    ImgVol crop = imgvol::CropForeground(img);
+    CHECK(crop.SizeX() == 1 && crop.SizeY() == 1 && crop.SizeZ() == 1);
+    crop = imgvol::CropForeground(img, 0, 3);
+    CHECK(crop.SizeX() == 4 && crop.SizeY() == 4 && crop.SizeZ() == 4);
+    CHECK((crop.Origin() == std::array<size_t, 3>{{0, 0, 0}}));
+  }
+
+  // The margin grows the box and is clipped at the volume faces.
+  {
+    ImgVol img(20, 15, 10);
+    img.SetVoxelIntensity(9, 1, 13, 5);
+    img.SetVoxelIntensity(9, 4, 10, 6);
+    ImgVol crop = imgvol::CropForeground(img, 0, 2);
+    CHECK((crop.Origin() == std::array<size_t, 3>{{0, 8, 3}}));
+    CHECK(crop.SizeX() == 7 && crop.SizeY() == 7 && crop.SizeZ() == 6);
+    CHECK(MatchesSource(crop, img));
+
+    // Cropping a crop keeps the origin in the first frame.
+    ImgVol inner = imgvol::Crop(crop, BoundingBox{{{1, 2, 2}}, {{5, 6, 4}}});
+    CHECK((inner.Origin() == std::array<size_t, 3>{{1, 10, 5}}));
+    CHECK(MatchesSource(inner, img));
+    CHECK(inner(0, 3, 0) == 9 && inner(3, 0, 1) == 9);
+
+    // Crops keep the voxel size, so resampling them matches resampling
+    // the source.
+    ImgVol aniso = img;
+    aniso.SetVoxelSize(0.5f, 1.25f, 3);
+    ImgVol part = imgvol::CropForeground(aniso, 0, 2);
+    CHECK(part.DimX() == 0.5f && part.DimY() == 1.25f && part.DimZ() == 3);
+    part = imgvol::Crop(part, BoundingBox{{{1, 2, 2}}, {{5, 6, 4}}});
+    CHECK(part.DimX() == 0.5f && part.DimY() == 1.25f && part.DimZ() == 3);
+    ImgVol iso = imgvol::Refactor(part, 1, 1, 1);
+    CHECK(iso.SizeX() == 2 && iso.SizeY() == 5 && iso.SizeZ() == 6);
+
+    // A box past the volume is clipped to it.
+    ImgVol edge = imgvol::Crop(img, BoundingBox{{{15, 10, 8}},
+                                                {{40, 40, 40}}});
+    CHECK(edge.SizeX() == 5 && edge.SizeY() == 5 && edge.SizeZ() == 2);
+    CHECK(MatchesSource(edge, img));
+  }
+
+  // Planes through a point of the uncropped frame. 12x16x21 has diagonal
+  // 29 and the 6x6x7 crop 11, so the cropped plane is the full one moved
+  // by exactly 9 pixels, and all the foreground lies inside the crop.
+  {
+    ImgVol img(12, 16, 21);
+    ImgVol part = Sparse(6, 6, 7, 120, &rng);
+    uint8_t* data = img.Data();
+
+    for (size_t z = 0; z < 7; z++) {
+      for (size_t y = 0; y < 6; y++) {
+        for (size_t x = 0; x < 6; x++) {
+          data[((z + 9)*16 + y + 5)*12 + x + 3] = part(x, y, z);
+        }
+      }
+    }
+
+    ImgVol crop = imgvol::Crop(img, BoundingBox{{{3, 5, 9}}, {{9, 11, 16}}});
+    CHECK((crop.Origin() == std::array<size_t, 3>{{3, 5, 9}}));
+
+    for (std::array<float, 3> p1 : {std::array<float, 3>{{5, 7, 12}},
+                                    std::array<float, 3>{{3, 10, 15}}}) {
+      for (std::array<float, 3> vec : {std::array<float, 3>{{0, 0, 1}},
+                                       std::array<float, 3>{{0, 0, -1}},
+                                       std::array<float, 3>{{0, 1, 1}},
+                                       std::array<float, 3>{{2, 1, 3}}}) {
+        ImgGray full(0, 0);
+        ImgGray cropped(0, 0);
+        imgvol::CortePlanar(img, p1, vec, &full);
+        imgvol::CortePlanar(crop, p1, vec, &cropped);
+        CHECK(full.SizeX() == 29 && cropped.SizeX() == 11);
+        bool same = true;
+        bool foreground = false;
+
+        for (size_t v = 0; v < cropped.SizeY(); v++) {
+          for (size_t u = 0; u < cropped.SizeX(); u++) {
+            same = same && cropped(u, v) == full(u + 9, v + 9);
+            foreground = foreground || cropped(u, v) > 0;
+          }
+        }
+
+        CHECK(same);
+        CHECK(foreground);
+      }
+    }
+
+    imgvol::MprViews views = imgvol::Mpr(crop, {{5, 7, 12}}, {});
+    bool same = true;
+
+    for (size_t y = 0; y < 6; y++) {
+      for (size_t x = 0; x < 6; x++) {
+        same = same && views.axial(x, y) == img(x + 3, y + 5, 12);
+      }
+    }
+
+    for (size_t z = 0; z < 7; z++) {
+      for (size_t y = 0; y < 6; y++) {
+        same = same && views.sagittal(z, y) == img(5, y + 5, z + 9);
+      }
+
+      for (size_t x = 0; x < 6; x++) {
+        same = same && views.coronal(z, x) == img(x + 3, 7, z + 9);
+      }
+    }
+
+    CHECK(same);
+  }
+
+  return imgvol::test::TestResult();
+}
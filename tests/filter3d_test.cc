@@ -0,0 +1,206 @@
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <stdexcept>
+#include <vector>
+#include "check.h"
+#include "filter3d.h"
+
+// The slab-parallel filters against direct evaluation over each voxel's
+// clamped neighbourhood.
+
+namespace {
+
+size_t Clamp(long v, size_t n) {
+  return v < 0 ? 0 : std::min(size_t(v), n - 1);
+}
+
+int At(const imgvol::ImgVol& img, long x, long y, long z) {
+  return img(Clamp(x, img.SizeX()), Clamp(y, img.SizeY()),
+             Clamp(z, img.SizeZ()));
+}
+
+imgvol::ImgVol BoxReference(const imgvol::ImgVol& img, long r) {
+  imgvol::ImgVol out(img.SizeX(), img.SizeY(), img.SizeZ());
+  long n = (2*r + 1)*(2*r + 1)*(2*r + 1);
+
+  for (size_t z = 0; z < img.SizeZ(); z++) {
+    for (size_t y = 0; y < img.SizeY(); y++) {
+      for (size_t x = 0; x < img.SizeX(); x++) {
+        long sum = 0;
+
+        for (long dz = -r; dz <= r; dz++) {
+          for (long dy = -r; dy <= r; dy++) {
+            for (long dx = -r; dx <= r; dx++) {
+              sum += At(img, x + dx, y + dy, z + dz);
+            }
+          }
+        }
+
+        out.SetVoxelIntensity((2*sum + n)/(2*n), x, y, z);
+      }
+    }
+  }
+
+  return out;
+}
+
+imgvol::ImgVol MedianReference(const imgvol::ImgVol& img) {
+  imgvol::ImgVol out(img.SizeX(), img.SizeY(), img.SizeZ());
+  std::vector<int> values;
+
+  for (size_t z = 0; z < img.SizeZ(); z++) {
+    for (size_t y = 0; y < img.SizeY(); y++) {
+      for (size_t x = 0; x < img.SizeX(); x++) {
+        values.clear();
+
+        for (long dz = -1; dz <= 1; dz++) {
+          for (long dy = -1; dy <= 1; dy++) {
+            for (long dx = -1; dx <= 1; dx++) {
+              values.push_back(At(img, x + dx, y + dy, z + dz));
+            }
+          }
+        }
+
+        std::sort(values.begin(), values.end());
+        out.SetVoxelIntensity(values[13], x, y, z);
+      }
+    }
+  }
+
+  return out;
+}
+
+// Largest voxel difference, or 256 when the sizes differ.
+int MaxDiff(const imgvol::ImgVol& a, const imgvol::ImgVol& b) {
+  if (a.SizeX() != b.SizeX() || a.SizeY() != b.SizeY() ||
+      a.SizeZ() != b.SizeZ()) {
+    return 256;
+  }
+
+  int diff = 0;
+
+  for (size_t i = 0; i < a.NumVoxels(); i++) {
+    diff = std::max(diff, std::abs(a.Data()[i] - b.Data()[i]));
+  }
+
+  return diff;
+}
+
+double GaussianReference(const imgvol::ImgVol& img, float sigma, long x,
+                         long y, long z) {
+  long r = long(std::ceil(3*sigma));
+  std::vector<double> w(2*r + 1);
+  double sum = 0;
+
+  for (long k = -r; k <= r; k++) {
+    w[k + r] = std::exp(-double(k*k)/(2*sigma*sigma));
+    sum += w[k + r];
+  }
+
+  double acc = 0;
+
+  for (long dz = -r; dz <= r; dz++) {
+    for (long dy = -r; dy <= r; dy++) {
+      for (long dx = -r; dx <= r; dx++) {
+        acc += w[dx + r]*w[dy + r]*w[dz + r]*At(img, x + dx, y + dy, z + dz);
+      }
+    }
+  }
+
+  return acc/(sum*sum*sum);
+}
+
+template <class Fn>
+bool ThrowsInvalid(Fn fn) {
+  try {
+    fn();
+  } catch (const std::invalid_argument&) {
+    return true;
+  }
+
+  return false;
+}
+
+}
+
+int main() {
+  std::mt19937 rng(13);
+  imgvol::ImgVol img(11, 9, 7);
+  img.SetOrigin(std::array<size_t, 3>{4, 5, 6});
+  uint8_t* data = img.Data();
+
+  for (size_t i = 0; i < img.NumVoxels(); i++) {
+    data[i] = rng()%256;
+  }
+
+  std::vector<uint8_t> original(data, data + img.NumVoxels());
+  imgvol::ImgVol out(0, 0, 0);
+
+  for (size_t nthreads : {1, 2, 3, 7}) {
+    for (size_t r : {0, 1, 2, 4}) {
+      imgvol::BoxFilter(img, r, &out, nthreads);
+      CHECK(MaxDiff(out, BoxReference(img, r)) == 0);
+    }
+
+    imgvol::MedianFilter(img, &out, nthreads);
+    CHECK(MaxDiff(out, MedianReference(img)) == 0);
+    CHECK(out.Origin() == img.Origin());
+
+    for (float sigma : {0.5f, 1.0f, 1.7f}) {
+      imgvol::GaussianFilter(img, sigma, &out, nthreads);
+      bool close = true;
+
+      for (size_t z = 0; z < img.SizeZ(); z++) {
+        for (size_t y = 0; y < img.SizeY(); y++) {
+          for (size_t x = 0; x < img.SizeX(); x++) {
+            double ref = GaussianReference(img, sigma, x, y, z);
+            close = close && std::abs(out(x, y, z) - ref) <= 0.51;
+          }
+        }
+      }
+
+      CHECK(close);
+    }
+  }
+
+  // In place, through dst == &src and through the one volume overloads.
+  imgvol::ImgVol expected(0, 0, 0);
+  imgvol::BoxFilter(img, 2, &expected, 3);
+  imgvol::ImgVol same = img;
+  imgvol::BoxFilter(same, 2, &same, 3);
+  CHECK(MaxDiff(same, expected) == 0);
+  same = img;
+  imgvol::BoxFilter(same, 2);
+  CHECK(MaxDiff(same, expected) == 0);
+
+  imgvol::MedianFilter(img, &expected, 3);
+  same = img;
+  imgvol::MedianFilter(same, &same, 3);
+  CHECK(MaxDiff(same, expected) == 0);
+  same = img;
+  imgvol::MedianFilter(same);
+  CHECK(MaxDiff(same, expected) == 0);
+
+  imgvol::GaussianFilter(img, 1.2f, &expected, 3);
+  same = img;
+  imgvol::GaussianFilter(same, 1.2f, &same, 3);
+  CHECK(MaxDiff(same, expected) == 0);
+  same = img;
+  imgvol::GaussianFilter(same, 1.2f);
+  CHECK(MaxDiff(same, expected) == 0);
+
+  // The source isn't touched by the in-place runs on its copies.
+  const imgvol::ImgVol& const_img = img;
+  CHECK(std::equal(original.begin(), original.end(), const_img.Data()));
+
+  // Invalid and degenerate sigmas.
+  CHECK(ThrowsInvalid([&]() { imgvol::GaussianFilter(img, 0, &out); }));
+  CHECK(ThrowsInvalid([&]() { imgvol::GaussianFilter(img, -1, &out); }));
+  CHECK(ThrowsInvalid([&]() { imgvol::GaussianFilter(img, NAN, &out); }));
+
+  imgvol::GaussianFilter(img, 1e-30f, &out);
+  CHECK(MaxDiff(out, img) == 0);
+
+  return imgvol::test::TestResult();
+}
@@ -0,0 +1,141 @@
+#include <cstdint>
+#include <random>
+#include <utility>
+#include <vector>
+#include "check.h"
+#include "img_vol.h"
+
+// Row operations of ImgColor in every layout against per-pixel access:
+// aligned rows, fills, row writes and blends that stop short of the row
+// ends, and the blend rounding over every input.
+
+namespace {
+
+using imgvol::ColorLayout;
+using imgvol::ImgColor;
+
+typedef std::array<uint8_t, 3> Bgr;
+
+// (v*a + d*(255 - a))/255 rounded to nearest, never a tie.
+uint8_t Blend(int v, int d, int a) {
+  return uint8_t((2*(v*a + d*(255 - a)) + 255)/510);
+}
+
+// Per-pixel copy, the reference the row operations are checked against.
+std::vector<Bgr> Pixels(const ImgColor& img) {
+  std::vector<Bgr> p;
+
+  for (size_t y = 0; y < img.SizeY(); y++) {
+    for (size_t x = 0; x < img.SizeX(); x++) {
+      p.push_back(img(x, y));
+    }
+  }
+
+  return p;
+}
+
+void TestLayout(ColorLayout layout, std::mt19937* rng) {
+  // 70 pixels are not a whole number of 64 byte lines in any layout.
+  const size_t w = 70;
+  const size_t h = 9;
+  ImgColor img(w, h, layout);
+  CHECK(img.Layout() == layout);
+  CHECK(img.Stride()%64 == 0 && img.Stride() >= w*img.PixelBytes());
+  CHECK(uintptr_t(img.Data())%64 == 0);
+
+  bool black = true;
+
+  for (const Bgr& p : Pixels(img)) {
+    black = black && p == Bgr{{0, 0, 0}};
+  }
+
+  CHECK(black);
+
+  img.Fill({{10, 200, 33}});
+  bool filled = true;
+
+  for (const Bgr& p : Pixels(img)) {
+    filled = filled && p == Bgr{{10, 200, 33}};
+  }
+
+  CHECK(filled);
+
+  // Rows written and blended over part of their width leave the rest,
+  // and the other rows, alone.
+  std::uniform_int_distribution<int> byte(0, 255);
+  std::vector<uint8_t> b(w), g(w), r(w), alpha(w);
+
+  for (size_t i = 0; i < w; i++) {
+    b[i] = byte(*rng);
+    g[i] = byte(*rng);
+    r[i] = byte(*rng);
+    alpha[i] = i%5 == 0 ? 0 : i%5 == 1 ? 255 : byte(*rng);
+  }
+
+  std::vector<Bgr> expected = Pixels(img);
+  img.WriteRow(2, 3, 60, b.data(), g.data(), r.data());
+
+  for (size_t i = 0; i < 60; i++) {
+    expected[2*w + 3 + i] = {{b[i], g[i], r[i]}};
+  }
+
+  CHECK(Pixels(img) == expected);
+
+  for (size_t y : {2, 5}) {
+    img.BlendRow(y, 1, 67, b.data(), g.data(), r.data(), alpha.data());
+
+    for (size_t i = 0; i < 67; i++) {
+      Bgr& d = expected[y*w + 1 + i];
+      d = {{Blend(b[i], d[0], alpha[i]), Blend(g[i], d[1], alpha[i]),
+            Blend(r[i], d[2], alpha[i])}};
+    }
+
+    CHECK(Pixels(img) == expected);
+  }
+
+  // Copies keep the layout and the pixels.
+  ImgColor copy = img;
+  CHECK(copy.Layout() == layout && Pixels(copy) == expected);
+  ImgColor moved = std::move(copy);
+  CHECK(moved.Layout() == layout && Pixels(moved) == expected);
+}
+
+}
+
+int main() {
+  std::mt19937 rng(50);
+
+  for (ColorLayout layout : {ColorLayout::kBgr, ColorLayout::kBgrx,
+                             ColorLayout::kPlanar}) {
+    TestLayout(layout, &rng);
+  }
+
+  // Every source value and alpha over every destination value.
+  {
+    ImgColor img(256, 1, ColorLayout::kBgrx);
+    std::vector<uint8_t> v(256), alpha(256);
+    bool exact = true;
+
+    for (int a = 0; a < 256; a++) {
+      for (int s = 0; s < 256; s++) {
+        for (size_t x = 0; x < 256; x++) {
+          img({{uint8_t(x), uint8_t(255 - x), uint8_t(x)}}, x, 0);
+          v[x] = uint8_t(s);
+          alpha[x] = uint8_t(a);
+        }
+
+        img.BlendRow(0, 0, 256, v.data(), v.data(), v.data(), alpha.data());
+
+        for (int d = 0; d < 256; d++) {
+          Bgr p = img(d, 0);
+          exact = exact && p[0] == Blend(s, d, a) &&
+                  p[1] == Blend(s, 255 - d, a);
+        }
+      }
+    }
+
+    CHECK(exact);
+  }
+
+  return imgvol::test::TestResult();
+}
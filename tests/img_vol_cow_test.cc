@@ -0,0 +1,119 @@
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include "check.h"
+#include "img_vol.h"
+#include "operations.h"
+
+// Copies of a volume share its voxels until one of them is written.
+
+static_assert(std::is_nothrow_move_constructible<imgvol::ImgVol>::value,
+              "ImgVol moves must not throw, so containers move them");
+static_assert(std::is_nothrow_move_assignable<imgvol::ImgVol>::value,
+              "ImgVol moves must not throw");
+
+int main() {
+  imgvol::ImgVol img(6, 5, 4);
+  uint8_t* data = img.Data();
+
+  for (size_t i = 0; i < img.NumVoxels(); i++) {
+    data[i] = uint8_t(i);
+  }
+
+  // A copy shares the buffer.
+  imgvol::ImgVol copy = img;
+  const imgvol::ImgVol& const_img = img;
+  const imgvol::ImgVol& const_copy = copy;
+  CHECK(const_copy.Data() == const_img.Data());
+  CHECK(!img.Unique() && !copy.Unique());
+
+  // Writing through the copy unshares it and leaves the original as it
+  // was.
+  copy.SetVoxelIntensity(200, 1, 2, 3);
+  CHECK(const_copy.Data() != const_img.Data());
+  CHECK(img.Unique() && copy.Unique());
+  CHECK(copy(1, 2, 3) == 200);
+  CHECK(img(1, 2, 3) == (3*5 + 2)*6 + 1);
+
+  bool same_rest = true;
+
+  for (size_t i = 0; i < img.NumVoxels(); i++) {
+    if (i != (3*5 + 2)*6 + 1) {
+      same_rest = same_rest && const_copy.Data()[i] == const_img.Data()[i];
+    }
+  }
+
+  CHECK(same_rest);
+
+  // Further writes to a unique buffer don't clone it again.
+  const uint8_t* before = const_copy.Data();
+  copy.SetVoxelIntensity(7, 0, 0, 0);
+  CHECK(copy.Data() == before);
+
+  // Data() unshares as well.
+  imgvol::ImgVol other = img;
+  other.Data()[0] = 99;
+  CHECK(img(0, 0, 0) == 0 && other(0, 0, 0) == 99);
+
+  // So does an in-place operation on a copy. A maximum of 15 is
+  // stretched to 255.
+  imgvol::ImgVol dark(4, 4, 4);
+  uint8_t* dark_data = dark.Data();
+
+  for (size_t i = 0; i < dark.NumVoxels(); i++) {
+    dark_data[i] = uint8_t(i/4);
+  }
+
+  imgvol::ImgVol normalized = dark;
+  imgvol::NormalizeImage(normalized);
+  CHECK(dark(3, 3, 3) == 15);
+  CHECK(normalized(3, 3, 3) == 255);
+  CHECK(normalized(3, 1, 0) == 17);
+
+  // Assignment shares too, and a copy outlives the volume it came from.
+  imgvol::ImgVol assigned(1, 1, 1);
+  {
+    imgvol::ImgVol scoped = img;
+    assigned = scoped;
+  }
+  CHECK(static_cast<const imgvol::ImgVol&>(assigned).Data() ==
+        const_img.Data());
+  CHECK(assigned(5, 4, 3) == img(5, 4, 3));
+
+  // Moves hand the buffer over and leave an empty, usable volume.
+  const uint8_t* moved_data = const_img.Data();
+  imgvol::ImgVol moved = std::move(img);
+  CHECK(static_cast<const imgvol::ImgVol&>(moved).Data() == moved_data);
+  CHECK(img.NumVoxels() == 0 && img.SizeX() == 0);
+
+  img.Resize(2, 2, 2);
+  img.Data()[7] = 5;
+  CHECK(img(1, 1, 1) == 5);
+  CHECK(moved(1, 1, 1) == (1*5 + 1)*6 + 1);
+
+  imgvol::ImgVol target(3, 3, 3);
+  target = std::move(moved);
+  CHECK(target.SizeX() == 6 && moved.NumVoxels() == 0);
+
+  // Moved-from volumes share the empty buffer, writing one clones it.
+  imgvol::ImgVol a(1, 1, 1);
+  imgvol::ImgVol b(1, 1, 1);
+  imgvol::ImgVol a2 = std::move(a);
+  imgvol::ImgVol b2 = std::move(b);
+  a.Resize(1, 1, 1);
+  a.Data()[0] = 1;
+  CHECK(b.NumVoxels() == 0);
+
+  std::vector<imgvol::ImgVol> volumes;
+
+  for (size_t i = 0; i < 10; i++) {
+    volumes.emplace_back(2, 2, 2);
+    volumes.back().Data()[0] = uint8_t(i);
+  }
+
+  for (size_t i = 0; i < 10; i++) {
+    CHECK(volumes[i](0, 0, 0) == int(i) && volumes[i].Unique());
+  }
+
+  return imgvol::test::TestResult();
+}
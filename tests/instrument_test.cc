@@ -0,0 +1,128 @@
+#include <random>
+#include <string>
+#include <vector>
+#include "check.h"
+#include "instrument.h"
+#include "operations.h"
+#include "parallel.h"
+#include "ray_camera.h"
+#include "voxel_traversal.h"
+
+// Counters and timers of work done on worker threads, which ParallelFor
+// joins before the snapshot, so their counts come from the totals of
+// exited threads. Deltas are checked against the rays and samples each
+// MIP traces, and the JSON against the counter and timer names.
+
+namespace {
+
+using imgvol::ImgVol;
+namespace instrument = imgvol::instrument;
+
+struct View {
+  float delta_x;
+  float delta_y;
+};
+
+// Rays that hit the volume and the voxels they walk, as the MIP counts
+// them.
+void ExpectedRays(const ImgVol& img, View v, uint64_t* rays,
+                  uint64_t* samples) {
+  imgvol::RayCamera camera(img, v.delta_x, v.delta_y, {{0, 0, 1}});
+  std::array<float, 3> p1;
+  std::array<float, 3> pn;
+
+  for (size_t y = 0; y < camera.Height(); y++) {
+    for (size_t x = 0; x < camera.Width(); x++) {
+      if (camera.Clip(x, y, &p1, &pn)) {
+        (*rays)++;
+        *samples += imgvol::VoxelTraversal(img, p1, pn).Remaining();
+      }
+    }
+  }
+}
+
+bool Contains(const std::string& s, const std::string& part) {
+  return s.find(part) != std::string::npos;
+}
+
+}
+
+int main() {
+  std::mt19937 rng(30);
+  ImgVol img(21, 17, 12);
+  uint8_t* data = img.Data();
+
+  for (size_t i = 0; i < img.NumVoxels(); i++) {
+    data[i] = rng()%200;
+  }
+
+  const std::vector<View> views = {{0, 0}, {0.3f, 0.5f}, {-1.1f, 2.0f},
+                                   {0.7f, -0.4f}, {1.5f, 0.2f}};
+  uint64_t rays = 0;
+  uint64_t samples = 0;
+
+  for (View v : views) {
+    ExpectedRays(img, v, &rays, &samples);
+  }
+
+  instrument::Snapshot before = instrument::TakeSnapshot();
+
+  // One view and one z cut per chunk, each chunk on its own thread.
+  imgvol::ParallelFor(0, views.size(), [&](size_t b, size_t e) {
+    for (size_t i = b; i < e; i++) {
+      ImgVol copy = img;
+      imgvol::MaxIntensionProjection(copy, views[i].delta_x,
+                                     views[i].delta_y, {{0, 0, 1}});
+      imgvol::Cut(img, ImgVol::Axis::aZ, i);
+    }
+  }, views.size());
+
+  instrument::Snapshot delta = instrument::TakeSnapshot() - before;
+  std::string json = delta.ToJson();
+
+#ifndef VIMAGE_NO_INSTRUMENTATION
+  CHECK(delta[instrument::Counter::kRaysCast] == rays);
+  CHECK(delta[instrument::Counter::kRaySamples] == samples);
+  CHECK(delta[instrument::Counter::kCutPixels] == views.size()*21*17);
+  CHECK(delta[instrument::Timer::kMaxIntensionProjection].calls ==
+        views.size());
+  CHECK(delta[instrument::Timer::kCut].calls == views.size());
+  CHECK(delta[instrument::Timer::kMaxIntensionProjection].nanoseconds > 0);
+  CHECK(delta[instrument::Counter::kWireframeLines] == 0);
+  CHECK(Contains(json, "\"rays_cast\": " + std::to_string(rays)));
+  CHECK(Contains(json, "\"ray_samples\": " + std::to_string(samples)));
+#endif
+
+  CHECK(rays > 0);
+  CHECK(json.front() == '{' && json.back() == '}');
+  CHECK(Contains(json, "\"counters\": {") && Contains(json, "\"timers\": {"));
+
+  for (size_t c = 0; c < instrument::kNumCounters; c++) {
+    std::string name = instrument::Name(instrument::Counter(c));
+    CHECK(Contains(json, "\"" + name + "\": "));
+  }
+
+  for (size_t t = 0; t < instrument::kNumTimers; t++) {
+    std::string name = instrument::Name(instrument::Timer(t));
+    CHECK(Contains(json, "\"" + name + "\": {\"calls\": "));
+  }
+
+  CHECK(Contains(json, "\"seconds\": "));
+
+  // Nothing ran between two snapshots, the difference is all zeros.
+  instrument::Snapshot now = instrument::TakeSnapshot();
+  instrument::Snapshot zero = now - now;
+  bool all_zero = true;
+
+  for (size_t c = 0; c < instrument::kNumCounters; c++) {
+    all_zero = all_zero && zero.counters[c] == 0;
+  }
+
+  for (size_t t = 0; t < instrument::kNumTimers; t++) {
+    all_zero = all_zero && zero.timers[t].calls == 0 &&
+               zero.timers[t].nanoseconds == 0;
+  }
+
+  CHECK(all_zero);
+  return imgvol::test::TestResult();
+}
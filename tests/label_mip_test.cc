@@ -0,0 +1,117 @@
+#include <random>
+#include <stdexcept>
+#include <vector>
+#include "check.h"
+#include "label_mip.h"
+#include "operations.h"
+#include "ray_camera.h"
+#include "voxel_traversal.h"
+
+// LabelMaxIntensionProjection against the plain MIP for the intensities,
+// and against a walk of each ray for the front-most maximum. Intensities
+// are drawn from a few values so most rays hold ties.
+
+namespace {
+
+using imgvol::ImgVol;
+
+ImgVol Random(size_t x, size_t y, size_t z, int max, std::mt19937* rng) {
+  ImgVol img(x, y, z);
+  std::uniform_int_distribution<int> dist(0, max);
+  uint8_t* data = img.Data();
+
+  for (size_t i = 0; i < img.NumVoxels(); i++) {
+    data[i] = dist(*rng);
+  }
+
+  return img;
+}
+
+void Compare(const ImgVol& img, const ImgVol& labels, float delta_x,
+             float delta_y, std::array<float, 3> normal, size_t nthreads) {
+  ImgVol normalized = img;
+  imgvol::LabelMip res = imgvol::LabelMaxIntensionProjection(
+      normalized, labels, delta_x, delta_y, normal, nthreads);
+  ImgVol copy = img;
+  imgvol::ImgGray mip = imgvol::MaxIntensionProjection(copy, delta_x, delta_y,
+                                                       normal);
+
+  CHECK(res.intensity.SizeX() == mip.SizeX());
+  CHECK(res.intensity.SizeY() == mip.SizeY());
+  CHECK(res.overlay.SizeX() == mip.SizeX());
+
+  imgvol::RayCamera camera(normalized, delta_x, delta_y, normal);
+  const uint8_t* data = static_cast<const ImgVol&>(normalized).Data();
+  bool same_intensity = true;
+  bool same_label = true;
+  bool same_depth = true;
+  size_t hits = 0;
+
+  for (size_t y = 0; y < mip.SizeY(); y++) {
+    for (size_t x = 0; x < mip.SizeX(); x++) {
+      same_intensity = same_intensity &&
+                       res.intensity(x, y) == int(mip(x, y));
+      std::array<float, 3> p1;
+      std::array<float, 3> pn;
+      int label = 0;
+      int depth = -1;
+
+      if (camera.Clip(x, y, &p1, &pn)) {
+        std::vector<size_t> ray;
+
+        for (imgvol::VoxelTraversal t(normalized, p1, pn); !t.Done();
+             t.Next()) {
+          ray.push_back(t.Offset());
+        }
+
+        for (size_t k = 0; k < ray.size(); k++) {
+          if (depth < 0 || data[ray[k]] > data[ray[depth]]) {
+            depth = k;
+          }
+        }
+
+        label = labels.Data()[ray[depth]];
+        hits++;
+      }
+
+      same_label = same_label && res.labels(x, y) == label;
+      same_depth = same_depth && res.depth(x, y) == depth;
+    }
+  }
+
+  CHECK(hits > 0);
+  CHECK(same_intensity);
+  CHECK(same_label);
+  CHECK(same_depth);
+}
+
+}
+
+int main() {
+  std::mt19937 rng(42);
+  ImgVol img = Random(23, 19, 14, 3, &rng);
+  ImgVol labels = Random(23, 19, 14, 200, &rng);
+
+  for (size_t nthreads : {1, 3}) {
+    Compare(img, labels, 0, 0, {{0, 0, 1}}, nthreads);
+    Compare(img, labels, 0, 0, {{0, 0, -1}}, nthreads);
+    Compare(img, labels, 0.4f, 0.9f, {{0, 0, 1}}, nthreads);
+    Compare(img, labels, -1.2f, 2.5f, {{0.3f, -0.2f, 1}}, nthreads);
+  }
+
+  // Wide range of intensities, few ties.
+  Compare(Random(17, 21, 9, 255, &rng), Random(17, 21, 9, 255, &rng), 0.7f,
+          0.1f, {{0, 0, 1}}, 2);
+
+  ImgVol other(23, 19, 13);
+  bool thrown = false;
+
+  try {
+    imgvol::LabelMaxIntensionProjection(img, other, 0, 0, {{0, 0, 1}});
+  } catch (const std::invalid_argument&) {
+    thrown = true;
+  }
+
+  CHECK(thrown);
+  return imgvol::test::TestResult();
+}
@@ -0,0 +1,176 @@
+#include <algorithm>
+#include <cstdlib>
+#include <queue>
+#include <random>
+#include <vector>
+#include "check.h"
+#include "labeling.h"
+
+// Slab-parallel labeling against a breadth first search over the whole
+// volume, with thread counts that put slab boundaries through the
+// components.
+
+namespace {
+
+struct Reference {
+  std::vector<uint32_t> labels;
+  std::vector<size_t> sizes;
+};
+
+// Components numbered as LabelComponents does: by decreasing size, ties
+// by first voxel in raster order.
+Reference Bfs(const imgvol::ImgVol& img, int threshold,
+              imgvol::Connectivity conn) {
+  long nx = img.SizeX(), ny = img.SizeY(), nz = img.SizeZ();
+  std::vector<uint32_t> found(img.NumVoxels(), 0);
+  std::vector<size_t> sizes(1, 0);
+  int max_dist = int(conn) == 6 ? 1 : int(conn) == 18 ? 2 : 3;
+
+  for (long i = 0; i < long(img.NumVoxels()); i++) {
+    if (img.Data()[i] <= threshold) {
+      sizes[0]++;
+      continue;
+    }
+
+    if (found[i] != 0) {
+      continue;
+    }
+
+    uint32_t label = sizes.size();
+    sizes.push_back(0);
+    std::queue<long> queue;
+    queue.push(i);
+    found[i] = label;
+
+    while (!queue.empty()) {
+      long v = queue.front();
+      queue.pop();
+      sizes[label]++;
+      long x = v%nx, y = (v/nx)%ny, z = v/(nx*ny);
+
+      for (long dz = -1; dz <= 1; dz++) {
+        for (long dy = -1; dy <= 1; dy++) {
+          for (long dx = -1; dx <= 1; dx++) {
+            int dist = std::abs(dx) + std::abs(dy) + std::abs(dz);
+            long qx = x + dx, qy = y + dy, qz = z + dz;
+
+            if (dist == 0 || dist > max_dist || qx < 0 || qx >= nx ||
+                qy < 0 || qy >= ny || qz < 0 || qz >= nz) {
+              continue;
+            }
+
+            long q = (qz*ny + qy)*nx + qx;
+
+            if (img.Data()[q] > threshold && found[q] == 0) {
+              found[q] = label;
+              queue.push(q);
+            }
+          }
+        }
+      }
+    }
+  }
+
+  // Found in raster order of their first voxel, a stable sort by size
+  // gives the final numbering.
+  std::vector<uint32_t> order(sizes.size() - 1);
+
+  for (size_t k = 0; k < order.size(); k++) {
+    order[k] = k + 1;
+  }
+
+  std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+    return sizes[a] > sizes[b];
+  });
+
+  Reference ref;
+  std::vector<uint32_t> renumber(sizes.size(), 0);
+  ref.sizes.push_back(sizes[0]);
+
+  for (size_t k = 0; k < order.size(); k++) {
+    renumber[order[k]] = k + 1;
+    ref.sizes.push_back(sizes[order[k]]);
+  }
+
+  for (uint32_t l : found) {
+    ref.labels.push_back(renumber[l]);
+  }
+
+  return ref;
+}
+
+void Compare(const imgvol::ImgVol& img, int threshold,
+             imgvol::Connectivity conn, size_t nthreads) {
+  Reference ref = Bfs(img, threshold, conn);
+  imgvol::Components res = imgvol::LabelComponents(img, threshold, conn,
+                                                   nthreads);
+
+  CHECK(res.labels == ref.labels);
+  CHECK(res.sizes == ref.sizes);
+
+  bool same_img = true;
+
+  for (size_t i = 0; i < img.NumVoxels(); i++) {
+    uint32_t l = ref.labels[i];
+    same_img = same_img && res.label_img.Data()[i] == (l <= 255 ? l : 0);
+  }
+
+  CHECK(same_img);
+  CHECK(res.label_img.Origin() == img.Origin());
+}
+
+}
+
+int main() {
+  std::mt19937 rng(17);
+
+  // Sparse noise makes many small components, some of them joined only
+  // through edges or corners.
+  imgvol::ImgVol noise(15, 13, 12);
+  noise.SetOrigin(std::array<size_t, 3>{1, 2, 3});
+  uint8_t* data = noise.Data();
+
+  for (size_t i = 0; i < noise.NumVoxels(); i++) {
+    data[i] = rng()%100 < 30 ? 200 : 10;
+  }
+
+  // Helices and diagonal chains run through every slab boundary, the
+  // chains are connected through edges (18) or corners (26) only.
+  imgvol::ImgVol shapes(16, 16, 20);
+  uint8_t* sdata = shapes.Data();
+
+  for (size_t z = 0; z < 20; z++) {
+    sdata[(z*16 + 2 + z%2)*16 + 2] = 255;
+    sdata[(z*16 + 8)*16 + 4 + z%8] = 255;
+    sdata[(z*16 + z%16)*16 + 12] = 255;
+    sdata[(z*16 + z%16)*16 + (z + 5)%16] = 255;
+  }
+
+  for (imgvol::Connectivity conn : {imgvol::Connectivity::k6,
+                                    imgvol::Connectivity::k18,
+                                    imgvol::Connectivity::k26}) {
+    for (size_t nthreads : {1, 2, 3, 5, 12}) {
+      Compare(noise, 100, conn, nthreads);
+      Compare(shapes, 0, conn, nthreads);
+    }
+  }
+
+  // Enough components to overflow the 8 bit label image.
+  imgvol::ImgVol dots(40, 40, 4);
+  uint8_t* ddata = dots.Data();
+
+  for (size_t i = 0; i < dots.NumVoxels(); i += 2) {
+    ddata[i] = (i/40)%2 == 0 ? 255 : 0;
+  }
+
+  Compare(dots, 0, imgvol::Connectivity::k6, 3);
+
+  // All background and all foreground.
+  imgvol::ImgVol empty(5, 4, 3);
+  std::fill(empty.Data(), empty.Data() + empty.NumVoxels(), 0);
+  Compare(empty, 0, imgvol::Connectivity::k26, 2);
+  std::fill(empty.Data(), empty.Data() + empty.NumVoxels(), 9);
+  Compare(empty, 0, imgvol::Connectivity::k6, 3);
+
+  return imgvol::test::TestResult();
+}
@@ -0,0 +1,163 @@
+#include <cmath>
+#include <cstdio>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "check.h"
+#include "mip_batch.h"
+#include "operations.h"
+#include "png_decode.h"
+
+// Batched MIP frames against MaxIntensionProjection() of each view, bit
+// for bit, over brick sizes that do and don't divide the volume, and the
+// same frames read back from ExportMipViews.
+
+namespace {
+
+using imgvol::ImgGray;
+using imgvol::ImgVol;
+using imgvol::MipBatchOptions;
+using imgvol::MipView;
+
+// Intensities below 255, so the normalization changes them.
+ImgVol Random(size_t x, size_t y, size_t z, std::mt19937* rng) {
+  ImgVol img(x, y, z);
+  std::uniform_int_distribution<int> dist(3, 180);
+  uint8_t* data = img.Data();
+
+  for (size_t i = 0; i < img.NumVoxels(); i++) {
+    data[i] = dist(*rng);
+  }
+
+  return img;
+}
+
+bool Equal(const ImgGray& a, const ImgGray& b) {
+  if (a.SizeX() != b.SizeX() || a.SizeY() != b.SizeY()) {
+    return false;
+  }
+
+  for (size_t y = 0; y < a.SizeY(); y++) {
+    for (size_t x = 0; x < a.SizeX(); x++) {
+      if (a(x, y) != b(x, y)) {
+        return false;
+      }
+    }
+  }
+
+  return true;
+}
+
+bool SameFrame(const imgvol::test::DecodedPng& png, const ImgGray& frame) {
+  if (png.width != frame.SizeX() || png.height != frame.SizeY() ||
+      png.channels != 1) {
+    return false;
+  }
+
+  for (size_t y = 0; y < frame.SizeY(); y++) {
+    for (size_t x = 0; x < frame.SizeX(); x++) {
+      if (png.pixels[y*png.width + x] != frame(x, y)) {
+        return false;
+      }
+    }
+  }
+
+  return true;
+}
+
+std::vector<ImgGray> PerView(const ImgVol& img,
+                             const std::vector<MipView>& views,
+                             std::array<float, 3> normal) {
+  std::vector<ImgGray> frames;
+
+  for (const MipView& v : views) {
+    ImgVol copy = img;
+    frames.push_back(imgvol::MaxIntensionProjection(copy, v.delta_x,
+                                                    v.delta_y, normal));
+  }
+
+  return frames;
+}
+
+}
+
+int main() {
+  std::mt19937 rng(47);
+  ImgVol img = Random(37, 29, 23, &rng);
+
+  // A turntable, plus views along the axes and an edge-on one.
+  std::vector<MipView> views = imgvol::MipTurntable(7, 0.3f);
+  views.push_back(MipView{0, 0});
+  views.push_back(MipView{1.2f, -0.7f});
+  views.push_back(MipView{float(M_PI/2), 0});
+  views.push_back(MipView{0, float(M_PI)});
+
+  for (std::array<float, 3> normal : {std::array<float, 3>{{0, 0, 1}},
+                                      std::array<float, 3>{{0.3f, -0.2f, 1}}}) {
+    std::vector<ImgGray> expected = PerView(img, views, normal);
+
+    // 5 and 7 divide none of the sizes, 64 holds the whole volume in one
+    // brick. Few rays per batch split the views and rows over batches.
+    for (size_t brick : {1, 5, 7, 16, 64}) {
+      for (size_t max_rays : {size_t(1) << 16, size_t(300)}) {
+        for (size_t nthreads : {1, 3}) {
+          MipBatchOptions opts;
+          opts.brick_size = brick;
+          opts.max_rays = max_rays;
+          opts.nthreads = nthreads;
+          ImgVol copy = img;
+          std::vector<ImgGray> frames =
+              imgvol::MaxIntensionProjections(copy, views, normal, opts);
+          CHECK(frames.size() == views.size());
+          bool same = frames.size() == views.size();
+
+          for (size_t v = 0; same && v < views.size(); v++) {
+            same = Equal(frames[v], expected[v]);
+          }
+
+          CHECK(same);
+        }
+      }
+    }
+  }
+
+  {
+    ImgVol copy = img;
+    CHECK(imgvol::MaxIntensionProjections(copy, {}, {{0, 0, 1}}).empty());
+  }
+
+  // Exported files decode to the per-view frames.
+  {
+    const std::string prefix = "mip_batch_test_";
+    std::vector<ImgGray> expected = PerView(img, views, {{0, 0, 1}});
+    MipBatchOptions opts;
+    opts.brick_size = 5;
+    opts.queue_depth = 1;
+    opts.encode_threads = 2;
+    opts.nthreads = 3;
+    ImgVol copy = img;
+    imgvol::MipExportStats stats =
+        imgvol::ExportMipViews(copy, views, {{0, 0, 1}}, prefix, opts);
+    CHECK(stats.frames == views.size());
+
+    for (size_t v = 0; v < views.size(); v++) {
+      std::string file_name = prefix + std::to_string(v) + ".png";
+      CHECK(SameFrame(imgvol::test::DecodePngFile(file_name), expected[v]));
+      std::remove(file_name.c_str());
+    }
+
+    bool thrown = false;
+
+    try {
+      imgvol::ExportMipViews(copy, views, {{0, 0, 1}},
+                             "no_such_dir/mip_batch_test_", opts);
+    } catch (const std::runtime_error&) {
+      thrown = true;
+    }
+
+    CHECK(thrown);
+  }
+
+  return imgvol::test::TestResult();
+}
@@ -0,0 +1,112 @@
+#include <algorithm>
+#include <random>
+#include <stdexcept>
+#include "check.h"
+#include "mpr.h"
+#include "operations.h"
+
+// Every Mpr plane against the single-plane operation it stands for: Cut
+// for the orthogonal slices, CortePlanar for the oblique ones.
+
+namespace {
+
+using imgvol::ImgGray;
+using imgvol::ImgVol;
+
+ImgVol Noise(size_t x, size_t y, size_t z, unsigned seed) {
+  ImgVol img(x, y, z);
+  std::mt19937 rng(seed);
+  std::uniform_int_distribution<int> dist(0, 255);
+  uint8_t* data = img.Data();
+
+  for (size_t i = 0; i < img.NumVoxels(); i++) {
+    data[i] = dist(rng);
+  }
+
+  return img;
+}
+
+bool Equal(const imgvol::Img2D& a, const imgvol::Img2D& b) {
+  return a.SizeX() == b.SizeX() && a.SizeY() == b.SizeY() &&
+         std::equal(a.Data(), a.Data() + a.NumPixels(), b.Data());
+}
+
+bool Equal(const ImgGray& a, const ImgGray& b) {
+  return a.SizeX() == b.SizeX() && a.SizeY() == b.SizeY() &&
+         std::equal(a.Data(), a.Data() + a.SizeX()*a.SizeY(), b.Data());
+}
+
+void Compare(const ImgVol& img, std::array<size_t, 3> point,
+             const std::vector<std::array<float, 3>>& normals,
+             const imgvol::MprOptions& opts, imgvol::MprViews* views) {
+  imgvol::Mpr(img, point, normals, opts, views);
+  std::array<size_t, 3> origin = img.Origin();
+  std::array<size_t, 3> local = {{point[0] - origin[0], point[1] - origin[1],
+                                  point[2] - origin[2]}};
+
+  CHECK(Equal(views->axial, imgvol::Cut(img, ImgVol::Axis::aZ, local[2],
+                                        opts.w)));
+  CHECK(Equal(views->coronal, imgvol::Cut(img, ImgVol::Axis::aY, local[1],
+                                          opts.w)));
+  CHECK(Equal(views->sagittal, imgvol::Cut(img, ImgVol::Axis::aX, local[0],
+                                           opts.w)));
+  CHECK(views->oblique.size() == normals.size());
+
+  std::array<float, 3> p1 = {{(float) point[0], (float) point[1],
+                              (float) point[2]}};
+
+  for (size_t i = 0; i < normals.size() && i < views->oblique.size(); i++) {
+    ImgGray expected(0, 0);
+    imgvol::CortePlanar(img, p1, normals[i], &expected);
+    CHECK(Equal(views->oblique[i], expected));
+  }
+}
+
+}
+
+int main() {
+  ImgVol img = Noise(29, 23, 17, 37);
+  std::vector<std::array<float, 3>> normals = {
+      {{0, 0, 1}}, {{1, 1, 0}}, {{0.3f, -0.5f, 0.8f}}, {{-1, 2, 0.5f}}};
+
+  imgvol::MprOptions opts;
+  imgvol::MprViews views;
+
+  for (bool w : {false, true}) {
+    for (size_t band : {size_t(1), size_t(7), size_t(32)}) {
+      for (size_t nthreads : {size_t(1), size_t(3)}) {
+        opts.w = w;
+        opts.band_rows = band;
+        opts.nthreads = nthreads;
+        Compare(img, {{0, 0, 0}}, normals, opts, &views);
+        Compare(img, {{14, 9, 5}}, normals, opts, &views);
+        Compare(img, {{28, 22, 16}}, normals, opts, &views);
+      }
+    }
+  }
+
+  // Reusing the views with fewer planes drops the extra ones.
+  Compare(img, {{3, 20, 11}}, {normals[2]}, opts, &views);
+
+  // A cropped volume takes the crosshair in the frame it was cropped from.
+  img.SetOrigin({{40, 5, 9}});
+  Compare(img, {{40, 5, 9}}, normals, opts, &views);
+  Compare(img, {{55, 17, 20}}, normals, opts, &views);
+
+  for (std::array<size_t, 3> point : {std::array<size_t, 3>{{39, 10, 10}},
+                                      std::array<size_t, 3>{{69, 10, 10}},
+                                      std::array<size_t, 3>{{50, 28, 10}},
+                                      std::array<size_t, 3>{{50, 10, 26}}}) {
+    bool thrown = false;
+
+    try {
+      imgvol::Mpr(img, point, normals, opts, &views);
+    } catch (const std::invalid_argument&) {
+      thrown = true;
+    }
+
+    CHECK(thrown);
+  }
+
+  return imgvol::test::TestResult();
+}
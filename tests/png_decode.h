@@ -0,0 +1,86 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <png.h>
+
+// PNG decoding with libpng for the test programs, 8 bit gray or RGB.
+
+namespace imgvol {
+namespace test {
+
+struct DecodedPng {
+  size_t width = 0;
+  size_t height = 0;
+  int channels = 0;
+  std::vector<uint8_t> pixels;
+};
+
+namespace internal {
+
+struct PngReader {
+  const std::vector<uint8_t>* data;
+  size_t pos;
+};
+
+inline void ReadFromVector(png_structp png, png_bytep out, png_size_t size) {
+  auto* reader = static_cast<PngReader*>(png_get_io_ptr(png));
+
+  if (reader->pos + size > reader->data->size()) {
+    png_error(png, "truncated png");
+  }
+
+  std::memcpy(out, reader->data->data() + reader->pos, size);
+  reader->pos += size;
+}
+
+}
+
+inline DecodedPng DecodePng(const std::vector<uint8_t>& data) {
+  DecodedPng out;
+  internal::PngReader reader = {&data, 0};
+  png_structp png = png_create_read_struct(PNG_LIBPNG_VER_STRING, nullptr,
+                                           nullptr, nullptr);
+  png_infop info = png_create_info_struct(png);
+
+  if (setjmp(png_jmpbuf(png))) {
+    png_destroy_read_struct(&png, &info, nullptr);
+    throw std::runtime_error("png decoding failed");
+  }
+
+  png_set_read_fn(png, &reader, internal::ReadFromVector);
+  png_read_info(png, info);
+
+  out.width = png_get_image_width(png, info);
+  out.height = png_get_image_height(png, info);
+  out.channels = png_get_channels(png, info);
+  out.pixels.resize(out.width*out.height*out.channels);
+
+  for (size_t y = 0; y < out.height; y++) {
+    png_read_row(png, out.pixels.data() + y*out.width*out.channels, nullptr);
+  }
+
+  png_read_end(png, nullptr);
+  png_destroy_read_struct(&png, &info, nullptr);
+  return out;
+}
+
+inline DecodedPng DecodePngFile(const std::string& file_name) {
+  std::ifstream in(file_name, std::ios::binary);
+
+  if (!in) {
+    throw std::runtime_error("can't open file: " + file_name);
+  }
+
+  std::vector<uint8_t> data((std::istreambuf_iterator<char>(in)),
+                            std::istreambuf_iterator<char>());
+  return DecodePng(data);
+}
+
+}
+}
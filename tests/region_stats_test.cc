@@ -0,0 +1,202 @@
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <stdexcept>
+#include <vector>
+#include "check.h"
+#include "crop.h"
+#include "region_stats.h"
+
+// Region statistics against a scan of every voxel, split over one or
+// many z slabs, with and without the background, on volumes with and
+// without an origin.
+
+namespace {
+
+using imgvol::BoundingBox;
+using imgvol::ImgVol;
+using imgvol::RegionStats;
+
+ImgVol Random(size_t x, size_t y, size_t z, int lo, int hi,
+              std::mt19937* rng) {
+  ImgVol img(x, y, z);
+  std::uniform_int_distribution<int> dist(lo, hi);
+  uint8_t* data = img.Data();
+
+  for (size_t i = 0; i < img.NumVoxels(); i++) {
+    data[i] = dist(*rng);
+  }
+
+  return img;
+}
+
+// Labels from a short list, plus a small blob of a label found nowhere
+// else, so some labels cover a few voxels only.
+ImgVol Labels(size_t x, size_t y, size_t z, std::mt19937* rng) {
+  ImgVol labels(x, y, z);
+  const int values[] = {0, 0, 0, 3, 17, 255};
+  std::uniform_int_distribution<int> pick(0, 5);
+  uint8_t* data = labels.Data();
+
+  for (size_t i = 0; i < labels.NumVoxels(); i++) {
+    data[i] = values[pick(*rng)];
+  }
+
+  labels.SetVoxelIntensity(90, 7, 4, 5);
+  labels.SetVoxelIntensity(90, 8, 4, 8);
+  return labels;
+}
+
+std::vector<RegionStats> Reference(const ImgVol& img, const ImgVol& labels,
+                                   bool include_background) {
+  std::vector<RegionStats> all(256);
+  std::vector<std::array<double, 3>> sums(256, {{0, 0, 0}});
+  std::vector<double> sum(256, 0);
+  std::array<size_t, 3> o = img.Origin();
+
+  for (size_t l = 0; l < 256; l++) {
+    all[l].label = int(l);
+    all[l].voxels = 0;
+    all[l].min = 255;
+    all[l].max = 0;
+    all[l].box = BoundingBox{{{size_t(-1), size_t(-1), size_t(-1)}},
+                             {{0, 0, 0}}};
+  }
+
+  for (size_t z = 0; z < img.SizeZ(); z++) {
+    for (size_t y = 0; y < img.SizeY(); y++) {
+      for (size_t x = 0; x < img.SizeX(); x++) {
+        RegionStats& s = all[labels(x, y, z)];
+        int v = img(x, y, z);
+        std::array<size_t, 3> p = {{o[0] + x, o[1] + y, o[2] + z}};
+        s.voxels++;
+        s.min = std::min(s.min, v);
+        s.max = std::max(s.max, v);
+        sum[s.label] += v;
+
+        for (int a = 0; a < 3; a++) {
+          sums[s.label][a] += p[a];
+          s.box.lo[a] = std::min(s.box.lo[a], p[a]);
+          s.box.hi[a] = std::max(s.box.hi[a], p[a] + 1);
+        }
+      }
+    }
+  }
+
+  std::vector<RegionStats> stats;
+
+  for (size_t l = include_background ? 0 : 1; l < 256; l++) {
+    RegionStats s = all[l];
+
+    if (s.voxels > 0) {
+      s.mean = sum[l]/s.voxels;
+
+      for (int a = 0; a < 3; a++) {
+        s.centroid[a] = sums[l][a]/s.voxels;
+      }
+
+      stats.push_back(s);
+    }
+  }
+
+  return stats;
+}
+
+bool Close(double a, double b) {
+  return std::abs(a - b) <= 1e-9*std::max(1.0, std::abs(b));
+}
+
+bool Same(const std::vector<RegionStats>& a,
+          const std::vector<RegionStats>& b) {
+  if (a.size() != b.size()) {
+    return false;
+  }
+
+  for (size_t i = 0; i < a.size(); i++) {
+    const RegionStats& s = a[i];
+    const RegionStats& r = b[i];
+
+    if (s.label != r.label || s.voxels != r.voxels || s.min != r.min ||
+        s.max != r.max || !Close(s.mean, r.mean) || s.box.lo != r.box.lo ||
+        s.box.hi != r.box.hi) {
+      return false;
+    }
+
+    for (int c = 0; c < 3; c++) {
+      if (!Close(s.centroid[c], r.centroid[c])) {
+        return false;
+      }
+    }
+  }
+
+  return true;
+}
+
+}
+
+int main() {
+  std::mt19937 rng(49);
+  ImgVol img = Random(29, 11, 13, 0, 255, &rng);
+  ImgVol labels = Labels(29, 11, 13, &rng);
+
+  // A crop records its origin, and the labels crop along with it.
+  BoundingBox part = {{{5, 2, 3}}, {{24, 10, 12}}};
+  ImgVol img_crop = imgvol::Crop(img, part);
+  ImgVol labels_crop = imgvol::Crop(labels, part);
+
+  for (bool background : {false, true}) {
+    std::vector<RegionStats> expected = Reference(img, labels, background);
+    std::vector<RegionStats> expected_crop =
+        Reference(img_crop, labels_crop, background);
+    CHECK(expected.size() == (background ? 5 : 4));
+
+    // One slab, and up to one slab per slice.
+    for (size_t nthreads : {1, 2, 3, 13, 40}) {
+      CHECK(Same(imgvol::ComputeRegionStats(img, labels, background,
+                                            nthreads), expected));
+      CHECK(Same(imgvol::ComputeRegionStats(img_crop, labels_crop,
+                                            background, nthreads),
+                 expected_crop));
+    }
+  }
+
+  // The blob of label 90, inside the crop, is found at the same place in
+  // both frames.
+  {
+    std::vector<RegionStats> full = imgvol::ComputeRegionStats(img, labels);
+    std::vector<RegionStats> crop =
+        imgvol::ComputeRegionStats(img_crop, labels_crop);
+    auto blob = [](const std::vector<RegionStats>& s) {
+      return *std::find_if(s.begin(), s.end(),
+                           [](const RegionStats& r) { return r.label == 90; });
+    };
+    RegionStats a = blob(full);
+    RegionStats b = blob(crop);
+    CHECK(a.voxels == 2 && b.voxels == 2);
+    CHECK((a.box.lo == std::array<size_t, 3>{{7, 4, 5}}));
+    CHECK((a.box.hi == std::array<size_t, 3>{{9, 5, 9}}));
+    CHECK(a.box.lo == b.box.lo && a.box.hi == b.box.hi);
+    CHECK(a.centroid == b.centroid);
+  }
+
+  // All background.
+  {
+    ImgVol zero(7, 5, 3);
+    ImgVol nines = Random(7, 5, 3, 9, 9, &rng);
+    CHECK(imgvol::ComputeRegionStats(nines, zero).empty());
+    std::vector<RegionStats> s = imgvol::ComputeRegionStats(nines, zero, true);
+    CHECK(s.size() == 1 && s[0].label == 0 && s[0].voxels == 7*5*3);
+    CHECK(s[0].mean == 9 && s[0].min == 9 && s[0].max == 9);
+  }
+
+  bool thrown = false;
+
+  try {
+    imgvol::ComputeRegionStats(img, ImgVol(29, 11, 12));
+  } catch (const std::invalid_argument&) {
+    thrown = true;
+  }
+
+  CHECK(thrown);
+  return imgvol::test::TestResult();
+}
@@ -0,0 +1,85 @@
+#include <atomic>
+#include <cstdlib>
+#include <iostream>
+#include <new>
+#include "img_vol.h"
+#include "operations.h"
+#include "img2d.h"
+
+// Checks that rendering into reused output images does no heap allocation
+// once the outputs and the thread arena are warm.
+
+namespace {
+
+std::atomic<size_t> num_allocs(0);
+
+}
+
+void* operator new(size_t size) {
+  num_allocs++;
+  void* p = std::malloc(size > 0 ? size : 1);
+
+  if (!p) {
+    throw std::bad_alloc();
+  }
+
+  return p;
+}
+
+void operator delete(void* p) noexcept {
+  std::free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+  std::free(p);
+}
+
+int main() {
+  imgvol::ImgVol img(64, 48, 40);
+
+  for (size_t z = 0; z < img.SizeZ(); z++) {
+    for (size_t y = 0; y < img.SizeY(); y++) {
+      for (size_t x = 0; x < img.SizeX(); x++) {
+        img.SetVoxelIntensity((x*3 + y*5 + z*7)%256, x, y, z);
+      }
+    }
+  }
+
+  imgvol::Img2D cut(0, 0);
+  imgvol::Img2D labels(0, 0);
+  imgvol::ImgColor color(0, 0);
+  imgvol::ImgGray planar(0, 0);
+  imgvol::ImgGray mip(0, 0);
+  imgvol::ImgVol reformat(0, 0, 0);
+
+  auto frame = [&](size_t k) {
+    imgvol::Cut(img, imgvol::ImgVol::Axis::aZ, k%img.SizeZ(), false, &cut);
+    imgvol::Cut(img, imgvol::ImgVol::Axis::aZ, (k + 1)%img.SizeZ(), false,
+                &labels);
+
+    for (size_t i = 0; i < labels.NumPixels(); i++) {
+      labels[i] = labels[i]%7;
+    }
+
+    imgvol::ColorLabels(cut, labels, 8, &color);
+    imgvol::CortePlanar(img, std::array<float, 3>{32, 24, float(k%40)},
+                        std::array<float, 3>{1, 2, 3}, &planar);
+    imgvol::MaxIntensionProjection(img, 0.1f*k, 0.2f,
+                                   std::array<float, 3>{0, 0, 1}, &mip);
+    imgvol::ReformataImg(img, 4, std::array<float, 3>{5, 5, 5},
+                         std::array<float, 3>{50, 40, 30}, &reformat);
+  };
+
+  frame(0);
+
+  size_t before = num_allocs;
+
+  for (size_t k = 1; k < 10; k++) {
+    frame(k);
+  }
+
+  size_t allocs = num_allocs - before;
+  std::cout << "allocations in steady state: " << allocs << "\n";
+
+  return allocs == 0 ? 0 : 1;
+}
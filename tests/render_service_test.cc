@@ -0,0 +1,195 @@
+#include <algorithm>
+#include <chrono>
+#include <future>
+#include <mutex>
+#include <random>
+#include <vector>
+#include "check.h"
+#include "operations.h"
+#include "render_service.h"
+
+// Scheduling of the render service with a single worker held busy by a
+// job that waits on a gate, so the order of the queued jobs is known.
+
+namespace {
+
+using imgvol::ImgGray;
+using imgvol::RenderPriority;
+using imgvol::RenderService;
+
+// Records which job rendered each tile, in order.
+struct Log {
+  void Add(int job) {
+    std::lock_guard<std::mutex> lock(mutex);
+    order.push_back(job);
+  }
+
+  std::vector<int> Order() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return order;
+  }
+
+  std::mutex mutex;
+  std::vector<int> order;
+};
+
+imgvol::RowRenderer Logged(Log* log, int job) {
+  return [log, job](size_t row_begin, size_t row_end, ImgGray* out) {
+    log->Add(job);
+
+    for (size_t y = row_begin; y < row_end; y++) {
+      for (size_t x = 0; x < out->SizeX(); x++) {
+        (*out)(uint8_t(job), x, y);
+      }
+    }
+  };
+}
+
+// Occupies the only worker with the first tile of a batch job until the
+// gate opens.
+std::future<ImgGray> Block(RenderService* service, size_t viewport,
+                           std::shared_future<void> gate, Log* log,
+                           size_t height = 1) {
+  auto started = std::make_shared<std::promise<void>>();
+  auto once = std::make_shared<std::once_flag>();
+  std::future<void> running = started->get_future();
+
+  std::future<ImgGray> f = service->Submit(
+      viewport, RenderPriority::kBatch, 4, height,
+      [gate, log, started, once](size_t, size_t, ImgGray*) {
+    std::call_once(*once, [&]() { started->set_value(); });
+    gate.wait();
+    log->Add(0);
+  });
+
+  running.wait();
+  return f;
+}
+
+bool Cancelled(std::future<ImgGray>& f) {
+  try {
+    f.get();
+  } catch (const imgvol::RenderCancelled&) {
+    return true;
+  }
+
+  return false;
+}
+
+void TestPriority() {
+  RenderService service(1, 1);
+  Log log;
+  std::promise<void> gate;
+  std::future<ImgGray> blocker = Block(&service, 0, gate.get_future().share(),
+                                       &log);
+
+  // Two tiles each, interactive tiles jump ahead of every batch tile and
+  // jobs of the same priority keep submission order.
+  std::future<ImgGray> b1 = service.Submit(1, RenderPriority::kBatch, 4, 2,
+                                           Logged(&log, 1));
+  std::future<ImgGray> b2 = service.Submit(2, RenderPriority::kBatch, 4, 2,
+                                           Logged(&log, 2));
+  std::future<ImgGray> i3 = service.Submit(3, RenderPriority::kInteractive, 4,
+                                           2, Logged(&log, 3));
+  std::future<ImgGray> i4 = service.Submit(4, RenderPriority::kInteractive, 4,
+                                           2, Logged(&log, 4));
+  gate.set_value();
+
+  CHECK(blocker.get().SizeY() == 1);
+  CHECK(b1.get()(3, 1) == 1);
+  CHECK(b2.get()(0, 0) == 2);
+  CHECK(i3.get()(2, 1) == 3);
+  CHECK(i4.get()(1, 0) == 4);
+  CHECK((log.Order() == std::vector<int>{0, 3, 3, 4, 4, 1, 1, 2, 2}));
+}
+
+void TestCancellation() {
+  RenderService service(1, 1);
+  Log log;
+  std::promise<void> gate;
+  std::shared_future<void> shared = gate.get_future().share();
+
+  // The blocker has three tiles, the running one finishes after it is
+  // superseded and the other two are dropped.
+  std::future<ImgGray> blocker = Block(&service, 0, shared, &log, 3);
+  std::future<ImgGray> a = service.Submit(1, RenderPriority::kInteractive, 4,
+                                          2, Logged(&log, 1));
+  std::future<ImgGray> b = service.Submit(1, RenderPriority::kBatch, 4, 2,
+                                          Logged(&log, 2));
+  std::future<ImgGray> c = service.Submit(2, RenderPriority::kBatch, 4, 2,
+                                          Logged(&log, 3));
+  std::future<ImgGray> d = service.Submit(3, RenderPriority::kBatch, 4, 2,
+                                          Logged(&log, 4));
+  service.Cancel(2);
+  std::future<ImgGray> replacement = service.Submit(
+      0, RenderPriority::kBatch, 4, 1, Logged(&log, 5));
+
+  // Cancelled jobs that never started are failed right away.
+  CHECK(a.wait_for(std::chrono::seconds(0)) == std::future_status::ready);
+  CHECK(Cancelled(a));
+  CHECK(Cancelled(c));
+  CHECK(blocker.wait_for(std::chrono::seconds(0)) !=
+        std::future_status::ready);
+  gate.set_value();
+
+  CHECK(Cancelled(blocker));
+  CHECK(b.get()(0, 1) == 2);
+  CHECK(d.get()(0, 1) == 4);
+  CHECK(replacement.get()(0, 0) == 5);
+  CHECK((log.Order() == std::vector<int>{0, 2, 2, 4, 4, 5}));
+}
+
+void TestMip() {
+  imgvol::ImgVol img(13, 11, 7);
+  std::mt19937 rng(36);
+  std::uniform_int_distribution<int> dist(0, 200);
+  uint8_t* data = img.Data();
+
+  for (size_t i = 0; i < img.NumVoxels(); i++) {
+    data[i] = dist(rng);
+  }
+
+  RenderService service(2, 3);
+  std::array<float, 3> normal = {{0, 0, 1}};
+
+  // Submitting leaves the caller's voxels alone, the job normalizes its
+  // own copy.
+  imgvol::ImgVol before = img;
+  ImgGray got = service.MaxIntensionProjection(
+      0, RenderPriority::kInteractive, img, 0.3f, 0.2f, normal).get();
+  const imgvol::ImgVol& view = img;
+  CHECK(std::equal(before.Data(), before.Data() + before.NumVoxels(),
+                   view.Data()));
+
+  imgvol::ImgVol copy = img;
+  ImgGray expected = imgvol::MaxIntensionProjection(copy, 0.3f, 0.2f, normal);
+  CHECK(got.SizeX() == expected.SizeX());
+  CHECK(std::equal(got.Data(), got.Data() + got.SizeX()*got.SizeY(),
+                   expected.Data()));
+
+  // A second view of the same volume reuses the normalized copy.
+  got = service.MaxIntensionProjection(0, RenderPriority::kInteractive, img,
+                                       0.1f, 0.5f, normal).get();
+  copy = img;
+  expected = imgvol::MaxIntensionProjection(copy, 0.1f, 0.5f, normal);
+  CHECK(std::equal(got.Data(), got.Data() + got.SizeX()*got.SizeY(),
+                   expected.Data()));
+
+  // Editing the volume invalidates the viewport's normalized copy.
+  img.SetVoxelIntensity(255, 6, 5, 3);
+  got = service.MaxIntensionProjection(
+      0, RenderPriority::kBatch, img, 0, 0, normal).get();
+  copy = img;
+  expected = imgvol::MaxIntensionProjection(copy, 0, 0, normal);
+  CHECK(std::equal(got.Data(), got.Data() + got.SizeX()*got.SizeY(),
+                   expected.Data()));
+}
+
+}
+
+int main() {
+  TestPriority();
+  TestCancellation();
+  TestMip();
+  return imgvol::test::TestResult();
+}
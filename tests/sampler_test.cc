@@ -0,0 +1,257 @@
+#include <cmath>
+#include <cstdlib>
+#include <random>
+#include <stdexcept>
+#include "check.h"
+#include "crop.h"
+#include "operations.h"
+#include "sampler.h"
+
+// The samplers on volumes with a known answer: planes against the
+// per-pixel transform CortePlanar used before the samplers, voxel
+// centers, linear ramps, and points past the volume faces.
+
+namespace {
+
+using imgvol::ClampBorder;
+using imgvol::ImgGray;
+using imgvol::ImgVol;
+using imgvol::Interpolation;
+using imgvol::ZeroBorder;
+
+ImgVol Random(size_t x, size_t y, size_t z, std::mt19937* rng) {
+  ImgVol img(x, y, z);
+  std::uniform_int_distribution<int> dist(0, 255);
+  uint8_t* data = img.Data();
+
+  for (size_t i = 0; i < img.NumVoxels(); i++) {
+    data[i] = dist(*rng);
+  }
+
+  return img;
+}
+
+// 3x + 2y + z, under 256 for the sizes used here.
+ImgVol Ramp(size_t x, size_t y, size_t z) {
+  ImgVol img(x, y, z);
+  uint8_t* data = img.Data();
+
+  for (size_t k = 0; k < z; k++) {
+    for (size_t j = 0; j < y; j++) {
+      for (size_t i = 0; i < x; i++) {
+        data[(k*y + j)*x + i] = uint8_t(3*i + 2*j + k);
+      }
+    }
+  }
+
+  return img;
+}
+
+// CortePlanar as it was before the samplers: each pixel through the
+// transform in double precision, truncated to the voxel it falls in.
+ImgGray ReferencePlane(const ImgVol& img, std::array<float, 3> p1,
+                       std::array<float, 3> vec) {
+  float diagonal = imgvol::Diagonal(std::array<float, 3>{{
+      float(img.SizeX()), float(img.SizeY()), float(img.SizeZ())}});
+  imgvol::Mat4 phi_inv = imgvol::PlanarTransform(img, p1, vec);
+  size_t n = size_t(diagonal);
+  ImgGray out(n, n);
+
+  for (size_t v = 0; v < n; v++) {
+    for (size_t u = 0; u < n; u++) {
+      imgvol::Vec4 p = imgvol::MultMat4(phi_inv, imgvol::Vec4{{
+          double(u), double(v), -diagonal/2, 1}});
+      int intensity = 0;
+
+      if (p[0] >= 0 && p[1] >= 0 && p[2] >= 0 && p[0] < img.SizeX() &&
+          p[1] < img.SizeY() && p[2] < img.SizeZ()) {
+        intensity = img(size_t(p[0]), size_t(p[1]), size_t(p[2]));
+      }
+
+      out(intensity, u, v);
+    }
+  }
+
+  return out;
+}
+
+bool Equal(const ImgGray& a, const ImgGray& b) {
+  if (a.SizeX() != b.SizeX() || a.SizeY() != b.SizeY()) {
+    return false;
+  }
+
+  for (size_t y = 0; y < a.SizeY(); y++) {
+    for (size_t x = 0; x < a.SizeX(); x++) {
+      if (a(x, y) != b(x, y)) {
+        return false;
+      }
+    }
+  }
+
+  return true;
+}
+
+// Every sampler reads each voxel back at its center.
+template <class Sampler>
+bool ExactAtCenters(const ImgVol& img) {
+  Sampler sampler(img);
+  bool same = true;
+
+  for (size_t z = 0; z < img.SizeZ(); z++) {
+    for (size_t y = 0; y < img.SizeY(); y++) {
+      for (size_t x = 0; x < img.SizeX(); x++) {
+        same = same && sampler(x + 0.5f, y + 0.5f, z + 0.5f) == img(x, y, z);
+      }
+    }
+  }
+
+  return same;
+}
+
+// Interpolating samplers follow a linear ramp to within rounding at
+// points whose neighbours all lie inside the volume.
+template <class Sampler>
+int MaxRampError(const ImgVol& ramp, float margin, std::mt19937* rng) {
+  Sampler sampler(ramp);
+  std::array<float, 3> size = {{float(ramp.SizeX()), float(ramp.SizeY()),
+                                float(ramp.SizeZ())}};
+  int error = 0;
+
+  for (int i = 0; i < 2000; i++) {
+    std::array<float, 3> p;
+
+    for (int a = 0; a < 3; a++) {
+      p[a] = std::uniform_real_distribution<float>(
+          0.5f + margin, size[a] - 0.5f - margin)(*rng);
+    }
+
+    float expected = 3*(p[0] - 0.5f) + 2*(p[1] - 0.5f) + (p[2] - 0.5f);
+    int v = sampler(p[0], p[1], p[2]);
+    error = std::max(error, std::abs(v - int(std::lround(expected))));
+  }
+
+  return error;
+}
+
+template <class Fn>
+bool Throws(Fn fn) {
+  try {
+    fn();
+  } catch (const std::invalid_argument&) {
+    return true;
+  }
+
+  return false;
+}
+
+}
+
+int main() {
+  std::mt19937 rng(46);
+
+  // Nearest planes match the old per-pixel transform bit for bit, also
+  // through the origin of a crop.
+  {
+    ImgVol img = Random(23, 17, 29, &rng);
+    ImgVol crop = imgvol::Crop(img, imgvol::BoundingBox{{{4, 2, 5}},
+                                                        {{19, 15, 24}}});
+
+    for (std::array<float, 3> vec : {std::array<float, 3>{{0, 0, 1}},
+                                     std::array<float, 3>{{0, 0, -1}},
+                                     std::array<float, 3>{{0, 1, 0}},
+                                     std::array<float, 3>{{1, 0, 0}},
+                                     std::array<float, 3>{{0.3f, -0.5f, 1}},
+                                     std::array<float, 3>{{-2, 1, -3}}}) {
+      for (std::array<float, 3> p1 : {std::array<float, 3>{{11, 8, 14}},
+                                      std::array<float, 3>{{5.5f, 3, 20.2f}}}) {
+        ImgGray out(0, 0);
+        imgvol::CortePlanar(img, p1, vec, &out);
+        CHECK(Equal(out, ReferencePlane(img, p1, vec)));
+        imgvol::CortePlanar(crop, p1, vec, &out);
+        CHECK(Equal(out, ReferencePlane(crop, p1, vec)));
+      }
+    }
+  }
+
+  {
+    ImgVol img = Random(13, 7, 5, &rng);
+    CHECK(ExactAtCenters<imgvol::NearestSampler<>>(img));
+    CHECK(ExactAtCenters<imgvol::TrilinearSampler<>>(img));
+    CHECK(ExactAtCenters<imgvol::TricubicSampler<>>(img));
+    CHECK(ExactAtCenters<imgvol::TrilinearSampler<ClampBorder>>(img));
+    CHECK(ExactAtCenters<imgvol::TricubicSampler<ClampBorder>>(img));
+  }
+
+  // Tricubic needs one more center on each side than trilinear.
+  {
+    ImgVol ramp = Ramp(40, 30, 20);
+    CHECK(MaxRampError<imgvol::TrilinearSampler<>>(ramp, 0, &rng) <= 1);
+    CHECK(MaxRampError<imgvol::TricubicSampler<>>(ramp, 1, &rng) <= 1);
+  }
+
+  // Points past a face read 0 with ZeroBorder and the edge voxel with
+  // ClampBorder. Points inside next to a face read the edge voxel either
+  // way.
+  {
+    ImgVol img = Random(6, 5, 4, &rng);
+
+    for (size_t y = 0; y < 5; y++) {
+      for (size_t z = 0; z < 4; z++) {
+        float cy = y + 0.5f;
+        float cz = z + 0.5f;
+
+        for (float x : {-0.01f, -0.5f, -7.0f}) {
+          CHECK(imgvol::NearestSampler<>(img)(x, cy, cz) == 0);
+          CHECK(imgvol::TrilinearSampler<>(img)(x, cy, cz) == 0);
+          CHECK(imgvol::TricubicSampler<>(img)(x, cy, cz) == 0);
+          CHECK(imgvol::NearestSampler<ClampBorder>(img)(x, cy, cz) ==
+                img(0, y, z));
+          CHECK(imgvol::TrilinearSampler<ClampBorder>(img)(x, cy, cz) ==
+                img(0, y, z));
+          CHECK(imgvol::TricubicSampler<ClampBorder>(img)(x, cy, cz) ==
+                img(0, y, z));
+        }
+
+        for (float x : {6.0f, 6.5f, 40.0f}) {
+          CHECK(imgvol::NearestSampler<>(img)(x, cy, cz) == 0);
+          CHECK(imgvol::TrilinearSampler<>(img)(x, cy, cz) == 0);
+          CHECK(imgvol::TricubicSampler<>(img)(x, cy, cz) == 0);
+          CHECK(imgvol::NearestSampler<ClampBorder>(img)(x, cy, cz) ==
+                img(5, y, z));
+          CHECK(imgvol::TrilinearSampler<ClampBorder>(img)(x, cy, cz) ==
+                img(5, y, z));
+          CHECK(imgvol::TricubicSampler<ClampBorder>(img)(x, cy, cz) ==
+                img(5, y, z));
+        }
+
+        CHECK(imgvol::NearestSampler<>(img)(0, cy, cz) == img(0, y, z));
+        CHECK(imgvol::NearestSampler<>(img)(5.99f, cy, cz) == img(5, y, z));
+        CHECK(imgvol::TrilinearSampler<>(img)(0.2f, cy, cz) == img(0, y, z));
+        CHECK(imgvol::TricubicSampler<>(img)(5.8f, cy, cz) == img(5, y, z));
+      }
+    }
+
+    // Past a corner on all three axes.
+    CHECK(imgvol::TrilinearSampler<ClampBorder>(img)(-1, 9, -3) ==
+          img(0, 4, 0));
+    CHECK(imgvol::NearestSampler<>(img)(2, 2, 4) == 0);
+  }
+
+  {
+    ImgVol img(4, 4, 4);
+
+    for (float f : {0.0f, -1.0f, INFINITY, NAN}) {
+      CHECK(Throws([&]() { imgvol::Interp(img, f, 1, 1); }));
+      CHECK(Throws([&]() { imgvol::Interp(img, 1, 1, f); }));
+    }
+
+    for (float d : {0.0f, -0.5f, NAN}) {
+      CHECK(Throws([&]() { imgvol::Refactor(img, 1, d, 1); }));
+    }
+
+    CHECK(!Throws([&]() { imgvol::Interp(img, 0.5f, 2, 1); }));
+    CHECK(!Throws([&]() { imgvol::Refactor(img, 2, 2, 0.5f); }));
+  }
+
+  return imgvol::test::TestResult();
+}
@@ -0,0 +1,111 @@
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "check.h"
+#include "img_vol.h"
+
+// Round trip of the .scn format, and 16 bit files as other tools write
+// them.
+
+namespace {
+
+const char* kFileName = "scn_test.scn";
+
+// 16 bit file with the given voxels, two little-endian bytes each.
+void Write16(size_t nx, size_t ny, size_t nz,
+             const std::vector<uint16_t>& voxels) {
+  std::ofstream out(kFileName, std::ios::binary);
+  out << "SCN\n" << nx << " " << ny << " " << nz << "\n0.5 0.5 2\n16\n";
+
+  for (uint16_t v : voxels) {
+    out.put(char(v & 0xff));
+    out.put(char(v >> 8));
+  }
+}
+
+template <class Fn>
+bool Throws(Fn fn) {
+  try {
+    fn();
+  } catch (const std::runtime_error&) {
+    return true;
+  }
+
+  return false;
+}
+
+}
+
+int main() {
+  std::mt19937 rng(11);
+  imgvol::ImgVol img(13, 7, 5);
+  img.SetVoxelSize(0.3f, 1.25f, 2.7f);
+  uint8_t* data = img.Data();
+
+  for (size_t i = 0; i < img.NumVoxels(); i++) {
+    data[i] = rng()%256;
+  }
+
+  img.WriteImg(kFileName);
+  imgvol::ImgVol back(kFileName);
+
+  CHECK(back.SizeX() == 13 && back.SizeY() == 7 && back.SizeZ() == 5);
+  CHECK(back.DimX() == 0.3f && back.DimY() == 1.25f && back.DimZ() == 2.7f);
+  CHECK(std::equal(back.Data(), back.Data() + back.NumVoxels(),
+                   img.Data()));
+
+  // 16 bit voxels that fit in 8 bits are kept.
+  std::vector<uint16_t> small(3*2*2);
+
+  for (size_t i = 0; i < small.size(); i++) {
+    small[i] = uint16_t(i*20);
+  }
+
+  Write16(3, 2, 2, small);
+  imgvol::ImgVol img16(kFileName);
+  CHECK(img16.SizeX() == 3 && img16.SizeY() == 2 && img16.SizeZ() == 2);
+  CHECK(img16.DimZ() == 2);
+
+  for (size_t i = 0; i < small.size(); i++) {
+    CHECK(img16.Data()[i] == small[i]);
+  }
+
+  // Wider ones are rescaled so the maximum is 255.
+  std::vector<uint16_t> wide = {0, 1000, 4095, 2048, 300, 65535};
+  Write16(3, 2, 1, wide);
+  imgvol::ImgVol scaled(kFileName);
+
+  for (size_t i = 0; i < wide.size(); i++) {
+    CHECK(scaled.Data()[i] == uint8_t(255*uint32_t(wide[i])/65535));
+  }
+
+  // Bad files.
+  {
+    std::ofstream out(kFileName, std::ios::binary);
+    out << "P5\n3 2 1\n";
+  }
+
+  CHECK(Throws([]() { imgvol::ImgVol bad(kFileName); }));
+
+  {
+    std::ofstream out(kFileName, std::ios::binary);
+    out << "SCN\n3 2 1\n1 1 1\n12\n";
+  }
+
+  CHECK(Throws([]() { imgvol::ImgVol bad(kFileName); }));
+
+  {
+    std::ofstream out(kFileName, std::ios::binary);
+    out << "SCN\n3 2 1\n1 1 1\n8\nabc";
+  }
+
+  CHECK(Throws([]() { imgvol::ImgVol bad(kFileName); }));
+  CHECK(Throws([]() { imgvol::ImgVol bad("no_such_file.scn"); }));
+
+  std::remove(kFileName);
+  return imgvol::test::TestResult();
+}
@@ -0,0 +1,132 @@
+#include <algorithm>
+#include <random>
+#include <stdexcept>
+#include "check.h"
+#include "operations.h"
+#include "slab_mip.h"
+
+// The running max slab MIP against the maximum over each clipped slab,
+// including in place, copy-on-write and runs split across threads.
+
+namespace {
+
+using imgvol::ImgVol;
+
+ImgVol Noise(size_t x, size_t y, size_t z, unsigned seed) {
+  ImgVol img(x, y, z);
+  std::mt19937 rng(seed);
+  std::uniform_int_distribution<int> dist(0, 255);
+  uint8_t* data = img.Data();
+
+  for (size_t i = 0; i < img.NumVoxels(); i++) {
+    data[i] = dist(rng);
+  }
+
+  return img;
+}
+
+ImgVol Reference(const ImgVol& img, ImgVol::Axis axis, size_t thickness) {
+  ImgVol out(img.SizeX(), img.SizeY(), img.SizeZ());
+  uint8_t* data = out.Data();
+  size_t a = axis == ImgVol::Axis::aX ? 0 : axis == ImgVol::Axis::aY ? 1 : 2;
+  std::array<size_t, 3> size = {{img.SizeX(), img.SizeY(), img.SizeZ()}};
+  long before = (thickness - 1)/2;
+  long after = thickness/2;
+
+  for (size_t z = 0; z < size[2]; z++) {
+    for (size_t y = 0; y < size[1]; y++) {
+      for (size_t x = 0; x < size[0]; x++) {
+        std::array<size_t, 3> p = {{x, y, z}};
+        long k = p[a];
+        int max = 0;
+
+        for (long s = k - before; s <= k + after; s++) {
+          if (s >= 0 && s < long(size[a])) {
+            p[a] = s;
+            max = std::max(max, img(p[0], p[1], p[2]));
+          }
+        }
+
+        data[(z*size[1] + y)*size[0] + x] = max;
+      }
+    }
+  }
+
+  return out;
+}
+
+bool Equal(const ImgVol& a, const ImgVol& b) {
+  return a.SizeX() == b.SizeX() && a.SizeY() == b.SizeY() &&
+         a.SizeZ() == b.SizeZ() &&
+         std::equal(a.Data(), a.Data() + a.NumVoxels(), b.Data());
+}
+
+bool Equal(const imgvol::Img2D& a, const imgvol::Img2D& b) {
+  return a.SizeX() == b.SizeX() && a.SizeY() == b.SizeY() &&
+         std::equal(a.Data(), a.Data() + a.NumPixels(), b.Data());
+}
+
+}
+
+int main() {
+  // A z slice of 70x61 is longer than one run, so its lines are split.
+  ImgVol img = Noise(70, 61, 9, 38);
+  const ImgVol& source = img;
+  ImgVol original = Noise(70, 61, 9, 38);
+
+  for (ImgVol::Axis axis : {ImgVol::Axis::aX, ImgVol::Axis::aY,
+                            ImgVol::Axis::aZ}) {
+    for (size_t thickness : {1, 2, 3, 4, 5, 8, 9, 10, 80}) {
+      ImgVol expected = Reference(img, axis, thickness);
+
+      for (size_t nthreads : {1, 3}) {
+        ImgVol out(0, 0, 0);
+        imgvol::SlabMip(img, axis, thickness, &out, nthreads);
+        CHECK(Equal(out, expected));
+
+        // In place on a volume sharing its voxels, which must be left
+        // alone.
+        ImgVol shared = img;
+        imgvol::SlabMip(shared, axis, thickness, &shared, nthreads);
+        CHECK(Equal(shared, expected));
+        CHECK(Equal(source, original));
+
+        // In place on a volume of its own.
+        ImgVol own = Noise(70, 61, 9, 38);
+        imgvol::SlabMip(own, axis, thickness, &own, nthreads);
+        CHECK(Equal(own, expected));
+      }
+
+      size_t n = axis == ImgVol::Axis::aX ? img.SizeX() :
+                 axis == ImgVol::Axis::aY ? img.SizeY() : img.SizeZ();
+
+      for (size_t pos : {size_t(0), n/2, n - 1}) {
+        for (bool w : {false, true}) {
+          CHECK(Equal(imgvol::SlabMipCut(img, axis, pos, thickness, w),
+                      imgvol::Cut(expected, axis, pos, w)));
+        }
+      }
+    }
+  }
+
+  ImgVol out(0, 0, 0);
+  bool thrown = false;
+
+  try {
+    imgvol::SlabMip(img, ImgVol::Axis::aZ, 0, &out);
+  } catch (const std::invalid_argument&) {
+    thrown = true;
+  }
+
+  CHECK(thrown);
+  thrown = false;
+
+  try {
+    imgvol::SlabMipCut(img, ImgVol::Axis::aZ, img.SizeZ(), 3);
+  } catch (const std::out_of_range&) {
+    thrown = true;
+  }
+
+  CHECK(thrown);
+  return imgvol::test::TestResult();
+}
@@ -0,0 +1,111 @@
+#include <cstdio>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include "check.h"
+#include "operations.h"
+#include "png_decode.h"
+#include "slice_export.h"
+
+// Every exported slice must decode to the windowed cut, and a failing
+// stage must stop the pipeline and surface its error instead of hanging.
+
+namespace {
+
+bool SameSlice(const imgvol::test::DecodedPng& png, const imgvol::Img2D& cut) {
+  if (png.width != cut.SizeX() || png.height != cut.SizeY() ||
+      png.channels != 1) {
+    return false;
+  }
+
+  for (size_t i = 0; i < cut.NumPixels(); i++) {
+    if (png.pixels[i] != std::min(std::max(cut[i], 0), 255)) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+}
+
+int main() {
+  const std::string prefix = "slice_export_test_";
+  std::mt19937 rng(5);
+  imgvol::ImgVol img(23, 17, 11);
+  uint8_t* data = img.Data();
+
+  for (size_t i = 0; i < img.NumVoxels(); i++) {
+    data[i] = rng()%256;
+  }
+
+  imgvol::SliceExportOptions opts;
+  opts.window = [](imgvol::Img2D& s) {
+    for (size_t i = 0; i < s.NumPixels(); i++) {
+      s[i] = 2*s[i] - 100;
+    }
+  };
+  opts.w = true;
+  opts.queue_depth = 1;
+  opts.nthreads = 5;
+
+  const imgvol::ImgVol::Axis axes[] = {imgvol::ImgVol::Axis::aX,
+                                       imgvol::ImgVol::Axis::aY,
+                                       imgvol::ImgVol::Axis::aZ};
+
+  for (imgvol::ImgVol::Axis axis : axes) {
+    imgvol::SliceExportStats stats =
+        imgvol::ExportSlices(img, axis, 2, 100, prefix, opts);
+    size_t last = axis == imgvol::ImgVol::Axis::aX ? 23 :
+        axis == imgvol::ImgVol::Axis::aY ? 17 : 11;
+    CHECK(stats.slices == last - 2);
+
+    for (size_t pos = 2; pos < last; pos++) {
+      std::string file_name = prefix + std::to_string(pos) + ".png";
+      imgvol::Img2D cut = imgvol::Cut(img, axis, pos, true);
+      opts.window(cut);
+
+      CHECK(SameSlice(imgvol::test::DecodePngFile(file_name), cut));
+      std::remove(file_name.c_str());
+    }
+  }
+
+  // Empty range.
+  CHECK(imgvol::ExportSlices(img, imgvol::ImgVol::Axis::aZ, 11, 20, prefix,
+                             opts).slices == 0);
+
+  // The writer fails on the first file, the other stages are blocked on
+  // full queues and must be released.
+  bool thrown = false;
+
+  try {
+    imgvol::ExportSlices(img, imgvol::ImgVol::Axis::aZ, 0, 11,
+                         "no_such_directory/slice_", opts);
+  } catch (const std::runtime_error&) {
+    thrown = true;
+  }
+
+  CHECK(thrown);
+
+  // A failing window stops the stages before and after it.
+  opts.window = [](imgvol::Img2D& s) {
+    if (s[0] >= 0) {
+      throw std::invalid_argument("window");
+    }
+  };
+  thrown = false;
+
+  try {
+    imgvol::ExportSlices(img, imgvol::ImgVol::Axis::aY, 0, 17, prefix, opts);
+  } catch (const std::invalid_argument&) {
+    thrown = true;
+  }
+
+  CHECK(thrown);
+
+  for (size_t pos = 0; pos < 17; pos++) {
+    std::remove((prefix + std::to_string(pos) + ".png").c_str());
+  }
+
+  return imgvol::test::TestResult();
+}
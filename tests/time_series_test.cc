@@ -0,0 +1,251 @@
+#include <algorithm>
+#include <atomic>
+#include <random>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+#include "check.h"
+#include "operations.h"
+#include "time_series.h"
+
+// Frames read back from a time series byte for byte: keyframes, deltas,
+// cached and prefetched frames, single-slab z cuts, and reads racing
+// with appends.
+
+namespace {
+
+using imgvol::ImgVol;
+using imgvol::TimeSeries;
+
+// A noisy base volume where each frame changes a few slabs only, so
+// deltas hold both empty and compressed slabs.
+std::vector<ImgVol> Frames(size_t n, size_t x, size_t y, size_t z,
+                           unsigned seed) {
+  std::mt19937 rng(seed);
+  std::uniform_int_distribution<int> value(0, 255);
+  std::uniform_int_distribution<size_t> slice(0, z - 1);
+  ImgVol img(x, y, z);
+  uint8_t* data = img.Data();
+
+  for (size_t i = 0; i < img.NumVoxels(); i++) {
+    data[i] = value(rng);
+  }
+
+  std::vector<ImgVol> frames;
+
+  for (size_t t = 0; t < n; t++) {
+    ImgVol frame = frames.empty() ? img : frames.back();
+    uint8_t* d = frame.Data();
+    size_t zs = slice(rng);
+
+    for (size_t i = zs*x*y; i < (zs + 1)*x*y; i += 7) {
+      d[i] = value(rng);
+    }
+
+    frames.push_back(frame);
+  }
+
+  return frames;
+}
+
+bool Equal(const ImgVol& a, const ImgVol& b) {
+  return a.SizeX() == b.SizeX() && a.SizeY() == b.SizeY() &&
+         a.SizeZ() == b.SizeZ() &&
+         std::equal(a.Data(), a.Data() + a.NumVoxels(), b.Data());
+}
+
+bool Equal(const imgvol::Img2D& a, const imgvol::Img2D& b) {
+  return a.SizeX() == b.SizeX() && a.SizeY() == b.SizeY() &&
+         std::equal(a.Data(), a.Data() + a.NumPixels(), b.Data());
+}
+
+void TestRoundTrip(const imgvol::TimeSeriesOptions& opts) {
+  std::vector<ImgVol> frames = Frames(11, 19, 13, 10, 43);
+  TimeSeries series(19, 13, 10, opts);
+
+  for (const ImgVol& f : frames) {
+    series.Append(f);
+  }
+
+  CHECK(series.NumFrames() == frames.size());
+
+  // z cuts of frames never decoded whole come from their slab alone.
+  for (size_t t = 0; t < frames.size(); t += 2) {
+    for (size_t z = 0; z < 10; z++) {
+      CHECK(Equal(series.Cut(t, ImgVol::Axis::aZ, z, z%2 == 1),
+                  imgvol::Cut(frames[t], ImgVol::Axis::aZ, z, z%2 == 1)));
+    }
+  }
+
+  // In order, backwards, and jumping around to go through cache misses,
+  // hits and prefetched frames.
+  std::vector<size_t> order;
+
+  for (size_t t = 0; t < frames.size(); t++) {
+    order.push_back(t);
+  }
+
+  for (size_t t = frames.size(); t-- > 0;) {
+    order.push_back(t);
+  }
+
+  for (size_t t : {5, 0, 9, 3, 3, 10, 1, 6}) {
+    order.push_back(t);
+  }
+
+  for (size_t t : order) {
+    CHECK(Equal(series.Frame(t), frames[t]));
+    CHECK(Equal(series.Cut(t, ImgVol::Axis::aX, 7),
+                imgvol::Cut(frames[t], ImgVol::Axis::aX, 7)));
+    CHECK(Equal(series.Cut(t, ImgVol::Axis::aZ, 9, true),
+                imgvol::Cut(frames[t], ImgVol::Axis::aZ, 9, true)));
+  }
+
+  // A frame handed out is a copy, writing to it leaves the series alone.
+  ImgVol f = series.Frame(4);
+  f.SetVoxelIntensity(0, 0, 0, 0);
+  f.SetVoxelIntensity(1, 1, 0, 0);
+  CHECK(Equal(series.Frame(4), frames[4]));
+
+  bool thrown = false;
+
+  try {
+    series.Frame(frames.size());
+  } catch (const std::out_of_range&) {
+    thrown = true;
+  }
+
+  CHECK(thrown);
+}
+
+// Frames are read while the series grows, which reallocates the frame
+// table under the readers.
+void TestConcurrentAppend() {
+  std::vector<ImgVol> frames = Frames(40, 9, 7, 6, 430);
+  imgvol::TimeSeriesOptions opts;
+  opts.keyframe_interval = 5;
+  opts.slab_slices = 2;
+  opts.cache_frames = 2;
+  opts.nthreads = 1;
+  TimeSeries series(9, 7, 6, opts);
+  series.Append(frames[0]);
+  std::atomic<bool> done(false);
+  std::atomic<int> mismatches(0);
+
+  std::thread reader([&]() {
+    std::mt19937 rng(431);
+
+    while (!done) {
+      size_t n = series.NumFrames();
+      size_t t = std::uniform_int_distribution<size_t>(0, n - 1)(rng);
+
+      if (!Equal(series.Frame(t), frames[t]) ||
+          !Equal(series.Cut(t, ImgVol::Axis::aZ, t%6),
+                 imgvol::Cut(frames[t], ImgVol::Axis::aZ, t%6))) {
+        mismatches++;
+      }
+    }
+  });
+
+  for (size_t t = 1; t < frames.size(); t++) {
+    series.Append(frames[t]);
+  }
+
+  done = true;
+  reader.join();
+  CHECK(mismatches == 0);
+
+  for (size_t t = 0; t < frames.size(); t++) {
+    CHECK(Equal(series.Frame(t), frames[t]));
+  }
+}
+
+}
+
+int main() {
+  imgvol::TimeSeriesOptions opts;
+  opts.keyframe_interval = 4;
+  opts.slab_slices = 3;
+  opts.cache_frames = 2;
+
+  for (bool prefetch : {false, true}) {
+    for (size_t nthreads : {1, 3}) {
+      opts.prefetch = prefetch;
+      opts.nthreads = nthreads;
+      TestRoundTrip(opts);
+    }
+  }
+
+  // Every frame a keyframe, and a single slab.
+  opts.keyframe_interval = 1;
+  TestRoundTrip(opts);
+  opts.keyframe_interval = 3;
+  opts.slab_slices = 10;
+  TestRoundTrip(opts);
+
+  // Frames equal to their keyframe take no space besides it.
+  {
+    std::vector<ImgVol> frames = Frames(1, 8, 8, 8, 44);
+    TimeSeries series(8, 8, 8, opts);
+    series.Append(frames[0]);
+    size_t key_bytes = series.EncodedBytes();
+    series.Append(frames[0]);
+    series.Append(frames[0]);
+    CHECK(series.EncodedBytes() == key_bytes);
+    CHECK(Equal(series.Frame(2), frames[0]));
+
+    bool thrown = false;
+
+    try {
+      series.Append(ImgVol(8, 8, 7));
+    } catch (const std::invalid_argument&) {
+      thrown = true;
+    }
+
+    CHECK(thrown);
+  }
+
+  // Frames come back with the voxel size and origin they were appended
+  // with, and frames of another geometry are refused.
+  {
+    std::vector<ImgVol> frames = Frames(5, 8, 6, 7, 45);
+    opts.keyframe_interval = 2;
+    opts.slab_slices = 3;
+    TimeSeries series(8, 6, 7, opts);
+
+    for (ImgVol& f : frames) {
+      f.SetVoxelSize(0.5f, 0.75f, 2.5f);
+      f.SetOrigin({{3, 4, 5}});
+      series.Append(f);
+    }
+
+    for (size_t t = 0; t < frames.size(); t++) {
+      ImgVol f = series.Frame(t);
+      CHECK(f.DimX() == 0.5f && f.DimY() == 0.75f && f.DimZ() == 2.5f);
+      CHECK((f.Origin() == std::array<size_t, 3>{{3, 4, 5}}));
+      CHECK(Equal(f, frames[t]));
+    }
+
+    ImgVol other = frames[0];
+    other.SetVoxelSize(0.5f, 0.75f, 2);
+    ImgVol moved = frames[0];
+    moved.SetOrigin({{3, 4, 6}});
+
+    for (const ImgVol& f : {other, moved}) {
+      bool thrown = false;
+
+      try {
+        series.Append(f);
+      } catch (const std::invalid_argument&) {
+        thrown = true;
+      }
+
+      CHECK(thrown);
+    }
+
+    CHECK(series.NumFrames() == frames.size());
+  }
+
+  TestConcurrentAppend();
+  return imgvol::test::TestResult();
+}
@@ -0,0 +1,200 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <sys/wait.h>
+#include "check.h"
+#include "manifest.h"
+#include "operations.h"
+#include "png_decode.h"
+
+// Manifests parsed line by line, malformed ones rejected with their line
+// number, and volbatch run end to end: its images against the same
+// operations in process, and bad cut positions and options failing with
+// an error instead of a crash.
+
+namespace {
+
+using imgvol::ImgVol;
+using imgvol::volbatch::Output;
+using imgvol::volbatch::VolumeJob;
+
+const char* kManifest = "volbatch_test.txt";
+const char* kVolume = "volbatch_test.scn";
+const char* kPrefix = "volbatch_test_out";
+
+void WriteManifest(const std::string& text) {
+  std::ofstream(kManifest) << text;
+}
+
+// The message of the error ReadManifest throws, empty when it doesn't.
+std::string ManifestError(const std::string& text) {
+  WriteManifest(text);
+
+  try {
+    imgvol::volbatch::ReadManifest(kManifest);
+  } catch (const std::runtime_error& e) {
+    return e.what();
+  }
+
+  return "";
+}
+
+// Exit status of volbatch on the manifest, -1 when it didn't exit
+// normally.
+int RunTool(const std::string& args) {
+  std::string cmd = std::string(VOLBATCH_PATH) + " " + kManifest + " " +
+      args + " > /dev/null 2>&1";
+  int status = std::system(cmd.c_str());
+  return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+bool SameImage(const imgvol::test::DecodedPng& png, const uint8_t* pixels,
+               size_t width, size_t height) {
+  if (png.width != width || png.height != height || png.channels != 1) {
+    return false;
+  }
+
+  for (size_t i = 0; i < width*height; i++) {
+    if (png.pixels[i] != pixels[i]) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+bool SameCut(const std::string& file_name, const ImgVol& img,
+             ImgVol::Axis axis, size_t pos, bool w) {
+  imgvol::Img2D cut = imgvol::Cut(img, axis, pos, w);
+  imgvol::Normalize(cut, 8);
+  std::vector<uint8_t> pixels(cut.NumPixels());
+
+  for (size_t i = 0; i < cut.NumPixels(); i++) {
+    pixels[i] = uint8_t(std::min(std::max(cut[i], 0), 255));
+  }
+
+  return SameImage(imgvol::test::DecodePngFile(file_name), pixels.data(),
+                   cut.SizeX(), cut.SizeY());
+}
+
+}
+
+int main() {
+  // Parsed commands, comments and blank lines.
+  {
+    WriteManifest("# head\n"
+                  "\n"
+                  "volume a.scn out/a\n"
+                  "cut y 7 w   # flipped\n"
+                  "mip 30 -45\n"
+                  "volume b.scn out/b\n"
+                  "reformat 4 1 2 3 4 5 6\n");
+    std::vector<VolumeJob> jobs = imgvol::volbatch::ReadManifest(kManifest);
+    CHECK(jobs.size() == 2);
+    CHECK(jobs[0].file_name == "a.scn" && jobs[0].prefix == "out/a");
+    CHECK(jobs[0].outputs.size() == 2 && jobs[1].outputs.size() == 1);
+
+    const Output& cut = jobs[0].outputs[0];
+    CHECK(cut.kind == Output::Kind::kCut && cut.axis == ImgVol::Axis::aY);
+    CHECK(cut.pos == 7 && cut.w && cut.name == "out/a_cut_y7");
+    CHECK(cut.where == std::string(kManifest) + ":4");
+
+    const Output& mip = jobs[0].outputs[1];
+    CHECK(mip.kind == Output::Kind::kMip && mip.name == "out/a_mip_30_-45");
+    CHECK(std::abs(mip.delta_x - M_PI/6) < 1e-6);
+    CHECK(std::abs(mip.delta_y + M_PI/4) < 1e-6);
+
+    const Output& reformat = jobs[1].outputs[0];
+    CHECK(reformat.kind == Output::Kind::kReformat && reformat.n == 4);
+    CHECK((reformat.p1 == std::array<float, 3>{{1, 2, 3}}));
+    CHECK((reformat.pn == std::array<float, 3>{{4, 5, 6}}));
+    CHECK(reformat.name == "out/b_reformat");
+  }
+
+  // Every malformed line is reported with its number.
+  {
+    const std::string line2 = std::string(kManifest) + ":2: ";
+    CHECK(ManifestError("volume a.scn\n").find(":1: ") != std::string::npos);
+    CHECK(ManifestError("# x\ncut z 4\n").find(line2) == 0);
+    CHECK(ManifestError("volume a.scn p\ncut q 4\n").find(line2) == 0);
+    CHECK(ManifestError("volume a.scn p\ncut z\n").find(line2) == 0);
+    CHECK(ManifestError("volume a.scn p\nmip 30\n").find(line2) == 0);
+    CHECK(ManifestError("volume a.scn p\nreformat 0 1 2 3 4 5 6\n")
+              .find(line2) == 0);
+    CHECK(ManifestError("volume a.scn p\nrender 1\n").find(line2) == 0);
+    CHECK(ManifestError("").empty());
+
+    bool thrown = false;
+
+    try {
+      imgvol::volbatch::ReadManifest("no_such_manifest.txt");
+    } catch (const std::runtime_error&) {
+      thrown = true;
+    }
+
+    CHECK(thrown);
+  }
+
+  // End to end on a small volume.
+  std::mt19937 rng(44);
+  ImgVol img(40, 30, 20);
+  uint8_t* data = img.Data();
+
+  for (size_t i = 0; i < img.NumVoxels(); i++) {
+    data[i] = rng()%200;
+  }
+
+  img.WriteImg(kVolume);
+  std::string volume_line = std::string("volume ") + kVolume + " " +
+      kPrefix + "\n";
+
+  WriteManifest(volume_line + "cut x 39\ncut z 3 w\nmip 20 10\n"
+                "reformat 3 10 10 2 10 10 15\n");
+  CHECK(RunTool("--render-threads 2 --queue-depth 1") == 0);
+  CHECK(SameCut(std::string(kPrefix) + "_cut_x39.png", img,
+                ImgVol::Axis::aX, 39, false));
+  CHECK(SameCut(std::string(kPrefix) + "_cut_z3.png", img, ImgVol::Axis::aZ,
+                3, true));
+
+  ImgVol copy = img;
+  imgvol::ImgGray mip = imgvol::MaxIntensionProjection(
+      copy, float(20*M_PI/180), float(10*M_PI/180), {{0, 0, 1}});
+  CHECK(SameImage(imgvol::test::DecodePngFile(std::string(kPrefix) +
+                                              "_mip_20_10.png"),
+                  mip.Data(), mip.SizeX(), mip.SizeY()));
+
+  for (size_t i = 0; i < 3; i++) {
+    std::string file_name = std::string(kPrefix) + "_reformat" +
+        std::to_string(i) + ".png";
+    CHECK(std::ifstream(file_name).good());
+    std::remove(file_name.c_str());
+  }
+
+  std::remove((std::string(kPrefix) + "_cut_x39.png").c_str());
+  std::remove((std::string(kPrefix) + "_cut_z3.png").c_str());
+  std::remove((std::string(kPrefix) + "_mip_20_10.png").c_str());
+
+  // Cuts past the volume fail cleanly, on every axis.
+  for (const char* cut : {"cut x 40\n", "cut y 100\n", "cut z 100000\n"}) {
+    WriteManifest(volume_line + "mip 0 0\n" + cut);
+    CHECK(RunTool("") == 1);
+  }
+
+  std::remove((std::string(kPrefix) + "_mip_0_0.png").c_str());
+
+  WriteManifest(volume_line + "cut z 1\n");
+  CHECK(RunTool("--queue-depth 0") == 1);
+  CHECK(RunTool("--queue-depth x") == 1);
+  CHECK(RunTool("--queue-depth 1") == 0);
+  std::remove((std::string(kPrefix) + "_cut_z1.png").c_str());
+
+  std::remove(kVolume);
+  std::remove(kManifest);
+  return imgvol::test::TestResult();
+}
@@ -0,0 +1,197 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <random>
+#include "check.h"
+#include "ray_camera.h"
+#include "volume_render.h"
+
+// Direct volume rendering of volumes with a known answer. Through a
+// uniform volume every sample has the same corrected opacity, so front to
+// back compositing of n samples of step s gives an opacity of
+// 1 - (1 - alpha)^(n*s) whatever the view.
+
+namespace {
+
+using imgvol::ImgColor;
+using imgvol::ImgVol;
+
+const std::array<float, 3> kColor = {{0.8f, 0.4f, 0.2f}};
+const std::array<float, 3> kBackground = {{0, 0.25f, 1}};
+
+ImgVol Uniform(size_t x, size_t y, size_t z, uint8_t v) {
+  ImgVol img(x, y, z);
+  std::fill(img.Data(), img.Data() + img.NumVoxels(), v);
+  return img;
+}
+
+imgvol::TransferLut ConstantLut(float alpha) {
+  return imgvol::BuildTransferLut({{0, {{kColor[0], kColor[1], kColor[2],
+                                         alpha}}}});
+}
+
+float MajorAxis(std::array<float, 3> d) {
+  return std::max(std::abs(d[0]), std::max(std::abs(d[1]), std::abs(d[2])));
+}
+
+// Expected BGR pixel of each ray, compositing stops after the first sample
+// bringing the opacity to threshold.
+ImgColor Expected(const ImgVol& img, float delta_x, float delta_y,
+                  std::array<float, 3> normal, float alpha, float threshold) {
+  imgvol::RayCamera camera(img, delta_x, delta_y, normal);
+  ImgColor out(camera.Width(), camera.Height());
+  float step = 1/MajorAxis(camera.Direction());
+
+  for (size_t y = 0; y < out.SizeY(); y++) {
+    for (size_t x = 0; x < out.SizeX(); x++) {
+      std::array<float, 3> a;
+      std::array<float, 3> b;
+      double opacity = 0;
+
+      if (camera.Clip(x, y, &a, &b)) {
+        size_t n = size_t(MajorAxis({{b[0] - a[0], b[1] - a[1],
+                                      b[2] - a[2]}})) + 1;
+        size_t k = 0;
+
+        while (k < n && opacity < threshold) {
+          k++;
+          opacity = 1 - std::pow(1.0 - alpha, k*double(step));
+        }
+      }
+
+      std::array<uint8_t, 3> bgr;
+
+      for (int c = 0; c < 3; c++) {
+        double v = opacity*kColor[c] + (1 - opacity)*kBackground[c];
+        bgr[2 - c] = uint8_t(std::lround(v*255));
+      }
+
+      out(bgr, x, y);
+    }
+  }
+
+  return out;
+}
+
+// Largest channel difference between two images of the same size.
+int MaxDiff(const ImgColor& a, const ImgColor& b) {
+  int diff = 0;
+
+  for (size_t y = 0; y < a.SizeY(); y++) {
+    for (size_t x = 0; x < a.SizeX(); x++) {
+      for (int c = 0; c < 3; c++) {
+        diff = std::max(diff, std::abs(int(a(x, y)[c]) - int(b(x, y)[c])));
+      }
+    }
+  }
+
+  return diff;
+}
+
+bool SameSize(const ImgColor& a, const ImgColor& b) {
+  return a.SizeX() == b.SizeX() && a.SizeY() == b.SizeY();
+}
+
+void TestUniform(float delta_x, float delta_y, std::array<float, 3> normal,
+                 float alpha, float threshold) {
+  ImgVol img = Uniform(24, 20, 16, 100);
+  imgvol::DvrOptions opts;
+  opts.opacity_threshold = threshold;
+  opts.background = kBackground;
+
+  ImgColor out = imgvol::VolumeRender(img, delta_x, delta_y, normal,
+                                      ConstantLut(alpha), opts);
+  ImgColor expected = Expected(img, delta_x, delta_y, normal, alpha,
+                               threshold);
+
+  CHECK(SameSize(out, expected));
+  CHECK(MaxDiff(out, expected) <= 1);
+}
+
+}
+
+int main() {
+  // Axis aligned, every sample a full voxel apart.
+  TestUniform(0, 0, {{0, 0, 1}}, 0.1f, 2);
+  TestUniform(0, 0, {{1, 0, 0}}, 0.1f, 2);
+  TestUniform(0, 0, {{0, 0, -1}}, 0.1f, 2);
+
+  // Oblique, the step is longer than a voxel and the opacity of each
+  // sample is corrected for it.
+  TestUniform(0, 0.5f, {{0, 0, 1}}, 0.1f, 2);
+  TestUniform(0.4f, 0.7f, {{0, 0, 1}}, 0.05f, 2);
+
+  // Early ray termination stops at the sample reaching the threshold.
+  TestUniform(0, 0, {{0, 0, 1}}, 0.3f, 0.95f);
+  TestUniform(0.4f, 0.7f, {{0, 0, 1}}, 0.3f, 0.95f);
+
+  // Without correction the oblique view would composite fewer, equally
+  // opaque samples and come out visibly lighter.
+  {
+    ImgVol img = Uniform(24, 20, 16, 100);
+    imgvol::DvrOptions opts;
+    opts.opacity_threshold = 2;
+    ImgColor out = imgvol::VolumeRender(img, 0, 0.7f, {{0, 0, 1}},
+                                        ConstantLut(0.05f), opts);
+    imgvol::RayCamera camera(img, 0, 0.7f, {{0, 0, 1}});
+    std::array<float, 3> a;
+    std::array<float, 3> b;
+    size_t cx = out.SizeX()/2;
+    size_t cy = out.SizeY()/2;
+
+    CHECK(camera.Clip(cx, cy, &a, &b));
+    size_t n = size_t(MajorAxis({{b[0] - a[0], b[1] - a[1],
+                                  b[2] - a[2]}})) + 1;
+    int uncorrected = std::lround(255*kColor[0]*(1 - std::pow(0.95, n)));
+    CHECK(int(out(cx, cy)[2]) > uncorrected + 2);
+  }
+
+  // Early termination drops at most the remaining 1 - threshold of the
+  // ray, and nothing at all behind a fully opaque front face.
+  {
+    ImgVol img(24, 20, 16);
+    std::mt19937 rng(35);
+    std::uniform_int_distribution<int> dist(0, 255);
+
+    uint8_t* data = img.Data();
+
+    for (size_t i = 0; i < img.NumVoxels(); i++) {
+      data[i] = dist(rng);
+    }
+
+    imgvol::TransferLut lut = imgvol::BuildTransferLut({
+        {0, {{0, 0, 0, 0}}}, {128, {{1, 0.5f, 0, 0.2f}}},
+        {255, {{0.2f, 0.6f, 1, 0.6f}}}});
+    imgvol::DvrOptions full;
+    full.opacity_threshold = 2;
+    full.background = kBackground;
+    imgvol::DvrOptions early = full;
+    early.opacity_threshold = 0.9f;
+
+    ImgColor a = imgvol::VolumeRender(img, 0.3f, 0.2f, {{0, 0, 1}}, lut, full);
+    ImgColor b = imgvol::VolumeRender(img, 0.3f, 0.2f, {{0, 0, 1}}, lut,
+                                      early);
+    CHECK(SameSize(a, b));
+    CHECK(MaxDiff(a, b) <= int(std::ceil(0.1f*255)) + 1);
+
+    std::fill(img.Data(), img.Data() + img.SizeX()*img.SizeY(), 255);
+
+    lut[255] = {{0.2f, 0.6f, 1, 1}};
+    a = imgvol::VolumeRender(img, 0, 0, {{0, 0, 1}}, lut, full);
+    b = imgvol::VolumeRender(img, 0, 0, {{0, 0, 1}}, lut, early);
+    CHECK(MaxDiff(a, b) == 0);
+
+    // Tiles and threads only change who renders a pixel.
+    imgvol::DvrOptions tiled = early;
+    tiled.tile_size = 7;
+    tiled.nthreads = 3;
+    ImgColor c = imgvol::VolumeRender(img, 0.3f, 0.2f, {{0, 0, 1}}, lut,
+                                      early);
+    ImgColor d = imgvol::VolumeRender(img, 0.3f, 0.2f, {{0, 0, 1}}, lut,
+                                      tiled);
+    CHECK(SameSize(c, d));
+    CHECK(MaxDiff(c, d) == 0);
+  }
+
+  return imgvol::test::TestResult();
+}
@@ -0,0 +1,64 @@
+#include <cstdint>
+#include <unistd.h>
+#include "check.h"
+#include "img_vol.h"
+#include "voxel_memory.h"
+
+// Buffers under every placement: alignment, zeroed voxels and round trips
+// through copy-on-write clones.
+
+namespace {
+
+using imgvol::VoxelPlacement;
+
+bool Aligned(const void* p, size_t align) {
+  return uintptr_t(p)%align == 0;
+}
+
+}
+
+int main() {
+  size_t page = size_t(sysconf(_SC_PAGESIZE));
+
+  for (VoxelPlacement placement : {VoxelPlacement::kFirstTouch,
+                                   VoxelPlacement::kInterleave,
+                                   VoxelPlacement::kSlabs}) {
+    for (bool huge : {false, true}) {
+      imgvol::VoxelMemoryOptions opts;
+      opts.placement = placement;
+      opts.huge_pages = huge;
+      imgvol::SetVoxelMemoryOptions(opts);
+
+      for (size_t bytes : {size_t(0), size_t(1), page - 1, page, page + 1,
+                           size_t(3 << 20) + 17}) {
+        void* p = imgvol::AllocateVoxels(bytes);
+        CHECK(Aligned(p, bytes >= page ? page : 64));
+        static_cast<uint8_t*>(p)[bytes > 0 ? bytes - 1 : 0] = 1;
+        imgvol::FreeVoxels(p, bytes);
+      }
+
+      // Volumes come out zeroed and clone into buffers of the same kind.
+      imgvol::ImgVol img(67, 45, 31);
+      const imgvol::ImgVol& view = img;
+      CHECK(Aligned(view.Data(), page));
+      bool zero = true;
+
+      for (size_t i = 0; i < img.NumVoxels(); i++) {
+        zero = zero && view.Data()[i] == 0;
+      }
+
+      CHECK(zero);
+      img.SetVoxelIntensity(200, 66, 44, 30);
+      imgvol::ImgVol copy = img;
+      copy.SetVoxelIntensity(10, 0, 0, 0);
+      CHECK(img(0, 0, 0) == 0 && img(66, 44, 30) == 200);
+      CHECK(copy(0, 0, 0) == 10 && copy(66, 44, 30) == 200);
+
+      imgvol::ImgVol small(3, 2, 1);
+      CHECK(small(2, 1, 0) == 0);
+    }
+  }
+
+  imgvol::SetVoxelMemoryOptions(imgvol::VoxelMemoryOptions());
+  return imgvol::test::TestResult();
+}
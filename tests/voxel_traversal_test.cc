@@ -0,0 +1,176 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <random>
+#include <set>
+#include <vector>
+#include "check.h"
+#include "voxel_traversal.h"
+
+// VoxelTraversal against a reference DDA built from the boundary crossings
+// of the segment. Along an axis with n voxel steps the segment crosses the
+// boundaries at t = (2j - 1)/(2n), j = 1..n. Sorting every crossing,
+// exactly and with ties in x, y, z order, gives the voxels in order.
+
+namespace {
+
+typedef std::array<long, 3> Voxel;
+
+struct Crossing {
+  long num;
+  long den;
+  int axis;
+};
+
+std::vector<Voxel> Reference(Voxel p1, Voxel pn) {
+  std::vector<Crossing> crossings;
+
+  for (int a = 0; a < 3; a++) {
+    long n = std::labs(pn[a] - p1[a]);
+
+    for (long j = 1; j <= n; j++) {
+      crossings.push_back(Crossing{2*j - 1, 2*n, a});
+    }
+  }
+
+  std::stable_sort(crossings.begin(), crossings.end(),
+                   [](const Crossing& a, const Crossing& b) {
+    long l = a.num*b.den;
+    long r = b.num*a.den;
+    return l < r || (l == r && a.axis < b.axis);
+  });
+
+  std::vector<Voxel> voxels = {p1};
+  Voxel v = p1;
+
+  for (const Crossing& c : crossings) {
+    v[c.axis] += pn[c.axis] > p1[c.axis] ? 1 : -1;
+    voxels.push_back(v);
+  }
+
+  return voxels;
+}
+
+std::vector<Voxel> Traverse(const imgvol::ImgVol& img, Voxel p1, Voxel pn,
+                            std::vector<int>* axes) {
+  std::vector<Voxel> voxels;
+  size_t nx = img.SizeX();
+  size_t nxy = nx*img.SizeY();
+  imgvol::VoxelTraversal t(img, {{float(p1[0]), float(p1[1]), float(p1[2])}},
+                           {{float(pn[0]), float(pn[1]), float(pn[2])}});
+
+  CHECK(t.Remaining() == size_t(1 + std::labs(pn[0] - p1[0]) +
+                                std::labs(pn[1] - p1[1]) +
+                                std::labs(pn[2] - p1[2])));
+
+  while (!t.Done()) {
+    size_t o = t.Offset();
+    voxels.push_back(Voxel{{long(o%nx), long(o%nxy/nx), long(o/nxy)}});
+    axes->push_back(t.Next());
+  }
+
+  return voxels;
+}
+
+// Every voxel the segment passes through the inside of is visited, and
+// consecutive voxels share a face.
+bool Covers(const std::vector<Voxel>& voxels, Voxel p1, Voxel pn) {
+  std::set<Voxel> visited(voxels.begin(), voxels.end());
+
+  for (size_t i = 1; i < voxels.size(); i++) {
+    long d = std::labs(voxels[i][0] - voxels[i - 1][0]) +
+             std::labs(voxels[i][1] - voxels[i - 1][1]) +
+             std::labs(voxels[i][2] - voxels[i - 1][2]);
+
+    if (d != 1) {
+      return false;
+    }
+  }
+
+  // Odd sample counts keep the samples off the half-voxel boundaries of
+  // the exact diagonals.
+  const int samples = 4001;
+
+  for (int s = 0; s <= samples; s++) {
+    double t = double(s)/samples;
+    Voxel v;
+
+    for (int a = 0; a < 3; a++) {
+      v[a] = std::lround(p1[a] + t*(pn[a] - p1[a]));
+    }
+
+    if (!visited.count(v)) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+void Check(const imgvol::ImgVol& img, Voxel p1, Voxel pn) {
+  std::vector<int> axes;
+  std::vector<Voxel> got = Traverse(img, p1, pn, &axes);
+  std::vector<Voxel> expected = Reference(p1, pn);
+
+  CHECK(got == expected);
+  CHECK(Covers(got, p1, pn));
+  CHECK(!axes.empty() && axes.back() == -1);
+
+  for (size_t i = 0; i + 1 < axes.size() && i + 1 < got.size(); i++) {
+    int a = axes[i];
+    CHECK(a >= 0 && a < 3 && got[i + 1][a] != got[i][a]);
+  }
+}
+
+}
+
+int main() {
+  imgvol::ImgVol img(31, 27, 23);
+
+  // A single voxel, and rays along each axis both ways.
+  Check(img, {{4, 5, 6}}, {{4, 5, 6}});
+  Check(img, {{0, 3, 4}}, {{30, 3, 4}});
+  Check(img, {{30, 3, 4}}, {{0, 3, 4}});
+  Check(img, {{7, 0, 2}}, {{7, 26, 2}});
+  Check(img, {{7, 26, 2}}, {{7, 0, 2}});
+  Check(img, {{7, 2, 0}}, {{7, 2, 22}});
+  Check(img, {{7, 2, 22}}, {{7, 2, 0}});
+
+  // Exact diagonals cross edges and corners, every one of them a tie.
+  Check(img, {{0, 0, 0}}, {{22, 22, 22}});
+  Check(img, {{22, 22, 22}}, {{0, 0, 0}});
+  Check(img, {{0, 26, 0}}, {{22, 4, 22}});
+  Check(img, {{3, 3, 5}}, {{20, 20, 5}});
+  Check(img, {{20, 3, 5}}, {{3, 20, 5}});
+  Check(img, {{1, 1, 1}}, {{7, 3, 5}});
+  Check(img, {{7, 3, 5}}, {{1, 1, 1}});
+  Check(img, {{0, 0, 0}}, {{30, 10, 20}});
+  Check(img, {{30, 10, 20}}, {{0, 0, 0}});
+
+  std::mt19937 rng(39);
+  std::uniform_int_distribution<long> x(0, 30);
+  std::uniform_int_distribution<long> y(0, 26);
+  std::uniform_int_distribution<long> z(0, 22);
+
+  for (int i = 0; i < 500; i++) {
+    Voxel p1 = {{x(rng), y(rng), z(rng)}};
+    Voxel pn = {{x(rng), y(rng), z(rng)}};
+    Check(img, p1, pn);
+    Check(img, pn, p1);
+  }
+
+  // End points are rounded to the nearest voxel center.
+  {
+    std::vector<Voxel> got;
+    imgvol::VoxelTraversal t(img, {{0.4f, 1.6f, 2.2f}}, {{9.7f, 1.4f, 2.49f}});
+
+    for (; !t.Done(); t.Next()) {
+      size_t o = t.Offset();
+      got.push_back(Voxel{{long(o%31), long(o%(31*27)/31), long(o/(31*27))}});
+    }
+
+    CHECK(got == Reference({{0, 2, 2}}, {{10, 1, 2}}));
+  }
+
+  return imgvol::test::TestResult();
+}
@@ -0,0 +1,98 @@
+#include "manifest.h"
+#include <cmath>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+namespace imgvol {
+namespace volbatch {
+
+std::vector<VolumeJob> ReadManifest(const std::string& file_name) {
+  std::ifstream in(file_name);
+
+  if (!in) {
+    throw std::runtime_error("can't open manifest: " + file_name);
+  }
+
+  std::vector<VolumeJob> jobs;
+  std::string line;
+  size_t line_no = 0;
+
+  while (std::getline(in, line)) {
+    line_no++;
+    line = line.substr(0, line.find('#'));
+    std::istringstream ls(line);
+    std::string cmd;
+
+    if (!(ls >> cmd)) {
+      continue;
+    }
+
+    auto error = [&](const std::string& what) {
+      return std::runtime_error(file_name + ":" + std::to_string(line_no) +
+                                ": " + what);
+    };
+
+    if (cmd == "volume") {
+      VolumeJob job;
+
+      if (!(ls >> job.file_name >> job.prefix)) {
+        throw error("expected: volume file.scn prefix");
+      }
+
+      jobs.push_back(job);
+      continue;
+    }
+
+    if (jobs.empty()) {
+      throw error("output before the first volume");
+    }
+
+    Output out = {};
+    std::string prefix = jobs.back().prefix;
+    out.where = file_name + ":" + std::to_string(line_no);
+
+    if (cmd == "cut") {
+      std::string axis;
+      std::string flag;
+
+      if (!(ls >> axis >> out.pos) ||
+          (axis != "x" && axis != "y" && axis != "z")) {
+        throw error("expected: cut x|y|z pos [w]");
+      }
+
+      out.kind = Output::Kind::kCut;
+      out.axis = axis == "x" ? ImgVol::Axis::aX :
+          axis == "y" ? ImgVol::Axis::aY : ImgVol::Axis::aZ;
+      out.w = (ls >> flag) && flag == "w";
+      out.name = prefix + "_cut_" + axis + std::to_string(out.pos);
+    } else if (cmd == "mip") {
+      if (!(ls >> out.delta_x >> out.delta_y)) {
+        throw error("expected: mip delta_x delta_y");
+      }
+
+      out.kind = Output::Kind::kMip;
+      out.name = prefix + "_mip_" + std::to_string(int(out.delta_x)) + "_" +
+          std::to_string(int(out.delta_y));
+      out.delta_x *= M_PI/180;
+      out.delta_y *= M_PI/180;
+    } else if (cmd == "reformat") {
+      if (!(ls >> out.n >> out.p1[0] >> out.p1[1] >> out.p1[2] >>
+            out.pn[0] >> out.pn[1] >> out.pn[2]) || out.n == 0) {
+        throw error("expected: reformat n x1 y1 z1 x2 y2 z2");
+      }
+
+      out.kind = Output::Kind::kReformat;
+      out.name = prefix + "_reformat";
+    } else {
+      throw error("unknown command: " + cmd);
+    }
+
+    jobs.back().outputs.push_back(out);
+  }
+
+  return jobs;
+}
+
+}
+}
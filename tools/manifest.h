@@ -0,0 +1,53 @@
+#pragma once
+
+#include <array>
+#include <string>
+#include <vector>
+#include "img_vol.h"
+
+namespace imgvol {
+namespace volbatch {
+
+// Manifest of volumes and outputs, one command per line:
+//
+//   # comment
+//   volume head.scn out/head        .scn file and output prefix
+//   cut z 40 [w]                    axis cut, written as <prefix>_cut_z40.png
+//   mip 30 45                       MIP at delta_x, delta_y degrees
+//   reformat 16 x1 y1 z1 x2 y2 z2   ReformataImg stack, one png per slice
+//
+// Outputs apply to the last volume line.
+
+struct Output {
+  enum class Kind {
+    kCut, kMip, kReformat
+  };
+
+  Kind kind;
+  ImgVol::Axis axis;
+  size_t pos;
+  bool w;
+  float delta_x;
+  float delta_y;
+  size_t n;
+  std::array<float, 3> p1;
+  std::array<float, 3> pn;
+  std::string name;
+
+  // manifest:line of the command, for errors found once the volume is
+  // loaded.
+  std::string where;
+};
+
+struct VolumeJob {
+  std::string file_name;
+  std::string prefix;
+  std::vector<Output> outputs;
+};
+
+// Throws std::runtime_error naming the line of the first malformed
+// command.
+std::vector<VolumeJob> ReadManifest(const std::string& file_name);
+
+}
+}
@@ -0,0 +1,534 @@
+// Batch renderer driven by a manifest of volumes and outputs, see
+// manifest.h. Loading, rendering, PNG encoding and writing run as a
+// pipeline of bounded queues across volumes, and the volumes in flight
+// are kept under a memory cap.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <exception>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include "bounded_queue.h"
+#include "img_vol.h"
+#include "manifest.h"
+#include "operations.h"
+#include "parallel.h"
+#include "png_encoder.h"
+#include "ray_camera.h"
+
+using namespace imgvol;
+using volbatch::Output;
+using volbatch::VolumeJob;
+
+namespace {
+
+// Voxels of a .scn file, read from its header.
+size_t ScnVoxels(const std::string& file_name) {
+  std::ifstream in(file_name);
+  std::string magic;
+  size_t x = 0, y = 0, z = 0;
+
+  if (!(in >> magic >> x >> y >> z) || magic != "SCN") {
+    throw std::runtime_error("not a scn file: " + file_name);
+  }
+
+  return x*y*z;
+}
+
+// Bytes of volumes in flight. Acquire blocks while the cap would be
+// exceeded, unless nothing is in flight so one oversized volume still
+// goes through.
+class MemoryBudget {
+ public:
+  explicit MemoryBudget(size_t cap)
+    : cap_(cap)
+    , used_(0)
+    , peak_(0)
+    , closed_(false) {}
+
+  bool Acquire(size_t bytes) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    released_.wait(lock, [&]() {
+      return closed_ || used_ == 0 || used_ + bytes <= cap_;
+    });
+
+    if (closed_) {
+      return false;
+    }
+
+    used_ += bytes;
+    peak_ = std::max(peak_, used_);
+    return true;
+  }
+
+  void Release(size_t bytes) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    used_ -= bytes;
+    released_.notify_all();
+  }
+
+  void Close() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    closed_ = true;
+    released_.notify_all();
+  }
+
+  size_t Peak() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return peak_;
+  }
+
+ private:
+  std::mutex mutex_;
+  std::condition_variable released_;
+  size_t cap_;
+  size_t used_;
+  size_t peak_;
+  bool closed_;
+};
+
+// A loaded volume, its budget is released with the last task using it.
+struct LoadedVolume {
+  LoadedVolume(ImgVol img, ImgVol mip_img, size_t bytes,
+               MemoryBudget* budget)
+    : img(std::move(img))
+    , mip_img(std::move(mip_img))
+    , bytes(bytes)
+    , budget(budget) {}
+
+  ~LoadedVolume() {
+    budget->Release(bytes);
+  }
+
+  ImgVol img;
+
+  // Normalized once for all the MIPs of the volume.
+  ImgVol mip_img;
+
+  size_t bytes;
+  MemoryBudget* budget;
+};
+
+struct RenderTask {
+  std::shared_ptr<LoadedVolume> volume;
+  Output output;
+};
+
+struct Image {
+  std::string file_name;
+  ImgGray img;
+};
+
+struct Encoded {
+  std::string file_name;
+  std::vector<uint8_t> png;
+};
+
+// Items and busy time of a stage, plus the depth of its input queue
+// sampled at every pop.
+class StageStats {
+ public:
+  explicit StageStats(const std::string& name)
+    : name_(name)
+    , items_(0)
+    , busy_ns_(0)
+    , depth_sum_(0)
+    , depth_max_(0)
+    , samples_(0) {}
+
+  void Add(size_t items, std::chrono::steady_clock::duration busy) {
+    items_ += items;
+    busy_ns_ += std::chrono::duration_cast<std::chrono::nanoseconds>(
+        busy).count();
+  }
+
+  void SampleDepth(size_t depth) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    depth_sum_ += depth;
+    depth_max_ = std::max(depth_max_, depth);
+    samples_++;
+  }
+
+  void Print(double wall, size_t threads) const {
+    double busy = busy_ns_*1e-9;
+    std::printf("%-8s %8zu items %8.2f items/s %6.1f%% busy"
+                "  queue avg %5.2f max %zu\n",
+                name_.c_str(), size_t(items_),
+                wall > 0 ? items_/wall : 0.0,
+                wall > 0 ? 100*busy/(wall*threads) : 0.0,
+                samples_ ? double(depth_sum_)/samples_ : 0.0, depth_max_);
+  }
+
+ private:
+  std::string name_;
+  std::atomic<size_t> items_;
+  std::atomic<uint64_t> busy_ns_;
+  std::mutex mutex_;
+  size_t depth_sum_;
+  size_t depth_max_;
+  size_t samples_;
+};
+
+ImgGray ToGray(Img2D& img) {
+  Normalize(img, 8);
+  ImgGray gray(img.SizeX(), img.SizeY());
+  const int* src = img.Data();
+  uint8_t* dst = gray.Data();
+
+  for (size_t i = 0; i < img.NumPixels(); i++) {
+    dst[i] = uint8_t(std::min(std::max(src[i], 0), 255));
+  }
+
+  return gray;
+}
+
+std::vector<Image> Render(const LoadedVolume& volume, const Output& out) {
+  std::vector<Image> images;
+
+  switch (out.kind) {
+    case Output::Kind::kCut: {
+      size_t size = out.axis == ImgVol::Axis::aX ? volume.img.SizeX() :
+          out.axis == ImgVol::Axis::aY ? volume.img.SizeY() :
+          volume.img.SizeZ();
+
+      if (out.pos >= size) {
+        throw std::runtime_error(out.where + ": cut position " +
+                                 std::to_string(out.pos) +
+                                 " past the volume size " +
+                                 std::to_string(size));
+      }
+
+      Img2D cut = Cut(volume.img, out.axis, out.pos, out.w);
+      images.push_back(Image{out.name + ".png", ToGray(cut)});
+      break;
+    }
+
+    case Output::Kind::kMip: {
+      const ImgVol& img = volume.mip_img;
+      std::array<float, 3> normal = {{0, 0, 1}};
+      RayCamera camera(img, out.delta_x, out.delta_y, normal);
+      ImgGray mip(camera.Width(), camera.Height());
+      MaxIntensionProjectionRows(img, out.delta_x, out.delta_y, normal, 0,
+                                 mip.SizeY(), &mip);
+      images.push_back(Image{out.name + ".png", std::move(mip)});
+      break;
+    }
+
+    case Output::Kind::kReformat: {
+      ImgVol stack(0, 0, 0);
+      ReformataImg(volume.img, out.n, out.p1, out.pn, &stack);
+      size_t slice = stack.SizeX()*stack.SizeY();
+
+      for (size_t i = 0; i < stack.SizeZ(); i++) {
+        images.push_back(Image{out.name + std::to_string(i) + ".png",
+                               ImgGray(stack.Data() + i*slice, stack.SizeX(),
+                                       stack.SizeY())});
+      }
+
+      break;
+    }
+  }
+
+  return images;
+}
+
+struct Options {
+  std::string manifest;
+  size_t render_threads = 0;
+  size_t encode_threads = 0;
+  size_t queue_depth = 8;
+  size_t memory_cap_mb = 2048;
+};
+
+// Value of a numeric option, digits only.
+size_t OptionValue(const std::string& arg, const std::string& value) {
+  if (value.empty() ||
+      value.find_first_not_of("0123456789") != std::string::npos) {
+    throw std::invalid_argument(arg + " expects a number, got '" + value +
+                                "'");
+  }
+
+  try {
+    return std::stoul(value);
+  } catch (const std::out_of_range&) {
+    throw std::invalid_argument(arg + " value out of range: " + value);
+  }
+}
+
+Options ParseOptions(int argc, char** argv) {
+  Options opts;
+
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+
+    if (arg.compare(0, 2, "--") != 0) {
+      opts.manifest = arg;
+      continue;
+    }
+
+    if (i + 1 >= argc) {
+      throw std::invalid_argument(arg + " expects a value");
+    }
+
+    size_t value = OptionValue(arg, argv[++i]);
+
+    if (arg == "--render-threads") {
+      opts.render_threads = value;
+    } else if (arg == "--encode-threads") {
+      opts.encode_threads = value;
+    } else if (arg == "--queue-depth") {
+      if (value == 0) {
+        throw std::invalid_argument(arg + " must be at least 1");
+      }
+
+      opts.queue_depth = value;
+    } else if (arg == "--memory-cap-mb") {
+      opts.memory_cap_mb = value;
+    } else {
+      throw std::invalid_argument("unknown option " + arg);
+    }
+  }
+
+  if (opts.manifest.empty()) {
+    throw std::invalid_argument("no manifest given");
+  }
+
+  return opts;
+}
+
+void Usage(const char* name) {
+  std::cerr << "usage: " << name << " manifest [--render-threads n]"
+            << " [--encode-threads n] [--queue-depth n]"
+            << " [--memory-cap-mb n]\n";
+}
+
+void Run(const Options& opts) {
+  std::vector<VolumeJob> jobs = volbatch::ReadManifest(opts.manifest);
+
+  size_t hw = NumThreads();
+  size_t nrender = opts.render_threads ? opts.render_threads :
+      std::max<size_t>(1, hw/2);
+  size_t nencode = opts.encode_threads ? opts.encode_threads :
+      hw > nrender ? hw - nrender : 1;
+
+  MemoryBudget budget(opts.memory_cap_mb << 20);
+  BoundedQueue<RenderTask> render_queue(opts.queue_depth);
+  BoundedQueue<Image> encode_queue(opts.queue_depth);
+  BoundedQueue<Encoded> write_queue(opts.queue_depth);
+
+  StageStats load_stats("load");
+  StageStats render_stats("render");
+  StageStats encode_stats("encode");
+  StageStats write_stats("write");
+
+  std::exception_ptr error;
+  std::mutex error_mutex;
+
+  // On failure every queue is closed, so blocked stages wake up and stop.
+  auto fail = [&]() {
+    {
+      std::lock_guard<std::mutex> lock(error_mutex);
+
+      if (!error) {
+        error = std::current_exception();
+      }
+    }
+
+    budget.Close();
+    render_queue.Close();
+    encode_queue.Close();
+    write_queue.Close();
+  };
+
+  auto start = std::chrono::steady_clock::now();
+
+  std::thread loader([&]() {
+    try {
+      for (const VolumeJob& job : jobs) {
+        bool mips = std::any_of(job.outputs.begin(), job.outputs.end(),
+                                [](const Output& o) {
+          return o.kind == Output::Kind::kMip;
+        });
+        size_t bytes = ScnVoxels(job.file_name)*(mips ? 2 : 1);
+
+        if (!budget.Acquire(bytes)) {
+          break;
+        }
+
+        auto t0 = std::chrono::steady_clock::now();
+        ImgVol img(job.file_name);
+        ImgVol mip_img(0, 0, 0);
+
+        if (mips) {
+          mip_img = img;
+          NormalizeImage(mip_img);
+        }
+
+        auto volume = std::make_shared<LoadedVolume>(
+            std::move(img), std::move(mip_img), bytes, &budget);
+        load_stats.Add(1, std::chrono::steady_clock::now() - t0);
+
+        for (const Output& out : job.outputs) {
+          if (!render_queue.Push(RenderTask{volume, out})) {
+            break;
+          }
+        }
+      }
+    } catch (...) {
+      fail();
+    }
+
+    render_queue.Close();
+  });
+
+  std::vector<std::thread> renderers;
+
+  for (size_t t = 0; t < nrender; t++) {
+    renderers.emplace_back([&]() {
+      try {
+        RenderTask task;
+
+        while (true) {
+          render_stats.SampleDepth(render_queue.Size());
+
+          if (!render_queue.Pop(&task)) {
+            break;
+          }
+
+          auto t0 = std::chrono::steady_clock::now();
+          std::vector<Image> images = Render(*task.volume, task.output);
+          task.volume.reset();
+          render_stats.Add(1, std::chrono::steady_clock::now() - t0);
+
+          for (auto& image : images) {
+            if (!encode_queue.Push(std::move(image))) {
+              break;
+            }
+          }
+        }
+      } catch (...) {
+        fail();
+      }
+    });
+  }
+
+  std::vector<std::thread> encoders;
+
+  for (size_t t = 0; t < nencode; t++) {
+    encoders.emplace_back([&]() {
+      try {
+        Image image{"", ImgGray(0, 0)};
+
+        while (true) {
+          encode_stats.SampleDepth(encode_queue.Size());
+
+          if (!encode_queue.Pop(&image)) {
+            break;
+          }
+
+          auto t0 = std::chrono::steady_clock::now();
+          PngOptions png;
+          png.nthreads = 1;
+          Encoded encoded{image.file_name, EncodePng(image.img, png)};
+          encode_stats.Add(1, std::chrono::steady_clock::now() - t0);
+
+          if (!write_queue.Push(std::move(encoded))) {
+            break;
+          }
+        }
+      } catch (...) {
+        fail();
+      }
+    });
+  }
+
+  std::thread closer([&]() {
+    for (auto& r : renderers) {
+      r.join();
+    }
+
+    encode_queue.Close();
+
+    for (auto& e : encoders) {
+      e.join();
+    }
+
+    write_queue.Close();
+  });
+
+  // Files are written from the calling thread, one at a time.
+  try {
+    Encoded encoded;
+
+    while (true) {
+      write_stats.SampleDepth(write_queue.Size());
+
+      if (!write_queue.Pop(&encoded)) {
+        break;
+      }
+
+      auto t0 = std::chrono::steady_clock::now();
+      std::ofstream fout(encoded.file_name, std::ios::binary);
+      fout.write(reinterpret_cast<const char*>(encoded.png.data()),
+                 encoded.png.size());
+      fout.close();
+
+      if (!fout) {
+        throw std::runtime_error("can't write file: " + encoded.file_name);
+      }
+
+      write_stats.Add(1, std::chrono::steady_clock::now() - t0);
+    }
+  } catch (...) {
+    fail();
+  }
+
+  loader.join();
+  closer.join();
+
+  if (error) {
+    std::rethrow_exception(error);
+  }
+
+  std::chrono::duration<double> wall =
+      std::chrono::steady_clock::now() - start;
+
+  std::printf("%zu volumes in %.2f s, peak volume memory %.1f MiB\n",
+              jobs.size(), wall.count(), budget.Peak()/1048576.0);
+  load_stats.Print(wall.count(), 1);
+  render_stats.Print(wall.count(), nrender);
+  encode_stats.Print(wall.count(), nencode);
+  write_stats.Print(wall.count(), 1);
+}
+
+}
+
+int main(int argc, char **argv) {
+  Options opts;
+
+  try {
+    opts = ParseOptions(argc, argv);
+  } catch (const std::exception& e) {
+    std::cerr << "volbatch: " << e.what() << "\n";
+    Usage(argv[0]);
+    return 1;
+  }
+
+  try {
+    Run(opts);
+  } catch (const std::exception& e) {
+    std::cerr << "volbatch: " << e.what() << "\n";
+    return 1;
+  }
+
+  return 0;
+}